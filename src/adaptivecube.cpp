@@ -0,0 +1,382 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "adaptivecube.h"
+
+#include "basisset.h"
+#include "cubescheduler.h"
+
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+
+namespace OpenQube {
+
+// The points along each axis of a block
+static const int BLOCK_POINTS = AdaptiveCube::BLOCK_SIZE + 1;
+static const int BLOCK_VALUES = BLOCK_POINTS * BLOCK_POINTS * BLOCK_POINTS;
+
+static inline int pointOffset(int i, int j, int k)
+{
+  return (i * BLOCK_POINTS + j) * BLOCK_POINTS + k;
+}
+
+struct AdaptiveCube::PointTask
+{
+  BasisSet *basis;
+  Vector3d pos;
+  double *value; ///< Into m_values
+};
+
+namespace {
+// A plane of points of the uniform cube filled by toCube
+struct PlaneTask
+{
+  const AdaptiveCube *adaptive;
+  const Cube *cube;
+  std::vector<double> *values;
+  int plane;
+};
+
+void fillPlane(PlaneTask &task)
+{
+  Vector3i dim = task.cube->dimensions();
+  unsigned int index = task.plane * dim.y() * dim.z();
+  for (int j = 0; j < dim.y(); ++j)
+    for (int k = 0; k < dim.z(); ++k, ++index)
+      (*task.values)[index] = task.adaptive->value(task.cube->position(index));
+}
+}
+
+AdaptiveCube::AdaptiveCube() : m_min(0.0, 0.0, 0.0), m_max(0.0, 0.0, 0.0),
+  m_spacing(0.0), m_levels(0), m_tolerance(1e-4), m_roots(0, 0, 0),
+  m_pointCount(0), m_minValue(0.0), m_maxValue(0.0), m_cubeType(Cube::None)
+{
+}
+
+bool AdaptiveCube::setLimits(const Vector3d &min, const Vector3d &max,
+                             double spacing, int levels)
+{
+  if (spacing <= 0.0 || levels < 1 || levels > 16
+      || (max - min).minCoeff() < 0.0) {
+    qDebug() << "Invalid limits passed to AdaptiveCube::setLimits.";
+    return false;
+  }
+  m_min = min;
+  m_max = max;
+  m_spacing = spacing;
+  m_levels = levels;
+  double rootWidth = blockWidth(0) * spacing;
+  for (int i = 0; i < 3; ++i)
+    m_roots[i] = std::max(1, static_cast<int>(std::ceil((max[i] - min[i])
+                                                         / rootWidth - 1e-9)));
+  m_blocks.clear();
+  m_values.clear();
+  m_pointCount = 0;
+  m_minValue = m_maxValue = 0.0;
+  return true;
+}
+
+void AdaptiveCube::calculate(BasisSet *basis,
+                             const std::vector<Vector3d> &nuclei)
+{
+  m_blocks.clear();
+  m_pointCount = 0;
+  if (!m_levels)
+    return;
+
+  // The root blocks
+  int width = blockWidth(0);
+  for (int i = 0; i < m_roots.x(); ++i) {
+    for (int j = 0; j < m_roots.y(); ++j) {
+      for (int k = 0; k < m_roots.z(); ++k) {
+        Block block;
+        block.origin = Vector3i(i, j, k) * width;
+        block.level = 0;
+        block.parent = -1;
+        block.firstChild = -1;
+        block.offset = m_blocks.size() * BLOCK_VALUES;
+        m_blocks.push_back(block);
+      }
+    }
+  }
+
+  unsigned int levelBegin = 0;
+  for (int level = 0; level < m_levels; ++level) {
+    unsigned int levelEnd = m_blocks.size();
+    if (levelBegin == levelEnd)
+      break;
+
+    // Calculate the points of this level in parallel
+    m_values.resize(levelEnd * BLOCK_VALUES);
+    std::vector<PointTask> tasks;
+    for (unsigned int b = levelBegin; b < levelEnd; ++b)
+      prepareBlock(m_blocks[b], basis, tasks);
+    CubeScheduler::instance()->map(basis->priority(), tasks.begin(),
+                                   tasks.end(), calculatePoint)
+        .waitForFinished();
+    m_pointCount += tasks.size();
+
+    // Split the blocks that are not accurate enough
+    if (level + 1 == m_levels)
+      break;
+    int half = blockWidth(level) / 2;
+    for (unsigned int b = levelBegin; b < levelEnd; ++b) {
+      if (estimateError(m_blocks[b]) <= m_tolerance
+          && !containsNucleus(m_blocks[b], nuclei))
+        continue;
+      m_blocks[b].firstChild = m_blocks.size();
+      Vector3i origin = m_blocks[b].origin;
+      for (int octant = 0; octant < 8; ++octant) {
+        Block child;
+        child.origin = origin + Vector3i(octant >> 2, (octant >> 1) & 1,
+                                         octant & 1) * half;
+        child.level = level + 1;
+        child.parent = b;
+        child.firstChild = -1;
+        child.offset = m_blocks.size() * BLOCK_VALUES;
+        m_blocks.push_back(child);
+      }
+    }
+    levelBegin = levelEnd;
+  }
+  constrainHangingNodes();
+
+  if (!m_values.empty()) {
+    m_minValue = *std::min_element(m_values.begin(), m_values.end());
+    m_maxValue = *std::max_element(m_values.begin(), m_values.end());
+  }
+}
+
+void AdaptiveCube::prepareBlock(const Block &block, BasisSet *basis,
+                                std::vector<PointTask> &tasks)
+{
+  double *values = &m_values[block.offset];
+  int step = 1 << (m_levels - 1 - block.level);
+
+  // The points shared with the parent are every other point of one octant
+  // of it
+  const double *parent = 0;
+  Vector3i octant(0, 0, 0);
+  if (block.parent >= 0) {
+    const Block &p = m_blocks[block.parent];
+    parent = &m_values[p.offset];
+    octant = (block.origin - p.origin) / step / 2;
+  }
+
+  PointTask task;
+  task.basis = basis;
+  for (int i = 0; i < BLOCK_POINTS; ++i) {
+    for (int j = 0; j < BLOCK_POINTS; ++j) {
+      for (int k = 0; k < BLOCK_POINTS; ++k) {
+        int offset = pointOffset(i, j, k);
+        if (parent && !(i % 2) && !(j % 2) && !(k % 2)) {
+          values[offset] = parent[pointOffset(octant.x() + i / 2,
+                                              octant.y() + j / 2,
+                                              octant.z() + k / 2)];
+        }
+        else {
+          task.pos = m_min + (block.origin + Vector3i(i, j, k) * step)
+              .cast<double>() * m_spacing;
+          task.value = values + offset;
+          tasks.push_back(task);
+        }
+      }
+    }
+  }
+}
+
+void AdaptiveCube::calculatePoint(PointTask &task)
+{
+  *task.value = task.basis->pointValue(task.pos);
+}
+
+void AdaptiveCube::constrainHangingNodes()
+{
+  // Coarser blocks first, so that the values they are interpolated from have
+  // been constrained themselves
+  for (size_t b = 0; b < m_blocks.size(); ++b) {
+    const Block &block = m_blocks[b];
+    if (block.firstChild >= 0 || block.level == 0)
+      continue;
+    double *values = &m_values[block.offset];
+    int step = 1 << (m_levels - 1 - block.level);
+    for (int i = 0; i < BLOCK_POINTS; ++i) {
+      for (int j = 0; j < BLOCK_POINTS; ++j) {
+        for (int k = 0; k < BLOCK_POINTS; ++k) {
+          if (i % BLOCK_SIZE && j % BLOCK_SIZE && k % BLOCK_SIZE)
+            continue;
+          // The blocks around a point on the surface of the block each
+          // contain one of the positions half a cell away from it diagonally
+          Vector3d cell = (block.origin + Vector3i(i, j, k) * step)
+              .cast<double>();
+          int coarsest = -1;
+          for (int d = 0; d < 8; ++d) {
+            Vector3d probe = cell + Vector3d(d >> 2 ? 0.5 : -0.5,
+                                             (d >> 1) & 1 ? 0.5 : -0.5,
+                                             d & 1 ? 0.5 : -0.5);
+            int n = findBlock(probe);
+            if (n >= 0 && m_blocks[n].level < block.level
+                && (coarsest < 0
+                    || m_blocks[n].level < m_blocks[coarsest].level))
+              coarsest = n;
+          }
+          if (coarsest >= 0)
+            values[pointOffset(i, j, k)] = interpolate(m_blocks[coarsest],
+                                                       cell);
+        }
+      }
+    }
+  }
+}
+
+double AdaptiveCube::estimateError(const Block &block) const
+{
+  // The error of linear interpolation within a cell is bounded by an eighth
+  // of the second difference across it
+  const double *values = &m_values[block.offset];
+  double error = 0.0;
+  for (int i = 0; i < BLOCK_POINTS; ++i) {
+    for (int j = 0; j < BLOCK_POINTS; ++j) {
+      for (int k = 0; k < BLOCK_POINTS; ++k) {
+        double twice = 2.0 * values[pointOffset(i, j, k)];
+        if (i > 0 && i < BLOCK_SIZE)
+          error = std::max(error, std::abs(values[pointOffset(i - 1, j, k)]
+              - twice + values[pointOffset(i + 1, j, k)]));
+        if (j > 0 && j < BLOCK_SIZE)
+          error = std::max(error, std::abs(values[pointOffset(i, j - 1, k)]
+              - twice + values[pointOffset(i, j + 1, k)]));
+        if (k > 0 && k < BLOCK_SIZE)
+          error = std::max(error, std::abs(values[pointOffset(i, j, k - 1)]
+              - twice + values[pointOffset(i, j, k + 1)]));
+      }
+    }
+  }
+  return error / 8.0;
+}
+
+bool AdaptiveCube::containsNucleus(const Block &block,
+                                   const std::vector<Vector3d> &nuclei) const
+{
+  Vector3d min = block.origin.cast<double>();
+  Vector3d max = min + Vector3d::Constant(blockWidth(block.level));
+  for (size_t i = 0; i < nuclei.size(); ++i) {
+    Vector3d cell = (nuclei[i] - m_min) / m_spacing;
+    if ((cell.array() >= min.array()).all()
+        && (cell.array() <= max.array()).all())
+      return true;
+  }
+  return false;
+}
+
+int AdaptiveCube::findBlock(const Vector3d &cell) const
+{
+  if (m_blocks.empty())
+    return -1;
+
+  int width = blockWidth(0);
+  Vector3i root;
+  for (int i = 0; i < 3; ++i) {
+    if (cell[i] < 0.0 || cell[i] > m_roots[i] * width)
+      return -1;
+    root[i] = std::min(static_cast<int>(cell[i] / width), m_roots[i] - 1);
+  }
+
+  int b = (root.x() * m_roots.y() + root.y()) * m_roots.z() + root.z();
+  while (m_blocks[b].firstChild >= 0) {
+    const Block &block = m_blocks[b];
+    double half = blockWidth(block.level) / 2;
+    int octant = 0;
+    for (int i = 0; i < 3; ++i)
+      if (cell[i] >= block.origin[i] + half)
+        octant |= 4 >> i;
+    b = block.firstChild + octant;
+  }
+  return b;
+}
+
+double AdaptiveCube::value(const Vector3d &pos) const
+{
+  Vector3d cell = (pos - m_min) / m_spacing;
+  int b = findBlock(cell);
+  return b < 0 ? 0.0 : interpolate(m_blocks[b], cell);
+}
+
+double AdaptiveCube::interpolate(const Block &block,
+                                 const Vector3d &cell) const
+{
+  const double *values = &m_values[block.offset];
+  Vector3d local = (cell - block.origin.cast<double>())
+      / (1 << (m_levels - 1 - block.level));
+  int c[3];
+  double t[3];
+  for (int i = 0; i < 3; ++i) {
+    c[i] = std::max(0, std::min(static_cast<int>(local[i]), BLOCK_SIZE - 1));
+    t[i] = std::max(0.0, std::min(local[i] - c[i], 1.0));
+  }
+
+  double result = 0.0;
+  for (int corner = 0; corner < 8; ++corner) {
+    int di = corner >> 2, dj = (corner >> 1) & 1, dk = corner & 1;
+    double weight = (di ? t[0] : 1.0 - t[0]) * (dj ? t[1] : 1.0 - t[1])
+        * (dk ? t[2] : 1.0 - t[2]);
+    result += weight * values[pointOffset(c[0] + di, c[1] + dj, c[2] + dk)];
+  }
+  return result;
+}
+
+int AdaptiveCube::level(const Vector3d &pos) const
+{
+  int b = findBlock((pos - m_min) / m_spacing);
+  return b < 0 ? -1 : m_blocks[b].level;
+}
+
+bool AdaptiveCube::toCube(Cube *cube) const
+{
+  if (m_blocks.empty())
+    return false;
+
+  Vector3i dim = cube->dimensions();
+  if (dim.x() * dim.y() * dim.z() == 0) {
+    if (!cube->setLimits(m_min, m_max, m_spacing))
+      return false;
+    dim = cube->dimensions();
+  }
+
+  std::vector<double> values(dim.x() * dim.y() * dim.z());
+  std::vector<PlaneTask> tasks(dim.x());
+  for (int i = 0; i < dim.x(); ++i) {
+    tasks[i].adaptive = this;
+    tasks[i].cube = cube;
+    tasks[i].values = &values;
+    tasks[i].plane = i;
+  }
+  CubeScheduler::instance()->blockingMap(CubeScheduler::Interactive, tasks,
+                                         fillPlane);
+
+  cube->lock()->lockForWrite();
+  bool success = cube->setData(values);
+  cube->setCubeType(m_cubeType);
+  cube->lock()->unlock();
+  return success;
+}
+
+} // End namespace
@@ -0,0 +1,246 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_ADAPTIVECUBE_H
+#define OQ_ADAPTIVECUBE_H
+
+#include "openqubeabi.h"
+
+#include "cube.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+namespace OpenQube {
+
+class BasisSet;
+
+/**
+ * @class AdaptiveCube adaptivecube.h <openqube/adaptivecube.h>
+ * @brief AdaptiveCube holds a scalar field sampled with a resolution that
+ * adapts to the field.
+ *
+ * The region is covered by root blocks of BLOCK_SIZE cells along each axis,
+ * with a spacing of the finest spacing times 2^(levels - 1). The values at
+ * the corners of the cells of each block are calculated, and the error of
+ * interpolating them is estimated from their second differences. Blocks
+ * where it exceeds the tolerance are split into eight children of half the
+ * spacing, down to the finest spacing, as are the blocks containing a
+ * nucleus. The points a child shares with its parent are copied rather than
+ * calculated again. The points are calculated in the priority class of the
+ * basis set, see BasisSet::setPriority.
+ *
+ * The blocks are not balanced, a block may border on blocks any number of
+ * levels finer or coarser. The values on the faces a block shares with a
+ * coarser one are replaced by the ones interpolated from the coarser block,
+ * so that value() is continuous where the levels meet. The error this adds
+ * is within the tolerance the coarser block was accepted with.
+ *
+ * The field is smooth far away from the atoms, so most of the region is
+ * covered by coarse blocks and only the nuclear cusps and the nodes of the
+ * orbitals are calculated at the finest spacing.
+ *
+ * The cube is calculated by BasisSet::calculateAdaptiveCubeMO or
+ * BasisSet::calculateAdaptiveCubeDensity.
+ */
+
+class OPENQUBE_EXPORT AdaptiveCube
+{
+public:
+  /**
+   * The number of cells along each axis of a block.
+   */
+  static const int BLOCK_SIZE = 8;
+
+  AdaptiveCube();
+
+  /**
+   * Set the limits of the cube, discarding its values.
+   * @param min The minimum point in the cube.
+   * @param max The maximum point in the cube. The root blocks may extend
+   * beyond it.
+   * @param spacing The finest interval between points in the cube.
+   * @param levels The number of levels of refinement, at least 1. The
+   * spacing of the root blocks is @a spacing * 2^(@a levels - 1).
+   */
+  bool setLimits(const Eigen::Vector3d &min, const Eigen::Vector3d &max,
+                 double spacing, int levels = 4);
+
+  /**
+   * @return The minimum point in the cube.
+   */
+  Eigen::Vector3d min() const { return m_min; }
+
+  /**
+   * @return The maximum point in the cube.
+   */
+  Eigen::Vector3d max() const { return m_max; }
+
+  /**
+   * @return The finest spacing of the cube.
+   */
+  double spacing() const { return m_spacing; }
+
+  /**
+   * @return The number of levels of refinement.
+   */
+  int levels() const { return m_levels; }
+
+  /**
+   * Set the largest interpolation error tolerated before a block is refined,
+   * defaults to 1e-4.
+   */
+  void setTolerance(double tolerance) { m_tolerance = tolerance; }
+
+  /**
+   * @return The largest interpolation error tolerated before a block is
+   * refined.
+   */
+  double tolerance() const { return m_tolerance; }
+
+  /**
+   * @return The value at @a pos, interpolated trilinearly from the finest
+   * block containing it. Zero outside of the cube.
+   */
+  double value(const Eigen::Vector3d &pos) const;
+
+  /**
+   * @return The level of the finest block containing @a pos, 0 is the
+   * coarsest. -1 outside of the cube.
+   */
+  int level(const Eigen::Vector3d &pos) const;
+
+  /**
+   * Fill @a cube with the values of this cube at its points, interpolated in
+   * parallel in the Interactive class of CubeScheduler. If @a cube has no
+   * points its limits are set to those of this cube, with the finest
+   * spacing.
+   * @return True on success.
+   */
+  bool toCube(Cube *cube) const;
+
+  /**
+   * @return The number of points that were calculated.
+   */
+  unsigned int pointCount() const { return m_pointCount; }
+
+  /**
+   * @return The number of blocks, including the ones that were split.
+   */
+  unsigned int blockCount() const
+  {
+    return static_cast<unsigned int>(m_blocks.size());
+  }
+
+  /**
+   * @return The minimum value at any point in the cube.
+   */
+  double minValue() const { return m_minValue; }
+
+  /**
+   * @return The maximum value at any point in the cube.
+   */
+  double maxValue() const { return m_maxValue; }
+
+  void setCubeType(Cube::Type type) { m_cubeType = type; }
+  Cube::Type cubeType() const { return m_cubeType; }
+
+private:
+  friend class BasisSet;
+
+  struct Block
+  {
+    Eigen::Vector3i origin; ///< In cells of the finest spacing
+    int level;
+    int parent;             ///< -1 for root blocks
+    int firstChild;         ///< -1 for leaves, the children are consecutive
+    unsigned int offset;    ///< Into m_values
+  };
+
+  /**
+   * Calculate the cube from the point values of @a basis, which must have
+   * been initialized with BasisSet::initPointValues. The blocks containing
+   * one of @a nuclei are always refined, as the cusps are too narrow for
+   * the coarser blocks to sample.
+   */
+  void calculate(BasisSet *basis, const std::vector<Eigen::Vector3d> &nuclei);
+
+  /**
+   * @return True if @a block contains one of @a nuclei.
+   */
+  bool containsNucleus(const Block &block,
+                       const std::vector<Eigen::Vector3d> &nuclei) const;
+
+  /**
+   * @return The index of the finest block containing @a cell, a position in
+   * cells of the finest spacing, -1 if none.
+   */
+  int findBlock(const Eigen::Vector3d &cell) const;
+
+  /**
+   * @return The value at @a cell, a position in cells of the finest spacing,
+   * interpolated trilinearly from the points of @a block.
+   */
+  double interpolate(const Block &block, const Eigen::Vector3d &cell) const;
+
+  /**
+   * Replace the values on the faces of the blocks that border on coarser
+   * ones by the values interpolated from the coarser blocks.
+   */
+  void constrainHangingNodes();
+
+  /**
+   * @return The estimated interpolation error of @a block.
+   */
+  double estimateError(const Block &block) const;
+
+  /**
+   * @return The width of the blocks at @a level in cells of the finest
+   * spacing.
+   */
+  int blockWidth(int level) const
+  {
+    return BLOCK_SIZE << (m_levels - 1 - level);
+  }
+
+  /**
+   * Copy the points of @a block shared with its parent, and queue the others
+   * in @a tasks to be calculated.
+   */
+  struct PointTask;
+  void prepareBlock(const Block &block, BasisSet *basis,
+                    std::vector<PointTask> &tasks);
+
+  /**
+   * Calculate one point, in parallel with the other points of its level.
+   */
+  static void calculatePoint(PointTask &task);
+
+  Eigen::Vector3d m_min, m_max;
+  double m_spacing;
+  int m_levels;
+  double m_tolerance;
+  Eigen::Vector3i m_roots;       ///< Root blocks along each axis
+  std::vector<Block> m_blocks;   ///< Root blocks first
+  std::vector<double> m_values;  ///< (BLOCK_SIZE + 1)^3 values per block
+  unsigned int m_pointCount;
+  double m_minValue, m_maxValue;
+  Cube::Type m_cubeType;
+};
+
+} // End namespace
+
+#endif
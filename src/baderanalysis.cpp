@@ -0,0 +1,472 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "baderanalysis.h"
+
+#include "cube.h"
+#include "cubescheduler.h"
+#include "molecule.h"
+
+#include <QtCore/QReadLocker>
+#include <QtCore/QReadWriteLock>
+
+#include <algorithm>
+#include <cmath>
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+using std::vector;
+
+namespace OpenQube {
+
+namespace {
+
+const double ANGSTROM_TO_BOHR = 1.0 / 0.529177249;
+
+const unsigned int NO_POINT = ~0u;
+
+// The state shared by the planes of the cube
+struct Analysis
+{
+  const double *data;
+  int points[3];
+  unsigned int strides[3];
+  double spacing[3];
+  double vacuum;
+  int offsets[26][3];        // The neighbours of a point
+  double inverseLengths[26]; // One over the distance to each neighbour
+  vector<unsigned int> ascent;  // The steepest neighbour, itself at maxima
+  vector<unsigned int> roots;   // The maximum each path ends at
+  vector<unsigned int> jumped;
+  vector<int> basins;           // The basin of each point, -1 in vacuum
+  vector<int> refined;
+  vector<char> check;           // The points to assign again
+  vector<char> changedRows;     // The rows along z where points changed
+  int basinCount;
+};
+
+// A plane of points across x
+struct Plane
+{
+  Analysis *analysis;
+  int plane;
+  bool changed;
+  vector<double> populations; // Density summed over each basin
+  vector<unsigned int> counts;
+  double vacuumPopulation;
+  unsigned int vacuumCount;
+};
+
+// Whether the density at a is above that at b, breaking ties by the index so
+// that no path can go round in circles on a plateau
+inline bool above(const double *data, unsigned int a, unsigned int b)
+{
+  return data[a] > data[b] || (data[a] == data[b] && a > b);
+}
+
+// The neighbour each point rises most steeply to, per unit of length
+void findAscent(Plane &p)
+{
+  Analysis &a = *p.analysis;
+  int i = p.plane;
+  unsigned int index = i * a.strides[0];
+  for (int j = 0; j < a.points[1]; ++j) {
+    for (int k = 0; k < a.points[2]; ++k, ++index) {
+      if (a.data[index] < a.vacuum) {
+        a.ascent[index] = NO_POINT;
+        continue;
+      }
+      unsigned int steepest = index;
+      double slope = 0.0;
+      for (int n = 0; n < 26; ++n) {
+        int x = i + a.offsets[n][0], y = j + a.offsets[n][1],
+            z = k + a.offsets[n][2];
+        if (x < 0 || y < 0 || z < 0 || x >= a.points[0]
+            || y >= a.points[1] || z >= a.points[2])
+          continue;
+        unsigned int neighbour = x * a.strides[0] + y * a.strides[1] + z;
+        if (!above(a.data, neighbour, index))
+          continue;
+        double rise = (a.data[neighbour] - a.data[index])
+            * a.inverseLengths[n];
+        if (rise > slope || steepest == index) {
+          steepest = neighbour;
+          slope = rise;
+        }
+      }
+      a.ascent[index] = steepest;
+    }
+  }
+}
+
+// Halve the paths to the maxima, reading the roots and writing the jumped
+// roots
+void jumpRoots(Plane &p)
+{
+  Analysis &a = *p.analysis;
+  unsigned int first = p.plane * a.strides[0];
+  unsigned int last = first + a.strides[0];
+  p.changed = false;
+  for (unsigned int i = first; i < last; ++i) {
+    unsigned int root = a.roots[i];
+    if (root != NO_POINT && a.roots[root] != root) {
+      root = a.roots[root];
+      p.changed = true;
+    }
+    a.jumped[i] = root;
+  }
+}
+
+void labelPoints(Plane &p)
+{
+  Analysis &a = *p.analysis;
+  unsigned int first = p.plane * a.strides[0];
+  unsigned int last = first + a.strides[0];
+  for (unsigned int i = first; i < last; ++i)
+    if (a.roots[i] != NO_POINT && a.roots[i] != i)
+      a.basins[i] = a.basins[a.roots[i]];
+}
+
+// Whether a point lies on the boundary of its basin, next to a point of
+// another basin across one of the faces of its cell
+bool onBoundary(const Analysis &a, const int point[3], unsigned int index)
+{
+  int basin = a.basins[index];
+  if (basin < 0)
+    return false;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (point[axis] > 0) {
+      int other = a.basins[index - a.strides[axis]];
+      if (other >= 0 && other != basin)
+        return true;
+    }
+    if (point[axis] + 1 < a.points[axis]) {
+      int other = a.basins[index + a.strides[axis]];
+      if (other >= 0 && other != basin)
+        return true;
+    }
+  }
+  return false;
+}
+
+// Follow the near-grid path from a point on a boundary until it reaches a
+// point inside a basin or a maximum. Each step moves to the point of the
+// grid nearest to the gradient scaled so its largest component is one
+// point, and the remainder is carried over to later steps. Steps that would
+// not go uphill fall back to the steepest neighbour, and drop the remainder.
+int nearGridBasin(const Analysis &a, const int start[3], unsigned int index)
+{
+  int point[3] = { start[0], start[1], start[2] };
+  Vector3d remainder = Vector3d::Zero();
+  for (bool first = true; ; first = false) {
+    if (a.ascent[index] == index || (!first && !onBoundary(a, point, index)))
+      return a.basins[index];
+
+    // The gradient by central differences, one-sided on the faces of the
+    // cube, in points of the cube
+    Vector3d step;
+    for (int axis = 0; axis < 3; ++axis) {
+      unsigned int lower = point[axis] > 0 ? index - a.strides[axis] : index;
+      unsigned int upper = point[axis] + 1 < a.points[axis]
+          ? index + a.strides[axis] : index;
+      int width = (lower != index) + (upper != index);
+      step[axis] = width ? (a.data[upper] - a.data[lower])
+                           / (width * a.spacing[axis] * a.spacing[axis])
+                         : 0.0;
+    }
+    double largest = step.cwiseAbs().maxCoeff();
+
+    unsigned int next = NO_POINT;
+    int nextPoint[3];
+    if (largest > 0.0) {
+      step /= largest;
+      next = 0;
+      for (int axis = 0; axis < 3; ++axis) {
+        double rounded = std::floor(step[axis] + 0.5);
+        remainder[axis] += step[axis] - rounded;
+        if (remainder[axis] >= 0.5) {
+          rounded += 1.0;
+          remainder[axis] -= 1.0;
+        }
+        else if (remainder[axis] <= -0.5) {
+          rounded -= 1.0;
+          remainder[axis] += 1.0;
+        }
+        nextPoint[axis] = std::max(0, std::min(point[axis]
+                                               + static_cast<int>(rounded),
+                                               a.points[axis] - 1));
+        next += nextPoint[axis] * a.strides[axis];
+      }
+      if (!above(a.data, next, index))
+        next = NO_POINT;
+    }
+    if (next == NO_POINT) {
+      next = a.ascent[index];
+      remainder.setZero();
+      unsigned int rest = next;
+      for (int axis = 0; axis < 3; ++axis) {
+        nextPoint[axis] = rest / a.strides[axis];
+        rest %= a.strides[axis];
+      }
+    }
+    index = next;
+    for (int axis = 0; axis < 3; ++axis)
+      point[axis] = nextPoint[axis];
+  }
+}
+
+// Assign the points to check that lie on a boundary again, reading the
+// basins and writing the refined basins
+void refinePlane(Plane &p)
+{
+  Analysis &a = *p.analysis;
+  int point[3] = { p.plane, 0, 0 };
+  unsigned int index = p.plane * a.strides[0];
+  p.changed = false;
+  for (point[1] = 0; point[1] < a.points[1]; ++point[1]) {
+    char &rowChanged = a.changedRows[p.plane * a.points[1] + point[1]];
+    rowChanged = false;
+    for (point[2] = 0; point[2] < a.points[2]; ++point[2], ++index) {
+      a.refined[index] = a.basins[index];
+      if (!a.check[index] || !onBoundary(a, point, index))
+        continue;
+      a.refined[index] = nearGridBasin(a, point, index);
+      if (a.refined[index] != a.basins[index])
+        rowChanged = true;
+    }
+    p.changed = p.changed || rowChanged;
+  }
+}
+
+// Check the points next to those that changed basin again, only looking at
+// the neighbours in rows where some point changed
+void markChanges(Plane &p)
+{
+  Analysis &a = *p.analysis;
+  int i = p.plane;
+  unsigned int index = i * a.strides[0];
+  for (int j = 0; j < a.points[1]; ++j, index += a.strides[1]) {
+    bool nearChange = false;
+    for (int x = std::max(i - 1, 0); x <= std::min(i + 1, a.points[0] - 1);
+         ++x)
+      for (int y = std::max(j - 1, 0); y <= std::min(j + 1, a.points[1] - 1);
+           ++y)
+        nearChange = nearChange || a.changedRows[x * a.points[1] + y];
+    char *check = &a.check[index];
+    std::fill(check, check + a.points[2], false);
+    if (!nearChange)
+      continue;
+    for (int k = 0; k < a.points[2]; ++k) {
+      for (int n = 0; n < 26 && !check[k]; ++n) {
+        int x = i + a.offsets[n][0], y = j + a.offsets[n][1],
+            z = k + a.offsets[n][2];
+        if (x < 0 || y < 0 || z < 0 || x >= a.points[0]
+            || y >= a.points[1] || z >= a.points[2])
+          continue;
+        unsigned int neighbour = x * a.strides[0] + y * a.strides[1] + z;
+        check[k] = a.refined[neighbour] != a.basins[neighbour];
+      }
+    }
+  }
+}
+
+void integratePlane(Plane &p)
+{
+  Analysis &a = *p.analysis;
+  unsigned int first = p.plane * a.strides[0];
+  unsigned int last = first + a.strides[0];
+  p.populations.assign(a.basinCount, 0.0);
+  p.counts.assign(a.basinCount, 0);
+  p.vacuumPopulation = 0.0;
+  p.vacuumCount = 0;
+  for (unsigned int i = first; i < last; ++i) {
+    if (a.basins[i] < 0) {
+      p.vacuumPopulation += a.data[i];
+      ++p.vacuumCount;
+    }
+    else {
+      p.populations[a.basins[i]] += a.data[i];
+      ++p.counts[a.basins[i]];
+    }
+  }
+}
+
+// The maximum interpolated by a parabola along each axis through the point
+// of the cube and its neighbours, kept within the cell of the point
+void interpolateMaximum(const Analysis &a, const Cube &cube,
+                        unsigned int index, BaderAnalysis::Basin &basin)
+{
+  basin.maximum = cube.position(index);
+  basin.maximumValue = a.data[index];
+  unsigned int rest = index;
+  for (int axis = 0; axis < 3; ++axis) {
+    int point = rest / a.strides[axis];
+    rest %= a.strides[axis];
+    if (point == 0 || point + 1 == a.points[axis])
+      continue;
+    double lower = a.data[index - a.strides[axis]];
+    double upper = a.data[index + a.strides[axis]];
+    double curvature = upper - 2.0 * a.data[index] + lower;
+    if (curvature >= 0.0)
+      continue;
+    double offset = std::max(-0.5, std::min(0.5 * (lower - upper) / curvature,
+                                            0.5));
+    basin.maximum[axis] += offset * a.spacing[axis];
+    basin.maximumValue += 0.25 * (upper - lower) * offset;
+  }
+}
+
+}
+
+BaderAnalysis::Partition BaderAnalysis::partition(const Cube &density,
+                                                  double vacuum)
+{
+  Partition result;
+  QReadLocker locker(density.lock());
+  Vector3i points = density.dimensions();
+  unsigned int count = density.data()->size();
+  if (count == 0 || count != static_cast<size_t>(points[0]) * points[1]
+      * points[2])
+    return result;
+
+  Analysis a;
+  a.data = &(*density.data())[0];
+  a.vacuum = vacuum;
+  for (int axis = 0; axis < 3; ++axis) {
+    a.points[axis] = points[axis];
+    a.spacing[axis] = density.spacing()[axis];
+  }
+  a.strides[0] = points[1] * points[2];
+  a.strides[1] = points[2];
+  a.strides[2] = 1;
+  int n = 0;
+  for (int x = -1; x <= 1; ++x) {
+    for (int y = -1; y <= 1; ++y) {
+      for (int z = -1; z <= 1; ++z) {
+        if (!x && !y && !z)
+          continue;
+        a.offsets[n][0] = x;
+        a.offsets[n][1] = y;
+        a.offsets[n][2] = z;
+        a.inverseLengths[n] = 1.0 / Vector3d(x * a.spacing[0],
+                                             y * a.spacing[1],
+                                             z * a.spacing[2]).norm();
+        ++n;
+      }
+    }
+  }
+
+  vector<Plane> planes(points[0]);
+  for (int i = 0; i < points[0]; ++i) {
+    planes[i].analysis = &a;
+    planes[i].plane = i;
+  }
+
+  // The passes are scheduled with the cube calculations the user is waiting
+  // for
+  CubeScheduler *scheduler = CubeScheduler::instance();
+
+  // The on-grid paths, and the maxima they end at by pointer jumping
+  a.ascent.resize(count);
+  scheduler->blockingMap(CubeScheduler::Interactive, planes, findAscent);
+  a.roots = a.ascent;
+  a.jumped.resize(count);
+  for (bool changed = true; changed; ) {
+    scheduler->blockingMap(CubeScheduler::Interactive, planes, jumpRoots);
+    a.roots.swap(a.jumped);
+    changed = false;
+    for (int i = 0; i < points[0]; ++i)
+      changed = changed || planes[i].changed;
+  }
+  vector<unsigned int>().swap(a.jumped);
+
+  // A basin for each maximum, in the order of the points of the cube
+  a.basins.assign(count, -1);
+  a.basinCount = 0;
+  for (unsigned int i = 0; i < count; ++i) {
+    if (a.ascent[i] == i) {
+      a.basins[i] = a.basinCount++;
+      result.basins.push_back(Basin());
+      interpolateMaximum(a, density, i, result.basins.back());
+    }
+  }
+  scheduler->blockingMap(CubeScheduler::Interactive, planes, labelPoints);
+  vector<unsigned int>().swap(a.roots);
+
+  // The near-grid refinement of the boundaries, until no point changes basin
+  // or the boundaries have had time to cross the cube
+  a.refined.resize(count);
+  a.check.assign(count, true);
+  a.changedRows.resize(points[0] * points[1]);
+  int passes = points.maxCoeff();
+  for (bool changed = true; changed && passes > 0; --passes) {
+    scheduler->blockingMap(CubeScheduler::Interactive, planes, refinePlane);
+    changed = false;
+    for (int i = 0; i < points[0]; ++i)
+      changed = changed || planes[i].changed;
+    if (changed)
+      scheduler->blockingMap(CubeScheduler::Interactive, planes, markChanges);
+    a.basins.swap(a.refined);
+  }
+
+  // The density summed over each basin, in electrons
+  scheduler->blockingMap(CubeScheduler::Interactive, planes, integratePlane);
+  double volume = a.spacing[0] * a.spacing[1] * a.spacing[2];
+  double electrons = volume * std::pow(ANGSTROM_TO_BOHR, 3);
+  for (int i = 0; i < points[0]; ++i) {
+    for (int b = 0; b < a.basinCount; ++b) {
+      result.basins[b].population += planes[i].populations[b] * electrons;
+      result.basins[b].volume += planes[i].counts[b] * volume;
+    }
+    result.vacuumPopulation += planes[i].vacuumPopulation * electrons;
+    result.vacuumVolume += planes[i].vacuumCount * volume;
+  }
+  result.pointBasins.swap(a.basins);
+  return result;
+}
+
+BaderAnalysis::Partition BaderAnalysis::partition(const Cube &density,
+                                                  const Molecule &molecule,
+                                                  double vacuum)
+{
+  Partition result = partition(density, vacuum);
+  size_t atoms = molecule.numAtoms();
+  result.populations.assign(atoms, 0.0);
+  result.volumes.assign(atoms, 0.0);
+  for (size_t b = 0; b < result.basins.size(); ++b) {
+    Basin &basin = result.basins[b];
+    double nearest = 0.0;
+    for (size_t i = 0; i < atoms; ++i) {
+      if (molecule.atomAtomicNumber(i) == 0)
+        continue;
+      double distance = (molecule.atomPos(i) - basin.maximum).squaredNorm();
+      if (basin.atom < 0 || distance < nearest) {
+        basin.atom = i;
+        nearest = distance;
+      }
+    }
+    if (basin.atom >= 0) {
+      result.populations[basin.atom] += basin.population;
+      result.volumes[basin.atom] += basin.volume;
+    }
+  }
+  result.charges.resize(atoms);
+  for (size_t i = 0; i < atoms; ++i)
+    result.charges[i] = molecule.atomAtomicNumber(i) - result.populations[i];
+  return result;
+}
+
+} // End namespace
@@ -0,0 +1,110 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_BADERANALYSIS_H
+#define OQ_BADERANALYSIS_H
+
+#include "openqubeabi.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+namespace OpenQube {
+
+class Cube;
+class Molecule;
+
+/**
+ * @class BaderAnalysis baderanalysis.h <openqube/baderanalysis.h>
+ * @brief BaderAnalysis splits an electron density Cube into the basins of
+ * the quantum theory of atoms in molecules, and integrates the number of
+ * electrons and the volume of each.
+ *
+ * Each point of the cube belongs to the maximum of the density its steepest
+ * ascent path ends at. Paths are first followed from point to point along
+ * the steepest of the 26 neighbouring points, which gives every point a basin
+ * in time linear in the number of points but biases the boundaries towards
+ * the axes of the grid. The points on the boundaries between basins are then
+ * assigned again with the near-grid method of Tang, Sanville and Henkelman:
+ * the paths follow the gradient interpolated by central differences, with
+ * the part of each step that does not fall on the grid carried over to the
+ * next. This is repeated for the points next to those that changed basin,
+ * until none do. Every pass is parallel over the planes of the cube, in the
+ * Interactive class of CubeScheduler.
+ *
+ * The density is taken to be in electrons per cubic Bohr, as calculated by
+ * BasisSet, on a cube in Angstrom, and volumes are in cubic Angstrom. Points
+ * with a density below the vacuum threshold belong to no basin.
+ */
+
+class OPENQUBE_EXPORT BaderAnalysis
+{
+public:
+  /**
+   * @struct Basin
+   * A basin of the density, around one of its maxima.
+   */
+  struct Basin
+  {
+    Basin() : maximum(Eigen::Vector3d::Zero()), maximumValue(0.0),
+      population(0.0), volume(0.0), atom(-1) {}
+    Eigen::Vector3d maximum; ///< Position of the maximum, interpolated.
+    double maximumValue;     ///< Density at the maximum, interpolated.
+    double population;       ///< Number of electrons in the basin.
+    double volume;           ///< Volume of the basin.
+    int atom;                ///< Index of the nearest atom, or -1.
+  };
+
+  /**
+   * @struct Partition
+   * The basins of a density cube and, if a Molecule was given, their sums
+   * over the atoms.
+   */
+  struct Partition
+  {
+    Partition() : vacuumPopulation(0.0), vacuumVolume(0.0) {}
+    std::vector<Basin> basins;       ///< Basins in the order of the maxima.
+    std::vector<int> pointBasins;    ///< Basin of each point, -1 in vacuum.
+    double vacuumPopulation;         ///< Electrons below the threshold.
+    double vacuumVolume;             ///< Volume below the threshold.
+    std::vector<double> populations; ///< Electrons of each atom.
+    std::vector<double> charges;     ///< Atomic number less population.
+    std::vector<double> volumes;     ///< Volume of each atom.
+  };
+
+  /**
+   * Split @a density into basins. The cube is locked for reading while it
+   * is partitioned.
+   * @param vacuum Points with a density below this belong to no basin.
+   * @return The basins, empty if the cube has no data.
+   */
+  static Partition partition(const Cube &density, double vacuum = 1e-3);
+
+  /**
+   * Split @a density into basins, and give each basin to the atom of
+   * @a molecule nearest to its maximum, so non-nuclear maxima are counted
+   * with their nearest atom. The positions of the atoms are taken to be in
+   * the units of the cube, Angstrom. Atoms with an atomic number of zero are
+   * given no basins, and the charges of atoms with an effective core
+   * potential should be corrected for the core electrons.
+   */
+  static Partition partition(const Cube &density, const Molecule &molecule,
+                             double vacuum = 1e-3);
+};
+
+} // End namespace
+
+#endif
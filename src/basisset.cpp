@@ -16,27 +16,760 @@
 
 #include "basisset.h"
 
+#include "adaptivecube.h"
 #include "cube.h"
+#include "cubecache.h"
+#include "cubediskcache.h"
+#include "cubescheduler.h"
+#include "multicube.h"
 
+#include <QtCore/QFutureInterface>
 #include <QtCore/QFutureWatcher>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QDebug>
+
+#include <Eigen/Eigenvalues>
+
+#include <algorithm>
+#include <cmath>
+#include <math.h> // needed for M_PI
 
 namespace OpenQube
 {
 
+// The stride of the coarsest subgrid calculated in Progressive and Adaptive
+// mode
+static const int COARSEST_STRIDE = 4;
+
+// The points along an axis of the Adaptive subgrid, which also includes the
+// last point so that the subgrid covers the whole cube
+static void subgridAxis(int points, std::vector<int> &axis)
+{
+  axis.clear();
+  for (int i = 0; i < points; i += COARSEST_STRIDE)
+    axis.push_back(i);
+  if (axis.back() != points - 1)
+    axis.push_back(points - 1);
+}
+
+// The number of points calculated together by calculateTile
+static const unsigned int TILE_SIZE = 64;
+
+// Spread the low 10 bits of v out to every third bit, for Morton codes
+static inline unsigned int spreadBits(unsigned int v)
+{
+  v = (v | (v << 16)) & 0x030000FF;
+  v = (v | (v << 8)) & 0x0300F00F;
+  v = (v | (v << 4)) & 0x030C30C3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+struct BasisSet::PointTile
+{
+  BasisSet *basis;
+  const Eigen::Vector3d *points;
+  unsigned int count;
+  double *values;
+  Eigen::Vector3d *gradients;
+  Eigen::Matrix3d *hessians;
+};
+
+// The points along each axis of the bricks of the grid calculated together
+// by calculateDensityGrid
+static const int BRICK_SIZE = 4;
+static const int BRICK_POINTS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+// The fields derived from the density by calculateDensityGrid
+enum DensityField {
+  DensityDerivativesField, // The DensityChannel channels
+  ReducedGradientField,    // s, and optionally sign(lambda2) * rho
+  LocalizationField        // The ELF
+};
+
+// The density per cubic Angstrom below which the derived fields are not
+// calculated, as they are dominated by rounding errors, and the reduced
+// density gradient used there instead
+static const double DENSITY_CUTOFF = 1e-9;
+static const double MAX_REDUCED_GRADIENT = 100.0;
+
+// The constants of the reduced density gradient, 2 (3 pi^2)^(1/3), and of
+// the kinetic energy density of the uniform electron gas,
+// 3/10 (3 pi^2)^(2/3)
+static const double REDUCED_GRADIENT_FACTOR =
+    2.0 * std::pow(3.0 * M_PI * M_PI, 1.0 / 3.0);
+static const double UNIFORM_GAS_FACTOR =
+    0.3 * std::pow(3.0 * M_PI * M_PI, 2.0 / 3.0);
+
+struct BasisSet::GridTile
+{
+  BasisSet *basis;
+  const Cube *grid;
+  int field;
+  Eigen::Vector3i first;
+  std::vector<std::vector<double> > *channels;
+};
+
 bool BasisSet::blockingCalculateCubeMO(Cube *cube, unsigned int mo)
 {
-  if (!this->calculateCubeMO(cube, mo))
+  // The levels of a progressive calculation are chained from the event loop
+  EvaluationMode mode = m_evaluationMode;
+  m_evaluationMode = Direct;
+  bool success = this->calculateCubeMO(cube, mo);
+  m_evaluationMode = mode;
+  if (!success)
     return false;
   this->watcher().waitForFinished();
+  // Complete the calculation here rather than from the event loop, so the
+  // cube is unlocked and stored before returning
+  calculationComplete();
   return true;
 }
 
 bool BasisSet::blockingCalculateCubeDensity(Cube *cube)
 {
-  if (!this->calculateCubeDensity(cube))
+  EvaluationMode mode = m_evaluationMode;
+  m_evaluationMode = Direct;
+  bool success = this->calculateCubeDensity(cube);
+  m_evaluationMode = mode;
+  if (!success)
     return false;
   this->watcher().waitForFinished();
+  calculationComplete();
+  return true;
+}
+
+bool BasisSet::calculateAdaptiveCubeMO(AdaptiveCube *cube, unsigned int mo)
+{
+  if (!initPointValues(Cube::MO, mo))
+    return false;
+  cube->setCubeType(Cube::MO);
+  cube->calculate(this, nuclearPositions());
+  return true;
+}
+
+bool BasisSet::calculateAdaptiveCubeDensity(AdaptiveCube *cube)
+{
+  if (!initPointValues(Cube::ElectronDensity))
+    return false;
+  cube->setCubeType(Cube::ElectronDensity);
+  cube->calculate(this, nuclearPositions());
+  return true;
+}
+
+bool BasisSet::calculateMOValues(const Eigen::Vector3d *points,
+                                 unsigned int count, unsigned int mo,
+                                 double *values, Eigen::Vector3d *gradients,
+                                 Eigen::Matrix3d *hessians)
+{
+  return calculatePoints(Cube::MO, mo, points, count, values, gradients,
+                         hessians);
+}
+
+bool BasisSet::calculateDensityValues(const Eigen::Vector3d *points,
+                                      unsigned int count, double *values,
+                                      Eigen::Vector3d *gradients,
+                                      Eigen::Matrix3d *hessians)
+{
+  return calculatePoints(Cube::ElectronDensity, 1, points, count, values,
+                         gradients, hessians);
+}
+
+bool BasisSet::calculateESPValues(const Eigen::Vector3d *points,
+                                  unsigned int count, double *values)
+{
+  return calculatePoints(Cube::ESP, 1, points, count, values, 0, 0);
+}
+
+bool BasisSet::calculateCubeESP(Cube *cube)
+{
+  Eigen::Vector3i dim = cube->dimensions();
+  unsigned int size = dim.x() * dim.y() * dim.z();
+  // One spare point, so that the pointers are valid for empty cubes
+  std::vector<Eigen::Vector3d> points(size + 1);
+  for (unsigned int i = 0; i < size; ++i)
+    points[i] = cube->position(i);
+  std::vector<double> values(size + 1);
+  if (!calculatePoints(Cube::ESP, 1, &points[0], size, &values[0], 0, 0))
+    return false;
+  values.pop_back();
+
+  cube->lock()->lockForWrite();
+  bool success = cube->setData(values);
+  cube->setCubeType(Cube::ESP);
+  cube->lock()->unlock();
+  return success;
+}
+
+bool BasisSet::calculateDensityDerivatives(MultiCube *cube)
+{
+  if (cube->channelCount() != DensityChannelCount) {
+    qDebug() << "The cube passed to calculateDensityDerivatives needs"
+             << DensityChannelCount << "channels.";
+    return false;
+  }
+  std::vector<std::vector<double> > channels(DensityChannelCount);
+  if (!calculateDensityGrid(DensityDerivativesField, cube->channel(0),
+                            channels))
+    return false;
+
+  bool success = true;
+  for (int c = 0; c < DensityChannelCount; ++c) {
+    Cube *channel = cube->channel(c);
+    channel->lock()->lockForWrite();
+    success = channel->setData(channels[c]) && success;
+    channel->setCubeType(c == DensityValue ? Cube::ElectronDensity
+                                           : Cube::None);
+    channel->lock()->unlock();
+  }
+  return success;
+}
+
+bool BasisSet::calculateCubeReducedDensityGradient(Cube *cube,
+                                                   Cube *signedDensity)
+{
+  std::vector<std::vector<double> > channels(signedDensity ? 2 : 1);
+  if (!calculateDensityGrid(ReducedGradientField, cube, channels))
+    return false;
+
+  cube->lock()->lockForWrite();
+  bool success = cube->setData(channels[0]);
+  cube->setCubeType(Cube::ReducedDensityGradient);
+  cube->lock()->unlock();
+  if (signedDensity) {
+    signedDensity->lock()->lockForWrite();
+    success = signedDensity->setLimits(*cube)
+        && signedDensity->setData(channels[1]) && success;
+    signedDensity->setCubeType(Cube::None);
+    signedDensity->lock()->unlock();
+  }
+  return success;
+}
+
+bool BasisSet::calculateCubeElectronLocalization(Cube *cube)
+{
+  std::vector<std::vector<double> > channels(1);
+  if (!calculateDensityGrid(LocalizationField, cube, channels))
+    return false;
+
+  cube->lock()->lockForWrite();
+  bool success = cube->setData(channels[0]);
+  cube->setCubeType(Cube::ElectronLocalization);
+  cube->lock()->unlock();
+  return success;
+}
+
+bool BasisSet::calculateDensityGrid(int field, const Cube *grid,
+                                    std::vector<std::vector<double> > &channels)
+{
+  if (!initPointValues(Cube::ElectronDensity))
+    return false;
+
+  Eigen::Vector3i dim = grid->dimensions();
+  unsigned int size = dim.x() * dim.y() * dim.z();
+  for (size_t c = 0; c < channels.size(); ++c)
+    channels[c].resize(size);
+  std::vector<GridTile> tiles;
+  for (int i = 0; i < dim.x(); i += BRICK_SIZE) {
+    for (int j = 0; j < dim.y(); j += BRICK_SIZE) {
+      for (int k = 0; k < dim.z(); k += BRICK_SIZE) {
+        GridTile tile;
+        tile.basis = this;
+        tile.grid = grid;
+        tile.field = field;
+        tile.first = Eigen::Vector3i(i, j, k);
+        tile.channels = &channels;
+        tiles.push_back(tile);
+      }
+    }
+  }
+  CubeScheduler::instance()->blockingMap(m_priority, tiles,
+                                         processDensityGrid);
   return true;
 }
 
+bool BasisSet::calculatePoints(Cube::Type type, unsigned int mo,
+                               const Eigen::Vector3d *points,
+                               unsigned int count, double *values,
+                               Eigen::Vector3d *gradients,
+                               Eigen::Matrix3d *hessians)
+{
+  if (!initPointValues(type, mo))
+    return false;
+  if (!count)
+    return true;
+
+  // Sort the points along a Morton curve over their bounding box, so that
+  // consecutive points are close together
+  Eigen::Vector3d min = points[0], max = points[0];
+  for (unsigned int i = 1; i < count; ++i) {
+    min = min.cwiseMin(points[i]);
+    max = max.cwiseMax(points[i]);
+  }
+  Eigen::Vector3d scale;
+  for (int i = 0; i < 3; ++i)
+    scale[i] = max[i] > min[i] ? 1023.0 / (max[i] - min[i]) : 0.0;
+  std::vector<std::pair<unsigned int, unsigned int> > order(count);
+  for (unsigned int i = 0; i < count; ++i) {
+    Eigen::Vector3d cell = (points[i] - min).cwiseProduct(scale);
+    order[i].first = (spreadBits(static_cast<unsigned int>(cell.x())) << 2)
+        | (spreadBits(static_cast<unsigned int>(cell.y())) << 1)
+        | spreadBits(static_cast<unsigned int>(cell.z()));
+    order[i].second = i;
+  }
+  std::sort(order.begin(), order.end());
+
+  std::vector<Eigen::Vector3d> sorted(count);
+  for (unsigned int i = 0; i < count; ++i)
+    sorted[i] = points[order[i].second];
+  std::vector<double> sortedValues(count);
+  std::vector<Eigen::Vector3d> sortedGradients(gradients ? count : 0);
+  std::vector<Eigen::Matrix3d> sortedHessians(hessians ? count : 0);
+
+  std::vector<PointTile> tiles((count + TILE_SIZE - 1) / TILE_SIZE);
+  for (unsigned int i = 0; i < tiles.size(); ++i) {
+    unsigned int first = i * TILE_SIZE;
+    tiles[i].basis = this;
+    tiles[i].points = &sorted[first];
+    tiles[i].count = std::min(TILE_SIZE, count - first);
+    tiles[i].values = &sortedValues[first];
+    tiles[i].gradients = gradients ? &sortedGradients[first] : 0;
+    tiles[i].hessians = hessians ? &sortedHessians[first] : 0;
+  }
+  CubeScheduler::instance()->blockingMap(m_priority, tiles, processTile);
+
+  for (unsigned int i = 0; i < count; ++i) {
+    values[order[i].second] = sortedValues[i];
+    if (gradients)
+      gradients[order[i].second] = sortedGradients[i];
+    if (hessians)
+      hessians[order[i].second] = sortedHessians[i];
+  }
+  return true;
+}
+
+void BasisSet::processTile(PointTile &tile)
+{
+  Eigen::Vector3d center = Eigen::Vector3d::Zero();
+  for (unsigned int i = 0; i < tile.count; ++i)
+    center += tile.points[i];
+  center /= tile.count;
+  double radius = 0.0;
+  for (unsigned int i = 0; i < tile.count; ++i)
+    radius = std::max(radius, (tile.points[i] - center).norm());
+  tile.basis->calculateTile(tile.points, tile.count, center, radius,
+                            tile.values, tile.gradients, tile.hessians, 0);
+}
+
+void BasisSet::processDensityGrid(GridTile &tile)
+{
+  // Gather the points of the brick, which are then calculated together
+  Eigen::Vector3i dim = tile.grid->dimensions();
+  Eigen::Vector3i last = (tile.first + Eigen::Vector3i::Constant(BRICK_SIZE))
+      .cwiseMin(dim);
+  unsigned int indices[BRICK_POINTS];
+  Eigen::Vector3d points[BRICK_POINTS];
+  unsigned int count = 0;
+  for (int i = tile.first.x(); i < last.x(); ++i) {
+    for (int j = tile.first.y(); j < last.y(); ++j) {
+      for (int k = tile.first.z(); k < last.z(); ++k) {
+        indices[count] = (i * dim.y() + j) * dim.z() + k;
+        points[count] = tile.grid->position(indices[count]);
+        ++count;
+      }
+    }
+  }
+
+  // Only the ingredients of the requested field are calculated
+  std::vector<std::vector<double> > &channels = *tile.channels;
+  bool needHessians = tile.field == DensityDerivativesField
+      || (tile.field == ReducedGradientField && channels.size() > 1);
+  bool needKinetic = tile.field == LocalizationField;
+  Eigen::Vector3d center = 0.5 * (points[0] + points[count - 1]);
+  double radius = (points[0] - center).norm();
+  double values[BRICK_POINTS];
+  Eigen::Vector3d gradients[BRICK_POINTS];
+  Eigen::Matrix3d hessians[BRICK_POINTS];
+  double kinetic[BRICK_POINTS];
+  tile.basis->calculateTile(points, count, center, radius, values, gradients,
+                            needHessians ? hessians : 0,
+                            needKinetic ? kinetic : 0);
+
+  // The derived fields are dimensionless, so all of the ingredients are
+  // taken per Angstrom
+  double unit = tile.basis->valueLengthUnit();
+  double volume = unit * unit * unit;
+  for (unsigned int p = 0; p < count; ++p) {
+    unsigned int index = indices[p];
+    switch (tile.field) {
+    case DensityDerivativesField:
+      channels[DensityValue][index] = values[p];
+      channels[DensityGradientX][index] = gradients[p].x();
+      channels[DensityGradientY][index] = gradients[p].y();
+      channels[DensityGradientZ][index] = gradients[p].z();
+      channels[DensityLaplacian][index] = hessians[p].trace();
+      break;
+    case ReducedGradientField: {
+      // s = |grad rho| / (2 (3 pi^2)^(1/3) rho^(4/3))
+      double rho = values[p] / volume;
+      double s = MAX_REDUCED_GRADIENT;
+      if (rho > DENSITY_CUTOFF) {
+        s = std::min(s, gradients[p].norm() / volume
+                     / (REDUCED_GRADIENT_FACTOR * std::pow(rho, 4.0 / 3.0)));
+      }
+      channels[0][index] = s;
+      if (channels.size() > 1) {
+        // The eigenvalues are sorted in increasing order
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+        solver.computeDirect(hessians[p], Eigen::EigenvaluesOnly);
+        channels[1][index] = solver.eigenvalues()[1] < 0.0 ? -values[p]
+                                                            : values[p];
+      }
+      break;
+    }
+    case LocalizationField: {
+      // ELF = 1 / (1 + (D / D_h)^2), with the excess kinetic energy density
+      // D = tau - |grad rho|^2 / (8 rho) and its value in the uniform
+      // electron gas D_h = 3/10 (3 pi^2)^(2/3) rho^(5/3)
+      double rho = values[p] / volume;
+      double elf = 0.0;
+      if (rho > DENSITY_CUTOFF) {
+        Eigen::Vector3d gradient = gradients[p] / volume;
+        double excess = kinetic[p] / volume
+            - gradient.squaredNorm() / (8.0 * rho);
+        double uniform = UNIFORM_GAS_FACTOR * std::pow(rho, 5.0 / 3.0);
+        double chi = excess / uniform;
+        elf = 1.0 / (1.0 + chi * chi);
+      }
+      channels[0][index] = elf;
+      break;
+    }
+    }
+  }
+}
+
+std::vector<Eigen::Vector3d> BasisSet::nuclearPositions() const
+{
+  std::vector<Eigen::Vector3d> positions(m_molecule.numAtoms());
+  for (size_t i = 0; i < positions.size(); ++i)
+    positions[i] = m_molecule.atomPos(i);
+  return positions;
+}
+
+QByteArray BasisSet::hash() const
+{
+  // The molecule can be changed through moleculeRef at any time, so only the
+  // content is cached
+  QCryptographicHash result(QCryptographicHash::Sha1);
+  result.addData(contentHash());
+  addMoleculeToHash(result);
+  return result.result();
+}
+
+QByteArray BasisSet::cubeHash(Cube::Type, unsigned int) const
+{
+  return hash();
+}
+
+void BasisSet::addMoleculeToHash(QCryptographicHash &hash) const
+{
+  for (size_t i = 0; i < m_molecule.numAtoms(); ++i) {
+    short atomicNumber = m_molecule.atomAtomicNumber(i);
+    Eigen::Vector3d pos = m_molecule.atomPos(i);
+    hash.addData(reinterpret_cast<const char *>(&atomicNumber),
+                 sizeof(atomicNumber));
+    hash.addData(reinterpret_cast<const char *>(pos.data()),
+                 3 * sizeof(double));
+  }
+}
+
+QByteArray BasisSet::contentHash() const
+{
+  // Hashing the MO coefficients is relatively expensive, so it is cached.
+  // Cube caches may ask for the hash from several threads at once.
+  QMutexLocker locker(&m_contentHashMutex);
+  if (m_contentHash.isEmpty()) {
+    QCryptographicHash content(QCryptographicHash::Sha1);
+    hashContent(content);
+    m_contentHash = content.result();
+  }
+  return m_contentHash;
+}
+
+void BasisSet::initLevels(Cube *cube)
+{
+  m_level = 0;
+  m_refining = false;
+  m_pointOrder.clear();
+  m_levelEnds.clear();
+
+  // The points are written from several threads, so a cube that shares its
+  // values with a cached one takes its own copy first
+  cube->data();
+
+  Eigen::Vector3i dim = cube->dimensions();
+  if (m_evaluationMode == Direct
+      || (m_evaluationMode == Adaptive && !isInterpolated(cube))) {
+    m_levelEnds.push_back(cube->data()->size());
+    return;
+  }
+
+  if (m_evaluationMode == Adaptive) {
+    // The subgrid, including the last point along each axis. The points of
+    // the next level are only known once it has been calculated.
+    std::vector<int> axes[3];
+    for (int a = 0; a < 3; ++a)
+      subgridAxis(dim[a], axes[a]);
+    m_pointOrder.reserve(axes[0].size() * axes[1].size() * axes[2].size());
+    for (size_t i = 0; i < axes[0].size(); ++i)
+      for (size_t j = 0; j < axes[1].size(); ++j)
+        for (size_t k = 0; k < axes[2].size(); ++k)
+          m_pointOrder.push_back(axes[0][i]*dim.y()*dim.z()
+                                 + axes[1][j]*dim.z() + axes[2][k]);
+    m_levelEnds.assign(2, m_pointOrder.size());
+    return;
+  }
+
+  // Each level holds the points on a subgrid with half the stride of the
+  // previous one, skipping the points already calculated by that level.
+  m_pointOrder.reserve(cube->data()->size());
+  for (int stride = COARSEST_STRIDE; stride >= 1; stride /= 2) {
+    int coarser = 2 * stride;
+    for (int i = 0; i < dim.x(); i += stride) {
+      for (int j = 0; j < dim.y(); j += stride) {
+        for (int k = 0; k < dim.z(); k += stride) {
+          if (stride < COARSEST_STRIDE && i % coarser == 0
+              && j % coarser == 0 && k % coarser == 0)
+            continue;
+          m_pointOrder.push_back(i*dim.y()*dim.z() + j*dim.z() + k);
+        }
+      }
+    }
+    m_levelEnds.push_back(m_pointOrder.size());
+  }
+}
+
+bool BasisSet::isInterpolated(const Cube *cube) const
+{
+  return m_evaluationMode == Adaptive && !m_isovalues.empty()
+      && cube->dimensions().minCoeff() >= 2;
+}
+
+bool BasisSet::loadFromCache(Cube *cube, Cube::Type type, unsigned int mo)
+{
+  m_cacheKey.clear();
+  m_storeInCubeCache = m_storeInDiskCache = false;
+  if (!m_cubeCache && !m_diskCache)
+    return false;
+
+  // The key does not hold the evaluation mode, so only cubes calculated in
+  // full are stored. Any mode may use them.
+  m_cacheKey = CubeCache::key(this, type, mo, *cube);
+  bool store = !isInterpolated(cube);
+  bool loaded = false;
+  if (m_cubeCache) {
+    // The cube belongs to the caller, so it shares the cached values, which
+    // are only copied if it changes them
+    QSharedPointer<const Cube> cached = m_cubeCache->find(m_cacheKey);
+    if (cached && cached->dimensions() == cube->dimensions()) {
+      cube->shareData(*cached);
+      cube->setCubeType(cached->cubeType());
+      loaded = true;
+    }
+  }
+  bool inMemory = loaded;
+  if (!loaded && m_diskCache) {
+    loaded = m_diskCache->load(m_cacheKey, cube);
+    m_storeInDiskCache = store && !loaded;
+  }
+  // Cubes loaded from the disk cache were calculated in full too
+  m_storeInCubeCache = m_cubeCache && !inMemory && (store || loaded);
+  if (!loaded)
+    return false;
+
+  // A single level with nothing left to calculate
+  m_level = 0;
+  m_pointOrder.clear();
+  m_levelEnds.assign(1, 0);
+
+  QFutureInterface<void> done;
+  done.reportStarted();
+  done.reportFinished();
+  watcher().setFuture(done.future());
+  return true;
+}
+
+void BasisSet::storeInCache(Cube *cube)
+{
+  if (!m_cacheKey.isEmpty() && !watcher().future().isCanceled()) {
+    if (m_diskCache && m_storeInDiskCache)
+      m_diskCache->store(m_cacheKey, *cube);
+    if (m_cubeCache && m_storeInCubeCache) {
+      Cube *copy = new Cube;
+      copy->shareData(*cube);
+      copy->setCubeType(cube->cubeType());
+      m_cubeCache->insert(m_cacheKey, copy);
+    }
+  }
+  m_cacheKey.clear();
+  m_storeInCubeCache = m_storeInDiskCache = false;
+}
+
+bool BasisSet::nextLevel(Cube *cube)
+{
+  // A canceled level is incomplete, so it is neither published nor refined
+  if (isFinalLevel() || watcher().future().isCanceled()) {
+    m_refining = false;
+    return false;
+  }
+
+  // Publish the completed level. In Progressive mode the points it
+  // calculated are on a subgrid with a stride of COARSEST_STRIDE / 2^level.
+  // In Adaptive mode the cells are bounded first, which takes as long as a
+  // level, so it is not done here, on the thread of the event loop.
+  if (m_evaluationMode == Adaptive) {
+    if (!m_refining && boundCells(cube)) {
+      m_refining = true;
+      return true;
+    }
+    m_refining = false;
+    refineAroundIsovalues(cube);
+  }
+  else {
+    cube->fillFromSubgrid(COARSEST_STRIDE >> m_level);
+  }
+  cube->lock()->unlock();
+  emit cubeRefined(m_level, m_levelEnds.size());
+  cube->lock()->lockForWrite();
+
+  ++m_level;
+  return true;
+}
+
+// The points of the subgrid of Adaptive mode along each axis of the cube,
+// which of the points are on it, and the number of cells along each axis
+static void subgridCells(const Eigen::Vector3i &dim, std::vector<int> axes[3],
+                         std::vector<bool> onSubgrid[3], int cells[3])
+{
+  for (int a = 0; a < 3; ++a) {
+    subgridAxis(dim[a], axes[a]);
+    onSubgrid[a].assign(dim[a], false);
+    for (size_t i = 0; i < axes[a].size(); ++i)
+      onSubgrid[a][axes[a][i]] = true;
+    cells[a] = static_cast<int>(axes[a].size()) - 1;
+  }
+}
+
+bool BasisSet::boundCells(Cube *cube)
+{
+  Eigen::Vector3i dim = cube->dimensions();
+  const std::vector<double> &data = *cube->data();
+  std::vector<int> axes[3];
+  std::vector<bool> onSubgrid[3];
+  int cells[3];
+  subgridCells(dim, axes, onSubgrid, cells);
+
+  // The range of the corner values of each cell of the subgrid, and the box
+  // it covers
+  int cellCount = cells[0] * cells[1] * cells[2];
+  m_cellLow.resize(cellCount);
+  m_cellHigh.resize(cellCount);
+  m_cellMin.resize(cellCount);
+  m_cellMax.resize(cellCount);
+  for (int i = 0, c = 0; i < cells[0]; ++i) {
+    for (int j = 0; j < cells[1]; ++j) {
+      for (int k = 0; k < cells[2]; ++k, ++c) {
+        for (int corner = 0; corner < 8; ++corner) {
+          int ci = i + (corner & 1), cj = j + (corner >> 1 & 1),
+              ck = k + (corner >> 2 & 1);
+          double value = data[axes[0][ci]*dim.y()*dim.z()
+                              + axes[1][cj]*dim.z() + axes[2][ck]];
+          if (!corner || value < m_cellLow[c])
+            m_cellLow[c] = value;
+          if (!corner || value > m_cellHigh[c])
+            m_cellHigh[c] = value;
+        }
+        m_cellMin[c] = cube->position(axes[0][i]*dim.y()*dim.z()
+                                      + axes[1][j]*dim.z() + axes[2][k]);
+        m_cellMax[c] = cube->position(axes[0][i + 1]*dim.y()*dim.z()
+                                      + axes[1][j + 1]*dim.z()
+                                      + axes[2][k + 1]);
+      }
+    }
+  }
+
+  QFuture<void> future;
+  m_cellsBounded = gradientBounds(cube, m_cellMin, m_cellMax, m_cellBounds,
+                                  future);
+  if (m_cellsBounded)
+    watcher().setFuture(future);
+  return m_cellsBounded;
+}
+
+void BasisSet::refineAroundIsovalues(Cube *cube)
+{
+  Eigen::Vector3i dim = cube->dimensions();
+  std::vector<int> axes[3];
+  std::vector<bool> onSubgrid[3];
+  int cells[3];
+  subgridCells(dim, axes, onSubgrid, cells);
+
+  // Every point of a cell is within half its diagonal of a corner, so the
+  // field differs from the corner values by at most that times the largest
+  // gradient in the cell. A cell whose widened range holds no isovalue
+  // cannot be crossed by an isosurface, and is interpolated. Without a bound
+  // on the gradient every cell is refined.
+  std::vector<bool> queued(cube->data()->size(), false);
+  for (int i = 0, c = 0; i < cells[0]; ++i) {
+    for (int j = 0; j < cells[1]; ++j) {
+      for (int k = 0; k < cells[2]; ++k, ++c) {
+        bool straddles = !m_cellsBounded;
+        if (m_cellsBounded) {
+          double margin = 0.5 * m_cellBounds[c]
+              * (m_cellMax[c] - m_cellMin[c]).norm();
+          for (size_t v = 0; v < m_isovalues.size(); ++v)
+            if (m_isovalues[v] >= m_cellLow[c] - margin
+                && m_isovalues[v] <= m_cellHigh[c] + margin)
+              straddles = true;
+        }
+        if (!straddles)
+          continue;
+
+        for (int x = axes[0][i]; x <= axes[0][i + 1]; ++x) {
+          for (int y = axes[1][j]; y <= axes[1][j + 1]; ++y) {
+            for (int z = axes[2][k]; z <= axes[2][k + 1]; ++z) {
+              if (onSubgrid[0][x] && onSubgrid[1][y] && onSubgrid[2][z])
+                continue;
+              unsigned int index = x*dim.y()*dim.z() + y*dim.z() + z;
+              if (queued[index])
+                continue;
+              queued[index] = true;
+              m_pointOrder.push_back(index);
+            }
+          }
+        }
+      }
+    }
+  }
+  m_levelEnds[m_level + 1] = m_pointOrder.size();
+
+  // The cells are only needed between the levels
+  std::vector<double>().swap(m_cellLow);
+  std::vector<double>().swap(m_cellHigh);
+  std::vector<Eigen::Vector3d>().swap(m_cellMin);
+  std::vector<Eigen::Vector3d>().swap(m_cellMax);
+  std::vector<double>().swap(m_cellBounds);
+  m_cellsBounded = false;
+
+  cube->interpolateFromSubgrid(COARSEST_STRIDE);
+}
+
+bool BasisSet::gradientBounds(const Cube *,
+                              const std::vector<Eigen::Vector3d> &,
+                              const std::vector<Eigen::Vector3d> &,
+                              std::vector<double> &, QFuture<void> &)
+{
+  return false;
+}
+
 }
@@ -21,9 +21,16 @@
 #include "openqubeabi.h"
 
 #include "molecule.h"
+#include "cube.h"
+#include "cubescheduler.h"
 
 #include <QtCore/QObject>
 #include <QtCore/QFutureWatcher>
+#include <QtCore/QByteArray>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QMutex>
+
+#include <vector>
 
 namespace OpenQube
 {
@@ -38,17 +45,46 @@ namespace OpenQube
  * used to calculate values of the basis set in a cube.
  */
 
-class Cube;
+class AdaptiveCube;
+class CubeCache;
+class CubeDiskCache;
+class MultiCube;
 
 class OPENQUBE_EXPORT BasisSet : public QObject
 {
   Q_OBJECT
 
 public:
+  /**
+   * @enum EvaluationMode
+   * The order in which the points of a cube are calculated.
+   */
+  enum EvaluationMode {
+    Direct,      ///< Calculate every point of the cube in one pass.
+    Progressive, ///< Calculate a strided subgrid first, then refine it.
+    Adaptive     ///< Only refine a strided subgrid close to the isovalues.
+  };
+
+  /**
+   * @enum DensityChannel
+   * The channels of the MultiCube filled by calculateDensityDerivatives.
+   */
+  enum DensityChannel {
+    DensityValue,        ///< The electron density.
+    DensityGradientX,    ///< The x component of its gradient.
+    DensityGradientY,    ///< The y component of its gradient.
+    DensityGradientZ,    ///< The z component of its gradient.
+    DensityLaplacian,    ///< Its Laplacian.
+    DensityChannelCount  ///< The number of channels.
+  };
+
   /**
    * Constructor.
    */
-  BasisSet() : m_electrons(0), m_valid(true) {}
+  BasisSet() : m_electrons(0), m_valid(true), m_evaluationMode(Direct),
+    m_priority(CubeScheduler::Interactive), m_level(0), m_refining(false),
+    m_cellsBounded(false), m_cubeCache(0), m_diskCache(0),
+    m_storeInCubeCache(false), m_storeInDiskCache(false) {}
 
   /**
    * Destructor.
@@ -140,6 +176,8 @@ public:
    * Calculate the MO over the entire range of the supplied Cube.
    * @param cube The cube to write the values of the MO into.
    * @param mo The molecular orbital number to calculate.
+   * @note The cube has been unlocked, and stored in the caches that are set,
+   * by the time this function returns.
    * @sa calculateCubeMO
    * @return True if the calculation was successful.
    */
@@ -158,23 +196,492 @@ public:
   /**
    * Calculate the electron density over the entire range of the supplied Cube.
    * @param cube The cube to write the values of the MO into.
+   * @note The cube has been unlocked, and stored in the caches that are set,
+   * by the time this function returns.
    * @sa calculateCubeDensity
    * @return True if the calculation was successful.
    */
   virtual bool blockingCalculateCubeDensity(Cube *cube);
 
+  /**
+   * Calculate the MO over the region of the supplied AdaptiveCube, refining
+   * it where the interpolation error exceeds its tolerance. Blocks until the
+   * calculation is complete.
+   * @param cube The adaptive cube to write the values of the MO into.
+   * @param mo The molecular orbital number to calculate.
+   * @return True if the calculation was successful.
+   */
+  bool calculateAdaptiveCubeMO(AdaptiveCube *cube, unsigned int mo = 1);
+
+  /**
+   * Calculate the electron density over the region of the supplied
+   * AdaptiveCube, refining it where the interpolation error exceeds its
+   * tolerance. Blocks until the calculation is complete.
+   * @param cube The adaptive cube to write the values of the density into.
+   * @return True if the calculation was successful.
+   */
+  bool calculateAdaptiveCubeDensity(AdaptiveCube *cube);
+
+  /**
+   * Calculate the MO at each of @a count @a points (in Angstrom), in
+   * parallel in the priority class of the basis set. The points are sorted
+   * along a space filling curve and calculated in tiles of points close
+   * together, so that the basis functions negligible across a tile are only
+   * screened out once.
+   * @param points The positions to calculate the MO at.
+   * @param count The number of points.
+   * @param mo The molecular orbital number to calculate.
+   * @param values Receives the value at each point.
+   * @param gradients Receives the gradient at each point, with respect to
+   * the position in Angstrom. Not calculated if null.
+   * @param hessians Receives the matrix of second derivatives at each point,
+   * with respect to the position in Angstrom. Not calculated if null.
+   * @warning Must not be called while a cube is being calculated.
+   * @return True if the calculation was successful.
+   */
+  bool calculateMOValues(const Eigen::Vector3d *points, unsigned int count,
+                         unsigned int mo, double *values,
+                         Eigen::Vector3d *gradients = 0,
+                         Eigen::Matrix3d *hessians = 0);
+
+  /**
+   * Calculate the electron density at each of @a count @a points (in
+   * Angstrom), in parallel.
+   * @param points The positions to calculate the density at.
+   * @param count The number of points.
+   * @param values Receives the value at each point.
+   * @param gradients Receives the gradient at each point, with respect to
+   * the position in Angstrom. Not calculated if null.
+   * @param hessians Receives the matrix of second derivatives at each point,
+   * with respect to the position in Angstrom. Not calculated if null.
+   * @sa calculateMOValues
+   * @return True if the calculation was successful.
+   */
+  bool calculateDensityValues(const Eigen::Vector3d *points,
+                              unsigned int count, double *values,
+                              Eigen::Vector3d *gradients = 0,
+                              Eigen::Matrix3d *hessians = 0);
+
+  /**
+   * Calculate the electrostatic potential of the nuclei and the electrons at
+   * a batch of points, in atomic units.
+   * @param points The positions, in Angstrom.
+   * @param count The number of points.
+   * @param values Receives the potential at each point.
+   * @sa calculateMOValues
+   * @return True if the calculation was successful, false if the basis set
+   * cannot calculate the potential.
+   */
+  bool calculateESPValues(const Eigen::Vector3d *points, unsigned int count,
+                          double *values);
+
+  /**
+   * Calculate the electrostatic potential, in atomic units, over the grid of
+   * @a cube. Blocks until the calculation is complete.
+   * @return True if the calculation was successful.
+   */
+  bool calculateCubeESP(Cube *cube);
+
+  /**
+   * Calculate the electron density, its gradient and its Laplacian over the
+   * grid of @a cube in a single pass, sharing the basis function values
+   * between them. The derivatives are with respect to the position in
+   * Angstrom. Blocks until the calculation is complete.
+   * @param cube The cube to write the values into, with DensityChannelCount
+   * channels laid out as in DensityChannel.
+   * @return True if the calculation was successful.
+   */
+  bool calculateDensityDerivatives(MultiCube *cube);
+
+  /**
+   * Calculate the reduced density gradient
+   * s = |grad rho| / (2 (3 pi^2)^(1/3) rho^(4/3)) over the grid of @a cube,
+   * for non-covalent interaction (NCI) analysis. The density, its gradient
+   * and, if needed, its Hessian are calculated together at each point and
+   * only the derived fields are stored. Blocks until the calculation is
+   * complete.
+   * @param cube The cube to write s into, capped at 100 where the density
+   * vanishes.
+   * @param signedDensity If not null, receives sign(lambda2) * rho on the
+   * same grid, where lambda2 is the second eigenvalue of the Hessian of the
+   * density, to tell attractive from repulsive interactions.
+   * @return True if the calculation was successful.
+   */
+  bool calculateCubeReducedDensityGradient(Cube *cube,
+                                           Cube *signedDensity = 0);
+
+  /**
+   * Calculate the electron localization function (ELF) over the grid of
+   * @a cube, from the density, its gradient and the kinetic energy density
+   * calculated together at each point. The ELF is zero where the density
+   * is negligible. Blocks until the calculation is complete.
+   * @return True if the calculation was successful.
+   */
+  bool calculateCubeElectronLocalization(Cube *cube);
+
+  /**
+   * Prepare the calculation of single points with pointValue.
+   * @param type Cube::MO, Cube::ElectronDensity or, if supported,
+   * Cube::ESP.
+   * @param mo The molecular orbital number, ignored for the density.
+   * @return True if the values can be calculated, false if they cannot or
+   * a cube is being calculated, see isCalculating.
+   */
+  virtual bool initPointValues(Cube::Type type, unsigned int mo = 1) = 0;
+
+  /**
+   * @return The value prepared by initPointValues at @a pos (in Angstrom).
+   * May be called from several threads at once.
+   */
+  virtual double pointValue(const Eigen::Vector3d &pos) = 0;
+
+  /**
+   * Set the evaluation mode used by calculateCubeMO and calculateCubeDensity.
+   * In Progressive mode every 4th point along each axis is calculated first,
+   * then every 2nd point and finally the remaining points. Points calculated
+   * at a coarser level are reused, and the final cube is identical to the
+   * one calculated in Direct mode.
+   *
+   * In Adaptive mode every 4th point along each axis is calculated first, as
+   * well as the last point along each axis. A cell of that subgrid is only
+   * calculated in full if one of the isovalues (see setIsovalues) lies
+   * within the range of its corner values, widened by a bound of the
+   * gradient over the cell times half its diagonal. The points of all other
+   * cells are interpolated from their corners. Without isovalues the
+   * calculation is Direct.
+   *
+   * The widening is a conservative bound: the field cannot reach an
+   * isovalue in a cell that is interpolated, so isosurfaces extracted from
+   * the cube match the ones from a Direct calculation, peaks and lobes
+   * smaller than a cell included. The gradient is bounded from the basis
+   * functions over each cell, which is loose close to the atoms. Basis sets
+   * that cannot bound it calculate every point, see gradientBounds.
+   *
+   * The blocking calculations always use Direct mode. Cubes with
+   * interpolated points are not stored in the caches, see setCubeCache.
+   * @sa cubeRefined
+   */
+  void setEvaluationMode(EvaluationMode mode) { m_evaluationMode = mode; }
+
+  /**
+   * @return The evaluation mode used by the cube calculations.
+   */
+  EvaluationMode evaluationMode() const { return m_evaluationMode; }
+
+  /**
+   * Set the isovalues the cube calculations are refined around in Adaptive
+   * mode.
+   */
+  void setIsovalues(const std::vector<double> &isovalues)
+  {
+    m_isovalues = isovalues;
+  }
+
+  /**
+   * @return The isovalues the cube calculations are refined around in
+   * Adaptive mode.
+   */
+  const std::vector<double> & isovalues() const { return m_isovalues; }
+
+  /**
+   * Set the priority class the cube and point calculations are scheduled in,
+   * defaults to CubeScheduler::Interactive. Set it to CubeScheduler::Batch
+   * for long running calculations that nobody is waiting for, so that they
+   * yield to interactive ones.
+   */
+  void setPriority(CubeScheduler::Priority priority) { m_priority = priority; }
+
+  /**
+   * @return The priority class the cube calculations are scheduled in.
+   */
+  CubeScheduler::Priority priority() const { return m_priority; }
+
+  /**
+   * Set a memory cache to look cubes up in before calculating them, and to
+   * add the calculated cubes to. calculateCubeMO and calculateCubeDensity
+   * copy a cached cube into the cube they are given and finish as usual,
+   * without calculating any points, so toggling back to a cube that was
+   * viewed before is cheap without blocking. The memory cache is looked in
+   * before the disk cache, and cubes loaded from the disk cache are added to
+   * it.
+   * @param cache The cube cache, not owned. Null to disable the cache.
+   */
+  void setCubeCache(CubeCache *cache) { m_cubeCache = cache; }
+
+  /**
+   * @return The memory cache cubes are looked up in, null if none.
+   */
+  CubeCache * cubeCache() const { return m_cubeCache; }
+
+  /**
+   * Set a disk cache to look cubes up in before calculating them, and to
+   * store the calculated cubes in. Cubes found in the cache are loaded and
+   * the calculation finishes as usual, without calculating any points.
+   * @param cache The disk cache, not owned. Null to disable the disk cache.
+   */
+  void setDiskCache(CubeDiskCache *cache) { m_diskCache = cache; }
+
+  /**
+   * @return The disk cache cubes are looked up in, null if none.
+   */
+  CubeDiskCache * diskCache() const { return m_diskCache; }
+
+  /**
+   * @return A hash of everything that determines the cubes calculated from
+   * the basis set: the molecule, the basis functions, the MO coefficients and
+   * the density matrix. Equal hashes mean the cubes are interchangeable.
+   */
+  QByteArray hash() const;
+
+  /**
+   * @return A hash of everything that determines the cube of @a type, and
+   * of MO @a mo if @a type is Cube::MO. Defaults to hash(), basis sets that
+   * read their MOs on demand only hash the MO or density matrix the cube is
+   * calculated from, so the first cube can be looked up without reading all
+   * of them.
+   */
+  virtual QByteArray cubeHash(Cube::Type type, unsigned int mo) const;
+
   /**
    * When performing a calculation the QFutureWatcher is useful if you want
    * to update a progress bar.
    */
   virtual QFutureWatcher<void> & watcher()=0;
 
+  /**
+   * @return True from the moment calculateCubeMO or calculateCubeDensity
+   * starts a calculation until finished() is emitted. The calculation reads
+   * the MOs, the density matrix and the atoms while it runs, so they must not
+   * be changed until then.
+   */
+  virtual bool isCalculating() const = 0;
+
   /**
    * Create a deep copy of @a this and return a pointer to it.
    */
   virtual BasisSet * clone() = 0;
 
+signals:
+  /**
+   * Emitted when a calculation started by calculateCubeMO or
+   * calculateCubeDensity is complete and the cube has been unlocked. Also
+   * emitted once a canceled calculation has stopped, in which case the
+   * points that were not reached hold stale values.
+   */
+  void finished();
+
+  /**
+   * Emitted in Progressive and Adaptive mode each time a refinement level has
+   * been written into the cube. Points that have not been calculated yet
+   * hold the value of the closest calculated point below them on the
+   * subgrid in Progressive mode, and are interpolated from the subgrid in
+   * Adaptive mode.
+   * The cube is not locked while this signal is emitted.
+   * @param level The level that was completed, 0 is the coarsest.
+   * @param levels The total number of levels in the calculation.
+   */
+  void cubeRefined(int level, int levels);
+
+protected slots:
+  /**
+   * Called when the watcher has finished the current level: starts the next
+   * level, or stores the cube in the caches, unlocks it and emits finished.
+   * Does nothing if no calculation is in progress.
+   */
+  virtual void calculationComplete() = 0;
+
 protected:
+  /**
+   * Set up the order the points of @a cube will be calculated in, according
+   * to the evaluation mode. Must be called before the first level starts.
+   */
+  void initLevels(Cube *cube);
+
+  /**
+   * Called when the current level has been calculated. If there is another
+   * level the completed one is published into @a cube, cubeRefined is
+   * emitted and the next level becomes current. The cube must be locked for
+   * writing, and is locked again on return.
+   *
+   * In Adaptive mode the gradient over the cells of the subgrid is bounded
+   * before the next level is known, by a job of its own which the watcher
+   * is set to. isRefining() is true until it finishes and calls
+   * calculationComplete, which is to call this again.
+   * @return True if there is another level to calculate, or the bounds of
+   * it are being calculated, false if the calculation is complete or was
+   * canceled.
+   */
+  bool nextLevel(Cube *cube);
+
+  /**
+   * @return True while the gradient bounds of Adaptive mode are being
+   * calculated, after nextLevel has returned and before the next level can
+   * start.
+   */
+  bool isRefining() const { return m_refining; }
+
+  /**
+   * Adaptive mode: find the range of the values at the corners of each cell
+   * of the subgrid, and start bounding the gradient over the cells.
+   * @return True if the bounds are being calculated, with the watcher
+   * watching them, false if the gradient cannot be bounded.
+   */
+  bool boundCells(Cube *cube);
+
+  /**
+   * Adaptive mode: queue the points of the subgrid cells that may straddle
+   * an isovalue as the next level, and interpolate every point that has not
+   * been calculated from the subgrid. Uses the bounds found by boundCells,
+   * or refines every cell if there are none.
+   */
+  void refineAroundIsovalues(Cube *cube);
+
+  /**
+   * @return Index into the cube of the @a i th point to be calculated. Only
+   * valid for the points of the current and previous levels, as the points
+   * of the later levels may depend on the earlier ones.
+   */
+  unsigned int pointIndex(unsigned int i) const
+  {
+    return m_pointOrder.empty() ? i : m_pointOrder[i];
+  }
+
+  /**
+   * @return The first point (as passed to pointIndex) of the current level.
+   */
+  unsigned int levelBegin() const
+  {
+    return m_level ? m_levelEnds[m_level - 1] : 0;
+  }
+
+  /**
+   * @return One past the last point (as passed to pointIndex) of the current
+   * level.
+   */
+  unsigned int levelEnd() const { return m_levelEnds[m_level]; }
+
+  /**
+   * @return True if the current level is the last one of the calculation.
+   */
+  bool isFinalLevel() const { return m_level + 1 >= m_levelEnds.size(); }
+
+  /**
+   * Look @a cube up in the memory cache and then in the disk cache, if they
+   * are set. The calculation of the cube must already have been set up: the
+   * cube locked for writing and the watcher connected to the
+   * calculationComplete slot. If the cube is found it is loaded, a finished
+   * future is set on the watcher and true returned. Otherwise the cube will
+   * be stored by storeInCache once calculated, unless it is interpolated.
+   * @param mo The MO number, ignored unless @a type is Cube::MO.
+   */
+  bool loadFromCache(Cube *cube, Cube::Type type, unsigned int mo);
+
+  /**
+   * @return True if some of the points of @a cube will be interpolated
+   * rather than calculated, as in Adaptive mode with isovalues set.
+   */
+  bool isInterpolated(const Cube *cube) const;
+
+  /**
+   * Store @a cube in the caches it was not found in by loadFromCache, unless
+   * the calculation was canceled.
+   */
+  void storeInCache(Cube *cube);
+
+  /**
+   * Calculate the values prepared by initPointValues at the @a count
+   * @a points, which all lie within @a radius of @a center, into @a values
+   * and, if not null, @a gradients, @a hessians and @a kineticEnergies.
+   * The kinetic energy density is 1/2 sum_ij D_ij grad phi_i . grad phi_j
+   * for the density and 1/2 |grad psi|^2 for an MO. The basis functions
+   * that are negligible at all of the points should be skipped. May be
+   * called from several threads at once.
+   */
+  virtual void calculateTile(const Eigen::Vector3d *points, unsigned int count,
+                             const Eigen::Vector3d &center, double radius,
+                             double *values, Eigen::Vector3d *gradients,
+                             Eigen::Matrix3d *hessians,
+                             double *kineticEnergies) = 0;
+
+  /**
+   * @return The unit of length of the values calculated by calculateTile,
+   * in Angstrom, e.g. the density is per cubic unit. Derivatives are always
+   * with respect to the position in Angstrom. Defaults to 1.
+   */
+  virtual double valueLengthUnit() const { return 1.0; }
+
+  /**
+   * Start bounding the gradient of the field being calculated into @a cube
+   * over boxes of its grid. Box b runs from @a min[b] to @a max[b], in
+   * Angstrom, and @a bounds[b] is set to an upper bound of the magnitude of
+   * the gradient anywhere in it, per Angstrom. Adaptive mode uses the bounds
+   * to find the cells an isovalue may pass through.
+   *
+   * The bounds are calculated in the background, and are only set once
+   * @a future has finished. The boxes and the bounds must be kept until
+   * then.
+   * @return False if the gradient cannot be bounded, the default, in which
+   * case Adaptive mode calculates every point.
+   */
+  virtual bool gradientBounds(const Cube *cube,
+                              const std::vector<Eigen::Vector3d> &min,
+                              const std::vector<Eigen::Vector3d> &max,
+                              std::vector<double> &bounds,
+                              QFuture<void> &future);
+
+  /**
+   * @return The positions of the nuclei in the coordinates of the cubes,
+   * Angstrom. Defaults to the positions of the atoms of the molecule.
+   */
+  virtual std::vector<Eigen::Vector3d> nuclearPositions() const;
+
+  /**
+   * Add the content of the basis set to @a hash, excluding the molecule which
+   * is hashed by the base class.
+   */
+  virtual void hashContent(QCryptographicHash &hash) const = 0;
+
+  /**
+   * Add the atoms of the molecule to @a hash, as hash() does.
+   */
+  void addMoleculeToHash(QCryptographicHash &hash) const;
+
+  /**
+   * @return The hash of hashContent, calculated the first time it is needed
+   * after the content changed.
+   */
+  QByteArray contentHash() const;
+
+  /**
+   * Must be called by mutators once the content added to the hash by
+   * hashContent has changed.
+   */
+  void contentChanged()
+  {
+    QMutexLocker locker(&m_contentHashMutex);
+    m_contentHash.clear();
+  }
+
+  /**
+   * Helper functions for hashContent.
+   */
+  template <typename T>
+  static void addToHash(QCryptographicHash &hash, const std::vector<T> &v)
+  {
+    int size = static_cast<int>(v.size());
+    hash.addData(reinterpret_cast<const char *>(&size), sizeof(size));
+    if (size)
+      hash.addData(reinterpret_cast<const char *>(&v[0]), size * sizeof(T));
+  }
+  static void addToHash(QCryptographicHash &hash, const Eigen::MatrixXd &m)
+  {
+    int size[2] = { static_cast<int>(m.rows()), static_cast<int>(m.cols()) };
+    hash.addData(reinterpret_cast<const char *>(size), sizeof(size));
+    if (m.size())
+      hash.addData(reinterpret_cast<const char *>(m.data()),
+                   m.size() * sizeof(double));
+  }
+
   /// Total number of electrons
   unsigned int m_electrons;
 
@@ -189,6 +696,53 @@ protected:
    */
   Molecule m_molecule;
 
+  EvaluationMode m_evaluationMode;
+  std::vector<double> m_isovalues;       //! Refined around in Adaptive mode
+  CubeScheduler::Priority m_priority;
+  std::vector<unsigned int> m_pointOrder; //! Points in order, empty if Direct
+  std::vector<unsigned int> m_levelEnds; //! End of each level in m_pointOrder
+  unsigned int m_level;                  //! The level being calculated
+  bool m_refining;                       //! Bounding the cells in Adaptive mode
+
+  // The cells of the subgrid in Adaptive mode, while they are bounded
+  std::vector<double> m_cellLow;         //! Lowest value at a corner
+  std::vector<double> m_cellHigh;        //! Highest value at a corner
+  std::vector<Eigen::Vector3d> m_cellMin;
+  std::vector<Eigen::Vector3d> m_cellMax;
+  std::vector<double> m_cellBounds;      //! Of the gradient over each cell
+  bool m_cellsBounded;                   //! If m_cellBounds is set
+
+  mutable QByteArray m_contentHash;      //! Cached result of hashContent
+  mutable QMutex m_contentHashMutex;     //! Guards m_contentHash
+
+  CubeCache *m_cubeCache;
+  CubeDiskCache *m_diskCache;
+  QByteArray m_cacheKey;                 //! Key of the cube to store, if any
+  bool m_storeInCubeCache;               //! If it was not in the memory cache
+  bool m_storeInDiskCache;               //! If it was not on disk
+
+private:
+  /**
+   * Calculate @a type at a batch of points, in tiles of points that are
+   * close together along a Morton curve.
+   */
+  bool calculatePoints(Cube::Type type, unsigned int mo,
+                       const Eigen::Vector3d *points, unsigned int count,
+                       double *values, Eigen::Vector3d *gradients,
+                       Eigen::Matrix3d *hessians);
+
+  struct PointTile;
+  static void processTile(PointTile &tile);
+  /**
+   * Calculate the channels of one of the fields derived from the density at
+   * every point of @a grid, in parallel over bricks of points in the
+   * priority class of the basis set.
+   */
+  bool calculateDensityGrid(int field, const Cube *grid,
+                            std::vector<std::vector<double> > &channels);
+
+  struct GridTile;
+  static void processDensityGrid(GridTile &tile);
 };
 
 } // End namespace openqube
@@ -16,6 +16,7 @@
 
 #include "basissetloader.h"
 
+#include "basissetsnapshot.h"
 #include "gaussianset.h"
 #include "slaterset.h"
 #include "gamessukout.h"
@@ -25,12 +26,126 @@
 #include "gamessus.h"
 #include "cube.h"
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QDir>
 #include <QtCore/QFileInfo>
+#include <QtCore/QFutureInterface>
+#include <QtCore/QRunnable>
 #include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 
 namespace OpenQube {
 
+namespace {
+
+class LoaderPool : public QThreadPool
+{
+public:
+  LoaderPool()
+  {
+    int ideal = QThread::idealThreadCount();
+    setMaxThreadCount(ideal > 0 ? ideal : 1);
+  }
+};
+
+Q_GLOBAL_STATIC(LoaderPool, loaderPool)
+
+/**
+ * The state shared by the files of one LoadBasisSets() call.
+ */
+class Batch
+{
+public:
+  Batch(int files, bool writeSnapshot_, bool indexed_)
+    : writeSnapshot(writeSnapshot_), indexed(indexed_),
+      thread(QThread::currentThread()),
+      remaining(files), done(0)
+  {
+    futureInterface.reportStarted();
+    futureInterface.setProgressRange(0, files);
+  }
+  bool writeSnapshot;
+  bool indexed;
+  QThread *thread; // The thread that the basis sets are moved to
+  QFutureInterface<BasisSetLoader::LoadResult> futureInterface;
+  QAtomicInt remaining; // Files that have not been reported yet
+  QAtomicInt done;
+};
+
+class LoadTask : public QRunnable
+{
+public:
+  LoadTask(Batch *batch, int index, const QString &fileName)
+    : m_batch(batch), m_index(index), m_fileName(fileName) {}
+
+  void run()
+  {
+    if (!m_batch->futureInterface.isCanceled())
+      report(load());
+    else
+      report(BasisSetLoader::LoadResult());
+  }
+
+private:
+  BasisSetLoader::LoadResult load()
+  {
+    BasisSetLoader::LoadResult result;
+    result.fileName = m_fileName;
+    QFileInfo info(m_fileName);
+    if (!info.isFile() || !info.isReadable()) {
+      result.error = "Could not read the file.";
+      return result;
+    }
+    BasisSet *basis = BasisSetLoader::LoadBasisSet(m_fileName,
+                                                   m_batch->writeSnapshot,
+                                                   m_batch->indexed);
+    if (!basis) {
+      result.error = "The file type was not recognized.";
+      return result;
+    }
+    if (basis->numMOs() == 0) {
+      delete basis;
+      result.error = "No molecular orbitals were found in the file.";
+      return result;
+    }
+
+    // Objects created on a pool thread would never see their events, as the
+    // pool threads run no event loop.
+    basis->watcher().moveToThread(m_batch->thread);
+    basis->moveToThread(m_batch->thread);
+    result.basis = basis;
+    return result;
+  }
+
+  void report(const BasisSetLoader::LoadResult &result)
+  {
+    QFutureInterface<BasisSetLoader::LoadResult> &future =
+        m_batch->futureInterface;
+    if (!result.fileName.isEmpty()) {
+      // A future canceled before the result is reported drops it, and with
+      // it the basis set. The future may be canceled at any time, so only
+      // whether the result is ready afterwards tells if that happened.
+      future.reportResult(result, m_index);
+      // The basis set belongs to the thread it was moved to now
+      if (result.basis && !future.future().isResultReadyAt(m_index))
+        result.basis->deleteLater();
+    }
+    future.setProgressValue(m_batch->done.fetchAndAddOrdered(1) + 1);
+
+    if (m_batch->remaining.fetchAndAddOrdered(-1) == 1) {
+      future.reportFinished();
+      delete m_batch;
+    }
+  }
+
+  Batch *m_batch;
+  int m_index;
+  QString m_fileName;
+};
+
+} // End anonymous namespace
+
 QString BasisSetLoader::MatchBasisSet(const QString& filename)
 {
   QString matchedFile;
@@ -90,42 +205,57 @@ void BasisSetLoader::MatchBasisSet(const char* filename, char *basisName )
 
 BasisSet * BasisSetLoader::LoadBasisSet(const QString& filename)
 {
+  return BasisSetLoader::LoadBasisSet(filename, false);
+}
+
+BasisSet * BasisSetLoader::LoadBasisSet(const QString& filename,
+                                        bool writeSnapshot, bool indexed)
+{
+  // A snapshot written since the file last changed is much faster to read
+  if (BasisSetSnapshot::isFresh(filename)) {
+    BasisSet *basis = BasisSetSnapshot::read(filename);
+    if (basis)
+      return basis;
+  }
+
   // Here we assume that the file name is correct, and attempt to load it.
+  BasisSet *basis = 0;
   QFileInfo info(filename);
   QString completeSuffix = info.completeSuffix();
   if (completeSuffix.contains("fchk", Qt::CaseInsensitive)
       || completeSuffix.contains("fch", Qt::CaseInsensitive)
       || completeSuffix.contains("fck", Qt::CaseInsensitive)) {
     GaussianSet *gaussian = new GaussianSet;
-    GaussianFchk fchk(filename, gaussian);
-
-    return gaussian;
+    GaussianFchk fchk(filename, gaussian, indexed);
+    basis = gaussian;
   }
   else if (completeSuffix.contains("gamout", Qt::CaseInsensitive)
            || completeSuffix.contains("gamess", Qt::CaseInsensitive)) {
     GaussianSet *gaussian = new GaussianSet;
     GAMESSUSOutput gamout(filename, gaussian);
-    return gaussian;
+    basis = gaussian;
   }
   else if (completeSuffix.contains("gukout", Qt::CaseInsensitive)) {
     GaussianSet *gaussian = new GaussianSet;
     GamessukOut gukout(filename, gaussian);
-    return gaussian;
+    basis = gaussian;
   }
   else if (completeSuffix.contains("aux", Qt::CaseInsensitive)) {
     SlaterSet *slater = new SlaterSet;
     MopacAux aux(filename, slater);
-    return slater;
+    basis = slater;
   }
   else if (completeSuffix.contains("molden", Qt::CaseInsensitive)
       || completeSuffix.contains("mold", Qt::CaseInsensitive)
       || completeSuffix.contains("molf", Qt::CaseInsensitive)) {
    GaussianSet *gaussian = new GaussianSet;
    MoldenFile mold(filename, gaussian);
-   return gaussian;
+   basis = gaussian;
   }
 
-  return 0;
+  if (basis && writeSnapshot)
+    BasisSetSnapshot::write(basis, filename);
+  return basis;
 }
 
 BasisSet * BasisSetLoader::LoadBasisSet(const char *filename)
@@ -133,4 +263,32 @@ BasisSet * BasisSetLoader::LoadBasisSet(const char *filename)
   return BasisSetLoader::LoadBasisSet(QString(filename));
 }
 
+QFuture<BasisSetLoader::LoadResult>
+BasisSetLoader::LoadBasisSets(const QStringList &filenames, bool writeSnapshot,
+                              bool indexed)
+{
+  Batch *batch = new Batch(filenames.size(), writeSnapshot, indexed);
+  QFuture<LoadResult> future = batch->futureInterface.future();
+  if (filenames.isEmpty()) {
+    batch->futureInterface.reportFinished();
+    delete batch;
+    return future;
+  }
+
+  // The batch is deleted by its last file, which may end before this loop
+  for (int i = 0; i < filenames.size(); ++i)
+    loaderPool()->start(new LoadTask(batch, i, filenames[i]));
+  return future;
+}
+
+void BasisSetLoader::SetMaxThreadCount(int count)
+{
+  loaderPool()->setMaxThreadCount(count > 0 ? count : 1);
+}
+
+int BasisSetLoader::MaxThreadCount()
+{
+  return loaderPool()->maxThreadCount();
+}
+
 } // End namespace
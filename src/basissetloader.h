@@ -19,8 +19,11 @@
 
 #include "openqubeabi.h"
 
+#include <QtCore/QFuture>
+#include <QtCore/QString>
+
 // Forward declarations
-class QString;
+class QStringList;
 
 namespace OpenQube {
 
@@ -35,11 +38,26 @@ class BasisSet;
  * This class is very much subject to change. It removes the logic from the
  * individual classes, and takes care of choosing the correct parser before
  * loading a basis set and returning an object containing this data.
+ *
+ * Many files can be loaded at once with LoadBasisSets(), which parses them
+ * concurrently on a thread pool of its own.
  */
 
 class OPENQUBE_EXPORT BasisSetLoader
 {
 public:
+  /**
+   * @struct LoadResult
+   * The outcome of loading one file with LoadBasisSets().
+   */
+  struct LoadResult
+  {
+    LoadResult() : basis(0) {}
+    QString fileName; ///< The file that was loaded.
+    BasisSet *basis;  ///< The basis set, owned by the caller. Null on error.
+    QString error;    ///< Why the file could not be loaded, if it could not.
+  };
+
   /**
    * Try to match the basis set to the supplied file path. This function will
    * search for a matching basis set file in the same directory.
@@ -60,12 +78,31 @@ public:
 
   /**
    * Load the supplied output file. The filename should be a valid quantum
-   * output file.
+   * output file. A fresh snapshot of the file is read instead if there is one.
    *
    * @return A BasisSet object populated with data file the file. Null on error.
    */
   static BasisSet * LoadBasisSet(const QString& filename);
 
+  /**
+   * Load the supplied output file, reading it from its snapshot instead if
+   * there is a fresh one (see BasisSetSnapshot). If @a writeSnapshot is true
+   * and the file had to be parsed, a snapshot is written next to it so that
+   * it opens quickly next time.
+   *
+   * If @a indexed is true, formatted checkpoint files are only indexed, and
+   * the MO coefficients and density matrix are read from the file when they
+   * are first needed (see GaussianFchk). This opens large files much faster,
+   * but the file stays mapped for as long as the basis set or any of its
+   * clones exists, and must not be changed in that time. Otherwise, and
+   * always for compressed files, everything is read up front and the file
+   * is closed before returning.
+   *
+   * @return A BasisSet object populated with data file the file. Null on error.
+   */
+  static BasisSet * LoadBasisSet(const QString& filename, bool writeSnapshot,
+                                 bool indexed = false);
+
   /**
    * Load the supplied output file. The filename should be a valid quantum
    * output file.
@@ -73,6 +110,39 @@ public:
    * @return A BasisSet object populated with data file the file. Null on error.
    */
   static BasisSet * LoadBasisSet(const char *filename);
+
+  /**
+   * Load all of the supplied output files concurrently, each as
+   * LoadBasisSet() would. A file that cannot be loaded, or that holds no
+   * MOs, is reported in its result and does not stop the others.
+   *
+   * The result for @a filenames[i] is at index i of the future, but the
+   * results become available in the order the files finish. Watch the future
+   * with a QFutureWatcher and connect to resultReadyAt() to handle each file
+   * as soon as it is loaded. The progress is reported in files. Canceling
+   * the future skips the files that have not started yet.
+   *
+   * The basis sets are moved to the thread that called this function, and
+   * are owned by the caller once their result is reported. Basis sets that
+   * were loaded but not reported because the future was canceled are
+   * deleted from the event loop of that thread.
+   *
+   * @a writeSnapshot and @a indexed are passed on to LoadBasisSet().
+   */
+  static QFuture<LoadResult> LoadBasisSets(const QStringList &filenames,
+                                           bool writeSnapshot = false,
+                                           bool indexed = false);
+
+  /**
+   * Set the maximum number of files loaded at once by LoadBasisSets().
+   * Defaults to QThread::idealThreadCount().
+   */
+  static void SetMaxThreadCount(int count);
+
+  /**
+   * @return The maximum number of files loaded at once by LoadBasisSets().
+   */
+  static int MaxThreadCount();
 };
 
 } // End namespace
@@ -0,0 +1,821 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "basissetsnapshot.h"
+
+#include "gaussianset.h"
+#include "slaterset.h"
+#include "orbitalsource.h"
+#include "textparser.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMap>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QtEndian>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+#include <cstring>
+
+using Eigen::MatrixXd;
+using Eigen::Vector3d;
+using Eigen::VectorXd;
+using std::vector;
+
+namespace OpenQube {
+
+// File layout, all little-endian. A 96 byte header: magic, version, basis
+// set type, number of sections, size and modification time of the source
+// file, number of electrons, valid flag, length of the content hash and
+// the hash itself, padded, then the SHA-1 of the start and end of the
+// source file, padded. Then a table of 24 byte section entries: id, element
+// type, rows, columns and offset of the data. The data of each section
+// starts on an eight byte boundary, matrices are stored column by column.
+static const quint32 SNAPSHOT_MAGIC = 0x4e53514f; // "OQSN"
+static const quint32 SNAPSHOT_VERSION = 2;
+static const qint64 HEADER_SIZE = 96;
+static const qint64 ENTRY_SIZE = 24;
+static const int MAX_HASH_SIZE = 20;
+static const qint64 SOURCE_HASH_OFFSET = 64;
+// Bytes hashed at each end of the source file
+static const qint64 SOURCE_SAMPLE_SIZE = 65536;
+static const char SNAPSHOT_SUFFIX[] = ".oqsnap";
+
+enum BasisType {
+  Gaussian = 1,
+  Slater = 2
+};
+
+enum ElementType {
+  Int32 = 1,
+  Float64 = 2,
+  Float64Lower = 3 // Packed lower triangle of a symmetric rows x rows matrix
+};
+
+enum SectionId {
+  AtomPositions = 1,
+  AtomicNumbers,
+  Density,
+  // GaussianSet
+  Symmetry = 16,
+  AtomIndices,
+  MOIndices,
+  GTOIndices,
+  CIndices,
+  GTOExponents,
+  GTOCoefficients,
+  GTONormalized,
+  Counts,
+  MOMatrix,
+  // SlaterSet
+  SlaterAtomPositions = 32,
+  SlaterIndices,
+  SlaterTypes,
+  Zetas,
+  PQNs,
+  ShiftedPQNs,
+  Factors,
+  Overlap,
+  EigenVectors,
+  Normalized
+};
+
+namespace {
+
+// Hash the start and the end of the source file. Modification times only
+// have a resolution of a second, so a file rewritten with the same size
+// within the second it was snapshotted in is told apart by its content.
+QByteArray sourceHash(const QString &source)
+{
+  QFile file(source);
+  if (!file.open(QIODevice::ReadOnly))
+    return QByteArray();
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(file.read(SOURCE_SAMPLE_SIZE));
+  if (file.size() > SOURCE_SAMPLE_SIZE) {
+    file.seek(qMax(SOURCE_SAMPLE_SIZE, file.size() - SOURCE_SAMPLE_SIZE));
+    hash.addData(file.read(SOURCE_SAMPLE_SIZE));
+  }
+  return hash.result();
+}
+
+// Check that @a indices holds at least @a count entries, in order, into an
+// array of @a size values, the last entry may be the end of the array
+bool validIndices(const vector<unsigned int> &indices, size_t count,
+                  size_t size)
+{
+  if (indices.size() < count)
+    return false;
+  for (size_t i = 1; i < indices.size(); ++i)
+    if (indices[i] < indices[i - 1])
+      return false;
+  return indices.empty() || indices.back() <= size;
+}
+
+struct Section
+{
+  Section() : id(0), type(0), rows(0), cols(0), offset(0) {}
+  Section(quint32 id_, quint32 type_, quint32 rows_, quint32 cols_)
+    : id(id_), type(type_), rows(rows_), cols(cols_), offset(0) {}
+
+  qint64 count() const
+  {
+    if (type == Float64Lower)
+      return static_cast<qint64>(rows) * (rows + 1) / 2;
+    return static_cast<qint64>(rows) * cols;
+  }
+  qint64 bytes() const { return count() * (type == Int32 ? 4 : 8); }
+
+  quint32 id, type, rows, cols;
+  quint64 offset;
+};
+
+// Reverse the bytes of each value on big-endian hosts, in place
+template <typename T>
+void swapValues(T *values, qint64 count)
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+  for (qint64 i = 0; i < count; ++i) {
+    char *p = reinterpret_cast<char *>(&values[i]);
+    std::reverse(p, p + sizeof(T));
+  }
+#else
+  Q_UNUSED(values);
+  Q_UNUSED(count);
+#endif
+}
+
+// Copy count values out of the file, converting them to host byte order
+template <typename T>
+void readValues(const char *data, qint64 count, T *values)
+{
+  if (count) {
+    memcpy(values, data, count * sizeof(T));
+    swapValues(values, count);
+  }
+}
+
+/**
+ * A snapshot mapped into memory, with its section table. Shared between the
+ * basis set read from it and the orbital source reading its MOs.
+ */
+class SnapshotFile
+{
+public:
+  SnapshotFile() : type(0), electrons(0), valid(0) {}
+
+  bool open(const QString &filename);
+
+  /// @return The section @a id, or 0 if there is none
+  const Section * section(quint32 id) const
+  {
+    QMap<quint32, Section>::const_iterator it = m_sections.find(id);
+    return it == m_sections.end() ? 0 : &it.value();
+  }
+  const char * data(const Section &s) const
+  {
+    return m_file.begin() + s.offset;
+  }
+
+  /// Copy section @a id into @a v, false if it is missing or of another type
+  template <typename T>
+  bool read(quint32 id, vector<T> &v) const
+  {
+    const Section *s = section(id);
+    if (!s || s->type != (sizeof(T) == 4 ? Int32 : Float64))
+      return false;
+    v.resize(s->count());
+    if (!v.empty())
+      readValues(data(*s), s->count(), &v[0]);
+    return true;
+  }
+  bool read(quint32 id, MatrixXd &m) const;
+  bool readLower(quint32 id, vector<double> &v) const;
+
+  quint32 type;
+  quint32 electrons;
+  quint32 valid;
+  QByteArray hash;
+
+private:
+  MappedFile m_file;
+  QMap<quint32, Section> m_sections;
+};
+
+bool SnapshotFile::open(const QString &filename)
+{
+  if (!m_file.open(filename))
+    return false;
+  const char *begin = m_file.begin();
+  qint64 size = m_file.end() - begin;
+  if (size < HEADER_SIZE) {
+    qDebug() << "Snapshot too short" << filename;
+    return false;
+  }
+
+  const uchar *header = reinterpret_cast<const uchar *>(begin);
+  quint32 count = qFromLittleEndian<quint32>(header + 12);
+  if (qFromLittleEndian<quint32>(header) != SNAPSHOT_MAGIC
+      || qFromLittleEndian<quint32>(header + 4) != SNAPSHOT_VERSION
+      || HEADER_SIZE + count * ENTRY_SIZE > size) {
+    qDebug() << "Ignoring invalid snapshot" << filename;
+    return false;
+  }
+  type = qFromLittleEndian<quint32>(header + 8);
+  electrons = qFromLittleEndian<quint32>(header + 32);
+  valid = qFromLittleEndian<quint32>(header + 36);
+  quint32 hashSize = qFromLittleEndian<quint32>(header + 40);
+  if (hashSize <= static_cast<quint32>(MAX_HASH_SIZE))
+    hash = QByteArray(begin + 44, hashSize);
+
+  m_sections.clear();
+  for (quint32 i = 0; i < count; ++i) {
+    const uchar *entry = header + HEADER_SIZE + i * ENTRY_SIZE;
+    Section s(qFromLittleEndian<quint32>(entry),
+              qFromLittleEndian<quint32>(entry + 4),
+              qFromLittleEndian<quint32>(entry + 8),
+              qFromLittleEndian<quint32>(entry + 12));
+    s.offset = qFromLittleEndian<quint64>(entry + 16);
+    if (s.type < Int32 || s.type > Float64Lower
+        || s.offset > static_cast<quint64>(size)
+        || s.bytes() > size - static_cast<qint64>(s.offset)) {
+      qDebug() << "Snapshot section" << s.id << "is out of bounds" << filename;
+      return false;
+    }
+    m_sections.insert(s.id, s);
+  }
+  return true;
+}
+
+bool SnapshotFile::read(quint32 id, MatrixXd &m) const
+{
+  const Section *s = section(id);
+  if (!s || s->type != Float64)
+    return false;
+  m.resize(s->rows, s->cols);
+  readValues(data(*s), s->count(), m.data());
+  return true;
+}
+
+bool SnapshotFile::readLower(quint32 id, vector<double> &v) const
+{
+  const Section *s = section(id);
+  if (!s || s->type != Float64Lower)
+    return false;
+  v.resize(s->count());
+  if (!v.empty())
+    readValues(data(*s), s->count(), &v[0]);
+  return true;
+}
+
+/**
+ * Reads the MO coefficients and density matrix of a GaussianSet straight out
+ * of the mapped snapshot.
+ */
+class SnapshotOrbitalSource : public OrbitalSource
+{
+public:
+  SnapshotOrbitalSource(const QSharedPointer<SnapshotFile> &file,
+                        const Section &mos, const Section *density)
+    : m_file(file), m_mos(mos), m_density(density ? *density : Section()) {}
+
+  unsigned int numMOs() const { return m_mos.cols; }
+
+  bool readMO(unsigned int mo, VectorXd &column) const
+  {
+    if (mo >= m_mos.cols)
+      return false;
+    column.resize(m_mos.rows);
+    readValues(m_file->data(m_mos) + static_cast<qint64>(mo) * m_mos.rows * 8,
+               m_mos.rows, column.data());
+    return true;
+  }
+
+  bool hasDensity() const { return m_density.type == Float64Lower; }
+
+  bool readDensity(MatrixXd &density) const
+  {
+    if (!hasDensity())
+      return false;
+    unsigned int n = m_density.rows;
+    density.resize(n, n);
+    const char *p = m_file->data(m_density);
+    for (unsigned int i = 0; i < n; ++i)
+      for (unsigned int j = 0; j <= i; ++j, p += 8)
+        readValues(p, 1, &density.coeffRef(i, j));
+    return true;
+  }
+
+  void hashContent(QCryptographicHash &hash) const
+  {
+    quint32 sizes[3] = { m_mos.rows, m_mos.cols, m_density.rows };
+    hash.addData(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+    addData(hash, m_mos);
+    if (hasDensity())
+      addData(hash, m_density);
+  }
+
+private:
+  // Add the data of section s, in pieces small enough for addData
+  void addData(QCryptographicHash &hash, const Section &s) const
+  {
+    const qint64 piece = 1 << 30;
+    const char *p = m_file->data(s);
+    qint64 bytes = s.bytes();
+    for (; bytes > piece; p += piece, bytes -= piece)
+      hash.addData(p, static_cast<int>(piece));
+    hash.addData(p, static_cast<int>(bytes));
+  }
+
+  QSharedPointer<SnapshotFile> m_file;
+  Section m_mos;
+  Section m_density;
+};
+
+/**
+ * Writes the sections of a snapshot. The sizes of all sections are declared
+ * with add() before anything is written, so that the section table can be
+ * written first and the data streamed after it.
+ */
+class SnapshotWriter
+{
+public:
+  explicit SnapshotWriter(QIODevice &file)
+    : m_file(file), m_next(0), m_ok(true) {}
+
+  void add(quint32 id, quint32 type, quint32 rows, quint32 cols)
+  {
+    m_sections.push_back(Section(id, type, rows, cols));
+  }
+
+  bool writeHeader(quint32 type, const QFileInfo &source, quint32 electrons,
+                   bool valid, const QByteArray &hash,
+                   const QByteArray &sourceHash);
+
+  /// Start writing the data of the next section
+  void beginSection();
+
+  /// Append count values to the data of the current section
+  template <typename T>
+  void write(const T *values, qint64 count);
+
+  bool ok() const { return m_ok; }
+
+private:
+  void pad(qint64 pos);
+
+  QIODevice &m_file;
+  vector<Section> m_sections;
+  size_t m_next;
+  bool m_ok;
+};
+
+bool SnapshotWriter::writeHeader(quint32 type, const QFileInfo &source,
+                                 quint32 electrons, bool valid,
+                                 const QByteArray &hash,
+                                 const QByteArray &sourceHash)
+{
+  // Lay the sections out after the table
+  quint64 offset = HEADER_SIZE + m_sections.size() * ENTRY_SIZE;
+  for (size_t i = 0; i < m_sections.size(); ++i) {
+    offset = (offset + 7) & ~quint64(7);
+    m_sections[i].offset = offset;
+    offset += m_sections[i].bytes();
+  }
+
+  QByteArray header(HEADER_SIZE + m_sections.size() * ENTRY_SIZE, '\0');
+  uchar *p = reinterpret_cast<uchar *>(header.data());
+  qToLittleEndian<quint32>(SNAPSHOT_MAGIC, p);
+  qToLittleEndian<quint32>(SNAPSHOT_VERSION, p + 4);
+  qToLittleEndian<quint32>(type, p + 8);
+  qToLittleEndian<quint32>(m_sections.size(), p + 12);
+  qToLittleEndian<qint64>(source.size(), p + 16);
+  qToLittleEndian<qint64>(source.lastModified().toTime_t(), p + 24);
+  qToLittleEndian<quint32>(electrons, p + 32);
+  qToLittleEndian<quint32>(valid ? 1 : 0, p + 36);
+  if (hash.size() <= MAX_HASH_SIZE) {
+    qToLittleEndian<quint32>(hash.size(), p + 40);
+    memcpy(p + 44, hash.constData(), hash.size());
+  }
+  if (sourceHash.size() <= MAX_HASH_SIZE) {
+    memcpy(p + SOURCE_HASH_OFFSET, sourceHash.constData(),
+           sourceHash.size());
+  }
+  for (size_t i = 0; i < m_sections.size(); ++i) {
+    uchar *entry = p + HEADER_SIZE + i * ENTRY_SIZE;
+    qToLittleEndian<quint32>(m_sections[i].id, entry);
+    qToLittleEndian<quint32>(m_sections[i].type, entry + 4);
+    qToLittleEndian<quint32>(m_sections[i].rows, entry + 8);
+    qToLittleEndian<quint32>(m_sections[i].cols, entry + 12);
+    qToLittleEndian<quint64>(m_sections[i].offset, entry + 16);
+  }
+  m_next = 0;
+  m_ok = m_file.write(header) == header.size();
+  return m_ok;
+}
+
+void SnapshotWriter::beginSection()
+{
+  if (m_next < m_sections.size())
+    pad(m_sections[m_next++].offset);
+  else
+    m_ok = false;
+}
+
+void SnapshotWriter::pad(qint64 pos)
+{
+  static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  qint64 gap = pos - m_file.pos();
+  if (gap < 0 || gap > 8 || (gap && m_file.write(zeros, gap) != gap))
+    m_ok = false;
+}
+
+template <typename T>
+void SnapshotWriter::write(const T *values, qint64 count)
+{
+  if (!m_ok || !count)
+    return;
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+  // Convert a block at a time
+  const qint64 block = 4096;
+  vector<T> buffer;
+  for (qint64 i = 0; i < count && m_ok; i += block) {
+    qint64 n = qMin(block, count - i);
+    buffer.assign(values + i, values + i + n);
+    swapValues(&buffer[0], n);
+    qint64 bytes = n * sizeof(T);
+    m_ok = m_file.write(reinterpret_cast<const char *>(&buffer[0]), bytes)
+        == bytes;
+  }
+#else
+  qint64 bytes = count * sizeof(T);
+  m_ok = m_file.write(reinterpret_cast<const char *>(values), bytes) == bytes;
+#endif
+}
+
+template <typename T>
+void addSection(SnapshotWriter &out, quint32 id, const vector<T> &v)
+{
+  out.add(id, sizeof(T) == 4 ? Int32 : Float64, v.size(), 1);
+}
+
+template <typename T>
+void writeSection(SnapshotWriter &out, const vector<T> &v)
+{
+  out.beginSection();
+  if (!v.empty())
+    out.write(&v[0], v.size());
+}
+
+// Write the lower triangle of m packed row by row
+void writeLower(SnapshotWriter &out, const MatrixXd &m)
+{
+  out.beginSection();
+  vector<double> row(m.rows());
+  for (int i = 0; i < m.rows(); ++i) {
+    for (int j = 0; j <= i; ++j)
+      row[j] = m(i, j);
+    out.write(&row[0], i + 1);
+  }
+}
+
+// The positions and atomic numbers of the atoms of the molecule
+void moleculeArrays(const Molecule &molecule, vector<double> &positions,
+                    vector<int> &atomicNumbers)
+{
+  size_t n = molecule.numAtoms();
+  positions.resize(3 * n);
+  atomicNumbers.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    Vector3d pos = molecule.atomPos(i);
+    positions[3 * i] = pos.x();
+    positions[3 * i + 1] = pos.y();
+    positions[3 * i + 2] = pos.z();
+    atomicNumbers[i] = molecule.atomAtomicNumber(i);
+  }
+}
+
+bool readMolecule(const SnapshotFile &file, Molecule &molecule)
+{
+  vector<double> positions;
+  vector<int> atomicNumbers;
+  if (!file.read(AtomPositions, positions)
+      || !file.read(AtomicNumbers, atomicNumbers)
+      || positions.size() != 3 * atomicNumbers.size())
+    return false;
+  molecule.clearAtoms();
+  for (size_t i = 0; i < atomicNumbers.size(); ++i)
+    molecule.addAtom(Vector3d(positions[3 * i], positions[3 * i + 1],
+                              positions[3 * i + 2]), atomicNumbers[i]);
+  return true;
+}
+
+} // End anonymous namespace
+
+QString BasisSetSnapshot::fileName(const QString &source)
+{
+  return source + SNAPSHOT_SUFFIX;
+}
+
+bool BasisSetSnapshot::isFresh(const QString &source)
+{
+  QFileInfo info(source);
+  QFile file(fileName(source));
+  if (!info.exists() || !file.open(QIODevice::ReadOnly))
+    return false;
+
+  QByteArray header = file.read(HEADER_SIZE);
+  if (header.size() != HEADER_SIZE)
+    return false;
+  const uchar *p = reinterpret_cast<const uchar *>(header.constData());
+  if (qFromLittleEndian<quint32>(p) != SNAPSHOT_MAGIC
+      || qFromLittleEndian<quint32>(p + 4) != SNAPSHOT_VERSION
+      || qFromLittleEndian<qint64>(p + 16) != info.size()
+      || qFromLittleEndian<qint64>(p + 24)
+         != static_cast<qint64>(info.lastModified().toTime_t()))
+    return false;
+  QByteArray hash = sourceHash(source);
+  return !hash.isEmpty() && hash.size() <= MAX_HASH_SIZE
+      && header.mid(SOURCE_HASH_OFFSET, hash.size()) == hash;
+}
+
+bool BasisSetSnapshot::write(BasisSet *basis, const QString &source)
+{
+  QFileInfo info(source);
+  GaussianSet *gaussian = qobject_cast<GaussianSet *>(basis);
+  SlaterSet *slater = qobject_cast<SlaterSet *>(basis);
+  if (!info.exists() || (!gaussian && !slater)) {
+    qDebug() << "Cannot write a snapshot of" << source;
+    return false;
+  }
+
+  // Write to a temporary file in the same directory, then rename it so that
+  // readers never see a partially written snapshot.
+  QTemporaryFile file(info.absoluteFilePath() + ".XXXXXX");
+  if (!file.open()) {
+    qDebug() << "Could not create a snapshot of" << source;
+    return false;
+  }
+
+  // A copy is initialized rather than the caller's basis set, which may be
+  // calculating. Hash before initializing, SlaterSet converts its exponents
+  // in place. The molecule is hashed separately, only the content hash is
+  // stored.
+  QScopedPointer<BasisSet> copy(basis->clone());
+  basis = copy.data();
+  gaussian = qobject_cast<GaussianSet *>(basis);
+  slater = qobject_cast<SlaterSet *>(basis);
+  QByteArray hash = gaussian ? gaussian->contentHash()
+                             : slater->contentHash();
+  vector<double> positions;
+  vector<int> atomicNumbers;
+  moleculeArrays(basis->moleculeRef(), positions, atomicNumbers);
+
+  QByteArray sampleHash = sourceHash(source);
+
+  SnapshotWriter out(file);
+  addSection(out, AtomPositions, positions);
+  addSection(out, AtomicNumbers, atomicNumbers);
+
+  if (gaussian) {
+    GaussianSet &g = *gaussian;
+    g.initCalculation();
+    unsigned int numMOs = 0;
+    if (g.m_orbitalSource)
+      numMOs = g.m_orbitalSource->numMOs();
+    else if (g.m_moMatrix.rows() == static_cast<int>(g.m_numMOs))
+      numMOs = g.m_moMatrix.cols();
+    unsigned int counts[2] = { g.m_numMOs, g.m_numAtoms };
+
+    // MOs and the density are read from the orbital source if there is one
+    MatrixXd density = g.m_density;
+    if (density.size() == 0 && g.m_orbitalSource
+        && g.m_orbitalSource->hasDensity()
+        && !g.m_orbitalSource->readDensity(density))
+      density.resize(0, 0);
+
+    addSection(out, Symmetry, g.m_symmetry);
+    addSection(out, AtomIndices, g.m_atomIndices);
+    addSection(out, MOIndices, g.m_moIndices);
+    addSection(out, GTOIndices, g.m_gtoIndices);
+    addSection(out, CIndices, g.m_cIndices);
+    addSection(out, GTOExponents, g.m_gtoA);
+    addSection(out, GTOCoefficients, g.m_gtoC);
+    addSection(out, GTONormalized, g.m_gtoCN);
+    out.add(Counts, Int32, 2, 1);
+    out.add(MOMatrix, Float64, g.m_numMOs, numMOs);
+    if (density.size())
+      out.add(Density, Float64Lower, density.rows(), density.rows());
+    out.writeHeader(Gaussian, info, basis->numElectrons(), basis->isValid(),
+                    hash, sampleHash);
+
+    writeSection(out, positions);
+    writeSection(out, atomicNumbers);
+    writeSection(out, g.m_symmetry);
+    writeSection(out, g.m_atomIndices);
+    writeSection(out, g.m_moIndices);
+    writeSection(out, g.m_gtoIndices);
+    writeSection(out, g.m_cIndices);
+    writeSection(out, g.m_gtoA);
+    writeSection(out, g.m_gtoC);
+    writeSection(out, g.m_gtoCN);
+    out.beginSection();
+    out.write(counts, 2);
+
+    // Stream the MOs from the source a column at a time
+    out.beginSection();
+    if (g.m_orbitalSource) {
+      VectorXd column;
+      for (unsigned int i = 0; i < numMOs && out.ok(); ++i) {
+        if (!g.m_orbitalSource->readMO(i, column)
+            || column.size() != static_cast<int>(g.m_numMOs)) {
+          qDebug() << "Reading MO" << i + 1 << "for the snapshot failed.";
+          return false;
+        }
+        out.write(column.data(), column.size());
+      }
+    }
+    else if (numMOs) {
+      out.write(g.m_moMatrix.data(), g.m_moMatrix.size());
+    }
+    if (density.size())
+      writeLower(out, density);
+  }
+  else {
+    SlaterSet &s = *slater;
+    if (!s.m_initialized)
+      s.initialize();
+
+    vector<double> atomPos(3 * s.m_atomPos.size());
+    for (size_t i = 0; i < s.m_atomPos.size(); ++i)
+      for (int j = 0; j < 3; ++j)
+        atomPos[3 * i + j] = s.m_atomPos[i][j];
+    unsigned int size = s.numMOs();
+
+    addSection(out, SlaterAtomPositions, atomPos);
+    addSection(out, SlaterIndices, s.m_slaterIndices);
+    addSection(out, SlaterTypes, s.m_slaterTypes);
+    addSection(out, Zetas, s.m_zetas);
+    addSection(out, PQNs, s.m_pqns);
+    addSection(out, ShiftedPQNs, s.m_PQNs);
+    addSection(out, Factors, s.m_factors);
+    out.add(Overlap, Float64Lower, size, size);
+    out.add(EigenVectors, Float64, s.m_eigenVectors.rows(),
+            s.m_eigenVectors.cols());
+    out.add(Normalized, Float64, s.m_normalized.rows(), s.m_normalized.cols());
+    if (!s.m_density.empty())
+      out.add(Density, Float64Lower, size, size);
+    out.writeHeader(Slater, info, basis->numElectrons(), basis->isValid(),
+                    hash, sampleHash);
+
+    writeSection(out, positions);
+    writeSection(out, atomicNumbers);
+    writeSection(out, atomPos);
+    writeSection(out, s.m_slaterIndices);
+    writeSection(out, s.m_slaterTypes);
+    writeSection(out, s.m_zetas);
+    writeSection(out, s.m_pqns);
+    writeSection(out, s.m_PQNs);
+    writeSection(out, s.m_factors);
+    writeSection(out, s.m_overlap);
+    out.beginSection();
+    out.write(s.m_eigenVectors.data(), s.m_eigenVectors.size());
+    out.beginSection();
+    out.write(s.m_normalized.data(), s.m_normalized.size());
+    if (!s.m_density.empty())
+      writeSection(out, s.m_density);
+  }
+
+  if (!out.ok()) {
+    qDebug() << "Error writing the snapshot of" << source;
+    return false;
+  }
+  file.close();
+  // Temporary files are only readable by their owner
+  file.setPermissions(info.permissions());
+
+  // Replace any stale snapshot
+  QString target = fileName(source);
+  QFile::remove(target);
+  if (!QFile::rename(file.fileName(), target)) {
+    qDebug() << "Could not rename the snapshot to" << target;
+    return false;
+  }
+  file.setAutoRemove(false);
+  return true;
+}
+
+BasisSet * BasisSetSnapshot::read(const QString &source)
+{
+  QSharedPointer<SnapshotFile> file(new SnapshotFile);
+  if (!file->open(fileName(source)))
+    return 0;
+
+  if (file->type == Gaussian) {
+    GaussianSet *g = new GaussianSet;
+    vector<unsigned int> counts;
+    const Section *mos = file->section(MOMatrix);
+    bool ok = readMolecule(*file, g->moleculeRef())
+        && file->read(Symmetry, g->m_symmetry)
+        && file->read(AtomIndices, g->m_atomIndices)
+        && file->read(MOIndices, g->m_moIndices)
+        && file->read(GTOIndices, g->m_gtoIndices)
+        && file->read(CIndices, g->m_cIndices)
+        && file->read(GTOExponents, g->m_gtoA)
+        && file->read(GTOCoefficients, g->m_gtoC)
+        && file->read(GTONormalized, g->m_gtoCN)
+        && file->read(Counts, counts) && counts.size() == 2
+        && mos && mos->type == Float64 && mos->rows == counts[0];
+    if (!ok) {
+      qDebug() << "Snapshot of" << source << "is incomplete.";
+      delete g;
+      return 0;
+    }
+
+    // The calculation indexes with these without checking them, so a
+    // damaged snapshot must not get that far. Shells are not required to
+    // be in the order of their atoms.
+    size_t shells = g->m_symmetry.size();
+    const Section *density = file->section(Density);
+    ok = counts[1] == g->moleculeRef().numAtoms()
+        && g->m_atomIndices.size() == shells
+        && g->m_moIndices.size() == shells
+        && (!shells || g->m_moIndices.back() < counts[0])
+        && validIndices(g->m_moIndices, shells, counts[0])
+        && g->m_gtoC.size() == g->m_gtoA.size()
+        && validIndices(g->m_gtoIndices, shells + 1, g->m_gtoA.size())
+        && validIndices(g->m_cIndices, shells, g->m_gtoCN.size())
+        && (!density || density->rows == counts[0]);
+    for (size_t i = 0; ok && i < shells; ++i)
+      ok = g->m_atomIndices[i] < counts[1];
+    if (!ok) {
+      qDebug() << "Snapshot of" << source << "is inconsistent.";
+      delete g;
+      return 0;
+    }
+    g->m_numMOs = counts[0];
+    g->m_numAtoms = counts[1];
+    // The MOs and density stay in the file until they are needed
+    g->m_orbitalSource = QSharedPointer<OrbitalSource>(
+          new SnapshotOrbitalSource(file, *mos, file->section(Density)));
+    g->m_init = true;
+    g->setNumElectrons(file->electrons);
+    g->setIsValid(file->valid);
+    g->m_contentHash = file->hash;
+    return g;
+  }
+  else if (file->type == Slater) {
+    SlaterSet *s = new SlaterSet;
+    vector<double> atomPos;
+    bool ok = readMolecule(*file, s->moleculeRef())
+        && file->read(SlaterAtomPositions, atomPos)
+        && file->read(SlaterIndices, s->m_slaterIndices)
+        && file->read(SlaterTypes, s->m_slaterTypes)
+        && file->read(Zetas, s->m_zetas)
+        && file->read(PQNs, s->m_pqns)
+        && file->read(ShiftedPQNs, s->m_PQNs)
+        && file->read(Factors, s->m_factors)
+        && file->readLower(Overlap, s->m_overlap)
+        && file->read(EigenVectors, s->m_eigenVectors)
+        && file->read(Normalized, s->m_normalized);
+    if (!ok) {
+      qDebug() << "Snapshot of" << source << "is incomplete.";
+      delete s;
+      return 0;
+    }
+    if (file->section(Density))
+      file->readLower(Density, s->m_density);
+    s->m_atomPos.resize(atomPos.size() / 3);
+    for (size_t i = 0; i < s->m_atomPos.size(); ++i)
+      s->m_atomPos[i] = Vector3d(atomPos[3 * i], atomPos[3 * i + 1],
+                                 atomPos[3 * i + 2]);
+    s->m_initialized = true;
+    s->setNumElectrons(file->electrons);
+    s->setIsValid(file->valid);
+    s->m_contentHash = file->hash;
+    return s;
+  }
+
+  qDebug() << "Unknown basis set type in the snapshot of" << source;
+  return 0;
+}
+
+} // End namespace
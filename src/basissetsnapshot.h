@@ -0,0 +1,80 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_BASISSETSNAPSHOT_H
+#define OQ_BASISSETSNAPSHOT_H
+
+#include "openqubeabi.h"
+
+#include <QtCore/QString>
+
+namespace OpenQube {
+
+class BasisSet;
+
+/**
+ * @class BasisSetSnapshot basissetsnapshot.h <openqube/basissetsnapshot.h>
+ * @brief BasisSetSnapshot stores parsed basis sets in a binary file that is
+ * much faster to read than the output they were parsed from.
+ *
+ * A snapshot holds everything a GaussianSet or SlaterSet needs once it has
+ * been initialized for calculations: the atoms, the shells and primitives
+ * with their normalized coefficients, the MO matrix and the density matrix.
+ * It is stored next to the output file it was parsed from, and records the
+ * size and modification time of that file and a hash of its first and last
+ * 64 KiB so that stale snapshots are ignored.
+ *
+ * The file is versioned and little-endian, with every array aligned to
+ * eight bytes. It is memory mapped when read: the MO coefficients and the
+ * density matrix of a GaussianSet are read straight out of the mapping when
+ * a calculation needs them, so opening even a very large calculation only
+ * reads the basis set itself.
+ */
+
+class OPENQUBE_EXPORT BasisSetSnapshot
+{
+public:
+  /**
+   * @return The name of the snapshot of the output file @a source.
+   */
+  static QString fileName(const QString &source);
+
+  /**
+   * @return True if there is a snapshot of @a source that was written since
+   * it last changed.
+   */
+  static bool isFresh(const QString &source);
+
+  /**
+   * Write a snapshot of @a basis, which was parsed from @a source. A copy of
+   * the basis set is initialized for calculations and written, @a basis
+   * itself is left as it is. The snapshot is written to a temporary file and
+   * renamed, so readers never see a partial snapshot.
+   * @return True on success.
+   */
+  static bool write(BasisSet *basis, const QString &source);
+
+  /**
+   * Read the snapshot of @a source, without checking that it is fresh.
+   * @return The basis set, owned by the caller, or 0 if there is no valid
+   * snapshot.
+   */
+  static BasisSet * read(const QString &source);
+};
+
+} // End namespace
+
+#endif
@@ -0,0 +1,519 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "compressedfile.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QThread>
+#include <QtCore/QtEndian>
+#include <QtCore/QDebug>
+
+#include <cstring>
+
+#ifdef OPENQUBE_HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef OPENQUBE_HAVE_LZMA
+# include <lzma.h>
+#endif
+#ifdef OPENQUBE_HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+namespace OpenQube {
+
+// Compressed input is read, and decompressed output queued, in blocks. The
+// worker stays at most MAX_BLOCKS blocks ahead of the reader.
+static const int INPUT_BLOCK = 256 * 1024;
+static const int OUTPUT_BLOCK = 1024 * 1024;
+static const int MAX_BLOCKS = 4;
+
+namespace {
+
+/**
+ * The interface to one decompression library. Streams made of several
+ * members or frames, as written by parallel compressors, are decompressed
+ * in full.
+ */
+class Decoder
+{
+public:
+  enum Status {
+    Error,
+    Ok,
+    StreamEnd ///< The end of a member or frame was reached
+  };
+
+  virtual ~Decoder() {}
+
+  /**
+   * Decompress from @a in into @a out, advancing both. @a finish is true once
+   * all of the input has been passed in.
+   */
+  virtual Status decode(const char *&in, const char *inEnd, char *&out,
+                        char *outEnd, bool finish) = 0;
+
+  QString error;
+};
+
+#ifdef OPENQUBE_HAVE_ZLIB
+class GzipDecoder : public Decoder
+{
+public:
+  GzipDecoder() : m_init(false)
+  {
+    memset(&m_stream, 0, sizeof(m_stream));
+    // Accept gzip and zlib headers
+    m_init = inflateInit2(&m_stream, 15 + 32) == Z_OK;
+    if (!m_init)
+      error = "Could not initialize zlib";
+  }
+  ~GzipDecoder()
+  {
+    if (m_init)
+      inflateEnd(&m_stream);
+  }
+
+  Status decode(const char *&in, const char *inEnd, char *&out, char *outEnd,
+                bool)
+  {
+    if (!m_init)
+      return Error;
+    m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+    m_stream.avail_in = static_cast<uInt>(inEnd - in);
+    m_stream.next_out = reinterpret_cast<Bytef *>(out);
+    m_stream.avail_out = static_cast<uInt>(outEnd - out);
+    int result = inflate(&m_stream, Z_NO_FLUSH);
+    in = reinterpret_cast<const char *>(m_stream.next_in);
+    out = reinterpret_cast<char *>(m_stream.next_out);
+
+    switch (result) {
+    case Z_OK:
+    case Z_BUF_ERROR: // No progress possible, more input or output needed
+      return Ok;
+    case Z_STREAM_END:
+      // Get ready for the next member, if there is one
+      inflateReset(&m_stream);
+      return StreamEnd;
+    default:
+      error = m_stream.msg ? m_stream.msg : "zlib error";
+      return Error;
+    }
+  }
+
+private:
+  z_stream m_stream;
+  bool m_init;
+};
+#endif
+
+#ifdef OPENQUBE_HAVE_LZMA
+class XzDecoder : public Decoder
+{
+public:
+  XzDecoder() : m_init(false)
+  {
+    lzma_stream init = LZMA_STREAM_INIT;
+    m_stream = init;
+    m_init = lzma_stream_decoder(&m_stream, UINT64_MAX, LZMA_CONCATENATED)
+        == LZMA_OK;
+    if (!m_init)
+      error = "Could not initialize liblzma";
+  }
+  ~XzDecoder()
+  {
+    lzma_end(&m_stream);
+  }
+
+  Status decode(const char *&in, const char *inEnd, char *&out, char *outEnd,
+                bool finish)
+  {
+    if (!m_init)
+      return Error;
+    m_stream.next_in = reinterpret_cast<const uint8_t *>(in);
+    m_stream.avail_in = inEnd - in;
+    m_stream.next_out = reinterpret_cast<uint8_t *>(out);
+    m_stream.avail_out = outEnd - out;
+    // Concatenated streams only end once the decoder is told to finish
+    lzma_ret result = lzma_code(&m_stream, finish ? LZMA_FINISH : LZMA_RUN);
+    in = reinterpret_cast<const char *>(m_stream.next_in);
+    out = reinterpret_cast<char *>(m_stream.next_out);
+
+    switch (result) {
+    case LZMA_OK:
+    case LZMA_BUF_ERROR:
+      return Ok;
+    case LZMA_STREAM_END:
+      return StreamEnd;
+    default:
+      error = QString("liblzma error %1").arg(static_cast<int>(result));
+      return Error;
+    }
+  }
+
+private:
+  lzma_stream m_stream;
+  bool m_init;
+};
+#endif
+
+#ifdef OPENQUBE_HAVE_ZSTD
+class ZstdDecoder : public Decoder
+{
+public:
+  ZstdDecoder() : m_stream(ZSTD_createDStream())
+  {
+    if (!m_stream || ZSTD_isError(ZSTD_initDStream(m_stream))) {
+      error = "Could not initialize zstd";
+      ZSTD_freeDStream(m_stream);
+      m_stream = 0;
+    }
+  }
+  ~ZstdDecoder()
+  {
+    ZSTD_freeDStream(m_stream);
+  }
+
+  Status decode(const char *&in, const char *inEnd, char *&out, char *outEnd,
+                bool)
+  {
+    if (!m_stream)
+      return Error;
+    ZSTD_inBuffer input = { in, static_cast<size_t>(inEnd - in), 0 };
+    ZSTD_outBuffer output = { out, static_cast<size_t>(outEnd - out), 0 };
+    size_t result = ZSTD_decompressStream(m_stream, &output, &input);
+    in += input.pos;
+    out += output.pos;
+
+    if (ZSTD_isError(result)) {
+      error = ZSTD_getErrorName(result);
+      return Error;
+    }
+    // Zero once a frame is completely decoded and flushed, the next frame
+    // starts with the next call
+    return result == 0 ? StreamEnd : Ok;
+  }
+
+private:
+  ZSTD_DStream *m_stream;
+};
+#endif
+
+Decoder * createDecoder(CompressedFile::Format format)
+{
+  switch (format) {
+#ifdef OPENQUBE_HAVE_ZLIB
+  case CompressedFile::Gzip:
+    return new GzipDecoder;
+#endif
+#ifdef OPENQUBE_HAVE_LZMA
+  case CompressedFile::Xz:
+    return new XzDecoder;
+#endif
+#ifdef OPENQUBE_HAVE_ZSTD
+  case CompressedFile::Zstd:
+    return new ZstdDecoder;
+#endif
+  default:
+    return 0;
+  }
+}
+
+} // End anonymous namespace
+
+class DecompressThread : public QThread
+{
+public:
+  explicit DecompressThread(CompressedFile *file) : m_file(file) {}
+
+protected:
+  void run() { m_file->decompress(); }
+
+private:
+  CompressedFile *m_file;
+};
+
+CompressedFile::CompressedFile(const QString &filename)
+  : m_fileName(filename), m_format(None), m_thread(0), m_finished(true),
+    m_stop(false), m_currentPos(0)
+{
+}
+
+CompressedFile::~CompressedFile()
+{
+  close();
+}
+
+CompressedFile::Format CompressedFile::format(const QString &filename)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly))
+    return None;
+  QByteArray magic = file.read(6);
+  if (magic.startsWith("\x1f\x8b"))
+    return Gzip;
+  if (magic == QByteArray("\xfd" "7zXZ\0", 6))
+    return Xz;
+  if (magic.startsWith("\x28\xb5\x2f\xfd"))
+    return Zstd;
+  return None;
+}
+
+bool CompressedFile::isSupported(Format format)
+{
+  switch (format) {
+#ifdef OPENQUBE_HAVE_ZLIB
+  case Gzip:
+    return true;
+#endif
+#ifdef OPENQUBE_HAVE_LZMA
+  case Xz:
+    return true;
+#endif
+#ifdef OPENQUBE_HAVE_ZSTD
+  case Zstd:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+qint64 CompressedFile::sizeHint() const
+{
+  QFile file(m_fileName);
+  if (!file.open(QIODevice::ReadOnly))
+    return -1;
+
+  switch (format(m_fileName)) {
+  case Gzip: {
+    // The trailer of the last member ends with the size modulo 2^32
+    if (file.size() < 18 || !file.seek(file.size() - 4))
+      return -1;
+    QByteArray size = file.read(4);
+    if (size.size() != 4)
+      return -1;
+    return qFromLittleEndian<quint32>(
+          reinterpret_cast<const uchar *>(size.constData()));
+  }
+#ifdef OPENQUBE_HAVE_ZSTD
+  case Zstd: {
+    // Frame headers are at most 18 bytes long
+    QByteArray header = file.read(18);
+    unsigned long long size = ZSTD_getFrameContentSize(header.constData(),
+                                                       header.size());
+    if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR)
+      return -1;
+    return static_cast<qint64>(size);
+  }
+#endif
+  default:
+    return -1;
+  }
+}
+
+bool CompressedFile::open(OpenMode mode)
+{
+  if (isOpen() || (mode & WriteOnly)) {
+    qDebug() << "CompressedFile can only be opened once, for reading.";
+    return false;
+  }
+  m_format = format(m_fileName);
+  if (!isSupported(m_format)) {
+    setErrorString("Unsupported compression format");
+    qDebug() << "Cannot decompress" << m_fileName;
+    return false;
+  }
+
+  m_blocks.clear();
+  m_current.clear();
+  m_currentPos = 0;
+  m_finished = false;
+  m_stop = false;
+  m_error.clear();
+  m_thread = new DecompressThread(this);
+  m_thread->start();
+  return QIODevice::open(mode);
+}
+
+void CompressedFile::close()
+{
+  if (m_thread) {
+    m_mutex.lock();
+    m_stop = true;
+    m_consumed.wakeAll();
+    m_mutex.unlock();
+    m_thread->wait();
+    delete m_thread;
+    m_thread = 0;
+  }
+  m_blocks.clear();
+  m_current.clear();
+  m_currentPos = 0;
+  if (isOpen())
+    QIODevice::close();
+}
+
+bool CompressedFile::atEnd() const
+{
+  if (!QIODevice::atEnd() || m_currentPos < m_current.size())
+    return false;
+  QMutexLocker locker(&m_mutex);
+  return m_blocks.isEmpty() && m_finished;
+}
+
+qint64 CompressedFile::bytesAvailable() const
+{
+  qint64 available = m_current.size() - m_currentPos;
+  QMutexLocker locker(&m_mutex);
+  for (int i = 0; i < m_blocks.size(); ++i)
+    available += m_blocks[i].size();
+  return available + QIODevice::bytesAvailable();
+}
+
+qint64 CompressedFile::readData(char *data, qint64 maxSize)
+{
+  qint64 total = 0;
+  while (total < maxSize) {
+    if (m_currentPos == m_current.size()) {
+      QMutexLocker locker(&m_mutex);
+      // Hand back what there is rather than wait for more
+      if (m_blocks.isEmpty() && total)
+        break;
+      while (m_blocks.isEmpty() && !m_finished)
+        m_produced.wait(&m_mutex);
+      if (m_blocks.isEmpty()) {
+        if (!m_error.isEmpty()) {
+          setErrorString(m_error);
+          return -1;
+        }
+        break;
+      }
+      m_current = m_blocks.dequeue();
+      m_currentPos = 0;
+      m_consumed.wakeAll();
+    }
+
+    int n = static_cast<int>(qMin<qint64>(maxSize - total,
+                                          m_current.size() - m_currentPos));
+    memcpy(data + total, m_current.constData() + m_currentPos, n);
+    m_currentPos += n;
+    total += n;
+  }
+  return total;
+}
+
+qint64 CompressedFile::writeData(const char *, qint64)
+{
+  return -1;
+}
+
+void CompressedFile::decompress()
+{
+  QFile file(m_fileName);
+  Decoder *decoder = createDecoder(m_format);
+  if (!file.open(QIODevice::ReadOnly) || !decoder) {
+    delete decoder;
+    finish("Cannot open " + m_fileName);
+    return;
+  }
+
+  QByteArray input;
+  input.resize(INPUT_BLOCK);
+  const char *in = input.constData();
+  const char *inEnd = in;
+  bool eof = false;
+  bool ended = false; // At the end of a member or frame
+
+  QByteArray block;
+  block.resize(OUTPUT_BLOCK);
+  char *out = block.data();
+
+  while (true) {
+    if (in == inEnd && !eof) {
+      qint64 n = file.read(input.data(), INPUT_BLOCK);
+      if (n < 0) {
+        delete decoder;
+        finish("Error reading " + m_fileName);
+        return;
+      }
+      eof = n == 0;
+      in = input.constData();
+      inEnd = in + n;
+    }
+
+    const char *inBefore = in;
+    char *outBefore = out;
+    bool finishing = eof && in == inEnd;
+    Decoder::Status status = decoder->decode(in, inEnd, out,
+                                             block.data() + block.size(),
+                                             finishing);
+    if (status == Decoder::Error) {
+      QString error = decoder->error;
+      delete decoder;
+      finish(m_fileName + ": " + error);
+      return;
+    }
+    bool progress = in != inBefore || out != outBefore;
+    if (status == Decoder::StreamEnd)
+      ended = true;
+    else if (progress)
+      ended = false;
+
+    bool done = finishing && (status == Decoder::StreamEnd || !progress);
+    if (out == block.data() + block.size() || (done && out != block.data())) {
+      block.resize(out - block.data());
+      if (!pushBlock(block)) {
+        delete decoder;
+        return;
+      }
+      // The queued block is shared, start a new one rather than detach it
+      block = QByteArray();
+      block.resize(OUTPUT_BLOCK);
+      out = block.data();
+    }
+
+    if (done) {
+      delete decoder;
+      finish(ended ? QString() : m_fileName + " is truncated");
+      return;
+    }
+  }
+}
+
+bool CompressedFile::pushBlock(const QByteArray &block)
+{
+  QMutexLocker locker(&m_mutex);
+  while (m_blocks.size() >= MAX_BLOCKS && !m_stop)
+    m_consumed.wait(&m_mutex);
+  if (m_stop)
+    return false;
+  m_blocks.enqueue(block);
+  m_produced.wakeAll();
+  return true;
+}
+
+void CompressedFile::finish(const QString &error)
+{
+  if (!error.isEmpty())
+    qDebug() << "Decompression failed:" << error;
+  QMutexLocker locker(&m_mutex);
+  m_error = error;
+  m_finished = true;
+  m_produced.wakeAll();
+}
+
+} // End namespace
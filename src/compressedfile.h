@@ -0,0 +1,130 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_COMPRESSEDFILE_H
+#define OQ_COMPRESSEDFILE_H
+
+#include "openqubeabi.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QIODevice>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QString>
+#include <QtCore/QWaitCondition>
+
+class QThread;
+
+namespace OpenQube {
+
+/**
+ * @class CompressedFile compressedfile.h <openqube/compressedfile.h>
+ * @brief CompressedFile reads a gzip, xz or zstd compressed file as a stream
+ * of its uncompressed contents.
+ *
+ * The file is decompressed on a worker thread, which runs a few blocks ahead
+ * of the reader, so decompression overlaps with whatever the reader does with
+ * the data. Readers that parse the stream as it arrives, such as GamessukOut
+ * or the parsers that use a RecordReader, never hold the uncompressed
+ * contents in full, MappedFile does. The
+ * format is recognized from the first bytes of the file rather than from its
+ * name. Which formats are supported depends on the libraries found when
+ * OpenQube was built, see isSupported().
+ *
+ * The device is sequential and can only be opened for reading.
+ */
+
+class OPENQUBE_EXPORT CompressedFile : public QIODevice
+{
+public:
+  /**
+   * @enum Format
+   * The compression formats that can be recognized.
+   */
+  enum Format {
+    None, ///< Not compressed, or not in a recognized format.
+    Gzip,
+    Xz,
+    Zstd
+  };
+
+  explicit CompressedFile(const QString &filename);
+
+  /**
+   * Destructor, stops the worker thread.
+   */
+  ~CompressedFile();
+
+  /**
+   * @return The compression format of @a filename, None if it is not
+   * compressed or cannot be read.
+   */
+  static Format format(const QString &filename);
+
+  /**
+   * @return True if files in @a format can be decompressed.
+   */
+  static bool isSupported(Format format);
+
+  /**
+   * @return The size of the uncompressed contents as recorded in the file,
+   * or -1 if it is not known. Only a hint, gzip records the size modulo 4 GB
+   * and only for the last member of the file.
+   */
+  qint64 sizeHint() const;
+
+  QString fileName() const { return m_fileName; }
+
+  bool open(OpenMode mode);
+  void close();
+  bool isSequential() const { return true; }
+  bool atEnd() const;
+  qint64 bytesAvailable() const;
+
+protected:
+  qint64 readData(char *data, qint64 maxSize);
+  qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+  friend class DecompressThread;
+
+  /// Run on the worker thread, decompresses the file into m_blocks
+  void decompress();
+  /// Queue a decompressed block, false if the reader stopped
+  bool pushBlock(const QByteArray &block);
+  void finish(const QString &error);
+
+  QString m_fileName;
+  Format m_format;
+  QThread *m_thread;
+
+  // Shared with the worker thread
+  mutable QMutex m_mutex;
+  QWaitCondition m_produced;    //! A block was queued, or the worker ended
+  QWaitCondition m_consumed;    //! A block was taken, or the reader stopped
+  QQueue<QByteArray> m_blocks;  //! Decompressed blocks waiting to be read
+  bool m_finished;              //! The worker has queued its last block
+  bool m_stop;                  //! The reader is closing the file
+  QString m_error;              //! Why decompression failed, if it did
+
+  // Only used by the reader
+  QByteArray m_current;         //! The block being read
+  int m_currentPos;
+};
+
+} // End namespace
+
+#endif
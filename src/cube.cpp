@@ -21,13 +21,15 @@
 #include <QtCore/QReadWriteLock>
 #include <QtCore/QDebug>
 
+#include <algorithm>
+
 namespace OpenQube {
 
 using Eigen::Vector3i;
 using Eigen::Vector3f;
 using Eigen::Vector3d;
 
-Cube::Cube() : m_data(0),
+Cube::Cube() : m_data(new CubeData),
   m_min(0.0, 0.0, 0.0), m_max(0.0, 0.0, 0.0), m_spacing(0.0, 0.0, 0.0),
   m_points(0, 0, 0), m_minValue(0.0), m_maxValue(0.0),
   m_lock(new QReadWriteLock)
@@ -51,7 +53,7 @@ bool Cube::setLimits(const Vector3d &min, const Vector3d &max,
   m_min = min;
   m_max = max;
   m_points = points;
-  m_data.resize(m_points.x() * m_points.y() * m_points.z());
+  m_data->values.resize(m_points.x() * m_points.y() * m_points.z());
   return true;
 }
 
@@ -75,7 +77,7 @@ bool Cube::setLimits(const Vector3d &min, const Vector3i &dim,
   m_max = max;
   m_points = dim;
   m_spacing = Vector3d(spacing, spacing, spacing);
-  m_data.resize(m_points.x() * m_points.y() * m_points.z());
+  m_data->values.resize(m_points.x() * m_points.y() * m_points.z());
   return true;
 }
 
@@ -85,7 +87,7 @@ bool Cube::setLimits(const Cube &cube)
   m_max = cube.m_max;
   m_points = cube.m_points;
   m_spacing = cube.m_spacing;
-  m_data.resize(m_points.x() * m_points.y() * m_points.z());
+  m_data->values.resize(m_points.x() * m_points.y() * m_points.z());
   return true;
 }
 
@@ -117,7 +119,12 @@ bool Cube::setLimits(const Molecule &mol, double spacing, double padding)
 
 std::vector<double> * Cube::data()
 {
-  return &m_data;
+  return &m_data->values;
+}
+
+const std::vector<double> * Cube::data() const
+{
+  return &m_data->values;
 }
 
 bool Cube::setData(const std::vector<double> &values)
@@ -127,11 +134,13 @@ bool Cube::setData(const std::vector<double> &values)
     return false;
   }
   if (static_cast<int>(values.size()) == m_points.x() * m_points.y() * m_points.z()) {
-    m_data = values;
-    qDebug() << "Loaded in cube data" << m_data.size();
+    // Values shared with another cube are replaced rather than copied first
+    m_data = new CubeData;
+    m_data->values = values;
+    qDebug() << "Loaded in cube data" << m_data->values.size();
     // Now to update the minimum and maximum values
-    m_minValue = m_maxValue = m_data[0];
-    foreach(double val, m_data) {
+    m_minValue = m_maxValue = m_data->values[0];
+    foreach(double val, m_data->values) {
       if (val < m_minValue)
         m_minValue = val;
       else if (val > m_maxValue)
@@ -147,26 +156,89 @@ bool Cube::setData(const std::vector<double> &values)
   }
 }
 
+void Cube::shareData(const Cube &cube)
+{
+  m_min = cube.m_min;
+  m_max = cube.m_max;
+  m_points = cube.m_points;
+  m_spacing = cube.m_spacing;
+  m_data = cube.m_data;
+  m_minValue = cube.m_minValue;
+  m_maxValue = cube.m_maxValue;
+}
+
 bool Cube::addData(const std::vector<double> &values)
 {
   // Initialise the cube to zero if necessary
-  if (!m_data.size()) {
-    m_data.resize(m_points.x() * m_points.y() * m_points.z());
+  if (!m_data->values.size()) {
+    m_data->values.resize(m_points.x() * m_points.y() * m_points.z());
   }
-  if (values.size() != m_data.size() || !values.size()) {
+  if (values.size() != m_data->values.size() || !values.size()) {
     qDebug() << "Attempted to add values to cube - sizes do not match...";
     return false;
   }
-  for (unsigned int i = 0; i < m_data.size(); i++) {
-    m_data[i] += values[i];
-    if (m_data[i] < m_minValue)
-      m_minValue = m_data[i];
-    else if (m_data[i] > m_maxValue)
-      m_maxValue = m_data[i];
+  for (unsigned int i = 0; i < m_data->values.size(); i++) {
+    m_data->values[i] += values[i];
+    if (m_data->values[i] < m_minValue)
+      m_minValue = m_data->values[i];
+    else if (m_data->values[i] > m_maxValue)
+      m_maxValue = m_data->values[i];
   }
   return true;
 }
 
+void Cube::fillFromSubgrid(int stride)
+{
+  if (stride <= 1)
+    return;
+  for (int i = 0; i < m_points.x(); ++i) {
+    int si = i - i % stride;
+    for (int j = 0; j < m_points.y(); ++j) {
+      int sj = j - j % stride;
+      unsigned int row = i*m_points.y()*m_points.z() + j*m_points.z();
+      unsigned int subRow = si*m_points.y()*m_points.z() + sj*m_points.z();
+      for (int k = 0; k < m_points.z(); ++k)
+        m_data->values[row + k] = m_data->values[subRow + k - k % stride];
+    }
+  }
+}
+
+void Cube::interpolateFromSubgrid(int stride)
+{
+  if (stride <= 1)
+    return;
+  int rowSize = m_points.z();
+  int planeSize = m_points.y() * rowSize;
+  for (int i = 0; i < m_points.x(); ++i) {
+    int i0 = i + 1 < m_points.x() ? i - i % stride : i;
+    int i1 = std::min(i0 + stride, m_points.x() - 1);
+    double ti = i1 > i0 ? double(i - i0) / (i1 - i0) : 0.0;
+    for (int j = 0; j < m_points.y(); ++j) {
+      int j0 = j + 1 < m_points.y() ? j - j % stride : j;
+      int j1 = std::min(j0 + stride, m_points.y() - 1);
+      double tj = j1 > j0 ? double(j - j0) / (j1 - j0) : 0.0;
+      bool onPlane = i == i0 && j == j0;
+      const double *r00 = &m_data->values[i0 * planeSize + j0 * rowSize];
+      const double *r10 = &m_data->values[i1 * planeSize + j0 * rowSize];
+      const double *r01 = &m_data->values[i0 * planeSize + j1 * rowSize];
+      const double *r11 = &m_data->values[i1 * planeSize + j1 * rowSize];
+      double *row = &m_data->values[i * planeSize + j * rowSize];
+      for (int k = 0; k < rowSize; ++k) {
+        int k0 = k + 1 < rowSize ? k - k % stride : k;
+        if (onPlane && k == k0)
+          continue;
+        int k1 = std::min(k0 + stride, rowSize - 1);
+        double tk = k1 > k0 ? double(k - k0) / (k1 - k0) : 0.0;
+        double a = (1.0 - ti) * ((1.0 - tj) * r00[k0] + tj * r01[k0])
+            + ti * ((1.0 - tj) * r10[k0] + tj * r11[k0]);
+        double b = (1.0 - ti) * ((1.0 - tj) * r00[k1] + tj * r01[k1])
+            + ti * ((1.0 - tj) * r10[k1] + tj * r11[k1]);
+        row[k] = (1.0 - tk) * a + tk * b;
+      }
+    }
+  }
+}
+
 unsigned int Cube::closestIndex(const Vector3d &pos) const
 {
   int i, j, k;
@@ -201,10 +273,10 @@ Vector3d Cube::position(unsigned int index) const
 double Cube::value(int i, int j, int k) const
 {
   unsigned int index = i*m_points.y()*m_points.z() + j*m_points.z() + k;
-  if (index < m_data.size())
-    return m_data[index];
+  if (index < m_data->values.size())
+    return m_data->values[index];
   else {
-    //      qDebug() << "Attempt to identify out of range index" << index << m_data.size();
+    //      qDebug() << "Attempt to identify out of range index" << index << m_data->values.size();
     return 0.0;
   }
 }
@@ -214,8 +286,8 @@ double Cube::value(const Vector3i &pos) const
   unsigned int index = pos.x()*m_points.y()*m_points.z() +
       pos.y()*m_points.z() +
       pos.z();
-  if (index < m_data.size())
-    return m_data[index];
+  if (index < m_data->values.size())
+    return m_data->values[index];
   else {
     qDebug() << "Attempted to access an index out of range.";
     return 6969.0;
@@ -283,8 +355,8 @@ double Cube::value(const Vector3d &pos) const
 bool Cube::setValue(int i, int j, int k, double value)
 {
   unsigned int index = i*m_points.y()*m_points.z() + j*m_points.z() + k;
-  if (index < m_data.size()) {
-    m_data[index] = value;
+  if (index < m_data->values.size()) {
+    m_data->values[index] = value;
     return true;
   }
   else
@@ -21,6 +21,7 @@
 
 #include <vector>
 #include <Eigen/Core>
+#include <QtCore/QSharedData>
 #include <QtCore/QString>
 
 // Forward declarations
@@ -30,6 +31,14 @@ namespace OpenQube {
 
 class Molecule;
 
+/**
+ * The values of a Cube, shared between cubes until one of them changes them.
+ */
+struct CubeData : public QSharedData
+{
+  std::vector<double> values;
+};
+
 class OPENQUBE_EXPORT Cube
 {
 public:
@@ -45,7 +54,11 @@ public:
     ElectronDensity,
     MO,
     FromFile,
-    None
+    None,
+    ReducedDensityGradient,
+    ElectronLocalization,
+    SolventAccessible,
+    SolventExcluded
   };
 
   /**
@@ -111,19 +124,47 @@ public:
 
   /**
    * @return Vector containing all the data in a one-dimensional array.
+   * @note The non-const version gives the cube its own copy of values it
+   * shares with another cube, see shareData. It must be called before the
+   * values are written from several threads.
    */
   std::vector<double> * data();
+  const std::vector<double> * data() const;
 
   /**
    * Set the values in the cube to those passed in the vector.
    */
   bool setData(const std::vector<double> &values);
 
+  /**
+   * Take the limits and the values of @a cube without copying the values.
+   * They are shared until either cube changes them, when that cube copies
+   * them first, so reading a shared cube through a const Cube is free.
+   */
+  void shareData(const Cube &cube);
+
   /**
    * Adds the values in the cube to those passed in the vector.
    */
   bool addData(const std::vector<double> &values);
 
+  /**
+   * Fill the points that are not on the subgrid with the given stride from
+   * the subgrid. Each point takes the value of the subgrid point with the
+   * largest indices not greater than its own. Used to display partially
+   * calculated cubes.
+   * @param stride The stride of the subgrid along each axis.
+   */
+  void fillFromSubgrid(int stride);
+
+  /**
+   * Interpolate the points that are not on the subgrid with the given stride
+   * trilinearly from the subgrid. The last point along each axis is taken to
+   * be on the subgrid too, so every point lies within a cell of it.
+   * @param stride The stride of the subgrid along each axis.
+   */
+  void interpolateFromSubgrid(int stride);
+
   /**
    * @return Index of the point closest to the position supplied.
    * @param pos Position to get closest index for.
@@ -212,7 +253,7 @@ public:
   QReadWriteLock * lock() const;
 
 protected:
-  std::vector<double> m_data;
+  QSharedDataPointer<CubeData> m_data;
   Eigen::Vector3d m_min, m_max, m_spacing;
   Eigen::Vector3i m_points;
   double m_minValue, m_maxValue;
@@ -223,8 +264,8 @@ protected:
 
 inline bool Cube::setValue(unsigned int i, double value)
 {
-  if (i < m_data.size()) {
-    m_data[i] = value;
+  if (i < m_data->values.size()) {
+    m_data->values[i] = value;
     if (value > m_maxValue)
       m_maxValue = value;
     if (value < m_minValue)
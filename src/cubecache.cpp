@@ -0,0 +1,215 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "cubecache.h"
+
+#include "basisset.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QDebug>
+
+namespace OpenQube {
+
+CubeCache::CubeCache(qint64 memoryBudget) : m_memoryBudget(memoryBudget),
+  m_memoryUsed(0)
+{
+}
+
+CubeCache::~CubeCache()
+{
+}
+
+void CubeCache::setMemoryBudget(qint64 bytes)
+{
+  QMutexLocker locker(&m_mutex);
+  m_memoryBudget = bytes;
+  evict();
+}
+
+qint64 CubeCache::memoryBudget() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_memoryBudget;
+}
+
+qint64 CubeCache::memoryUsed() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_memoryUsed;
+}
+
+int CubeCache::count() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_entries.size();
+}
+
+QByteArray CubeCache::key(const BasisSet *basis, Cube::Type type,
+                          unsigned int mo, const Cube &limits)
+{
+  return key(basis, type, mo, limits.min(), limits.max(),
+             limits.dimensions());
+}
+
+QByteArray CubeCache::key(const BasisSet *basis, Cube::Type type,
+                          unsigned int mo, const Eigen::Vector3d &min,
+                          const Eigen::Vector3d &max,
+                          const Eigen::Vector3i &points)
+{
+  if (type != Cube::MO)
+    mo = 0;
+  int cubeType = type;
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(basis->cubeHash(type, mo));
+  hash.addData(reinterpret_cast<const char *>(&cubeType), sizeof(cubeType));
+  hash.addData(reinterpret_cast<const char *>(&mo), sizeof(mo));
+  hash.addData(reinterpret_cast<const char *>(min.data()), 3 * sizeof(double));
+  hash.addData(reinterpret_cast<const char *>(max.data()), 3 * sizeof(double));
+  hash.addData(reinterpret_cast<const char *>(points.data()), 3 * sizeof(int));
+  return hash.result();
+}
+
+bool CubeCache::contains(const QByteArray &key) const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_entries.contains(key);
+}
+
+QSharedPointer<const Cube> CubeCache::find(const QByteArray &key)
+{
+  QMutexLocker locker(&m_mutex);
+  QHash<QByteArray, Entry>::iterator it = m_entries.find(key);
+  if (it == m_entries.end())
+    return QSharedPointer<const Cube>();
+
+  // Move the key to the front of the LRU list
+  m_lru.splice(m_lru.begin(), m_lru, it->lru);
+  return it->cube;
+}
+
+QSharedPointer<const Cube> CubeCache::insert(const QByteArray &key,
+                                             Cube *cube)
+{
+  QSharedPointer<const Cube> result(cube);
+  qint64 size = static_cast<qint64>(cube->data()->size()) * sizeof(double);
+
+  QMutexLocker locker(&m_mutex);
+  QHash<QByteArray, Entry>::iterator it = m_entries.find(key);
+  if (it != m_entries.end()) {
+    m_memoryUsed -= it->size;
+    m_lru.erase(it->lru);
+    m_entries.erase(it);
+  }
+
+  if (size > m_memoryBudget) {
+    qDebug() << "Cube of" << size << "bytes exceeds the cache budget.";
+    return result;
+  }
+
+  Entry entry;
+  entry.cube = result;
+  entry.size = size;
+  m_lru.push_front(key);
+  entry.lru = m_lru.begin();
+  m_entries.insert(key, entry);
+  m_memoryUsed += size;
+  evict();
+
+  return result;
+}
+
+QSharedPointer<const Cube> CubeCache::cubeMO(BasisSet *basis,
+                                             const Cube &limits,
+                                             unsigned int mo)
+{
+  QByteArray cubeKey = key(basis, Cube::MO, mo, limits);
+  QSharedPointer<const Cube> result = find(cubeKey);
+  if (result)
+    return result;
+
+  // The calculation is done without holding the lock
+  Cube *cube = new Cube;
+  cube->setLimits(limits);
+  if (!basis->blockingCalculateCubeMO(cube, mo)) {
+    delete cube;
+    return QSharedPointer<const Cube>();
+  }
+  return addCalculated(basis, cubeKey, cube);
+}
+
+QSharedPointer<const Cube> CubeCache::cubeDensity(BasisSet *basis,
+                                                  const Cube &limits)
+{
+  QByteArray cubeKey = key(basis, Cube::ElectronDensity, 0, limits);
+  QSharedPointer<const Cube> result = find(cubeKey);
+  if (result)
+    return result;
+
+  Cube *cube = new Cube;
+  cube->setLimits(limits);
+  if (!basis->blockingCalculateCubeDensity(cube)) {
+    delete cube;
+    return QSharedPointer<const Cube>();
+  }
+  return addCalculated(basis, cubeKey, cube);
+}
+
+void CubeCache::remove(const QByteArray &key)
+{
+  QMutexLocker locker(&m_mutex);
+  QHash<QByteArray, Entry>::iterator it = m_entries.find(key);
+  if (it == m_entries.end())
+    return;
+  m_memoryUsed -= it->size;
+  m_lru.erase(it->lru);
+  m_entries.erase(it);
+}
+
+void CubeCache::clear()
+{
+  QMutexLocker locker(&m_mutex);
+  m_entries.clear();
+  m_lru.clear();
+  m_memoryUsed = 0;
+}
+
+QSharedPointer<const Cube> CubeCache::addCalculated(const BasisSet *basis,
+                                                    const QByteArray &key,
+                                                    Cube *cube)
+{
+  if (basis->cubeCache() == this) {
+    QSharedPointer<const Cube> stored = find(key);
+    if (stored) {
+      delete cube;
+      return stored;
+    }
+  }
+  return insert(key, cube);
+}
+
+void CubeCache::evict()
+{
+  while (m_memoryUsed > m_memoryBudget && !m_lru.empty()) {
+    QHash<QByteArray, Entry>::iterator it = m_entries.find(m_lru.back());
+    m_memoryUsed -= it->size;
+    m_entries.erase(it);
+    m_lru.pop_back();
+  }
+}
+
+} // End namespace
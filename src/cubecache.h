@@ -0,0 +1,180 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_CUBECACHE_H
+#define OQ_CUBECACHE_H
+
+#include "openqubeabi.h"
+
+#include "cube.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedPointer>
+
+#include <list>
+
+namespace OpenQube {
+
+class BasisSet;
+
+/**
+ * @class CubeCache cubecache.h <openqube/cubecache.h>
+ * @brief CubeCache keeps recently calculated cubes in memory.
+ *
+ * Cubes are keyed on the content of the basis set, the type of cube, the MO
+ * number and the limits of the grid, see key(). The cache owns the cubes it
+ * holds and hands them out as shared, read-only pointers so that a hit never
+ * copies the data. Once the total size of the cached cubes exceeds the memory
+ * budget the least recently used cubes are dropped. Cubes still referenced by
+ * a caller stay valid after they have been dropped from the cache.
+ *
+ * cubeMO and cubeDensity block on a miss. For calculations that report
+ * their completion through the watcher of the basis set, set the cache with
+ * BasisSet::setCubeCache: the cube passed to BasisSet::calculateCubeMO or
+ * calculateCubeDensity then shares the values of a hit, see
+ * Cube::shareData, and the calculation finishes straight away.
+ *
+ * All functions are thread safe, but a basis set calculates one cube at a
+ * time, so the cubes of the same basis set must not be requested from
+ * several threads at once.
+ */
+
+class OPENQUBE_EXPORT CubeCache
+{
+public:
+  /**
+   * Constructor.
+   * @param memoryBudget The maximum size of the cached cube data in bytes.
+   */
+  explicit CubeCache(qint64 memoryBudget = 256 * 1024 * 1024);
+
+  /**
+   * Destructor.
+   */
+  ~CubeCache();
+
+  /**
+   * Set the maximum size of the cached cube data in bytes, evicting cubes
+   * if the cache is now over budget.
+   */
+  void setMemoryBudget(qint64 bytes);
+
+  /**
+   * @return The maximum size of the cached cube data in bytes.
+   */
+  qint64 memoryBudget() const;
+
+  /**
+   * @return The size of the cube data currently in the cache in bytes.
+   */
+  qint64 memoryUsed() const;
+
+  /**
+   * @return The number of cubes in the cache.
+   */
+  int count() const;
+
+  /**
+   * @return The key of the cube of @a type calculated from @a basis over the
+   * limits of @a limits. The MO number @a mo is ignored unless @a type is
+   * Cube::MO.
+   */
+  static QByteArray key(const BasisSet *basis, Cube::Type type,
+                        unsigned int mo, const Cube &limits);
+
+  /**
+   * @return The key of the cube of @a type calculated from @a basis over a
+   * grid from @a min to @a max with @a points points along each axis.
+   */
+  static QByteArray key(const BasisSet *basis, Cube::Type type,
+                        unsigned int mo, const Eigen::Vector3d &min,
+                        const Eigen::Vector3d &max,
+                        const Eigen::Vector3i &points);
+
+  /**
+   * @return True if there is a cube stored under @a key. Unlike find this
+   * does not count as a use of the cube.
+   */
+  bool contains(const QByteArray &key) const;
+
+  /**
+   * @return The cube stored under @a key, or a null pointer if there is
+   * none. A hit makes the cube the most recently used one.
+   */
+  QSharedPointer<const Cube> find(const QByteArray &key);
+
+  /**
+   * Add @a cube to the cache under @a key, replacing any cube already stored
+   * under it. The cache takes ownership of @a cube, which must not be
+   * modified afterwards. A cube larger than the memory budget is not cached.
+   * @return A shared pointer to @a cube.
+   */
+  QSharedPointer<const Cube> insert(const QByteArray &key, Cube *cube);
+
+  /**
+   * @return The cube for MO @a mo of @a basis over the limits of @a limits,
+   * calculating and caching it if it is not in the cache already. Null if
+   * the calculation failed.
+   * @note A miss blocks until the calculation is complete.
+   */
+  QSharedPointer<const Cube> cubeMO(BasisSet *basis, const Cube &limits,
+                                    unsigned int mo = 1);
+
+  /**
+   * @return The electron density cube of @a basis over the limits of
+   * @a limits, calculating and caching it if it is not in the cache already.
+   * Null if the calculation failed.
+   * @note A miss blocks until the calculation is complete.
+   */
+  QSharedPointer<const Cube> cubeDensity(BasisSet *basis, const Cube &limits);
+
+  /**
+   * Remove the cube stored under @a key from the cache.
+   */
+  void remove(const QByteArray &key);
+
+  /**
+   * Remove all cubes from the cache.
+   */
+  void clear();
+
+private:
+  struct Entry
+  {
+    QSharedPointer<const Cube> cube;
+    qint64 size;
+    std::list<QByteArray>::iterator lru;
+  };
+
+  /// Drop least recently used cubes until within budget, must hold m_mutex
+  void evict();
+  /// Add the cube @a basis has just calculated, unless the basis set has
+  /// already added a copy of it to this cache
+  QSharedPointer<const Cube> addCalculated(const BasisSet *basis,
+                                           const QByteArray &key, Cube *cube);
+
+  mutable QMutex m_mutex;
+  QHash<QByteArray, Entry> m_entries;
+  std::list<QByteArray> m_lru; //! Keys, most recently used first
+  qint64 m_memoryBudget;
+  qint64 m_memoryUsed;
+};
+
+} // End namespace
+
+#endif
@@ -0,0 +1,284 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "cubediskcache.h"
+
+#include "cube.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QStringList>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QtEndian>
+#include <QtCore/QDebug>
+
+#include <cstring>
+
+#ifdef Q_OS_WIN
+# include <sys/utime.h>
+#else
+# include <utime.h>
+#endif
+
+namespace OpenQube {
+
+// File layout, all little-endian: magic, version, cube type, points (3),
+// min (3), max (3), min value, max value, number of values, then the values.
+static const quint32 CUBE_MAGIC = 0x4243514f; // "OQCB"
+static const quint32 CUBE_VERSION = 1;
+static const qint64 HEADER_SIZE = 4 + 4 + 4 + 3 * 4 + 3 * 8 + 3 * 8 + 2 * 8 + 8;
+static const char CUBE_SUFFIX[] = ".cube";
+
+// Convert doubles between the host and the file byte order, in place
+static void swapValues(double *values, qint64 count)
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+  for (qint64 i = 0; i < count; ++i) {
+    quint64 bits;
+    memcpy(&bits, &values[i], sizeof(bits));
+    bits = qbswap(bits);
+    memcpy(&values[i], &bits, sizeof(bits));
+  }
+#else
+  Q_UNUSED(values);
+  Q_UNUSED(count);
+#endif
+}
+
+// Set the modification time of a file to now, marking it as recently used
+// for the other processes sharing the cache
+static void touch(const QString &fileName)
+{
+  QByteArray name = QFile::encodeName(fileName);
+#ifdef Q_OS_WIN
+  _utime(name.constData(), 0);
+#else
+  utime(name.constData(), 0);
+#endif
+}
+
+CubeDiskCache::CubeDiskCache(const QString &path, qint64 maxSize)
+  : m_path(path), m_maxSize(maxSize), m_indexed(false), m_size(0)
+{
+  if (!QDir().mkpath(m_path))
+    qDebug() << "Could not create the cube cache directory" << m_path;
+}
+
+CubeDiskCache::~CubeDiskCache()
+{
+}
+
+QString CubeDiskCache::fileName(const QByteArray &key) const
+{
+  return QDir(m_path).filePath(QString(key.toHex()) + CUBE_SUFFIX);
+}
+
+void CubeDiskCache::setMaxSize(qint64 bytes)
+{
+  QMutexLocker locker(&m_mutex);
+  m_maxSize = bytes;
+  index();
+  evict();
+}
+
+qint64 CubeDiskCache::maxSize() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_maxSize;
+}
+
+bool CubeDiskCache::load(const QByteArray &key, Cube *cube) const
+{
+  QFile file(fileName(key));
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  QDataStream in(&file);
+  in.setByteOrder(QDataStream::LittleEndian);
+  in.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+  quint32 magic, version;
+  qint32 type, x, y, z;
+  double min[3], max[3], minValue, maxValue;
+  quint64 count;
+  in >> magic >> version >> type >> x >> y >> z;
+  in >> min[0] >> min[1] >> min[2] >> max[0] >> max[1] >> max[2];
+  in >> minValue >> maxValue >> count;
+
+  Eigen::Vector3i points = cube->dimensions();
+  if (in.status() != QDataStream::Ok || magic != CUBE_MAGIC
+      || version != CUBE_VERSION) {
+    qDebug() << "Ignoring invalid cube cache file" << file.fileName();
+    return false;
+  }
+  if (x != points.x() || y != points.y() || z != points.z()
+      || count != cube->data()->size()
+      || file.size() != HEADER_SIZE + static_cast<qint64>(count) * 8) {
+    qDebug() << "Cube cache file does not match the cube" << file.fileName();
+    return false;
+  }
+
+  std::vector<double> values(count);
+  qint64 bytes = static_cast<qint64>(count) * sizeof(double);
+  if (count && file.read(reinterpret_cast<char *>(&values[0]), bytes)
+      != bytes) {
+    qDebug() << "Error reading cube cache file" << file.fileName();
+    return false;
+  }
+  swapValues(&values[0], count);
+  qint64 fileSize = file.size();
+  file.close();
+
+  cube->setData(values);
+  cube->setCubeType(static_cast<Cube::Type>(type));
+
+  QMutexLocker locker(&m_mutex);
+  index();
+  use(QFileInfo(file).fileName(), fileSize);
+  touch(file.fileName());
+  return true;
+}
+
+bool CubeDiskCache::store(const QByteArray &key, const Cube &cube)
+{
+  QString target = fileName(key);
+  if (QFile::exists(target)) {
+    QMutexLocker locker(&m_mutex);
+    index();
+    use(QFileInfo(target).fileName(), QFileInfo(target).size());
+    touch(target);
+    return true;
+  }
+
+  // Write to a temporary file in the same directory, then rename it so that
+  // other processes never see a partially written cube.
+  QTemporaryFile file(QDir(m_path).filePath("cube.XXXXXX"));
+  if (!file.open()) {
+    qDebug() << "Could not create a file in the cube cache" << m_path;
+    return false;
+  }
+
+  QDataStream out(&file);
+  out.setByteOrder(QDataStream::LittleEndian);
+  out.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+  Eigen::Vector3i points = cube.dimensions();
+  Eigen::Vector3d min = cube.min();
+  Eigen::Vector3d max = cube.max();
+  const std::vector<double> &data = *cube.data();
+  out << CUBE_MAGIC << CUBE_VERSION << qint32(cube.cubeType())
+      << qint32(points.x()) << qint32(points.y()) << qint32(points.z())
+      << min.x() << min.y() << min.z() << max.x() << max.y() << max.z()
+      << cube.minValue() << cube.maxValue() << quint64(data.size());
+
+  bool success = true;
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+  std::vector<double> values(data);
+  swapValues(&values[0], values.size());
+  const std::vector<double> &littleEndian = values;
+#else
+  const std::vector<double> &littleEndian = data;
+#endif
+  qint64 bytes = static_cast<qint64>(data.size()) * sizeof(double);
+  if (bytes && file.write(reinterpret_cast<const char *>(&littleEndian[0]),
+                          bytes) != bytes)
+    success = false;
+  file.close();
+
+  // Another process may have stored the same cube in the meantime, then the
+  // rename fails and the temporary file is removed.
+  if (!success || !QFile::rename(file.fileName(), target)) {
+    if (!success)
+      qDebug() << "Error writing to the cube cache" << m_path;
+    return QFile::exists(target);
+  }
+  file.setAutoRemove(false);
+
+  QMutexLocker locker(&m_mutex);
+  index();
+  use(QFileInfo(target).fileName(),
+      HEADER_SIZE + static_cast<qint64>(data.size()) * 8);
+  evict();
+  return true;
+}
+
+qint64 CubeDiskCache::size() const
+{
+  QMutexLocker locker(&m_mutex);
+  index();
+  return m_size;
+}
+
+void CubeDiskCache::clear()
+{
+  QMutexLocker locker(&m_mutex);
+  QDir dir(m_path);
+  QStringList files = dir.entryList(QStringList(QString("*") + CUBE_SUFFIX),
+                                    QDir::Files);
+  foreach(const QString &file, files)
+    dir.remove(file);
+  m_entries.clear();
+  m_lru.clear();
+  m_size = 0;
+  m_indexed = true;
+}
+
+void CubeDiskCache::index() const
+{
+  if (m_indexed)
+    return;
+  m_indexed = true;
+
+  // Oldest first, so the most recently used file ends up at the front
+  QFileInfoList files = QDir(m_path).entryInfoList(
+        QStringList(QString("*") + CUBE_SUFFIX), QDir::Files,
+        QDir::Time | QDir::Reversed);
+  foreach(const QFileInfo &info, files)
+    use(info.fileName(), info.size());
+}
+
+void CubeDiskCache::use(const QString &name, qint64 size) const
+{
+  QHash<QString, Entry>::iterator it = m_entries.find(name);
+  if (it != m_entries.end()) {
+    m_lru.splice(m_lru.begin(), m_lru, it->lru);
+    return;
+  }
+  m_lru.push_front(name);
+  Entry entry;
+  entry.size = size;
+  entry.lru = m_lru.begin();
+  m_entries.insert(name, entry);
+  m_size += size;
+}
+
+void CubeDiskCache::evict()
+{
+  // Files removed by another process are simply forgotten
+  QDir dir(m_path);
+  while (m_size > m_maxSize && !m_lru.empty()) {
+    QHash<QString, Entry>::iterator it = m_entries.find(m_lru.back());
+    dir.remove(m_lru.back());
+    m_size -= it->size;
+    m_entries.erase(it);
+    m_lru.pop_back();
+  }
+}
+
+} // End namespace
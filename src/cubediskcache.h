@@ -0,0 +1,138 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_CUBEDISKCACHE_H
+#define OQ_CUBEDISKCACHE_H
+
+#include "openqubeabi.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <list>
+
+namespace OpenQube {
+
+class Cube;
+
+/**
+ * @class CubeDiskCache cubediskcache.h <openqube/cubediskcache.h>
+ * @brief CubeDiskCache stores calculated cubes in a directory so that they
+ * can be reused by later sessions.
+ *
+ * Each cube is stored in its own file, named after the key of the cube as
+ * produced by CubeCache::key, in a little-endian binary format. Files are
+ * written to a temporary file first and then renamed, so several processes
+ * on one host can share the directory safely: a reader either sees a
+ * complete file or none at all. Once the total size of the cubes exceeds the
+ * maximum size the least recently used ones are removed.
+ *
+ * The sizes and the order of use of the files are kept in memory, read from
+ * the directory the first time they are needed. Loading a cube touches its
+ * file, so that the cache can be reopened, or shared by another process,
+ * without losing the order of use. Cubes stored by other processes after
+ * the directory was read are only counted once they are loaded. All
+ * functions are thread safe.
+ *
+ * Set a disk cache on a BasisSet with BasisSet::setDiskCache to make the
+ * lookup transparent to callers of calculateCubeMO and calculateCubeDensity.
+ */
+
+class OPENQUBE_EXPORT CubeDiskCache
+{
+public:
+  /**
+   * Constructor.
+   * @param path The directory to store the cubes in, created if necessary.
+   * @param maxSize The maximum size of the stored cubes in bytes.
+   */
+  explicit CubeDiskCache(const QString &path,
+                         qint64 maxSize = Q_INT64_C(1024) * 1024 * 1024);
+
+  /**
+   * Destructor.
+   */
+  ~CubeDiskCache();
+
+  /**
+   * @return The directory the cubes are stored in.
+   */
+  QString path() const { return m_path; }
+
+  /**
+   * Set the maximum size of the stored cubes in bytes, removing the least
+   * recently used cubes if the cache is now over its maximum size.
+   */
+  void setMaxSize(qint64 bytes);
+
+  /**
+   * @return The maximum size of the stored cubes in bytes.
+   */
+  qint64 maxSize() const;
+
+  /**
+   * Load the cube stored under @a key into @a cube, which must already have
+   * the limits of the stored cube.
+   * @return True if the cube was found and loaded.
+   */
+  bool load(const QByteArray &key, Cube *cube) const;
+
+  /**
+   * Store @a cube under @a key, then remove the least recently used cubes if
+   * the cache is over its maximum size.
+   * @return True if the cube was stored.
+   */
+  bool store(const QByteArray &key, const Cube &cube);
+
+  /**
+   * @return The total size of the stored cubes in bytes.
+   */
+  qint64 size() const;
+
+  /**
+   * Remove all stored cubes.
+   */
+  void clear();
+
+private:
+  QString fileName(const QByteArray &key) const;
+  /// Read the files of the directory into the index, if not done yet
+  void index() const;
+  /// Make the file @a name the most recently used, adding it if necessary
+  void use(const QString &name, qint64 size) const;
+  void evict();
+
+  QString m_path;
+  qint64 m_maxSize;
+
+  struct Entry
+  {
+    qint64 size;
+    std::list<QString>::iterator lru; // Position in m_lru
+  };
+
+  mutable QMutex m_mutex;
+  mutable bool m_indexed;
+  mutable QHash<QString, Entry> m_entries; // File names of the cubes
+  mutable std::list<QString> m_lru;        // Most recently used first
+  mutable qint64 m_size;                   // Total size of m_entries
+};
+
+} // End namespace
+
+#endif
@@ -0,0 +1,160 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "cubescheduler.h"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include <algorithm>
+
+namespace OpenQube {
+
+Q_GLOBAL_STATIC(CubeScheduler, globalScheduler)
+
+CubeScheduler::CubeScheduler() : m_tileSize(1024)
+{
+  int ideal = QThread::idealThreadCount();
+  if (ideal < 1)
+    ideal = 1;
+  m_maxThreads[Interactive] = ideal;
+  m_maxThreads[Batch] = ideal;
+  // Speculative work should leave some room for everything else
+  m_maxThreads[Background] = ideal > 1 ? ideal / 2 : 1;
+  m_pool.setMaxThreadCount(ideal);
+  for (int i = 0; i < PRIORITY_COUNT; ++i) {
+    m_running[i] = 0;
+    m_active[i] = 0;
+  }
+}
+
+CubeScheduler::~CubeScheduler()
+{
+  m_pool.waitForDone();
+}
+
+CubeScheduler * CubeScheduler::instance()
+{
+  return globalScheduler();
+}
+
+void CubeScheduler::setMaxThreadCount(Priority priority, int count)
+{
+  QMutexLocker locker(&m_mutex);
+  m_maxThreads[priority] = count > 0 ? count : 1;
+  // The pool is shared, so it needs the threads of the largest class
+  m_pool.setMaxThreadCount(*std::max_element(m_maxThreads,
+                                             m_maxThreads + PRIORITY_COUNT));
+}
+
+int CubeScheduler::maxThreadCount(Priority priority) const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_maxThreads[priority];
+}
+
+void CubeScheduler::setTileSize(int points)
+{
+  QMutexLocker locker(&m_mutex);
+  m_tileSize = points > 0 ? points : 1;
+}
+
+int CubeScheduler::tileSize() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_tileSize;
+}
+
+int CubeScheduler::activeCount(Priority priority) const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_active[priority];
+}
+
+CubeScheduler::Job * CubeScheduler::beginJob(Priority priority, int points,
+                                             int tileSize)
+{
+  QMutexLocker locker(&m_mutex);
+  ++m_active[priority];
+  return new Job(priority, points, tileSize > 0 ? tileSize : m_tileSize);
+}
+
+void CubeScheduler::enqueue(Priority priority, const QList<Tile *> &tiles)
+{
+  int workers;
+  {
+    QMutexLocker locker(&m_mutex);
+    m_queues[priority] += tiles;
+    workers = std::min(tiles.size(), m_maxThreads[priority]);
+  }
+  // Workers that find nothing to run return straight away, and the pool runs
+  // the workers of the higher classes first when all of its threads are busy
+  for (int i = 0; i < workers; ++i)
+    m_pool.start(new Worker(this), PRIORITY_COUNT - priority);
+}
+
+void CubeScheduler::work()
+{
+  // Every queued tile was counted towards the workers started by enqueue,
+  // and a class at its cap has workers of its own that carry on with its
+  // queue, so no tile is left behind when a worker returns.
+  int ended = -1; // The class of the tile that just ended, if any
+  for (;;) {
+    Tile *tile = 0;
+    {
+      QMutexLocker locker(&m_mutex);
+      if (ended >= 0)
+        --m_running[ended];
+      for (int i = 0; i < PRIORITY_COUNT && !tile; ++i) {
+        if (!m_queues[i].isEmpty() && m_running[i] < m_maxThreads[i]) {
+          tile = m_queues[i].dequeue();
+          ++m_running[i];
+        }
+      }
+    }
+    if (!tile)
+      return;
+
+    Job *job = tile->job;
+    ended = job->priority;
+    if (!job->futureInterface.isCanceled())
+      tile->run();
+    int points = tile->points;
+    delete tile;
+    endTile(job, points);
+  }
+}
+
+void CubeScheduler::endTile(Job *job, int points)
+{
+  if (points) {
+    int done = job->done.fetchAndAddOrdered(points) + points;
+    job->futureInterface.setProgressValue(done);
+  }
+  if (job->remaining.fetchAndAddOrdered(-1) != 1)
+    return;
+
+  // That was the last tile of the job, which is no longer active once its
+  // future has finished
+  {
+    QMutexLocker locker(&m_mutex);
+    --m_active[job->priority];
+  }
+  job->futureInterface.reportFinished();
+  delete job;
+}
+
+} // End namespace
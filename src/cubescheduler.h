@@ -0,0 +1,268 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_CUBESCHEDULER_H
+#define OQ_CUBESCHEDULER_H
+
+#include "openqubeabi.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QFuture>
+#include <QtCore/QFutureInterface>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
+
+namespace OpenQube {
+
+/**
+ * @class CubeScheduler cubescheduler.h <openqube/cubescheduler.h>
+ * @brief CubeScheduler runs cube calculations in priority classes.
+ *
+ * The points of a calculation are split into tiles, which wait in a queue
+ * for the priority class of the calculation. The threads of a single pool
+ * take the tiles from the highest priority queue that has tiles waiting, so
+ * a long batch calculation yields to an interactive one within a tile, and
+ * lower classes use the threads the higher ones leave idle. Each class also
+ * has a cap on the number of tiles it runs at once. Tiles that are already
+ * running are never interrupted.
+ *
+ * The futures returned by map() can be watched and canceled like the ones
+ * returned by QtConcurrent::map, the progress is reported in points. The
+ * remaining tiles of a canceled calculation are dropped as they come up.
+ */
+
+class OPENQUBE_EXPORT CubeScheduler
+{
+public:
+  /**
+   * @enum Priority
+   * The priority classes, from highest to lowest.
+   */
+  enum Priority {
+    Interactive, ///< Results the user is waiting for.
+    Batch,       ///< Long running calculations, such as scripted jobs.
+    Background   ///< Speculative work, only run when nothing else is.
+  };
+
+  CubeScheduler();
+  ~CubeScheduler();
+
+  /**
+   * @return The scheduler shared by all basis sets.
+   */
+  static CubeScheduler * instance();
+
+  /**
+   * Set the maximum number of threads used by the @a priority class.
+   */
+  void setMaxThreadCount(Priority priority, int count);
+
+  /**
+   * @return The maximum number of threads used by the @a priority class.
+   */
+  int maxThreadCount(Priority priority) const;
+
+  /**
+   * Set the number of points in a tile, the granularity at which lower
+   * priority work yields. Defaults to 1024. Calculations that have already
+   * started keep their tile size.
+   */
+  void setTileSize(int points);
+  int tileSize() const;
+
+  /**
+   * @return The number of unfinished calculations in the @a priority class.
+   */
+  int activeCount(Priority priority) const;
+
+  /**
+   * Call @a function once for every item in the range @a begin to @a end in
+   * the @a priority class.
+   * @return A future to monitor the progress of the calculation and cancel
+   * it.
+   */
+  template <typename Iterator, typename MapFunction>
+  QFuture<void> map(Priority priority, Iterator begin, Iterator end,
+                    MapFunction function);
+
+  /**
+   * Call @a function once for every item in the range @a begin to @a end in
+   * the @a priority class, each item a tile of its own as in blockingMap,
+   * without waiting for them.
+   * @return A future to monitor the progress of the calculation, in items,
+   * and cancel it.
+   */
+  template <typename Iterator, typename MapFunction>
+  QFuture<void> mapTiles(Priority priority, Iterator begin, Iterator end,
+                         MapFunction function);
+
+  /**
+   * Call @a function once for every item of @a sequence in the @a priority
+   * class, and wait until all of the calls have returned, like
+   * QtConcurrent::blockingMap. Each item is a tile of its own, for work that
+   * is already split into pieces of many points, such as the planes of a
+   * cube. Must not be called from within a tile, which would hold a thread
+   * of the pool while it waits.
+   */
+  template <typename Sequence, typename MapFunction>
+  void blockingMap(Priority priority, Sequence &sequence,
+                   MapFunction function);
+
+private:
+  /**
+   * The state shared by the tiles of one calculation.
+   */
+  class Job
+  {
+  public:
+    Job(Priority priority_, int points, int tileSize_)
+      : priority(priority_), tileSize(tileSize_),
+        remaining(points ? (points - 1) / tileSize_ + 1 : 1), done(0)
+    {
+      futureInterface.reportStarted();
+      futureInterface.setProgressRange(0, points);
+    }
+    Priority priority;
+    int tileSize;
+    QFutureInterface<void> futureInterface;
+    QAtomicInt remaining; // Tiles that have not ended yet
+    QAtomicInt done;      // Points that have been calculated
+  };
+
+  /**
+   * A range of the items of a job, waiting in the queue of its class.
+   */
+  class Tile
+  {
+  public:
+    Tile(Job *job_, int points_) : job(job_), points(points_) {}
+    virtual ~Tile() {}
+    virtual void run() = 0;
+    Job *job;
+    int points;
+  };
+
+  template <typename Iterator, typename MapFunction>
+  class MapTile : public Tile
+  {
+  public:
+    MapTile(Job *job, Iterator begin, Iterator end, MapFunction function)
+      : Tile(job, end - begin), m_begin(begin), m_end(end),
+        m_function(function) {}
+
+    void run()
+    {
+      for (Iterator it = m_begin; it != m_end; ++it)
+        m_function(*it);
+    }
+
+  private:
+    Iterator m_begin, m_end;
+    MapFunction m_function;
+  };
+
+  /**
+   * Runs tiles on a thread of the pool until none can be started.
+   */
+  class Worker : public QRunnable
+  {
+  public:
+    explicit Worker(CubeScheduler *scheduler) : m_scheduler(scheduler) {}
+    void run() { m_scheduler->work(); }
+
+  private:
+    CubeScheduler *m_scheduler;
+  };
+
+  /// Create a new job and count it as active until its last tile ends, with
+  /// tiles of @a tileSize items, or the tile size of the scheduler if zero
+  Job * beginJob(Priority priority, int points, int tileSize);
+  /// Split the items into tiles and queue them
+  template <typename Iterator, typename MapFunction>
+  QFuture<void> start(Priority priority, Iterator begin, Iterator end,
+                      MapFunction function, int tileSize);
+  /// Queue the tiles of a job, and start enough workers to run them
+  void enqueue(Priority priority, const QList<Tile *> &tiles);
+  /// Take and run tiles, highest priority first, until none can be started
+  void work();
+  /// Report the progress of the tile, finishes the job after its last tile
+  void endTile(Job *job, int points);
+
+  static const int PRIORITY_COUNT = Background + 1;
+
+  QThreadPool m_pool;
+  QQueue<Tile *> m_queues[PRIORITY_COUNT]; // Tiles waiting in each class
+  int m_running[PRIORITY_COUNT];           // Tiles running in each class
+  int m_maxThreads[PRIORITY_COUNT];        // Cap on m_running
+  int m_active[PRIORITY_COUNT];            // Unfinished jobs in each class
+  mutable QMutex m_mutex;
+  int m_tileSize;
+};
+
+template <typename Iterator, typename MapFunction>
+QFuture<void> CubeScheduler::map(Priority priority, Iterator begin,
+                                 Iterator end, MapFunction function)
+{
+  return start(priority, begin, end, function, 0);
+}
+
+template <typename Iterator, typename MapFunction>
+QFuture<void> CubeScheduler::mapTiles(Priority priority, Iterator begin,
+                                      Iterator end, MapFunction function)
+{
+  return start(priority, begin, end, function, 1);
+}
+
+template <typename Sequence, typename MapFunction>
+void CubeScheduler::blockingMap(Priority priority, Sequence &sequence,
+                                MapFunction function)
+{
+  mapTiles(priority, sequence.begin(), sequence.end(), function)
+      .waitForFinished();
+}
+
+template <typename Iterator, typename MapFunction>
+QFuture<void> CubeScheduler::start(Priority priority, Iterator begin,
+                                   Iterator end, MapFunction function,
+                                   int tileSize)
+{
+  int points = end - begin;
+  Job *job = beginJob(priority, points, tileSize);
+  QFuture<void> future = job->futureInterface.future();
+  if (points == 0) {
+    endTile(job, 0);
+    return future;
+  }
+
+  // The job is deleted by its last tile, which may end before this function
+  // returns
+  tileSize = job->tileSize;
+  QList<Tile *> tiles;
+  for (Iterator it = begin; it != end; ) {
+    Iterator tileEnd = end - it > tileSize ? it + tileSize : end;
+    tiles.append(new MapTile<Iterator, MapFunction>(job, it, tileEnd,
+                                                    function));
+    it = tileEnd;
+  }
+  enqueue(priority, tiles);
+  return future;
+}
+
+} // End namespace
+
+#endif
@@ -15,8 +15,11 @@
 ******************************************************************************/
 
 #include "gamessukout.h"
+#include "compressedfile.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 
 using Eigen::Vector3d;
 using std::vector;
@@ -56,6 +59,62 @@ bool tokenize(std::vector<std::string> &vcr, const char *buf,
   return(true);
 }
 
+/**
+ * Reads a CompressedFile through a std::istream, so that compressed output
+ * is parsed as it is decompressed. Seeking only reports the position, or
+ * skips forward by reading.
+ */
+class DeviceStreamBuf : public std::streambuf
+{
+public:
+  explicit DeviceStreamBuf(QIODevice &device)
+    : m_device(device), m_buffer(1 << 16), m_start(0) {}
+
+protected:
+  int_type underflow()
+  {
+    if (gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+    m_start += egptr() - eback();
+    qint64 n = m_device.read(&m_buffer[0], m_buffer.size());
+    if (n <= 0)
+      return traits_type::eof();
+    setg(&m_buffer[0], &m_buffer[0], &m_buffer[0] + n);
+    return traits_type::to_int_type(*gptr());
+  }
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which)
+  {
+    if (dir == std::ios_base::cur)
+      off += m_start + (gptr() - eback());
+    else if (dir != std::ios_base::beg)
+      return pos_type(off_type(-1));
+    return seekpos(pos_type(off), which);
+  }
+
+  pos_type seekpos(pos_type target, std::ios_base::openmode)
+  {
+    std::streamoff pos = m_start + (gptr() - eback());
+    if (std::streamoff(target) < pos)
+      return pos_type(off_type(-1));
+    while (pos < std::streamoff(target)) {
+      if (gptr() == egptr() && underflow() == traits_type::eof())
+        return pos_type(off_type(-1));
+      std::streamoff skip = std::min<std::streamoff>(target - pos,
+                                                     egptr() - gptr());
+      gbump(static_cast<int>(skip));
+      pos += skip;
+    }
+    return pos_type(pos);
+  }
+
+private:
+  QIODevice &m_device;
+  std::vector<char> m_buffer;
+  std::streamoff m_start; // Position of the start of the buffer
+};
+
 //! Removes white space from front and back of string
 std::string& Trim(std::string& txt)
 {
@@ -188,6 +247,11 @@ GamessukOut::GamessukOut(const QString &qtfilename, GaussianSet* basis)
   GamessukOutNoQt( filename, basis);
 } //end GamessukOut
 
+GamessukOut::GamessukOut(const QString &qtfilename)
+  : m_filename(qtfilename.toStdString()), m_offset(0), m_loaded(false)
+{
+} //end GamessukOut
+
 
 GamessukOut::~GamessukOut()
 {
@@ -196,35 +260,93 @@ GamessukOut::~GamessukOut()
 void GamessukOut::GamessukOutNoQt(const std::string &filename,
                                   GaussianSet* basis)
 {
-
-  bool ok;
-  std::ifstream ifs;
-
-  ifs.open( filename.c_str() );
-  if (!ifs){
-    std::cerr << "Cannot open: " << filename << "\n";
-    return;
-  }
-
   // Initialise the basis set object that holds the parsed data before we convert
   // it into Avogadro form
   gukBasis = GUKBasisSet();
+  m_filename = filename;
+  m_offset = 0;
+  m_mark.clear();
+  m_loaded = false;
 
   // Now read the file
-  ok = parseFile(ifs);
+  if (!update(basis))
+    std::cerr << "ERROR READING ORBITALS FROM FILE: " << filename << std::endl;
+
+} //end GamessukOutNoQt
+
+bool GamessukOut::update(GaussianSet* basis)
+{
+  // The output is left for the next call rather than changing the MOs and
+  // the atoms under a running calculation
+  if (basis->isCalculating())
+    return false;
 
-  ifs.close();
+  // A restarted calculation truncates or replaces its log, start over
+  QString filename = QString::fromStdString(m_filename);
+  if (m_offset > 0 && !m_mark.isContinuedBy(filename)) {
+    std::cerr << m_filename << " was rewritten, reading it again.\n";
+    reset(basis);
+  }
+
+  // Compressed output is parsed as it is decompressed
+  CompressedFile compressed(filename);
+  DeviceStreamBuf compressedBuf(compressed);
+  std::ifstream file;
+  std::istream ifs(0);
 
-  if (ok)
+  if (CompressedFile::format(filename) != CompressedFile::None) {
+    if (!compressed.open(QIODevice::ReadOnly)) {
+      std::cerr << "Cannot decompress: " << m_filename << "\n";
+      return false;
+    }
+    ifs.rdbuf(&compressedBuf);
+  }
+  else {
+    file.open( m_filename.c_str() );
+    if (!file){
+      std::cerr << "Cannot open: " << m_filename << "\n";
+      return false;
+    }
+    ifs.rdbuf(file.rdbuf());
+  }
+
+  // Carry on from the end of the last complete block read
+  ifs.seekg(m_offset);
+  std::streamoff offset = m_offset;
+  bool ok = parseFile(ifs);
+  if (m_offset != offset)
+    m_mark.set(filename, m_offset);
+
+  if (!ok)
+    return false;
+
+  if (!m_loaded)
   {
     //outputParsedData();
     // Create the Avogadro basis set object
     load(basis);
+    m_loaded = true;
   }
   else
-    std::cerr << "ERROR READING ORBITALS FROM FILE: " << filename << std::endl;
+  {
+    // The basis set stays the same, only replace the geometry and the MOs
+    basis->moleculeRef().clearAtoms();
+    for ( unsigned int i=0; i < gukBasis.coordinates.size(); i++ )
+      basis->addAtom( gukBasis.coordinates.at(i) );
+    loadMOs(basis);
+  }
+  return true;
 
-} //end GamessukOutNoQt
+} // end update
+
+void GamessukOut::reset(GaussianSet *basis)
+{
+  gukBasis = GUKBasisSet();
+  m_offset = 0;
+  m_mark.clear();
+  m_loaded = false;
+  basis->clear();
+} // end reset
 
 void GamessukOut::outputParsedData()
 {
@@ -233,7 +355,7 @@ void GamessukOut::outputParsedData()
 } // end outputParsedData
 
 
-bool GamessukOut::parseFile(std::ifstream &ifs)
+bool GamessukOut::parseFile(std::istream &ifs)
 {
 
   /**
@@ -245,18 +367,22 @@ bool GamessukOut::parseFile(std::ifstream &ifs)
 
   bool gotMOs=false; // used as return value - indicates if we have valid orbitals for the coordinates we've read in
 
-  while (ifs.good() && ifs.getline(buffer,BUFF_SIZE)) {
+  while (ifs.good()) {
+
+    // The last line may still be being written, leave it for the next call
+    ifs.getline(buffer,BUFF_SIZE);
+    if (!ifs.good()) break;
 
     // First find oriented geometry - use this for single-point calculations
     if ( strstr(buffer,"         *     atom   atomic                coordinates") != NULL )
     {
-      readInitialCoordinates(ifs);
+      if (!readBlock(ifs, &GamessukOut::readInitialCoordinates)) break;
     }
 
     // The basis set definition
     if ( strstr(buffer," atom        shell   type  prim       exponents            contraction coefficients") != NULL )
     {
-      readBasisSet(ifs);
+      if (!readBlock(ifs, &GamessukOut::readBasisSet)) break;
     }
 
     // Determine the scftype - can't do uhf yet
@@ -272,7 +398,7 @@ bool GamessukOut::parseFile(std::ifstream &ifs)
     // The converged geometry
     if ( strstr(buffer,"optimization converged") != NULL )
     {
-      readOptimisedCoordinates(ifs);
+      if (!readBlock(ifs, &GamessukOut::readOptimisedCoordinates)) break;
       if (gotMOs) gotMOs = false; // If we read in some MOs they are now redundant
     }
 
@@ -280,15 +406,41 @@ bool GamessukOut::parseFile(std::ifstream &ifs)
     if ( strstr(buffer,"                                                  eigenvectors") != NULL ||
          strstr(buffer,"          molecular orbitals") != NULL)
     {
-      readMOs(ifs);
+      if (!readBlock(ifs, &GamessukOut::readMOs)) break;
       gotMOs = true;
     }
+
+    m_offset = ifs.tellg();
   }
 
   return gotMOs;
 }
 
-void GamessukOut::readInitialCoordinates(std::ifstream &ifs)
+bool GamessukOut::readBlock(std::istream &ifs,
+                            void (GamessukOut::*reader)(std::istream &))
+{
+  /**
+     * Call reader to read the block starting at the current line, and undo what it read
+     * if the block runs past the end of the file - it is still being written
+
+     */
+
+  GUKBasisSet saved = gukBasis;
+  try {
+    (this->*reader)(ifs);
+  }
+  catch (std::out_of_range &) {
+    // A line of the block is incomplete
+    ifs.setstate(std::ios::failbit);
+  }
+  if (ifs.good())
+    return true;
+
+  gukBasis = saved;
+  return false;
+}
+
+void GamessukOut::readInitialCoordinates(std::istream &ifs)
 {
 
   //std::cout << "readInitialCoordinates\n";
@@ -305,7 +457,7 @@ void GamessukOut::readInitialCoordinates(std::ifstream &ifs)
       ifs.getline(buffer, BUFF_SIZE) &&
       ifs.getline(buffer, BUFF_SIZE);
 
-  while ( strstr(buffer, coordEnd) == NULL )
+  while ( ifs.good() && strstr(buffer, coordEnd) == NULL )
   {
     //std::cout << "COORD line" << buffer << std::endl;
     //ifs.getline(buffer, BUFF_SIZE);
@@ -327,7 +479,7 @@ void GamessukOut::readInitialCoordinates(std::ifstream &ifs)
 
 }
 
-void GamessukOut::readBasisSet(std::ifstream &ifs)
+void GamessukOut::readBasisSet(std::istream &ifs)
 {
 
   //std::cout << "readBasisSet\n";
@@ -565,7 +717,7 @@ inline void GamessukOut::addSpBasis(std::vector<double> s_coeff,
 } // end addSpBasis
 
 
-void GamessukOut::readOptimisedCoordinates(std::ifstream &ifs)
+void GamessukOut::readOptimisedCoordinates(std::istream &ifs)
 {
 
   //std::cout << "readOptimisedCoordinates\n";
@@ -638,7 +790,7 @@ void GamessukOut::readOptimisedCoordinates(std::ifstream &ifs)
 
 } // end readOptimisedCoordinates
 
-void GamessukOut::readMOs(std::ifstream &ifs)
+void GamessukOut::readMOs(std::istream &ifs)
 {
   /*
       Read the Molecular Orbitals as printed out by util1.m subroutine prev
@@ -648,6 +800,7 @@ void GamessukOut::readMOs(std::ifstream &ifs)
 
   // Nuke any old set - fix when look at alpha & beta
   gukBasis.moVectors.clear();
+  gukBasis.moEnergies.clear();
 
   // Skip 3 lines to be just before first header
   ifs.getline(buffer, BUFF_SIZE) && ifs.getline(buffer, BUFF_SIZE) &&
@@ -655,13 +808,13 @@ void GamessukOut::readMOs(std::ifstream &ifs)
 
   orbitalsRead1=readMOVectors(ifs);
   orbitalsRead=orbitalsRead1;
-  while (orbitalsRead==orbitalsRead1 || orbitalsRead!=0)
+  while (ifs.good() && (orbitalsRead==orbitalsRead1 || orbitalsRead!=0))
     orbitalsRead = readMOVectors(ifs);
 
 } //end readMos
 
 
-int GamessukOut::readMOVectors(std::ifstream &ifs)
+int GamessukOut::readMOVectors(std::istream &ifs)
 {
   /*
        Loop through a series of columns of printed MO vectors & return the
@@ -785,6 +938,13 @@ void GamessukOut::load(GaussianSet* basis)
     addBasisForLabel( i, gukBasis.atomLabels.at(i), basis );
   }
 
+  loadMOs(basis);
+
+} // end load
+
+void GamessukOut::loadMOs(GaussianSet* basis)
+{
+
   // Now to load in the MO coefficients
   // This currently a dirty hack - basisset addMO just expects a long vector of doubles, which
   // it then converts into a square matrix.
@@ -18,11 +18,13 @@
 #define GAMESSUKOUT_H
 
 #include "gaussianset.h"
+#include "textparser.h"
 
 #include <Eigen/Core>
 
 #include <vector>
 #include <string>
+#include <istream>
 
 #define BUFF_SIZE 32768
 
@@ -76,22 +78,45 @@ class OPENQUBE_EXPORT GamessukOut
 {
 public:
   GamessukOut(const QString &filename, GaussianSet *basis);
+
+  /**
+   * Constructor for following a running calculation, nothing is read until
+   * update() is called.
+   */
+  explicit GamessukOut(const QString &filename);
   ~GamessukOut();
   void GamessukOutNoQt(const std::string &filename, GaussianSet *basis);
   void outputParsedData();
 
+  /**
+   * Read the output appended to the file since the last call into @a basis,
+   * which must always be the same basis set. Blocks that have not been
+   * written completely yet are read again by the next call. The basis set is
+   * loaded with the first MOs, after that the geometry and the MOs are
+   * replaced whenever new MOs have been printed. If the file no longer
+   * starts with the output read before, as when the calculation has been
+   * restarted, the basis set is cleared and loaded again from the new
+   * output. Nothing is read while the basis set is calculating a cube.
+   * @return True if new MOs were read.
+   */
+  bool update(GaussianSet *basis);
+
 private:
-  bool parseFile(std::ifstream &ifs);
-  void readInitialCoordinates(std::ifstream &ifs);
-  void readBasisSet(std::ifstream &ifs);
+  bool parseFile(std::istream &ifs);
+  bool readBlock(std::istream &ifs,
+                 void (GamessukOut::*reader)(std::istream &));
+  void readInitialCoordinates(std::istream &ifs);
+  void readBasisSet(std::istream &ifs);
   inline void addSpBasis(std::vector<double> s_coeff,
                          std::vector<double> p_coeff,
                          std::vector<double> sp_exponents);
-  void readOptimisedCoordinates(std::ifstream &ifs);
-  void readMOs(std::ifstream &ifs);
-  int readMOVectors(std::ifstream &ifs);
+  void readOptimisedCoordinates(std::istream &ifs);
+  void readMOs(std::istream &ifs);
+  int readMOVectors(std::istream &ifs);
 
   void load(GaussianSet* basis);
+  void loadMOs(GaussianSet* basis);
+  void reset(GaussianSet* basis);
 
   void addBasisForLabel(unsigned int atomIndex, std::string label,
                         GaussianSet* basis );
@@ -100,6 +125,12 @@ private:
   // create the BasisSet
   GUKBasisSet gukBasis;
 
+  // For following a running calculation
+  std::string m_filename;
+  std::streamoff m_offset; // Where the unread output starts
+  ReadMark m_mark;         // The output read so far, to notice a restart
+  bool m_loaded;           // The basis set has been loaded
+
   // For parsing the file
   char buffer[BUFF_SIZE];
   std::string line;
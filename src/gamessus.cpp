@@ -16,7 +16,6 @@
 
 #include "gamessus.h"
 
-#include <QtCore/QFile>
 #include <QtCore/QStringList>
 #include <QtCore/QDebug>
 
@@ -30,40 +29,294 @@ using std::vector;
 namespace OpenQube
 {
 
-GAMESSUSOutput::GAMESSUSOutput(const QString &filename, GaussianSet* basis):
-  m_coordFactor(1.0), m_currentMode(NotParsing), m_currentAtom(1)
-{
-  // Open the file for reading and process it
-  QFile* file = new QFile(filename);
-  file->open(QIODevice::ReadOnly | QIODevice::Text);
-  m_in = file;
+static const char ANGSTROM_COORDINATES[] =
+    "COORDINATES OF ALL ATOMS ARE (ANGS)";
+static const char BOHR_COORDINATES[] = "COORDINATES (BOHR)";
+static const char EIGENVECTORS[] = "EIGENVECTORS";
 
+GAMESSUSOutput::GAMESSUSOutput(const QString &filename, GaussianSet* basis,
+                               bool indexed):
+  m_filename(filename), m_offset(-1), m_indexed(indexed), m_coordFactor(1.0),
+  m_currentMode(NotParsing), m_electrons(0), m_currentAtom(1),
+  m_numBasisFunctions(0)
+{
   qDebug() << "File" << filename << "opened.";
 
-  // Process the formatted checkpoint and extract all the information we need
-  while (!m_in->atEnd()) {
+  if (read(basis, true))
+    return;
+  if (m_offset < 0) {
+    // Not a complete log, parse all of it
+    m_in = LineReader(m_file.begin(), m_file.end());
+    while (!m_in.atEnd()) {
+      processLine(basis);
+    }
+    load(basis);
+  }
+}
+
+GAMESSUSOutput::GAMESSUSOutput(const QString &filename, bool indexed):
+  m_filename(filename), m_offset(-1), m_indexed(indexed), m_coordFactor(1.0),
+  m_currentMode(NotParsing), m_electrons(0), m_currentAtom(1),
+  m_numBasisFunctions(0)
+{
+}
+
+GAMESSUSOutput::~GAMESSUSOutput()
+{
+}
+
+bool GAMESSUSOutput::update(GaussianSet *basis)
+{
+  // The output is left for the next call rather than changing the MOs and
+  // the atoms under a running calculation
+  if (basis->isCalculating())
+    return false;
+  return read(basis, false);
+}
+
+bool GAMESSUSOutput::read(GaussianSet *basis, bool trailingGeometry)
+{
+  if (!m_file.open(m_filename))
+    return false;
+
+  // The last line may still be being written, only complete lines are read
+  const char *begin = m_file.begin();
+  const char *end = m_file.end();
+  while (end > begin && *(end - 1) != '\n')
+    --end;
+  m_in = LineReader(begin, end);
+
+  // A restarted calculation truncates or replaces its log, start over
+  if (m_offset >= 0 && !m_mark.isContinuedBy(m_filename, begin, end)) {
+    qDebug() << m_filename << "was rewritten, reading it again.";
+    reset(basis);
+  }
+
+  if (m_offset < 0) {
+    // The geometry, basis set and number of electrons are printed once, at
+    // the top of the log
+    const char *header = findText(begin, end, "NUMBER OF ELECTRONS");
+    if (!header)
+      return false;
+    LineReader headerLine(header, end);
+    const char *line, *lineEnd;
+    headerLine.readLine(line, lineEnd);
+    const char *body = headerLine.pos();
+    while (m_in.pos() < body) {
+      processLine(basis);
+    }
+    loadBasis(basis);
+    m_offset = body - begin;
+    m_mark.set(m_filename, begin, m_offset);
+  }
+
+  // Geometry optimizations print the geometry and the orbitals at every step,
+  // only the last complete ones are needed. While following a calculation a
+  // geometry is only read together with its orbitals, so that the MOs in the
+  // basis set always belong to its geometry.
+  const char *from = begin + m_offset;
+  const char *next = from;
+  const char *orbitals = lastOrbitals(from, end);
+  const char *coordinates = 0;
+  if (trailingGeometry)
+    coordinates = lastCoordinates(from, end);
+  else if (orbitals)
+    coordinates = lastCoordinates(from, orbitals);
+  if (coordinates) {
+    parseBlock(coordinates, basis);
+    next = blockEnd(coordinates, end);
+  }
+  if (orbitals) {
+    parseBlock(orbitals, basis);
+    if (m_MOcoeffs.size())
+      basis->addMOs(m_MOcoeffs);
+    const char *orbitalsEnd = blockEnd(orbitals, end);
+    if (orbitalsEnd > next)
+      next = orbitalsEnd;
+  }
+
+  if (m_indexed)
+    indexFrames(from, next);
+  m_offset = next - begin;
+  m_mark.set(m_filename, begin, m_offset);
+  return orbitals != 0;
+}
+
+void GAMESSUSOutput::reset(GaussianSet *basis)
+{
+  m_offset = -1;
+  m_mark.clear();
+  m_frames.clear();
+  m_coordFactor = 1.0;
+  m_currentMode = NotParsing;
+  m_electrons = 0;
+  m_currentAtom = 1;
+  m_numBasisFunctions = 0;
+  m_shellTypes.clear();
+  m_shellNums.clear();
+  m_shelltoAtom.clear();
+  m_a.clear();
+  m_c.clear();
+  m_csp.clear();
+  m_orbitalEnergy.clear();
+  m_MOcoeffs.clear();
+  basis->clear();
+}
+
+bool GAMESSUSOutput::readFrame(int frame, GaussianSet *basis)
+{
+  if (frame < 0 || frame >= frameCount() || basis->isCalculating())
+    return false;
+
+  const Frame &f = m_frames[frame];
+  if (f.coordinates >= 0)
+    parseBlock(m_file.begin() + f.coordinates, basis);
+  if (f.orbitals >= 0) {
+    parseBlock(m_file.begin() + f.orbitals, basis);
+    if (m_MOcoeffs.size())
+      basis->addMOs(m_MOcoeffs);
+  }
+  else {
+    // The orbitals of another frame do not belong to this geometry
+    basis->clearMOs();
+  }
+  return true;
+}
+
+QString GAMESSUSOutput::readLine()
+{
+  const char *line, *end;
+  if (!m_in.readLine(line, end))
+    return QString();
+  return QString::fromLatin1(line, end - line);
+}
+
+void GAMESSUSOutput::parseBlock(const char *header, GaussianSet *basis)
+{
+  if (!header)
+    return;
+  m_in.seek(header);
+  processLine(basis);
+  while (!m_in.atEnd() && m_currentMode != NotParsing) {
+    // The atoms of a geometry are followed by a blank line
+    const char *pos = m_in.pos();
+    const char *line, *end;
+    m_in.readLine(line, end);
+    if (m_currentMode == Atoms && skipSpaces(line, end) == end)
+      break;
+    m_in.seek(pos);
     processLine(basis);
   }
+  m_currentMode = NotParsing;
+}
+
+const char * GAMESSUSOutput::blockEnd(const char *header,
+                                      const char *end) const
+{
+  LineReader in(header, end);
+  const char *line, *lineEnd;
+  in.readLine(line, lineEnd);
+  if (findText(line, lineEnd, EIGENVECTORS)) {
+    // The orbitals are followed by the end of the SCF calculation
+    const char *last = findText(in.pos(), end, "END OF");
+    if (!last)
+      return 0;
+    in.seek(last);
+    in.readLine(line, lineEnd);
+    return in.pos();
+  }
 
-  // Now it should all be loaded load it into the basis set
-  load(basis);
+  // The atoms of a geometry are followed by a blank line
+  while (in.readLine(line, lineEnd)) {
+    if (skipSpaces(line, lineEnd) == lineEnd)
+      return in.pos();
+  }
+  return 0;
+}
 
-  delete file;
+const char * GAMESSUSOutput::lastCoordinates(const char *begin,
+                                             const char *end) const
+{
+  // The last geometry may be in either unit, a geometry in bohr after it can
+  // only follow the last one in angstrom. Geometries that are still being
+  // written are skipped.
+  while (begin < end) {
+    const char *last = findLastText(begin, end, ANGSTROM_COORDINATES);
+    const char *bohr = findLastText(last ? last : begin, end,
+                                    BOHR_COORDINATES);
+    if (bohr)
+      last = bohr;
+    if (!last)
+      return 0;
+    last = lineStart(begin, last);
+    if (blockEnd(last, end))
+      return last;
+    end = last;
+  }
+  return 0;
 }
 
-GAMESSUSOutput::~GAMESSUSOutput()
+const char * GAMESSUSOutput::lastOrbitals(const char *begin,
+                                          const char *end) const
+{
+  while (begin < end) {
+    const char *last = findLastText(begin, end, EIGENVECTORS);
+    if (!last)
+      return 0;
+    last = lineStart(begin, last);
+    if (blockEnd(last, end))
+      return last;
+    end = last;
+  }
+  return 0;
+}
+
+void GAMESSUSOutput::indexFrames(const char *begin, const char *end)
 {
+  // Find the blocks in the order they appear in, a frame starts with each
+  // geometry and takes the last orbitals printed before the next one. The
+  // last frame is continued by blocks read in later.
+  const char *markers[3] = { ANGSTROM_COORDINATES, BOHR_COORDINATES,
+                             EIGENVECTORS };
+  const char *next[3];
+  for (int i = 0; i < 3; ++i)
+    next[i] = findText(begin, end, markers[i]);
+
+  for (;;) {
+    int first = -1;
+    for (int i = 0; i < 3; ++i)
+      if (next[i] && (first < 0 || next[i] < next[first]))
+        first = i;
+    if (first < 0)
+      break;
+
+    qint64 header = lineStart(begin, next[first]) - m_file.begin();
+    if (first == 2 && !m_frames.empty()) {
+      m_frames.back().orbitals = header;
+    }
+    else {
+      Frame frame = { -1, -1 };
+      if (first == 2)
+        frame.orbitals = header;
+      else
+        frame.coordinates = header;
+      m_frames.push_back(frame);
+    }
+    next[first] = findText(next[first] + strlen(markers[first]), end,
+                           markers[first]);
+  }
+  qDebug() << "Indexed" << m_frames.size() << "frames.";
 }
 
 void GAMESSUSOutput::processLine(GaussianSet *basis)
 {
   // First truncate the line, remove trailing white space and check for blank lines
-  QString key = m_in->readLine().trimmed();
-  while(key.isEmpty() && !m_in->atEnd()) {
-    key = m_in->readLine().trimmed();
+  QString key = readLine().trimmed();
+  while(key.isEmpty() && !m_in.atEnd()) {
+    key = readLine().trimmed();
   }
 
-  if (m_in->atEnd())
+  if (key.isEmpty())
     return;
 
   QStringList list = key.split(' ', QString::SkipEmptyParts);
@@ -77,15 +330,15 @@ void GAMESSUSOutput::processLine(GaussianSet *basis)
 
     m_coordFactor = 1.0; // coordinates are supposed to be in bohr?!
     m_currentMode = Atoms;
-    key = m_in->readLine().trimmed(); // skip the column titles
+    key = readLine().trimmed(); // skip the column titles
   }
   else if (key.contains("COORDINATES OF ALL ATOMS ARE (ANGS)", Qt::CaseInsensitive)) {
     basis->moleculeRef().clearAtoms();
 
     m_coordFactor = 1.0/BOHR_TO_ANGSTROM; // in Angstroms now
     m_currentMode = Atoms;
-    key = m_in->readLine(); // skip column titles
-    key = m_in->readLine(); // and ----- line
+    key = readLine(); // skip column titles
+    key = readLine(); // and ----- line
   } else if (key.contains("ATOMIC BASIS SET")) {
     m_currentMode = GTO;
     // ---
@@ -96,7 +349,7 @@ void GAMESSUSOutput::processLine(GaussianSet *basis)
     // blank
     // element
     for (unsigned int i = 0; i < 7; ++i) {
-      key = m_in->readLine();
+      key = readLine();
     }
   } else if (key.contains("TOTAL NUMBER OF BASIS SET")) {
     m_currentMode = NotParsing; // no longer reading GTOs
@@ -106,8 +359,8 @@ void GAMESSUSOutput::processLine(GaussianSet *basis)
     m_electrons = list[4].toInt();
   } else if (key.contains("EIGENVECTORS")) { //|| key.contains("MOLECULAR ORBITALS")) {
     m_currentMode = MO;
-    key = m_in->readLine(); // ----
-    key = m_in->readLine(); // blank line
+    key = readLine(); // ----
+    key = readLine(); // blank line
   } else {
     QString shell;
     orbital shellType;
@@ -155,9 +408,9 @@ void GAMESSUSOutput::processLine(GaussianSet *basis)
           m_csp.push_back(list[5].toDouble());
 
         // read to the next shell
-        key = m_in->readLine().trimmed();
+        key = readLine().trimmed();
         if (key.isEmpty()) {
-          key = m_in->readLine().trimmed();
+          key = readLine().trimmed();
           m_shellNums.push_back(numGTOs);
           m_shellTypes.push_back(shellType);
           m_shelltoAtom.push_back(m_currentAtom);
@@ -166,17 +419,18 @@ void GAMESSUSOutput::processLine(GaussianSet *basis)
         list = key.split(' ', QString::SkipEmptyParts);
       } // end "while list > 1) -- i.e., we're on the next atom line
 
-      key = m_in->readLine(); // start reading the next atom
+      key = readLine(); // start reading the next atom
       m_currentAtom++;
       break;
 
     case MO:
       m_MOcoeffs.clear(); // if the orbitals were punched multiple times
-      while(!key.contains("END OF") && !key.contains("-----")) {
+      while(!m_in.atEnd() && !key.contains("END OF")
+            && !key.contains("-----")) {
         // currently reading the MO number
-        key = m_in->readLine(); // energies
-        key = m_in->readLine(); // symmetries
-        key = m_in->readLine(); // now we've got coefficients
+        key = readLine(); // energies
+        key = readLine(); // symmetries
+        key = readLine(); // now we've got coefficients
         list = key.split(' ', QString::SkipEmptyParts);
         while (list.size() > 5) {
           numColumns = list.size() - 4;
@@ -185,7 +439,7 @@ void GAMESSUSOutput::processLine(GaussianSet *basis)
             columns[i].push_back(list[i + 4].toDouble());
           }
 
-          key = m_in->readLine();
+          key = readLine();
           if (key.contains(QLatin1String("END OF RHF")))
             break;
           list = key.split(' ', QString::SkipEmptyParts);
@@ -195,14 +449,13 @@ void GAMESSUSOutput::processLine(GaussianSet *basis)
         for (unsigned int i = 0; i < numColumns; ++i) {
           numRows = columns[i].size();
           for (unsigned int j = 0; j < numRows; ++j) {
-            qDebug() << "push back" << columns[i][j];
             m_MOcoeffs.push_back(columns[i][j]);
           }
         }
         columns.clear();
 
         if (key.trimmed().isEmpty())
-          key = m_in->readLine(); // skip the blank line after the MOs
+          key = readLine(); // skip the blank line after the MOs
       } // finished parsing MOs
       m_currentMode = NotParsing;
       break;
@@ -214,6 +467,15 @@ void GAMESSUSOutput::processLine(GaussianSet *basis)
 } // end process line
 
 void GAMESSUSOutput::load(GaussianSet* basis)
+{
+  loadBasis(basis);
+
+  // Now to load in the MO coefficients
+  if (m_MOcoeffs.size())
+    basis->addMOs(m_MOcoeffs);
+}
+
+void GAMESSUSOutput::loadBasis(GaussianSet* basis)
 {
   // Now load up our basis set
   basis->setNumElectrons(m_electrons);
@@ -248,12 +510,6 @@ void GAMESSUSOutput::load(GaussianSet* basis)
       }
     }
   }
-  //    qDebug() << " loading MOs " << m_MOcoeffs.size();
-
-  // Now to load in the MO coefficients
-  if (m_MOcoeffs.size())
-    basis->addMOs(m_MOcoeffs);
-
   qDebug() << " done loadBasis ";
 }
 
@@ -17,29 +17,105 @@
 #ifndef GAMESSUS_H
 #define GAMESSUS_H
 
-#include <QtCore/QIODevice>
 #include <Eigen/Core>
 #include <vector>
 
 #include "gaussianset.h"
+#include "textparser.h"
 
-class QString;
+#include <QtCore/QString>
 
 namespace OpenQube
 {
+
+/**
+ * Reads GAMESS-US log files. The file is memory mapped, and only the header
+ * with the basis set, and the last geometry and EIGENVECTORS blocks, which
+ * are found by searching backwards from the end of the file, are parsed.
+ * Geometry optimizations print many more of them.
+ *
+ * If requested the position of every geometry and EIGENVECTORS block is
+ * indexed, so that any step of the optimization can be read in later.
+ *
+ * The log of a calculation that is still running can be followed with
+ * update(), which only looks at the output appended since the last call and
+ * never at blocks that have not been written completely yet. A log that has
+ * been truncated, rewritten or replaced since, as when the calculation is
+ * restarted, is read again from the start, see ReadMark.
+ *
+ * As the blocks are found from the end, a compressed log is decompressed in
+ * full into memory, see MappedFile.
+ */
 class OPENQUBE_EXPORT GAMESSUSOutput
 {
   // Parsing mode: section of the file currently being parsed
   enum mode { NotParsing, Atoms, GTO, MO};
 
 public:
-  GAMESSUSOutput(const QString &filename, GaussianSet *basis);
+  GAMESSUSOutput(const QString &filename, GaussianSet *basis,
+                 bool indexFrames = false);
+
+  /**
+   * Constructor for following a running calculation, nothing is read until
+   * update() is called.
+   */
+  explicit GAMESSUSOutput(const QString &filename, bool indexFrames = false);
   ~GAMESSUSOutput();
   void outputAll();
 
+  /**
+   * Read the output appended to the file since the last call into @a basis,
+   * which must always be the same basis set. The basis set is loaded once
+   * the header has been written, after that the geometry and the MOs are
+   * replaced whenever a new EIGENVECTORS block has been completed. If the
+   * file no longer starts with the output read before, the basis set is
+   * cleared and loaded again from the new output. Nothing is read while the
+   * basis set is calculating a cube.
+   * @return True if new MOs were read.
+   */
+  bool update(GaussianSet *basis);
+
+  /**
+   * @return The number of frames, each a geometry and the orbitals printed
+   * after it, if any. Zero unless the frames were indexed.
+   */
+  int frameCount() const { return static_cast<int>(m_frames.size()); }
+
+  /**
+   * Replace the geometry and the MOs of @a basis, which must have been
+   * loaded by this object, with those of @a frame. A frame without orbitals,
+   * such as the last geometry of an optimization, leaves the basis set
+   * without MOs.
+   * @return False if there is no such frame, or if the basis set is
+   * calculating a cube.
+   */
+  bool readFrame(int frame, GaussianSet *basis);
+
 private:
-  QIODevice *m_in;
+  /// The offsets of the header lines of the blocks of one frame, or -1
+  struct Frame
+  {
+    qint64 coordinates;
+    qint64 orbitals;
+  };
+
+  QString m_filename;
+  MappedFile m_file;
+  LineReader m_in;
+  qint64 m_offset;  //! Where unread output starts, -1 before the header
+  ReadMark m_mark;  //! The output read so far, to notice a restarted log
+  bool m_indexed;
+  std::vector<Frame> m_frames;
+  QString readLine();
   void processLine(GaussianSet *basis);
+  bool read(GaussianSet *basis, bool trailingGeometry);
+  void parseBlock(const char *header, GaussianSet *basis);
+  const char * blockEnd(const char *header, const char *end) const;
+  const char * lastCoordinates(const char *begin, const char *end) const;
+  const char * lastOrbitals(const char *begin, const char *end) const;
+  void indexFrames(const char *begin, const char *end);
+  void loadBasis(GaussianSet *basis);
+  void reset(GaussianSet *basis);
   void load(GaussianSet *basis);
 
   double m_coordFactor;
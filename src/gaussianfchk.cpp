@@ -16,100 +16,172 @@
 
 #include "gaussianfchk.h"
 #include "gaussianset.h"
+#include "compressedfile.h"
+#include "cubescheduler.h"
 
+#include <QtCore/QCryptographicHash>
 #include <QtCore/QFile>
-#include <QtCore/QStringList>
+#include <QtCore/QMutexLocker>
 #include <QtCore/QDebug>
 
+#include <algorithm>
+#include <cmath>
+
 using Eigen::Vector3d;
 using std::vector;
 
 namespace OpenQube
 {
 
-GaussianFchk::GaussianFchk(const QString &filename, GaussianSet* basis)
+// Section headers start with a letter, array data with a space
+static bool isSectionHeader(const char *line, const char *end)
+{
+  return line < end && !isSpace(*line);
+}
+
+GaussianFchk::GaussianFchk(const QString &filename, GaussianSet* basis,
+                           bool indexed)
+  : m_indexed(indexed), m_electrons(0), m_numBasisFunctions(0)
+{
+  if (CompressedFile::format(filename) != CompressedFile::None)
+    readCompressed(filename);
+  else
+    readMapped(filename);
+
+  // Now it should all be loaded load it into the basis set
+  load(basis);
+}
+
+GaussianFchk::~GaussianFchk()
 {
-  // Open the file for reading and process it
-  QFile* file = new QFile(filename);
-  file->open(QIODevice::ReadOnly | QIODevice::Text);
-  m_in = file;
+}
+
+void GaussianFchk::readMapped(const QString &filename)
+{
+  m_source = QSharedPointer<FchkOrbitalSource>(
+        new FchkOrbitalSource(filename));
+  m_in = LineReader(m_source->begin(), m_source->end());
 
   qDebug() << "File" << filename << "opened.";
 
-  // Process the formatted checkpoint and extract all the information we need
-  while (!m_in->atEnd()) {
-    processLine();
+  if (m_indexed) {
+    // Read the small sections, leaving the MOs and density for later
+    buildIndex();
+    for (unsigned int i = 0; i < m_sections.size(); ++i) {
+      const Section &s = m_sections[i];
+      if (s.name != "Alpha MO coefficients" && s.name != "Total SCF Density") {
+        m_in.seek(s.header);
+        processLine();
+      }
+    }
+    const Section *mos = section("Alpha MO coefficients");
+    if (mos && mos->array)
+      m_source->setMOs(mos->data, mos->end, mos->count, m_numBasisFunctions);
+    const Section *density = section("Total SCF Density");
+    if (density && density->array)
+      m_source->setDensity(density->data, density->end, density->count,
+                           m_numBasisFunctions);
+  }
+  else {
+    // Process the formatted checkpoint and extract all the information we need
+    while (!m_in.atEnd()) {
+      processLine();
+    }
   }
+}
 
-  // Now it should all be loaded load it into the basis set
-  load(basis);
+void GaussianFchk::readCompressed(const QString &filename)
+{
+  // Compressed files cannot be mapped, so rather than holding all of the text
+  // they are parsed a section at a time as they are decompressed
+  m_indexed = false;
+  CompressedFile file(filename);
+  if (!file.open(QIODevice::ReadOnly)) {
+    qDebug() << "Cannot decompress" << filename;
+    return;
+  }
+
+  qDebug() << "File" << filename << "opened.";
 
-  delete file;
+  RecordReader sections(&file, isSectionHeader);
+  const char *begin, *end;
+  while (sections.readRecord(begin, end)) {
+    m_in = LineReader(begin, end);
+    while (!m_in.atEnd())
+      processLine();
+  }
+  m_in = LineReader();
 }
 
-GaussianFchk::~GaussianFchk()
+// Check if the line is the header of the named section. The name is padded
+// with spaces to 43 columns, followed by the type and the value or size.
+static bool isSection(const char *line, const char *end, const char *key)
 {
+  if (!startsWith(line, end, key))
+    return false;
+  for (const char *p = line + strlen(key); p < line + 40; ++p)
+    if (*p != ' ')
+      return false;
+  return true;
 }
 
 void GaussianFchk::processLine()
 {
-  // First truncate the line, remove trailing white space and check
-  QString line = m_in->readLine();
-  if (line.isEmpty())
+  // Section headers start with a letter, array data with a space
+  const char *line, *end;
+  if (!m_in.readLine(line, end) || end - line < 43 || isSpace(*line))
     return;
-  QString key = line;
-  key.resize(42);
-  key = key.trimmed();
 
-  QString tmp = line.mid(43, 37);
-  QStringList list = tmp.split(' ', QString::SkipEmptyParts);
+  // The sections we are interested in all end with an integer, either the
+  // value or the number of elements in the array
+  int n = 0;
+  if (!parseLastInt(line, end, n))
+    return;
 
   // Big switch statement checking for various things we are interested in
-  if (key == "Number of atoms")
-    qDebug() << "Number of atoms =" << list.at(1).toInt();
-  else if (key == "Number of electrons")
-    m_electrons = list.at(1).toInt();
-  else if (key == "Number of basis functions") {
-    m_numBasisFunctions = list.at(1).toInt();
+  if (isSection(line, end, "Number of atoms"))
+    qDebug() << "Number of atoms =" << n;
+  else if (isSection(line, end, "Number of electrons"))
+    m_electrons = n;
+  else if (isSection(line, end, "Number of basis functions")) {
+    m_numBasisFunctions = n;
     qDebug() << "Number of basis functions =" << m_numBasisFunctions;
   }
-  else if (key == "Atomic numbers") {
-    m_aNums = readArrayI(list.at(2).toInt());
-    if (static_cast<int>(m_aNums.size()) != list.at(2).toInt())
+  else if (isSection(line, end, "Atomic numbers")) {
+    if (!readArrayI(n, m_aNums))
       qDebug() << "Reading atomic numbers failed.";
     else
       qDebug() << "Reading atomic numbers succeeded.";
   }
   // Now we get to the meat of it - coordinates of the atoms
-  else if (key == "Current cartesian coordinates")
-    m_aPos = readArrayD(list.at(2).toInt(), 16);
+  else if (isSection(line, end, "Current cartesian coordinates"))
+    readArrayD(n, m_aPos, 16);
   // The real meat is here - basis sets etc!
-  else if (key == "Shell types")
-    m_shellTypes = readArrayI(list.at(2).toInt());
-  else if (key == "Number of primitives per shell")
-    m_shellNums = readArrayI(list.at(2).toInt());
-  else if (key == "Shell to atom map")
-    m_shelltoAtom = readArrayI(list.at(2).toInt());
+  else if (isSection(line, end, "Shell types"))
+    readArrayI(n, m_shellTypes);
+  else if (isSection(line, end, "Number of primitives per shell"))
+    readArrayI(n, m_shellNums);
+  else if (isSection(line, end, "Shell to atom map"))
+    readArrayI(n, m_shelltoAtom);
   // Now to get the exponents and coefficients(
-  else if (key == "Primitive exponents")
-    m_a = readArrayD(list.at(2).toInt(), 16);
-  else if (key == "Contraction coefficients")
-    m_c = readArrayD(list.at(2).toInt(), 16);
-  else if (key == "P(S=P) Contraction coefficients")
-    m_csp = readArrayD(list.at(2).toInt(), 16);
-  else if (key == "Alpha Orbital Energies") {
-    m_orbitalEnergy = readArrayD(list.at(2).toInt(), 16);
+  else if (isSection(line, end, "Primitive exponents"))
+    readArrayD(n, m_a, 16);
+  else if (isSection(line, end, "Contraction coefficients"))
+    readArrayD(n, m_c, 16);
+  else if (isSection(line, end, "P(S=P) Contraction coefficients"))
+    readArrayD(n, m_csp, 16);
+  else if (isSection(line, end, "Alpha Orbital Energies")) {
+    readArrayD(n, m_orbitalEnergy, 16);
     qDebug() << "MO energies, n =" << m_orbitalEnergy.size();
   }
-  else if (key == "Alpha MO coefficients") {
-    m_MOcoeffs = readArrayD(list.at(2).toInt(), 16);
-    if (static_cast<int>(m_MOcoeffs.size()) == list.at(2).toInt())
+  else if (isSection(line, end, "Alpha MO coefficients")) {
+    if (readArrayD(n, m_MOcoeffs, 16))
       qDebug() << "MO coefficients, n =" << m_MOcoeffs.size();
     else
       qDebug() << "Error, MO coefficients, n =" << m_MOcoeffs.size();
   }
-  else if (key == "Total SCF Density") {
-    if (readDensityMatrix(list.at(2).toInt(), 16))
+  else if (isSection(line, end, "Total SCF Density")) {
+    if (readDensityMatrix(n, 16))
       qDebug() << "SCF density matrix read in" << m_density.rows();
     else
       qDebug() << "Error reading in the SCF density matrix.";
@@ -201,7 +273,9 @@ void GaussianFchk::load(GaussianSet* basis)
   }
   // Now to load in the MO coefficients
   if (basis->isValid()) {
-    if (m_MOcoeffs.size())
+    if (m_indexed && m_source->numMOs())
+      basis->setOrbitalSource(m_source);
+    else if (m_MOcoeffs.size())
       basis->addMOs(m_MOcoeffs);
     else
       qDebug() << "Error - no MO coefficients read in.";
@@ -210,169 +284,417 @@ void GaussianFchk::load(GaussianSet* basis)
   }
 }
 
-vector<int> GaussianFchk::readArrayI(unsigned int n)
+bool GaussianFchk::readArrayI(unsigned int n, vector<int> &values)
 {
-  vector<int> tmp;
-  tmp.reserve(n);
-  bool ok = false;
-  while (tmp.size() < n) {
-    if (m_in->atEnd()) {
+  values.resize(n);
+  unsigned int count = 0;
+  const char *line, *end;
+  while (count < n) {
+    if (!m_in.readLine(line, end)) {
       qDebug() << "GaussianFchk::readArrayI could not read all elements"
-               << n << "expected" << tmp.size() << "parsed.";
-      return tmp;
+               << n << "expected" << count << "parsed.";
+      values.resize(count);
+      return false;
+    }
+    if (line == end) {
+      values.resize(count);
+      return false;
     }
-    QString line = m_in->readLine();
-    if (line.isEmpty())
-      return tmp;
 
-    QStringList list = line.split(' ', QString::SkipEmptyParts);
-    for (int i = 0; i < list.size(); ++i) {
-      if (tmp.size() >= n) {
+    const char *p = line;
+    int value;
+    while (parseInt(p, end, value)) {
+      if (count >= n) {
         qDebug() << "Too many variables read in. File may be inconsistent."
-                 << tmp.size() << "of" << n;
-        return tmp;
-      }
-      tmp.push_back(list.at(i).toInt(&ok));
-      if (!ok) {
-        qDebug() << "Warning: problem converting string to integer:"
-                 << list.at(i) << "in GaussianFchk::readArrayI.";
-        return tmp;
+                 << count << "of" << n;
+        values.resize(count);
+        return false;
       }
+      values[count++] = value;
+    }
+    if (skipSpaces(p, end) != end) {
+      qDebug() << "Warning: problem converting string to integer:"
+               << QByteArray(line, end - line)
+               << "in GaussianFchk::readArrayI.";
+      values.resize(count);
+      return false;
     }
   }
-  return tmp;
+  return true;
 }
 
-vector<double> GaussianFchk::readArrayD(unsigned int n, int width)
+// Parse the next real on the line, in fields of width characters (Q-Chem
+// files use 16 character fields) or separated by spaces if width is zero.
+// Returns false at the end of the line, ok is false if the line is malformed.
+static bool nextDouble(const char *&p, const char *end, int width,
+                       double &value, bool &ok)
 {
-  // FIXME Should return a bool and operate on a vector by reference
-  vector<double> tmp;
-  tmp.reserve(n);
-  bool ok = false;
-  while (tmp.size() < n) {
-    if (m_in->atEnd()) {
-      qDebug() << "GaussianFchk::readArrayD could not read all elements"
-               << n << "expected" << tmp.size() << "parsed.";
-      return tmp;
+  ok = true;
+  if (width) {
+    if (end - p < width)
+      return false;
+    const char *fieldEnd = p + width;
+    ok = parseDouble(p, fieldEnd, value) && skipSpaces(p, fieldEnd) == fieldEnd;
+    p = fieldEnd;
+    return ok;
+  }
+  if (skipSpaces(p, end) == end)
+    return false;
+  ok = parseDouble(p, end, value) && (p == end || isSpace(*p));
+  return ok;
+}
+
+// Real arrays are written five to a line in fixed width fields, so in a well
+// formed array every line but the last has the same length and the position
+// of element k can be calculated. Large arrays are split into chunks of lines
+// that are decoded in parallel by the cube scheduler, in the batch class.
+static const int FIELDS_PER_LINE = 5;
+static const unsigned int PARALLEL_MIN_ELEMENTS = 16384;
+static const unsigned int CHUNK_LINES = 2048;
+
+namespace {
+struct FixedWidthChunk
+{
+  const char *begin;        // Start of the first line of the chunk
+  const char *end;          // End of the text
+  unsigned int first;       // Index of the first element in the chunk
+  unsigned int count;       // Number of elements in the chunk
+  int width;
+  int stride;               // Line length including the line ending
+  double *values;           // Destination of an array, or
+  Eigen::MatrixXd *lower;   // destination of a lower triangular matrix
+  bool ok;
+};
+}
+
+static void decodeChunk(FixedWidthChunk &chunk)
+{
+  // Position in the lower triangle of the first element of the chunk
+  unsigned int i = 0, j = 0;
+  if (chunk.lower) {
+    i = static_cast<unsigned int>((std::sqrt(8.0 * chunk.first + 1.0) - 1.0)
+                                  / 2.0);
+    while ((i + 1) * (i + 2) / 2 <= chunk.first)
+      ++i;
+    while (i * (i + 1) / 2 > chunk.first)
+      --i;
+    j = chunk.first - i * (i + 1) / 2;
+  }
+
+  const char *line = chunk.begin;
+  unsigned int done = 0;
+  while (done < chunk.count) {
+    int fields = chunk.count - done < unsigned(FIELDS_PER_LINE)
+        ? chunk.count - done : FIELDS_PER_LINE;
+    const char *lineEnd = line + fields * chunk.width;
+    // The line must end right after its fields, except at the end of the text
+    if (lineEnd > chunk.end || (lineEnd < chunk.end && *lineEnd != '\n'
+                                && *lineEnd != '\r')) {
+      chunk.ok = false;
+      return;
     }
-    QString line = m_in->readLine();
-    if (line.isEmpty())
-      return tmp;
-
-    if (width == 0) { // we can split by spaces
-      QStringList list = line.split(' ', QString::SkipEmptyParts);
-      for (int i = 0; i < list.size(); ++i) {
-        if (tmp.size() >= n) {
-          qDebug() << "Too many variables read in. File may be inconsistent."
-                   << tmp.size() << "of" << n;
-          return tmp;
-        }
-        tmp.push_back(list.at(i).trimmed().toDouble(&ok));
-        if (!ok) {
-          qDebug() << "Warning: problem converting string to double:"
-                   << list.at(i) << "in GaussianFchk::readArrayD.";
-          return tmp;
+    const char *p = line;
+    for (int f = 0; f < fields; ++f, ++done) {
+      const char *fieldEnd = p + chunk.width;
+      double value;
+      if (!parseDouble(p, fieldEnd, value)
+          || skipSpaces(p, fieldEnd) != fieldEnd) {
+        chunk.ok = false;
+        return;
+      }
+      p = fieldEnd;
+      if (chunk.lower) {
+        (*chunk.lower)(i, j) = value;
+        if (++j > i) {
+          j = 0;
+          ++i;
         }
       }
+      else {
+        chunk.values[chunk.first + done] = value;
+      }
     }
-    else { // Q-Chem files use 16 character fields
-      int maxColumns = 80 / width;
-      for (int i = 0; i < maxColumns; ++i) {
-        QString substring = line.mid(i * width, width);
-        if (substring.length() != width)
-          break;
-        if (tmp.size() >= n) {
-          qDebug() << "Too many variables read in. File may be inconsistent."
-                   << tmp.size() << "of" << n;
-          return tmp;
-        }
-        tmp.push_back(substring.toDouble(&ok));
-        if (!ok) {
-          qDebug() << "Warning: problem converting string to double:"
-                   << substring << "in GaussianFchk::readArrayD.";
-          return tmp;
-        }
+    line += chunk.stride;
+  }
+  chunk.ok = true;
+}
+
+// Work out the length of the lines of an array from its first line, which
+// must have length characters. Returns 0 if the first line is not as long.
+static int lineStride(const char *begin, const char *end, int length)
+{
+  const char *first = begin + length;
+  if (first >= end)
+    return 0;
+  if (*first == '\n')
+    return length + 1;
+  if (*first == '\r' && first + 1 < end && first[1] == '\n')
+    return length + 2;
+  return 0;
+}
+
+// Decode the n element array starting at the current line of in, into values
+// or the lower triangle of lower. Returns false without moving in if the
+// array is too small to be worth it or is not laid out in regular lines, in
+// which case it must be parsed sequentially.
+static bool decodeParallel(LineReader &in, unsigned int n, int width,
+                           double *values, Eigen::MatrixXd *lower)
+{
+  if (n < PARALLEL_MIN_ELEMENTS || width <= 0)
+    return false;
+
+  const char *begin = in.pos();
+  int stride = lineStride(begin, in.end(), FIELDS_PER_LINE * width);
+  if (!stride)
+    return false;
+
+  unsigned int lines = (n - 1) / FIELDS_PER_LINE + 1;
+  if (static_cast<qint64>(lines - 1) * stride > in.end() - begin)
+    return false;
+
+  unsigned int chunkSize = CHUNK_LINES * FIELDS_PER_LINE;
+  vector<FixedWidthChunk> chunks((n - 1) / chunkSize + 1);
+  for (unsigned int c = 0; c < chunks.size(); ++c) {
+    FixedWidthChunk &chunk = chunks[c];
+    chunk.begin = begin + static_cast<qint64>(c) * CHUNK_LINES * stride;
+    chunk.end = in.end();
+    chunk.first = c * chunkSize;
+    chunk.count = n - chunk.first < chunkSize ? n - chunk.first : chunkSize;
+    chunk.width = width;
+    chunk.stride = stride;
+    chunk.values = values;
+    chunk.lower = lower;
+    chunk.ok = false;
+  }
+  CubeScheduler::instance()->blockingMap(CubeScheduler::Batch, chunks,
+                                         decodeChunk);
+
+  for (unsigned int c = 0; c < chunks.size(); ++c)
+    if (!chunks[c].ok)
+      return false;
+
+  // Carry on after the last line of the array
+  const char *next = begin + static_cast<qint64>(lines) * stride;
+  in.seek(next < in.end() ? next : in.end());
+  return true;
+}
+
+static bool readReals(LineReader &in, unsigned int n, vector<double> &values,
+                      int width)
+{
+  values.resize(n);
+  if (decodeParallel(in, n, width, values.empty() ? 0 : &values[0], 0))
+    return true;
+
+  unsigned int count = 0;
+  const char *line, *end;
+  while (count < n) {
+    if (!in.readLine(line, end)) {
+      qDebug() << "GaussianFchk::readArrayD could not read all elements"
+               << n << "expected" << count << "parsed.";
+      values.resize(count);
+      return false;
+    }
+    if (line == end) {
+      values.resize(count);
+      return false;
+    }
+
+    const char *p = line;
+    double value;
+    bool ok;
+    while (nextDouble(p, end, width, value, ok)) {
+      if (count >= n) {
+        qDebug() << "Too many variables read in. File may be inconsistent."
+                 << count << "of" << n;
+        values.resize(count);
+        return false;
       }
+      values[count++] = value;
+    }
+    if (!ok) {
+      qDebug() << "Warning: problem converting string to double:"
+               << QByteArray(line, end - line)
+               << "in GaussianFchk::readArrayD.";
+      values.resize(count);
+      return false;
     }
   }
-  return tmp;
+  return true;
 }
 
-bool GaussianFchk::readDensityMatrix(unsigned int n, int width)
+static bool readLowerTriangle(LineReader &in, unsigned int n,
+                              unsigned int size, int width,
+                              Eigen::MatrixXd &density)
 {
   // This function reads in the lower triangular density matrix
-  m_density.resize(m_numBasisFunctions, m_numBasisFunctions);
+  if (n > size * (size + 1) / 2) {
+    qDebug() << "The density matrix has too many elements:" << n
+             << "for" << size << "basis functions.";
+    return false;
+  }
+  density.resize(size, size);
+  if (decodeParallel(in, n, width, 0, &density))
+    return true;
+
   unsigned int cnt = 0;
   unsigned int i = 0, j = 0;
   unsigned int f = 1;
-  bool ok = false;
+  const char *line, *end;
   while (cnt < n) {
-    if (m_in->atEnd()) {
+    if (!in.readLine(line, end)) {
       qDebug() << "GaussianFchk::readDensityMatrix could not read all elements"
                << n << "expected" << cnt << "parsed.";
       return false;
     }
-    QString line = m_in->readLine();
-    if (line.isEmpty())
+    if (line == end)
       return false;
 
-    if (width == 0) { // we can split by spaces
-      QStringList list = line.split(' ', QString::SkipEmptyParts);
-      for (int k = 0; k < list.size(); ++k) {
-        if (cnt >= n) {
-          qDebug() << "Too many variables read in. File may be inconsistent."
-                   << cnt << "of" << n;
-          return false;
-        }
-        // Read in lower half matrix
-        m_density(i, j) = list.at(k).toDouble(&ok);
-        if (ok) { // Valid double converted, carry on
-          ++j; ++cnt;
-          if (j == f) {
-            // We need to move down to the next row and increment f - lower tri
-            j = 0;
-            ++f;
-            ++i;
-          }
-        }
-        else { // Invalid conversion of a string to double
-          qDebug() << "Warning: problem converting string to double:"
-                   << list.at(k) << "\nIn GaussianFchk::readDensityMatrix.";
-          return false;
-        }
+    const char *p = line;
+    double value;
+    bool ok;
+    while (nextDouble(p, end, width, value, ok)) {
+      if (cnt >= n) {
+        qDebug() << "Too many variables read in. File may be inconsistent."
+                 << cnt << "of" << n;
+        return false;
+      }
+      // Read in lower half matrix
+      density(i, j) = value;
+      ++j; ++cnt;
+      if (j == f) {
+        // We need to move down to the next row and increment f - lower tri
+        j = 0;
+        ++f;
+        ++i;
       }
     }
-    else { // Q-Chem files use 16-character fields
-      int maxColumns = 80 / width;
-      for (int c = 0; c < maxColumns; ++c) {
-        QString substring = line.mid(c * width, width);
-        if (substring.length() != width)
-          break;
-        else if (cnt >= n) {
-          qDebug() << "Too many variables read in. File may be inconsistent."
-                   << cnt << "of" << n;
-          return false;
-        }
-        // Read in lower half matrix
-        m_density(i, j) = substring.toDouble(&ok);
-        if (ok) { // Valid double converted, carry on
-          ++j; ++cnt;
-          if (j == f) {
-            // We need to move down to the next row and increment f - lower tri
-            j = 0;
-            ++f;
-            ++i;
+    if (!ok) { // Invalid conversion of a string to double
+      qDebug() << "Warning: problem converting string to double:"
+               << QByteArray(line, end - line)
+               << "\nIn GaussianFchk::readDensityMatrix.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool GaussianFchk::readArrayD(unsigned int n, vector<double> &values,
+                              int width)
+{
+  return readReals(m_in, n, values, width);
+}
+
+bool GaussianFchk::readDensityMatrix(unsigned int n, int width)
+{
+  return readLowerTriangle(m_in, n, m_numBasisFunctions, width, m_density);
+}
+
+// The number of fields per line and their width for each type of array
+static bool fieldLayout(char type, int &perLine, int &width)
+{
+  switch (type) {
+  case 'I':
+    perLine = 6;
+    width = 12;
+    return true;
+  case 'R':
+    perLine = 5;
+    width = 16;
+    return true;
+  case 'C':
+    perLine = 5;
+    width = 12;
+    return true;
+  case 'L':
+    perLine = 72;
+    width = 1;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Check if the line is the header of a section. The name is padded to 40
+// columns and followed by the type in column 44.
+static bool isHeader(const char *line, const char *end)
+{
+  return end - line >= 44 && !isSpace(*line) && line[40] == ' '
+      && !isSpace(line[43]);
+}
+
+// Check that the line at last is length characters long and is the last line
+// of an array, followed by the end of the text or the header of a section
+static bool isLastLine(const char *last, const char *end, int length)
+{
+  LineReader in(last, end);
+  const char *line, *lineEnd;
+  if (!in.readLine(line, lineEnd))
+    return false;
+  if (lineEnd > line && lineEnd[-1] == '\r')
+    --lineEnd;
+  if (lineEnd - line != length)
+    return false;
+  return !in.readLine(line, lineEnd) || isHeader(line, lineEnd);
+}
+
+void GaussianFchk::buildIndex()
+{
+  const char *line, *end;
+  while (!m_in.atEnd()) {
+    const char *header = m_in.pos();
+    m_in.readLine(line, end);
+    if (!isHeader(line, end))
+      continue;
+
+    Section section;
+    section.name = QByteArray(line, 40).trimmed();
+    section.type = line[43];
+    section.array = end - line > 48 && line[47] == 'N' && line[48] == '=';
+    section.count = 0;
+    if (section.array || section.type == 'I')
+      parseLastInt(line, end, section.count);
+    section.header = header;
+    section.data = m_in.pos();
+
+    int perLine, width;
+    if (section.array && section.count > 0
+        && fieldLayout(section.type, perLine, width)) {
+      // Jump to the last line of the array if the lines are regular and the
+      // jump lands on a line of the right length, otherwise step over the
+      // lines up to the next section, as they may hold fewer fields
+      unsigned int lines = (section.count - 1) / perLine + 1;
+      int stride = lineStride(section.data, m_in.end(), perLine * width);
+      const char *last = section.data + static_cast<qint64>(lines - 1) * stride;
+      int lastLength = (section.count - (lines - 1) * perLine) * width;
+      if (stride && last < m_in.end() && (lines == 1 || *(last - 1) == '\n')
+          && isLastLine(last, m_in.end(), lastLength)) {
+        m_in.seek(last);
+        m_in.readLine(line, end);
+      }
+      else {
+        while (!m_in.atEnd()) {
+          const char *next = m_in.pos();
+          m_in.readLine(line, end);
+          if (isHeader(line, end)) {
+            m_in.seek(next);
+            break;
           }
         }
-        else { // Invalid conversion of a string to double
-          qDebug() << "Warning: problem converting string to double:"
-                   << substring << "\nIn GaussianFchk::readDensityMatrix.";
-          return false;
-        }
       }
     }
+    section.end = m_in.pos();
+    m_sections.push_back(section);
   }
-  return true;
+  qDebug() << "Indexed" << m_sections.size() << "sections.";
+}
+
+const GaussianFchk::Section * GaussianFchk::section(const char *name) const
+{
+  for (unsigned int i = 0; i < m_sections.size(); ++i)
+    if (m_sections[i].name == name)
+      return &m_sections[i];
+  return 0;
 }
 
 void GaussianFchk::outputAll()
@@ -387,4 +709,175 @@ void GaussianFchk::outputAll()
     qDebug() << m_MOcoeffs.at(i);
 }
 
+FchkOrbitalSource::FchkOrbitalSource(const QString &filename)
+  : m_moData(0), m_moEnd(0), m_moCount(0), m_moStride(0),
+    m_linesIndexed(false), m_densityData(0), m_densityEnd(0),
+    m_densityCount(0), m_numBasisFunctions(0)
+{
+  m_file.open(filename);
+}
+
+FchkOrbitalSource::~FchkOrbitalSource()
+{
+}
+
+void FchkOrbitalSource::setMOs(const char *data, const char *dataEnd,
+                               unsigned int count,
+                               unsigned int numBasisFunctions)
+{
+  m_moData = data;
+  m_moEnd = dataEnd;
+  m_moCount = count;
+  m_numBasisFunctions = numBasisFunctions;
+  m_moStride = lineStride(data, dataEnd, FIELDS_PER_LINE * 16);
+  // The lines are only regular if the last one is where the stride puts it
+  if (m_moStride && count) {
+    unsigned int lines = (count - 1) / FIELDS_PER_LINE + 1;
+    const char *last = data + static_cast<qint64>(lines - 1) * m_moStride;
+    int length = (count - (lines - 1) * FIELDS_PER_LINE) * 16;
+    if (last >= dataEnd || (lines > 1 && last[-1] != '\n')
+        || !isLastLine(last, dataEnd, length))
+      m_moStride = 0;
+  }
+}
+
+void FchkOrbitalSource::setDensity(const char *data, const char *dataEnd,
+                                   unsigned int count,
+                                   unsigned int numBasisFunctions)
+{
+  m_densityData = data;
+  m_densityEnd = dataEnd;
+  m_densityCount = count;
+  m_numBasisFunctions = numBasisFunctions;
+}
+
+unsigned int FchkOrbitalSource::numMOs() const
+{
+  return m_numBasisFunctions ? m_moCount / m_numBasisFunctions : 0;
+}
+
+bool FchkOrbitalSource::findField(unsigned int k, const char *&field) const
+{
+  if (k >= m_moCount)
+    return false;
+  if (m_moStride) {
+    field = m_moData + static_cast<qint64>(k / FIELDS_PER_LINE) * m_moStride
+        + (k % FIELDS_PER_LINE) * 16;
+  }
+  else {
+    QMutexLocker locker(&m_linesMutex);
+    if (!indexLines())
+      return false;
+    size_t line = std::upper_bound(m_lineFirst.begin(), m_lineFirst.end(), k)
+        - m_lineFirst.begin() - 1;
+    field = m_lines[line] + (k - m_lineFirst[line]) * 16;
+  }
+  return field + 16 <= m_moEnd;
+}
+
+bool FchkOrbitalSource::indexLines() const
+{
+  if (m_linesIndexed)
+    return !m_lines.empty();
+  m_linesIndexed = true;
+
+  // The fields are still 16 characters wide, but the lines may hold fewer
+  // than five of them or end in spaces
+  LineReader in(m_moData, m_moEnd);
+  const char *line, *end;
+  unsigned int count = 0;
+  while (count < m_moCount && in.readLine(line, end)) {
+    const char *p = line;
+    double value;
+    bool ok;
+    unsigned int fields = 0;
+    while (nextDouble(p, end, 16, value, ok))
+      ++fields;
+    if (!ok || !fields)
+      break;
+    m_lines.push_back(line);
+    m_lineFirst.push_back(count);
+    count += fields;
+  }
+  if (count != m_moCount) {
+    qDebug() << "Could not index the MO coefficients," << count << "of"
+             << m_moCount << "found.";
+    m_lines.clear();
+    m_lineFirst.clear();
+    return false;
+  }
+  return true;
+}
+
+bool FchkOrbitalSource::readMO(unsigned int mo, Eigen::VectorXd &column) const
+{
+  if (mo >= numMOs())
+    return false;
+  unsigned int first = mo * m_numBasisFunctions;
+  column.resize(m_numBasisFunctions);
+
+  // Go straight to the fields of the MO
+  for (unsigned int i = 0; i < m_numBasisFunctions; ++i) {
+    const char *p;
+    if (!findField(first + i, p))
+      return false;
+    const char *fieldEnd = p + 16;
+    if (!parseDouble(p, fieldEnd, column[i])
+        || skipSpaces(p, fieldEnd) != fieldEnd)
+      return false;
+  }
+  return true;
+}
+
+bool FchkOrbitalSource::readDensity(Eigen::MatrixXd &density) const
+{
+  if (!m_densityData)
+    return false;
+  LineReader in(m_densityData, m_densityEnd);
+  return readLowerTriangle(in, m_densityCount, m_numBasisFunctions, 16,
+                           density);
+}
+
+// Add the text from begin to end to the hash, in pieces small enough for
+// QCryptographicHash::addData
+static void addText(QCryptographicHash &hash, const char *begin,
+                    const char *end)
+{
+  const qint64 piece = 1 << 30;
+  for (; end - begin > piece; begin += piece)
+    hash.addData(begin, static_cast<int>(piece));
+  hash.addData(begin, static_cast<int>(end - begin));
+}
+
+void FchkOrbitalSource::hashContent(QCryptographicHash &hash) const
+{
+  unsigned int sizes[3] = { m_numBasisFunctions, m_moCount, m_densityCount };
+  hash.addData(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+  // Hashing the text is much faster than parsing it
+  if (m_moData)
+    addText(hash, m_moData, m_moEnd);
+  if (m_densityData)
+    addText(hash, m_densityData, m_densityEnd);
+}
+
+void FchkOrbitalSource::hashMO(unsigned int mo, QCryptographicHash &hash) const
+{
+  // Only the text of the fields of the MO, which for large files is a small
+  // part of the MO coefficients
+  unsigned int sizes[2] = { m_numBasisFunctions, mo };
+  hash.addData(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+  const char *begin, *last;
+  if (mo < numMOs() && findField(mo * m_numBasisFunctions, begin)
+      && findField((mo + 1) * m_numBasisFunctions - 1, last))
+    addText(hash, begin, last + 16);
+}
+
+void FchkOrbitalSource::hashDensity(QCryptographicHash &hash) const
+{
+  unsigned int sizes[2] = { m_numBasisFunctions, m_densityCount };
+  hash.addData(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+  if (m_densityData)
+    addText(hash, m_densityData, m_densityEnd);
+}
+
 }
@@ -17,7 +17,12 @@
 #ifndef GAUSSIANFCHK_H
 #define GAUSSIANFCHK_H
 
-#include <QtCore/QIODevice>
+#include "orbitalsource.h"
+#include "textparser.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedPointer>
 #include <Eigen/Core>
 #include <vector>
 
@@ -27,18 +32,102 @@ namespace OpenQube
 {
 class GaussianSet;
 
+/**
+ * Reads the MO coefficients and density matrix of an indexed formatted
+ * checkpoint file on demand. Holds the file mapped in memory for as long as
+ * the basis set, or any of its clones, needs it.
+ */
+class FchkOrbitalSource : public OrbitalSource
+{
+public:
+  explicit FchkOrbitalSource(const QString &filename);
+  ~FchkOrbitalSource();
+
+  /// The contents of the file
+  const char * begin() const { return m_file.begin(); }
+  const char * end() const { return m_file.end(); }
+
+  /// Set the data of the MO coefficient and density sections
+  void setMOs(const char *data, const char *dataEnd, unsigned int count,
+              unsigned int numBasisFunctions);
+  void setDensity(const char *data, const char *dataEnd, unsigned int count,
+                  unsigned int numBasisFunctions);
+
+  unsigned int numMOs() const;
+  bool readMO(unsigned int mo, Eigen::VectorXd &column) const;
+  bool hasDensity() const { return m_densityData != 0; }
+  bool readDensity(Eigen::MatrixXd &density) const;
+  void hashContent(QCryptographicHash &hash) const;
+  void hashMO(unsigned int mo, QCryptographicHash &hash) const;
+  void hashDensity(QCryptographicHash &hash) const;
+
+private:
+  /// Find the text of MO coefficient k, false if it is out of the section
+  bool findField(unsigned int k, const char *&field) const;
+  /// Record where each line of irregular MO coefficients starts
+  bool indexLines() const;
+
+  MappedFile m_file;
+  const char *m_moData, *m_moEnd;
+  unsigned int m_moCount;
+  int m_moStride;      //! Length of the MO lines, 0 if they are irregular
+  mutable QMutex m_linesMutex;
+  mutable bool m_linesIndexed;
+  mutable std::vector<const char *> m_lines;     //! Start of each MO line
+  mutable std::vector<unsigned int> m_lineFirst; //! Its first coefficient
+  const char *m_densityData, *m_densityEnd;
+  unsigned int m_densityCount;
+  unsigned int m_numBasisFunctions;
+};
+
+/**
+ * Reads Gaussian formatted checkpoint files. The file is memory mapped where
+ * possible, and the numbers are parsed straight out of the mapped file into
+ * pre-sized storage.
+ *
+ * In indexed mode a first pass records where each section is, skipping over
+ * the arrays, and then only the small sections are read. The MO coefficients
+ * and the density matrix are left for the basis set to read on demand.
+ *
+ * Compressed files are parsed a section at a time as they are decompressed,
+ * see RecordReader. They are always read in full, as they cannot be indexed
+ * without holding the whole text.
+ */
 class GaussianFchk
 {
 public:
-  GaussianFchk(const QString &filename, GaussianSet *basis);
+  GaussianFchk(const QString &filename, GaussianSet *basis,
+               bool indexed = false);
   ~GaussianFchk();
   void outputAll();
 private:
-  QIODevice *m_in;
+  /// A section of the file, either a scalar or an array
+  struct Section
+  {
+    QByteArray name;
+    char type;          // I, R, C, L or H
+    bool array;
+    int count;          // The number of elements, or the value of integers
+    const char *header; // Start of the header line
+    const char *data;   // Start of the array data
+    const char *end;    // End of the array data
+  };
+
+  QSharedPointer<FchkOrbitalSource> m_source;
+  LineReader m_in;
+  bool m_indexed;
+  std::vector<Section> m_sections;
+  /// Parse the mapped file, indexing it if m_indexed is set
+  void readMapped(const QString &filename);
+  /// Parse a compressed file as it is decompressed
+  void readCompressed(const QString &filename);
+  void buildIndex();
+  const Section * section(const char *name) const;
   void processLine();
   void load(GaussianSet* basis);
-  std::vector<int> readArrayI(unsigned int n);
-  std::vector<double> readArrayD(unsigned int n, int width = 0);
+  bool readArrayI(unsigned int n, std::vector<int> &values);
+  bool readArrayD(unsigned int n, std::vector<double> &values,
+                  int width = 0);
   bool readDensityMatrix(unsigned int n, int width = 0);
 
   int m_electrons;
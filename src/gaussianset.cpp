@@ -24,10 +24,10 @@
 
 #include "cube.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
-#include <QtCore/QtConcurrentMap>
 #include <QtCore/QFuture>
 #include <QtCore/QFutureWatcher>
 #include <QtCore/QReadWriteLock>
@@ -36,6 +36,7 @@
 using std::vector;
 using Eigen::Vector3d;
 using Eigen::Vector3i;
+using Eigen::Matrix3d;
 using Eigen::MatrixXd;
 
 namespace OpenQube
@@ -51,13 +52,247 @@ struct GaussianShell
 static const double BOHR_TO_ANGSTROM = 0.529177249;
 static const double ANGSTROM_TO_BOHR = 1.0 / BOHR_TO_ANGSTROM;
 
-GaussianSet::GaussianSet() : m_numMOs(0), m_numAtoms(0), m_init(false),
-  m_cube(0), m_gaussianShells(0)
+// Shells whose most diffuse GTO has a * r^2 above this at every point of a
+// batch are skipped, exp(-40) being negligible
+static const double SCREENING_EXPONENT = 40.0;
+
+// The number of components of the shells handled by the calculations
+static int shellComponents(int symmetry)
+{
+  switch (symmetry) {
+  case S:
+    return 1;
+  case P:
+    return 3;
+  case D:
+    return 6;
+  case D5:
+    return 5;
+  default:
+    return 0;
+  }
+}
+
+// The electrostatic potential uses the McMurchie-Davidson scheme: each pair
+// of primitives of the density is expanded in Hermite Gaussians, whose
+// Coulomb integrals R_tuv follow from the Boys functions F_n(T) by
+// recursion. Pairs of d shells need up to t + u + v = 4, which makes
+// GaussianSet::HERMITE_COUNT integrals.
+static const int HERMITE_MAX_ORDER = 4;
+static const int HERMITE_COUNT = GaussianSet::HERMITE_COUNT;
+
+// Pairs of primitives whose density times overlap is below this are skipped
+static const double ESP_SCREENING = 1e-14;
+
+// Shell pairs further than this many times their size from all of the points
+// of a batch are replaced by their multipoles
+static const double FAR_FIELD_RATIO = 10.0;
+
+// The index of R_tuv and of the Hermite coefficients, ordered by t + u + v
+static inline int hermiteIndex(int t, int u, int v)
+{
+  int n = t + u + v;
+  return n * (n + 1) * (n + 2) / 6 + (n - t) * (n - t + 1) / 2 + (n - t - u);
+}
+
+// The Boys functions F_n(T) = int_0^1 t^2n exp(-T t^2) dt, tabulated for the
+// highest order and interpolated by a Taylor expansion, using
+// dF_n/dT = -F_n+1. The lower orders follow by downward recursion.
+static const int BOYS_TAYLOR_TERMS = 7;
+static const int BOYS_ORDERS = HERMITE_MAX_ORDER + BOYS_TAYLOR_TERMS;
+static const double BOYS_STEP = 0.05;
+static const int BOYS_POINTS = 721;
+// Beyond this the asymptotic form is exact to double precision
+static const double BOYS_MAX_T = (BOYS_POINTS - 1) * BOYS_STEP;
+
+class BoysTable
+{
+public:
+  BoysTable() : m_values(BOYS_POINTS * BOYS_ORDERS)
+  {
+    // F_n(T) = exp(-T) sum_i (2T)^i / ((2n + 1)(2n + 3)...(2n + 2i + 1))
+    for (int k = 0; k < BOYS_POINTS; ++k) {
+      double t = k * BOYS_STEP;
+      for (int n = 0; n < BOYS_ORDERS; ++n) {
+        double term = 1.0 / (2 * n + 1);
+        double sum = term;
+        for (int i = 1; term > 1e-17 * sum; ++i) {
+          term *= 2.0 * t / (2 * n + 2 * i + 1);
+          sum += term;
+        }
+        m_values[k * BOYS_ORDERS + n] = exp(-t) * sum;
+      }
+    }
+  }
+
+  /// F_0(t) to F_order(t) into f
+  void evaluate(double t, int order, double *f) const
+  {
+    if (t >= BOYS_MAX_T) {
+      asymptotic(t, order, f);
+      return;
+    }
+    int k = static_cast<int>(t / BOYS_STEP + 0.5);
+    double delta = k * BOYS_STEP - t;
+    const double *table = &m_values[k * BOYS_ORDERS + order];
+    double factor = 1.0;
+    f[order] = 0.0;
+    for (int i = 0; i < BOYS_TAYLOR_TERMS; ++i) {
+      f[order] += table[i] * factor;
+      factor *= delta / (i + 1);
+    }
+    double expT = exp(-t);
+    for (int n = order; n > 0; --n)
+      f[n-1] = (2.0 * t * f[n] + expT) / (2 * n - 1);
+  }
+
+  /// The limits of F_0(t) to F_order(t) for large t, into f
+  static void asymptotic(double t, int order, double *f)
+  {
+    f[0] = 0.5 * sqrt(M_PI / t);
+    for (int n = 1; n <= order; ++n)
+      f[n] = f[n-1] * (2 * n - 1) / (2.0 * t);
+  }
+
+private:
+  std::vector<double> m_values;
+};
+
+static const BoysTable boysTable;
+
+// The Hermite Coulomb integrals R_tuv(p, pc) for t + u + v <= order. Their
+// limits far from the Hermite Gaussians, where they are the derivatives of
+// sqrt(pi / p) / (2 |pc|), are used if asymptotic is true.
+static void hermiteIntegrals(double p, const Vector3d &pc, int order,
+                             double *r, bool asymptotic = false)
+{
+  double f[HERMITE_MAX_ORDER + 1];
+  if (asymptotic)
+    BoysTable::asymptotic(p * pc.squaredNorm(), order, f);
+  else
+    boysTable.evaluate(p * pc.squaredNorm(), order, f);
+
+  // R^n_000 = (-2p)^n F_n, then R^n_tuv from R^n+1 for decreasing n
+  double work[HERMITE_MAX_ORDER + 1][HERMITE_COUNT];
+  double scale = 1.0;
+  for (int n = 0; n <= order; ++n) {
+    work[n][0] = scale * f[n];
+    scale *= -2.0 * p;
+  }
+  for (int n = order - 1; n >= 0; --n) {
+    const double *next = work[n+1];
+    for (int m = 1; m <= order - n; ++m) {
+      for (int t = m; t >= 0; --t) {
+        for (int u = m - t; u >= 0; --u) {
+          int v = m - t - u;
+          double value;
+          if (t > 0) {
+            value = pc.x() * next[hermiteIndex(t - 1, u, v)];
+            if (t > 1)
+              value += (t - 1) * next[hermiteIndex(t - 2, u, v)];
+          }
+          else if (u > 0) {
+            value = pc.y() * next[hermiteIndex(t, u - 1, v)];
+            if (u > 1)
+              value += (u - 1) * next[hermiteIndex(t, u - 2, v)];
+          }
+          else {
+            value = pc.z() * next[hermiteIndex(t, u, v - 1)];
+            if (v > 1)
+              value += (v - 1) * next[hermiteIndex(t, u, v - 2)];
+          }
+          work[n][hermiteIndex(t, u, v)] = value;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < (order + 1) * (order + 2) * (order + 3) / 6; ++i)
+    r[i] = work[0][i];
+}
+
+// The Hermite expansion coefficients E^ij_t of the product of two 1D
+// Gaussians, x_A^i x_B^j exp(-a x_A^2 - b x_B^2), for i, j <= 2
+static void hermiteExpansion(double p, double pa, double pb, double k,
+                             double e[3][3][6])
+{
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      for (int t = 0; t < 6; ++t)
+        e[i][j][t] = 0.0;
+  e[0][0][0] = k;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      if (!i && !j)
+        continue;
+      const double *prev = i ? e[i-1][j] : e[i][j-1];
+      double x = i ? pa : pb;
+      for (int t = 0; t <= i + j; ++t) {
+        e[i][j][t] = x * prev[t] + (t + 1) * prev[t+1];
+        if (t > 0)
+          e[i][j][t] += prev[t-1] / (2.0 * p);
+      }
+    }
+  }
+}
+
+// The Cartesian monomials x^l y^m z^n of s, p and d shells, in the order of
+// the components in shellValues
+static const int CARTESIAN_POWERS[10][3] = {
+  { 0, 0, 0 },
+  { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 },
+  { 2, 0, 0 }, { 0, 2, 0 }, { 0, 0, 2 }, { 1, 1, 0 }, { 1, 0, 1 }, { 0, 1, 1 }
+};
+
+// The monomials of a shell as the offset of the first into CARTESIAN_POWERS,
+// and the coefficients of the components in them
+static int cartesianMonomials(int symmetry, double transform[6][6])
+{
+  for (int c = 0; c < 6; ++c)
+    for (int m = 0; m < 6; ++m)
+      transform[c][m] = c == m ? 1.0 : 0.0;
+  switch (symmetry) {
+  case S:
+    return 0;
+  case P:
+    return 1;
+  case D5:
+    // d0 = z^2 - r^2, d+1 = xz, d-1 = yz, d+2 = x^2 - y^2 and d-2 = xy
+    for (int c = 0; c < 5; ++c)
+      for (int m = 0; m < 6; ++m)
+        transform[c][m] = 0.0;
+    transform[0][0] = transform[0][1] = -1.0;
+    transform[1][4] = 1.0;
+    transform[2][5] = 1.0;
+    transform[3][0] = 1.0;
+    transform[3][1] = -1.0;
+    transform[4][3] = 1.0;
+    return 4;
+  default:
+    return 4;
+  }
+}
+
+static int monomialCount(int symmetry)
+{
+  return symmetry == S ? 1 : symmetry == P ? 3 : 6;
+}
+
+GaussianSet::GaussianSet() : m_moCoeffs(0), m_pointType(Cube::MO),
+  m_numMOs(0), m_numAtoms(0),
+  m_init(false), m_cube(0), m_gaussianShells(0), m_boundTiles(0)
 {
 }
 
 GaussianSet::~GaussianSet()
 {
+  // The tasks of a calculation that is still running refer to this set
+  if (m_cube) {
+    m_watcher.cancel();
+    m_watcher.waitForFinished();
+    m_cube->lock()->unlock();
+  }
+  delete m_gaussianShells;
+  delete m_boundTiles;
 }
 
 unsigned int GaussianSet::addAtom(const Vector3d& pos, int atomicNumber)
@@ -103,6 +338,7 @@ unsigned int GaussianSet::addBasis(unsigned int atom, orbital type)
   // Add to the new data structure, delete the old soon
   m_symmetry.push_back(type);
   m_atomIndices.push_back(atom);
+  contentChanged();
   return m_symmetry.size() - 1;
 }
 
@@ -115,6 +351,7 @@ unsigned int GaussianSet::addGTO(unsigned int, double c, double a)
   }
   m_gtoA.push_back(a);
   m_gtoC.push_back(c);
+  contentChanged();
 
   return m_gtoA.size() - 1;
 }
@@ -133,6 +370,9 @@ void GaussianSet::addMOs(const vector<double>& MOs)
   for (unsigned int j = 0; j < columns; ++j)
     for (unsigned int i = 0; i < m_numMOs; ++i)
       m_moMatrix.coeffRef(i, j) = MOs[i + j*m_numMOs];
+  m_orbitalSource.clear();
+  m_moColumns.clear();
+  contentChanged();
 }
 
 void GaussianSet::addMO(double)
@@ -140,22 +380,79 @@ void GaussianSet::addMO(double)
   m_init = false;
 }
 
+void GaussianSet::clearMOs()
+{
+  m_init = false;
+  m_moMatrix.resize(0, 0);
+  m_orbitalSource.clear();
+  m_moColumns.clear();
+  contentChanged();
+}
+
+void GaussianSet::clear()
+{
+  m_molecule.clearAtoms();
+  m_symmetry.clear();
+  m_atomIndices.clear();
+  m_moIndices.clear();
+  m_gtoIndices.clear();
+  m_cIndices.clear();
+  m_gtoA.clear();
+  m_gtoC.clear();
+  m_gtoCN.clear();
+  m_density.resize(0, 0);
+  m_numMOs = 0;
+  m_numAtoms = 0;
+  clearMOs();
+}
+
 bool GaussianSet::setDensityMatrix(const Eigen::MatrixXd &m)
 {
   m_density.resize(m.rows(), m.cols());
   m_density = m;
+  contentChanged();
   return true;
 }
 
+void GaussianSet::setOrbitalSource(const QSharedPointer<OrbitalSource> &source)
+{
+  m_orbitalSource = source;
+  m_moMatrix.resize(0, 0);
+  m_moColumns.clear();
+  if (source && source->hasDensity())
+    m_density.resize(0, 0);
+  contentChanged();
+}
+
 bool GaussianSet::calculateCubeMO(Cube *cube, unsigned int state)
 {
   // Set up the calculation and ideally use the new QtConcurrent code to
   // multithread the calculation...
-  if (state < 1 || state > static_cast<unsigned int>(m_moMatrix.rows()))
+  if (state < 1 || state > numMOs())
+    return false;
+
+  // Read the MO in if it comes from an orbital source
+  if (!loadMO(state - 1))
     return false;
 
+  m_cube = cube;
+
+  // Lock the cube until we are done.
+  cube->lock()->lockForWrite();
+
+  // Set the cube type
+  cube->setCubeType(Cube::MO);
+
+  // Watch for the future
+  connect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
+
+  // Cached cubes do not need to be calculated
+  if (loadFromCache(cube, Cube::MO, state))
+    return true;
+
   // Must be called before calculations begin
   initCalculation();
+  initLevels(cube);
 
   // Set up the points we want to calculate the density at
   m_gaussianShells = new QVector<GaussianShell>(cube->data()->size());
@@ -163,38 +460,39 @@ bool GaussianSet::calculateCubeMO(Cube *cube, unsigned int state)
   for (int i = 0; i < m_gaussianShells->size(); ++i) {
     (*m_gaussianShells)[i].set = this;
     (*m_gaussianShells)[i].tCube = cube;
-    (*m_gaussianShells)[i].pos = i;
     (*m_gaussianShells)[i].state = state;
   }
 
-  // Lock the cube until we are done.
-  cube->lock()->lockForWrite();
-
-  // Set the cube type
-  cube->setCubeType(Cube::MO);
-
-  // Watch for the future
-  connect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
-
-  // The main part of the mapped reduced function...
-  m_future = QtConcurrent::map(*m_gaussianShells, GaussianSet::processPoint);
-  // Connect our watcher to our future
-  m_watcher.setFuture(m_future);
+  calculateLevel();
 
   return true;
 }
 
 bool GaussianSet::calculateCubeDensity(Cube *cube)
 {
-  if (m_density.size() == 0) {
-    qDebug() << "Cannot calculate density -- density matrix not set.";
+  if (!loadDensity())
     return false;
-  }
 
   // FIXME Still not working, committed so others could see current state.
 
+  m_cube = cube;
+
+  // Lock the cube until we are done.
+  cube->lock()->lockForWrite();
+
+  // Set the cube type
+  cube->setCubeType(Cube::ElectronDensity);
+
+  // Watch for the future
+  connect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
+
+  // Cached cubes do not need to be calculated
+  if (loadFromCache(cube, Cube::ElectronDensity, 0))
+    return true;
+
   // Must be called before calculations begin
   initCalculation();
+  initLevels(cube);
 
   // Set up the points we want to calculate the density at
   m_gaussianShells = new QVector<GaussianShell>(cube->data()->size());
@@ -202,30 +500,69 @@ bool GaussianSet::calculateCubeDensity(Cube *cube)
   for (int i = 0; i < m_gaussianShells->size(); ++i) {
     (*m_gaussianShells)[i].set = this;
     (*m_gaussianShells)[i].tCube = cube;
-    (*m_gaussianShells)[i].pos = i;
   }
 
-  // Lock the cube until we are done.
-  cube->lock()->lockForWrite();
-
-  // Set the cube type
-  cube->setCubeType(Cube::ElectronDensity);
+  calculateLevel();
 
-  // Watch for the future
-  connect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
+  return true;
+}
 
-  // The main part of the mapped reduced function...
-  m_future = QtConcurrent::map(*m_gaussianShells, GaussianSet::processDensity);
-  // Connect our watcher to our future
-  m_watcher.setFuture(m_future);
+bool GaussianSet::initPointValues(Cube::Type type, unsigned int mo)
+{
+  // The MO coefficients and the density are shared with the cube
+  if (isCalculating()) {
+    qDebug() << "Point values cannot be prepared while a cube is calculated.";
+    return false;
+  }
+  if (type == Cube::MO) {
+    if (mo < 1 || mo > numMOs() || !loadMO(mo - 1))
+      return false;
+  }
+  else if ((type != Cube::ElectronDensity && type != Cube::ESP)
+           || !loadDensity()) {
+    return false;
+  }
 
+  initCalculation();
+  if (type == Cube::ESP && !initESP())
+    return false;
+  m_pointType = type;
   return true;
 }
 
+double GaussianSet::pointValue(const Vector3d &pos)
+{
+  if (m_pointType == Cube::ESP) {
+    double value;
+    calculateESP(&pos, 1, pos, 0.0, &value);
+    return value;
+  }
+  if (m_pointType == Cube::ElectronDensity)
+    return densityValue(this, pos * ANGSTROM_TO_BOHR);
+  return moValue(this, pos * ANGSTROM_TO_BOHR);
+}
+
+std::vector<Vector3d> GaussianSet::nuclearPositions() const
+{
+  // The atoms are in Bohr, the cubes in Angstrom
+  std::vector<Vector3d> positions = BasisSet::nuclearPositions();
+  for (size_t i = 0; i < positions.size(); ++i)
+    positions[i] *= BOHR_TO_ANGSTROM;
+  return positions;
+}
+
 BasisSet * GaussianSet::clone()
 {
   GaussianSet *result = new GaussianSet();
 
+  result->m_molecule = this->m_molecule;
+  result->m_electrons = this->m_electrons;
+  result->m_valid = this->m_valid;
+  {
+    QMutexLocker locker(&m_contentHashMutex);
+    result->m_contentHash = m_contentHash;
+  }
+
   result->m_symmetry = this->m_symmetry;
   result->m_atomIndices = this->m_atomIndices;
   result->m_moIndices = this->m_moIndices;
@@ -236,6 +573,8 @@ BasisSet * GaussianSet::clone()
   result->m_gtoCN = this->m_gtoCN;
   result->m_moMatrix = this->m_moMatrix;
   result->m_density = this->m_density;
+  result->m_orbitalSource = this->m_orbitalSource;
+  result->m_moColumns = this->m_moColumns;
 
   result->m_numMOs = this->m_numMOs;
   result->m_numAtoms = this->m_numAtoms;
@@ -245,12 +584,85 @@ BasisSet * GaussianSet::clone()
   return result;
 }
 
+void GaussianSet::hashContent(QCryptographicHash &hash) const
+{
+  // Only the input data, the rest is derived from it by initCalculation
+  addToHash(hash, m_symmetry);
+  addToHash(hash, m_atomIndices);
+  addToHash(hash, m_gtoA);
+  addToHash(hash, m_gtoC);
+  if (m_orbitalSource) {
+    // Avoid reading the MOs in just to hash them
+    m_orbitalSource->hashContent(hash);
+    if (!m_orbitalSource->hasDensity())
+      addToHash(hash, m_density);
+  }
+  else {
+    addToHash(hash, m_moMatrix);
+    addToHash(hash, m_density);
+  }
+}
+
+QByteArray GaussianSet::cubeHash(Cube::Type type, unsigned int mo) const
+{
+  // The MOs of a large file are not read in just to look a cube up
+  if (!m_orbitalSource || (type != Cube::MO && type != Cube::ElectronDensity)
+      || (type == Cube::ElectronDensity && !m_orbitalSource->hasDensity()))
+    return BasisSet::cubeHash(type, mo);
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  addMoleculeToHash(hash);
+  addToHash(hash, m_symmetry);
+  addToHash(hash, m_atomIndices);
+  addToHash(hash, m_gtoA);
+  addToHash(hash, m_gtoC);
+  if (type == Cube::MO)
+    m_orbitalSource->hashMO(mo - 1, hash);
+  else
+    m_orbitalSource->hashDensity(hash);
+  return hash.result();
+}
+
+void GaussianSet::calculateLevel()
+{
+  // The main part of the mapped reduced function, over the current level...
+  CubeScheduler *scheduler = CubeScheduler::instance();
+  // In Adaptive mode the points of a level are only known once it starts
+  for (unsigned int i = levelBegin(); i < levelEnd(); ++i)
+    (*m_gaussianShells)[i].pos = pointIndex(i);
+  QVector<GaussianShell>::iterator shells = m_gaussianShells->begin();
+  if (m_cube->cubeType() == Cube::ElectronDensity)
+    m_future = scheduler->map(m_priority, shells + levelBegin(),
+                              shells + levelEnd(), GaussianSet::processDensity);
+  else
+    m_future = scheduler->map(m_priority, shells + levelBegin(),
+                              shells + levelEnd(), GaussianSet::processPoint);
+  // Connect our watcher to our future
+  m_watcher.setFuture(m_future);
+}
+
 void GaussianSet::calculationComplete()
 {
+  // The blocking calculations complete without waiting for the event loop
+  if (!m_cube || !m_watcher.isFinished())
+    return;
+  // Progressive calculations carry on with the next level, Adaptive ones
+  // once the cells to refine have been bounded
+  if (nextLevel(m_cube)) {
+    if (!isRefining())
+      calculateLevel();
+    return;
+  }
   disconnect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
-  (*m_gaussianShells)[0].tCube->lock()->unlock();
+  storeInCache(m_cube);
+  m_cube->lock()->unlock();
   delete m_gaussianShells;
   m_gaussianShells = 0;
+  delete m_boundTiles;
+  m_boundTiles = 0;
+  if (!m_pointOrder.empty() && !m_watcher.future().isCanceled())
+    emit cubeRefined(m_level, m_levelEnds.size());
+  m_cube = 0;
   emit finished();
 }
 
@@ -275,7 +687,11 @@ void GaussianSet::initCalculation()
   unsigned int skip = 0; // for unimplemented shells
 
   m_moIndices.resize(m_symmetry.size());
-  // Add a final entry to the gtoIndices
+  m_cIndices.clear();
+  // Add a final entry to the gtoIndices, replacing the one added when the
+  // calculation was last initialised
+  if (m_gtoIndices.size() > m_symmetry.size())
+    m_gtoIndices.resize(m_symmetry.size());
   m_gtoIndices.push_back(m_gtoA.size());
   for(unsigned int i = 0; i < m_symmetry.size(); ++i) {
     switch (m_symmetry[i]) {
@@ -369,10 +785,63 @@ void GaussianSet::initCalculation()
   m_init = true;
 }
 
+bool GaussianSet::loadMO(unsigned int indexMO)
+{
+  if (!m_orbitalSource) {
+    m_moCoeffs = m_moMatrix.data() + indexMO * m_moMatrix.rows();
+    return true;
+  }
+
+  // Columns are kept once read, the user is likely to come back to them
+  QHash<unsigned int, Eigen::VectorXd>::iterator it = m_moColumns.find(indexMO);
+  if (it == m_moColumns.end()) {
+    Eigen::VectorXd column;
+    if (!m_orbitalSource->readMO(indexMO, column)
+        || column.size() < static_cast<int>(m_numMOs)) {
+      qDebug() << "Reading the coefficients of MO" << indexMO + 1 << "failed.";
+      return false;
+    }
+    it = m_moColumns.insert(indexMO, column);
+  }
+  m_moCoeffs = it->data();
+  return true;
+}
+
+bool GaussianSet::loadDensity()
+{
+  // Read the density matrix in if it comes from an orbital source
+  if (m_density.size() == 0 && m_orbitalSource && m_orbitalSource->hasDensity()
+      && !m_orbitalSource->readDensity(m_density)) {
+    qDebug() << "Reading the density matrix failed.";
+    m_density.resize(0, 0);
+  }
+
+  if (m_density.size() == 0) {
+    qDebug() << "Cannot calculate density -- density matrix not set.";
+    return false;
+  }
+  return true;
+}
+
 /// This is the stuff we actually use right now - porting to new data structure
 void GaussianSet::processPoint(GaussianShell &shell)
 {
-  GaussianSet *set = shell.set;
+  // Calculate our position
+  Vector3d pos = shell.tCube->position(shell.pos) * ANGSTROM_TO_BOHR;
+  // Set the value
+  shell.tCube->setValue(shell.pos, moValue(shell.set, pos));
+}
+
+void GaussianSet::processDensity(GaussianShell &shell)
+{
+  // Calculate our position
+  Vector3d pos = shell.tCube->position(shell.pos) * ANGSTROM_TO_BOHR;
+  // Set the value
+  shell.tCube->setValue(shell.pos, densityValue(shell.set, pos));
+}
+
+double GaussianSet::moValue(GaussianSet *set, const Vector3d &pos)
+{
   unsigned int atomsSize = set->m_numAtoms;
   unsigned int basisSize = set->m_symmetry.size();
   std::vector<int> &basis = set->m_symmetry;
@@ -381,11 +850,6 @@ void GaussianSet::processPoint(GaussianShell &shell)
   deltas.reserve(atomsSize);
   dr2.reserve(atomsSize);
 
-  unsigned int indexMO = shell.state-1;
-
-  // Calculate our position
-  Vector3d pos = shell.tCube->position(shell.pos) * ANGSTROM_TO_BOHR;
-
   // Calculate the deltas for the position
   for (unsigned int i = 0; i < atomsSize; ++i) {
     deltas.push_back(pos - set->m_molecule.atomPos(i));
@@ -397,33 +861,31 @@ void GaussianSet::processPoint(GaussianShell &shell)
   for (unsigned int i = 0; i < basisSize; ++i) {
     switch(basis[i]) {
     case S:
-      tmp += pointS(shell.set, i,
-                    dr2[set->m_atomIndices[i]], indexMO);
+      tmp += pointS(set, i,
+                    dr2[set->m_atomIndices[i]]);
       break;
     case P:
-      tmp += pointP(shell.set, i, deltas[set->m_atomIndices[i]],
-                    dr2[set->m_atomIndices[i]], indexMO);
+      tmp += pointP(set, i, deltas[set->m_atomIndices[i]],
+                    dr2[set->m_atomIndices[i]]);
       break;
     case D:
-      tmp += pointD(shell.set, i, deltas[set->m_atomIndices[i]],
-                    dr2[set->m_atomIndices[i]], indexMO);
+      tmp += pointD(set, i, deltas[set->m_atomIndices[i]],
+                    dr2[set->m_atomIndices[i]]);
       break;
     case D5:
-      tmp += pointD5(shell.set, i, deltas[set->m_atomIndices[i]],
-                     dr2[set->m_atomIndices[i]], indexMO);
+      tmp += pointD5(set, i, deltas[set->m_atomIndices[i]],
+                     dr2[set->m_atomIndices[i]]);
       break;
     default:
       // Not handled - return a zero contribution
       ;
     }
   }
-  // Set the value
-  shell.tCube->setValue(shell.pos, tmp);
+  return tmp;
 }
 
-void GaussianSet::processDensity(GaussianShell &shell)
+double GaussianSet::densityValue(GaussianSet *set, const Vector3d &pos)
 {
-  GaussianSet *set = shell.set;
   unsigned int atomsSize = set->m_numAtoms;
   unsigned int basisSize = set->m_symmetry.size();
   unsigned int matrixSize = set->m_density.rows();
@@ -433,8 +895,6 @@ void GaussianSet::processDensity(GaussianShell &shell)
   deltas.reserve(atomsSize);
   dr2.reserve(atomsSize);
 
-  // Calculate our position
-  Vector3d pos = shell.tCube->position(shell.pos) * ANGSTROM_TO_BOHR;
   // Calculate the deltas for the position
   for (unsigned int i = 0; i < atomsSize; ++i) {
     deltas.push_back(pos - set->m_molecule.atomPos(i));
@@ -447,16 +907,16 @@ void GaussianSet::processDensity(GaussianShell &shell)
     unsigned int cAtom = set->m_atomIndices[i];
     switch(basis[i]) {
     case S:
-      pointS(shell.set, dr2[cAtom], i, values);
+      pointS(set, dr2[cAtom], i, values);
       break;
     case P:
-      pointP(shell.set, deltas[cAtom], dr2[cAtom], i, values);
+      pointP(set, deltas[cAtom], dr2[cAtom], i, values);
       break;
     case D:
-      pointD(shell.set, deltas[cAtom], dr2[cAtom], i, values);
+      pointD(set, deltas[cAtom], dr2[cAtom], i, values);
       break;
     case D5:
-      pointD5(shell.set, deltas[cAtom], dr2[cAtom], i, values);
+      pointD5(set, deltas[cAtom], dr2[cAtom], i, values);
       break;
     default:
       // Not handled - return a zero contribution
@@ -477,15 +937,598 @@ void GaussianSet::processDensity(GaussianShell &shell)
         * (values.coeffRef(i, 0) * values.coeffRef(i, 0));
   }
 
-  // Set the value
-  shell.tCube->setValue(shell.pos, rho);
+  return rho;
+}
+
+void GaussianSet::calculateTile(const Vector3d *points, unsigned int count,
+                                const Vector3d &center, double radius,
+                                double *values, Vector3d *gradients,
+                                Matrix3d *hessians, double *kineticEnergies)
+{
+  if (m_pointType == Cube::ESP) {
+    // The derivatives of the potential are not calculated
+    calculateESP(points, count, center, radius, values);
+    for (unsigned int p = 0; p < count; ++p) {
+      if (gradients)
+        gradients[p] = Vector3d::Zero();
+      if (hessians)
+        hessians[p] = Matrix3d::Zero();
+      if (kineticEnergies)
+        kineticEnergies[p] = 0.0;
+    }
+    return;
+  }
+
+  // Skip the shells that are negligible at every point of the tile
+  Vector3d tileCenter = center * ANGSTROM_TO_BOHR;
+  double tileRadius = radius * ANGSTROM_TO_BOHR;
+  vector<unsigned int> shells;
+  vector<unsigned int> aos;
+  for (unsigned int i = 0; i < m_symmetry.size(); ++i) {
+    int components = shellComponents(m_symmetry[i]);
+    if (!components || m_gtoIndices[i] == m_gtoIndices[i+1])
+      continue;
+    double distance = std::max(0.0, (tileCenter - m_molecule.atomPos(
+                                       m_atomIndices[i])).norm() - tileRadius);
+    double exponent = *std::min_element(m_gtoA.begin() + m_gtoIndices[i],
+                                        m_gtoA.begin() + m_gtoIndices[i+1]);
+    if (exponent * distance * distance > SCREENING_EXPONENT)
+      continue;
+    shells.push_back(i);
+    for (int c = 0; c < components; ++c)
+      aos.push_back(m_moIndices[i] + c);
+  }
+
+  unsigned int aoCount = aos.empty() ? 0 : aos.back() + 1;
+  vector<double> phi(aoCount, 0.0);
+  bool derivatives = gradients || hessians || kineticEnergies;
+  vector<Vector3d> dphi(derivatives ? aoCount : 0, Vector3d::Zero());
+  vector<Matrix3d> ddphi(hessians ? aoCount : 0, Matrix3d::Zero());
+  for (unsigned int p = 0; p < count; ++p) {
+    Vector3d pos = points[p] * ANGSTROM_TO_BOHR;
+    for (unsigned int i = 0; i < shells.size(); ++i) {
+      Vector3d delta = pos - m_molecule.atomPos(m_atomIndices[shells[i]]);
+      shellValues(this, shells[i], delta, delta.squaredNorm(), &phi[0],
+                  derivatives ? &dphi[0] : 0, hessians ? &ddphi[0] : 0);
+    }
+
+    double value = 0.0;
+    Vector3d gradient = Vector3d::Zero();
+    Matrix3d hessian = Matrix3d::Zero();
+    double kinetic = 0.0;
+    if (m_pointType == Cube::ElectronDensity) {
+      // rho = sum_ij D_ij phi_i phi_j, from the lower triangle of D, so with
+      // u_i = sum_j D_ij phi_j and w_i = sum_j D_ij grad phi_j the gradient
+      // is 2 sum_i u_i grad phi_i, the Hessian is
+      // 2 sum_i (u_i H_i + grad phi_i w_i^T) and the kinetic energy density
+      // is 1/2 sum_i grad phi_i . w_i
+      unsigned int matrixSize = m_density.rows();
+      for (unsigned int i = 0; i < aos.size(); ++i) {
+        if (aos[i] >= matrixSize)
+          continue;
+        double u = 0.0;
+        Vector3d w = Vector3d::Zero();
+        for (unsigned int j = 0; j < aos.size() && aos[j] < matrixSize; ++j) {
+          double d = j <= i ? m_density.coeffRef(aos[i], aos[j])
+                            : m_density.coeffRef(aos[j], aos[i]);
+          u += d * phi[aos[j]];
+          if (hessians || kineticEnergies)
+            w += d * dphi[aos[j]];
+        }
+        value += phi[aos[i]] * u;
+        if (gradients)
+          gradient += 2.0 * u * dphi[aos[i]];
+        if (hessians)
+          hessian += 2.0 * (u * ddphi[aos[i]] + dphi[aos[i]] * w.transpose());
+        if (kineticEnergies)
+          kinetic += 0.5 * dphi[aos[i]].dot(w);
+      }
+    }
+    else {
+      for (unsigned int i = 0; i < aos.size() && aos[i] < m_numMOs; ++i) {
+        double c = m_moCoeffs[aos[i]];
+        value += c * phi[aos[i]];
+        if (derivatives)
+          gradient += c * dphi[aos[i]];
+        if (hessians)
+          hessian += c * ddphi[aos[i]];
+      }
+      kinetic = 0.5 * gradient.squaredNorm();
+    }
+    values[p] = value;
+    // The derivatives are with respect to the position in Angstrom
+    if (gradients)
+      gradients[p] = gradient * ANGSTROM_TO_BOHR;
+    if (hessians)
+      hessians[p] = hessian * (ANGSTROM_TO_BOHR * ANGSTROM_TO_BOHR);
+    if (kineticEnergies)
+      kineticEnergies[p] = kinetic * (ANGSTROM_TO_BOHR * ANGSTROM_TO_BOHR);
+  }
+}
+
+double GaussianSet::valueLengthUnit() const
+{
+  return BOHR_TO_ANGSTROM;
+}
+
+struct GaussianSet::BoundTile
+{
+  GaussianSet *set;
+  const Vector3d *min;  // Corners of the boxes, in Angstrom
+  const Vector3d *max;
+  double *bounds;
+  unsigned int count;
+  bool density;
+  double densityNorm;   // Bounds the largest eigenvalue of |D|
+};
+
+// The largest value of r^p exp(-a r^2) for r from rMin to rMax. It rises up
+// to r = sqrt(p / 2a) and falls beyond, so that is where it is largest, or
+// at the end of the range closest to it.
+static double radialMax(int p, double a, double rMin, double rMax)
+{
+  double r = p > 0 ? std::sqrt(p / (2.0 * a)) : 0.0;
+  r = std::min(std::max(r, rMin), rMax);
+  return std::pow(r, p) * exp(-a * r * r);
+}
+
+bool GaussianSet::gradientBounds(const Cube *cube,
+                                 const std::vector<Vector3d> &min,
+                                 const std::vector<Vector3d> &max,
+                                 std::vector<double> &bounds,
+                                 QFuture<void> &future)
+{
+  BoundTile tile;
+  tile.set = this;
+  tile.density = cube->cubeType() == Cube::ElectronDensity;
+  tile.densityNorm = 0.0;
+  if (tile.density) {
+    // The density is calculated from the lower triangle of D, and the
+    // largest row sum of its magnitudes bounds the largest eigenvalue
+    for (int i = 0; i < m_density.rows(); ++i) {
+      double sum = 0.0;
+      for (int j = 0; j < m_density.rows(); ++j)
+        sum += std::abs(m_density(std::max(i, j), std::min(i, j)));
+      tile.densityNorm = std::max(tile.densityNorm, sum);
+    }
+  }
+  else if (!m_moCoeffs) {
+    return false;
+  }
+
+  // The tiles are kept until the job has finished
+  bounds.resize(min.size());
+  delete m_boundTiles;
+  m_boundTiles = new std::vector<BoundTile>;
+  const unsigned int boxesPerTile = 64;
+  for (unsigned int b = 0; b < min.size(); b += boxesPerTile) {
+    tile.min = &min[b];
+    tile.max = &max[b];
+    tile.bounds = &bounds[b];
+    tile.count = std::min(boxesPerTile, static_cast<unsigned int>(min.size())
+                          - b);
+    m_boundTiles->push_back(tile);
+  }
+  future = CubeScheduler::instance()->mapTiles(m_priority,
+                                               m_boundTiles->begin(),
+                                               m_boundTiles->end(), boundTile);
+  return true;
+}
+
+void GaussianSet::boundTile(BoundTile &tile)
+{
+  // Each component of a shell is a polynomial P of degree l times the
+  // contraction sum_k c_k exp(-a_k r^2). |P| <= w r^l and |grad P| <=
+  // w l r^(l-1), with w the sum of the magnitudes of the coefficients of
+  // its monomials, so over a box whose points lie between rMin and rMax of
+  // the atom
+  //   |phi| <= w sum_k |c_k| max r^l exp(-a_k r^2)
+  //   |grad phi| <= w sum_k |c_k| max (l r^(l-1) + 2 a_k r^(l+1))
+  //                 * exp(-a_k r^2)
+  // An MO is bounded by the sum of these times the magnitudes of its
+  // coefficients, and the gradient of the density sum_ij D_ij phi_i phi_j
+  // by 2 ||D|| |values| |gradients| over the basis functions.
+  GaussianSet *set = tile.set;
+  for (unsigned int b = 0; b < tile.count; ++b) {
+    Vector3d min = tile.min[b] * ANGSTROM_TO_BOHR;
+    Vector3d max = tile.max[b] * ANGSTROM_TO_BOHR;
+    double moBound = 0.0, valueNorm = 0.0, gradientNorm = 0.0;
+    for (unsigned int i = 0; i < set->m_symmetry.size(); ++i) {
+      int components = shellComponents(set->m_symmetry[i]);
+      if (!components)
+        continue;
+      double transform[6][6];
+      const int *powers =
+          CARTESIAN_POWERS[cartesianMonomials(set->m_symmetry[i], transform)];
+      int l = powers[0] + powers[1] + powers[2];
+
+      // The closest and farthest points of the box from the atom
+      const Vector3d &atom = set->m_molecule.atomPos(set->m_atomIndices[i]);
+      Vector3d nearest, farthest;
+      for (int a = 0; a < 3; ++a) {
+        nearest[a] = std::max(0.0, std::max(min[a] - atom[a],
+                                            atom[a] - max[a]));
+        farthest[a] = std::max(std::abs(min[a] - atom[a]),
+                               std::abs(max[a] - atom[a]));
+      }
+      double rMin = nearest.norm(), rMax = farthest.norm();
+
+      double values[6] = { 0.0 }, gradients[6] = { 0.0 };
+      unsigned int cIndex = set->m_cIndices[i];
+      for (unsigned int k = set->m_gtoIndices[i];
+           k < set->m_gtoIndices[i+1]; ++k) {
+        double a = set->m_gtoA[k];
+        double value = radialMax(l, a, rMin, rMax);
+        double gradient = 2.0 * a * radialMax(l + 1, a, rMin, rMax);
+        if (l)
+          gradient += l * radialMax(l - 1, a, rMin, rMax);
+        for (int c = 0; c < components; ++c, ++cIndex) {
+          values[c] += std::abs(set->m_gtoCN[cIndex]) * value;
+          gradients[c] += std::abs(set->m_gtoCN[cIndex]) * gradient;
+        }
+      }
+
+      for (int c = 0; c < components; ++c) {
+        double weight = 0.0;
+        for (int m = 0; m < monomialCount(set->m_symmetry[i]); ++m)
+          weight += std::abs(transform[c][m]);
+        unsigned int index = set->m_moIndices[i] + c;
+        if (tile.density) {
+          valueNorm += weight * weight * values[c] * values[c];
+          gradientNorm += weight * weight * gradients[c] * gradients[c];
+        }
+        else {
+          moBound += std::abs(set->m_moCoeffs[index]) * weight * gradients[c];
+        }
+      }
+    }
+    double bound = tile.density ? 2.0 * tile.densityNorm
+                                  * std::sqrt(valueNorm * gradientNorm)
+                                : moBound;
+    // The gradient is per Bohr
+    tile.bounds[b] = bound * ANGSTROM_TO_BOHR;
+  }
+}
+
+bool GaussianSet::initESP()
+{
+  // The expansion only changes with the density, the basis and the atoms,
+  // which are all in the hash
+  QByteArray hash = this->hash();
+  if (hash == m_espHash)
+    return true;
+  m_espHash = hash;
+
+  m_hermitePairs.clear();
+  m_hermiteCoefficients.clear();
+  m_shellPairs.clear();
+
+  unsigned int matrixSize = m_density.rows();
+  for (unsigned int i = 0; i < m_symmetry.size(); ++i) {
+    int componentsI = shellComponents(m_symmetry[i]);
+    if (!componentsI || m_moIndices[i] + componentsI > matrixSize)
+      continue;
+    for (unsigned int j = 0; j <= i; ++j) {
+      int componentsJ = shellComponents(m_symmetry[j]);
+      if (!componentsJ || m_moIndices[j] + componentsJ > matrixSize)
+        continue;
+
+      // The block of the density matrix, counting both triangles
+      double block[6][6];
+      double factor = i == j ? 1.0 : 2.0;
+      for (int c = 0; c < componentsI; ++c) {
+        for (int d = 0; d < componentsJ; ++d) {
+          unsigned int a = m_moIndices[i] + c, b = m_moIndices[j] + d;
+          block[c][d] = factor * (a >= b ? m_density.coeffRef(a, b)
+                                         : m_density.coeffRef(b, a));
+        }
+      }
+
+      double transformI[6][6], transformJ[6][6];
+      int firstI = cartesianMonomials(m_symmetry[i], transformI);
+      int firstJ = cartesianMonomials(m_symmetry[j], transformJ);
+      int countI = monomialCount(m_symmetry[i]);
+      int countJ = monomialCount(m_symmetry[j]);
+      unsigned int order = CARTESIAN_POWERS[firstI][0]
+          + CARTESIAN_POWERS[firstI][1] + CARTESIAN_POWERS[firstI][2]
+          + CARTESIAN_POWERS[firstJ][0] + CARTESIAN_POWERS[firstJ][1]
+          + CARTESIAN_POWERS[firstJ][2];
+      unsigned int coefficients = (order + 1) * (order + 2) * (order + 3) / 6;
+      Vector3d posA = m_molecule.atomPos(m_atomIndices[i]);
+      Vector3d posB = m_molecule.atomPos(m_atomIndices[j]);
+      double distance2 = (posA - posB).squaredNorm();
+
+      ShellPair pair;
+      pair.first = m_hermitePairs.size();
+      unsigned int cI = m_cIndices[i];
+      for (unsigned int pi = m_gtoIndices[i]; pi < m_gtoIndices[i+1];
+           ++pi, cI += componentsI) {
+        unsigned int cJ = m_cIndices[j];
+        for (unsigned int pj = m_gtoIndices[j]; pj < m_gtoIndices[j+1];
+             ++pj, cJ += componentsJ) {
+          double a = m_gtoA[pi], b = m_gtoA[pj], p = a + b;
+          double k = exp(-a * b / p * distance2);
+
+          // The density in the Cartesian monomials of the two primitives
+          double density[6][6];
+          double largest = 0.0;
+          for (int m = 0; m < countI; ++m) {
+            for (int n = 0; n < countJ; ++n) {
+              double sum = 0.0;
+              for (int c = 0; c < componentsI; ++c)
+                for (int d = 0; d < componentsJ; ++d)
+                  sum += block[c][d] * m_gtoCN[cI + c] * m_gtoCN[cJ + d]
+                      * transformI[c][m] * transformJ[d][n];
+              density[m][n] = sum;
+              largest = std::max(largest, std::abs(sum));
+            }
+          }
+          if (largest * k * pow(M_PI / p, 1.5) < ESP_SCREENING)
+            continue;
+
+          HermitePair hermite;
+          hermite.exponent = p;
+          hermite.center = m_atomIndices[i] == m_atomIndices[j]
+              ? posA : Vector3d((a * posA + b * posB) / p);
+          hermite.order = order;
+          hermite.offset = m_hermiteCoefficients.size();
+          double e[3][3][3][6];
+          for (int x = 0; x < 3; ++x)
+            hermiteExpansion(p, hermite.center[x] - posA[x],
+                             hermite.center[x] - posB[x], x ? 1.0 : k, e[x]);
+          m_hermiteCoefficients.resize(hermite.offset + coefficients, 0.0);
+          double *h = &m_hermiteCoefficients[hermite.offset];
+          for (int m = 0; m < countI; ++m) {
+            const int *powersI = CARTESIAN_POWERS[firstI + m];
+            for (int n = 0; n < countJ; ++n) {
+              const int *powersJ = CARTESIAN_POWERS[firstJ + n];
+              if (density[m][n] == 0.0)
+                continue;
+              for (int t = 0; t <= powersI[0] + powersJ[0]; ++t)
+                for (int u = 0; u <= powersI[1] + powersJ[1]; ++u)
+                  for (int v = 0; v <= powersI[2] + powersJ[2]; ++v)
+                    h[hermiteIndex(t, u, v)] += density[m][n]
+                        * e[0][powersI[0]][powersJ[0]][t]
+                        * e[1][powersI[1]][powersJ[1]][u]
+                        * e[2][powersI[2]][powersJ[2]][v];
+            }
+          }
+          for (unsigned int c = 0; c < coefficients; ++c)
+            h[c] *= 2.0 * M_PI / p;
+          m_hermitePairs.push_back(hermite);
+        }
+      }
+      pair.last = m_hermitePairs.size();
+      if (pair.first == pair.last)
+        continue;
+
+      // The Hermite multipoles about the center of the most diffuse
+      // primitives. Far away R_tuv(p, P - C) tends to R_tuv(1, P - C) /
+      // sqrt(p), and the derivatives at P follow from those at the center by
+      // a Taylor expansion, truncated at the fourth order. It is exact for
+      // the pairs on one atom, which share their center.
+      double smallest = m_hermitePairs[pair.first].exponent;
+      pair.center = m_hermitePairs[pair.first].center;
+      for (unsigned int k = pair.first; k < pair.last; ++k) {
+        if (m_hermitePairs[k].exponent < smallest) {
+          smallest = m_hermitePairs[k].exponent;
+          pair.center = m_hermitePairs[k].center;
+        }
+      }
+      pair.order = m_atomIndices[i] == m_atomIndices[j] ? order
+                                                        : HERMITE_MAX_ORDER;
+      for (int c = 0; c < HERMITE_COUNT; ++c)
+        pair.multipoles[c] = 0.0;
+      double size = 0.0;
+      for (unsigned int k = pair.first; k < pair.last; ++k) {
+        const HermitePair &hermite = m_hermitePairs[k];
+        const double *h = &m_hermiteCoefficients[hermite.offset];
+        Vector3d d = hermite.center - pair.center;
+        double scale = 1.0 / sqrt(hermite.exponent);
+        for (int n = 0; n <= static_cast<int>(hermite.order); ++n) {
+          for (int t = n; t >= 0; --t) {
+            for (int u = n - t; u >= 0; --u) {
+              int v = n - t - u;
+              double weight = h[hermiteIndex(t, u, v)] * scale;
+              // Shift by d^(a, b, c) / (a! b! c!) to order t + a, u + b, v + c
+              double fx = 1.0;
+              for (int a = 0; n + a <= static_cast<int>(pair.order); ++a) {
+                double fy = 1.0;
+                for (int b = 0; n + a + b <= static_cast<int>(pair.order);
+                     ++b) {
+                  double fz = 1.0;
+                  for (int c = 0;
+                       n + a + b + c <= static_cast<int>(pair.order); ++c) {
+                    pair.multipoles[hermiteIndex(t + a, u + b, v + c)] +=
+                        weight * fx * fy * fz;
+                    fz *= d.z() / (c + 1);
+                  }
+                  fy *= d.y() / (b + 1);
+                }
+                fx *= d.x() / (a + 1);
+              }
+            }
+          }
+        }
+        size = std::max(size, d.norm() + 1.0 / sqrt(hermite.exponent));
+      }
+      pair.extent = FAR_FIELD_RATIO * size;
+      m_shellPairs.push_back(pair);
+    }
+  }
+  return true;
+}
+
+void GaussianSet::calculateESP(const Vector3d *points, unsigned int count,
+                               const Vector3d &center, double radius,
+                               double *values) const
+{
+  // Shell pairs far from every point of the batch are replaced by their
+  // multipoles
+  Vector3d tileCenter = center * ANGSTROM_TO_BOHR;
+  double tileRadius = radius * ANGSTROM_TO_BOHR;
+  vector<const ShellPair *> nearPairs, farPairs;
+  for (unsigned int i = 0; i < m_shellPairs.size(); ++i) {
+    const ShellPair &pair = m_shellPairs[i];
+    if ((pair.center - tileCenter).norm() - tileRadius > pair.extent)
+      farPairs.push_back(&pair);
+    else
+      nearPairs.push_back(&pair);
+  }
+
+  double r[HERMITE_COUNT];
+  for (unsigned int p = 0; p < count; ++p) {
+    Vector3d pos = points[p] * ANGSTROM_TO_BOHR;
+
+    // The nuclei, apart from any at the point itself
+    double value = 0.0;
+    for (size_t a = 0; a < m_molecule.numAtoms(); ++a) {
+      double distance = (pos - m_molecule.atomPos(a)).norm();
+      if (distance > 1e-10)
+        value += m_molecule.atomAtomicNumber(a) / distance;
+    }
+
+    for (unsigned int i = 0; i < farPairs.size(); ++i) {
+      const ShellPair &pair = *farPairs[i];
+      hermiteIntegrals(1.0, pair.center - pos, pair.order, r, true);
+      unsigned int n = (pair.order + 1) * (pair.order + 2)
+          * (pair.order + 3) / 6;
+      double sum = 0.0;
+      for (unsigned int c = 0; c < n; ++c)
+        sum += pair.multipoles[c] * r[c];
+      value -= sum;
+    }
+
+    for (unsigned int i = 0; i < nearPairs.size(); ++i) {
+      for (unsigned int k = nearPairs[i]->first; k < nearPairs[i]->last; ++k) {
+        const HermitePair &hermite = m_hermitePairs[k];
+        hermiteIntegrals(hermite.exponent, hermite.center - pos, hermite.order,
+                         r);
+        const double *h = &m_hermiteCoefficients[hermite.offset];
+        unsigned int n = (hermite.order + 1) * (hermite.order + 2)
+            * (hermite.order + 3) / 6;
+        double sum = 0.0;
+        for (unsigned int c = 0; c < n; ++c)
+          sum += h[c] * r[c];
+        value -= sum;
+      }
+    }
+    values[p] = value;
+  }
+}
+
+void GaussianSet::shellValues(GaussianSet *set, unsigned int basis,
+                              const Vector3d &delta, double dr2,
+                              double *values, Vector3d *gradients,
+                              Matrix3d *hessians)
+{
+  // The contracted radial part of each component, its derivative with
+  // respect to r divided by r, and the derivative of that divided by r, all
+  // sharing the exponentials. The gradient of the radial part is then
+  // slope * delta and its Hessian slope * I + curvature * delta delta^T.
+  int components = shellComponents(set->m_symmetry[basis]);
+  double radial[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  double slope[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  double curvature[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  unsigned int cIndex = set->m_cIndices[basis];
+  for (unsigned int i = set->m_gtoIndices[basis];
+       i < set->m_gtoIndices[basis+1]; ++i) {
+    double a = set->m_gtoA[i];
+    double tmpGTO = exp(-a * dr2);
+    for (int c = 0; c < components; ++c) {
+      double cn = set->m_gtoCN[cIndex++] * tmpGTO;
+      radial[c] += cn;
+      slope[c] -= 2.0 * a * cn;
+      curvature[c] += 4.0 * a * a * cn;
+    }
+  }
+
+  // The angular part of each component, its gradient and its Hessian, which
+  // is constant for polynomials of at most second order
+  double x = delta.x(), y = delta.y(), z = delta.z();
+  double angular[6];
+  Vector3d dAngular[6];
+  Matrix3d ddAngular[6];
+  for (int c = 0; c < components; ++c)
+    ddAngular[c] = Matrix3d::Zero();
+  switch (set->m_symmetry[basis]) {
+  case S:
+    angular[0] = 1.0;
+    dAngular[0] = Vector3d::Zero();
+    break;
+  case P:
+    angular[0] = x;
+    angular[1] = y;
+    angular[2] = z;
+    dAngular[0] = Vector3d::UnitX();
+    dAngular[1] = Vector3d::UnitY();
+    dAngular[2] = Vector3d::UnitZ();
+    break;
+  case D:
+    // Order in xx, yy, zz, xy, xz, yz
+    angular[0] = x * x;
+    angular[1] = y * y;
+    angular[2] = z * z;
+    angular[3] = x * y;
+    angular[4] = x * z;
+    angular[5] = y * z;
+    dAngular[0] = Vector3d(2.0 * x, 0.0, 0.0);
+    dAngular[1] = Vector3d(0.0, 2.0 * y, 0.0);
+    dAngular[2] = Vector3d(0.0, 0.0, 2.0 * z);
+    dAngular[3] = Vector3d(y, x, 0.0);
+    dAngular[4] = Vector3d(z, 0.0, x);
+    dAngular[5] = Vector3d(0.0, z, y);
+    ddAngular[0](0, 0) = ddAngular[1](1, 1) = ddAngular[2](2, 2) = 2.0;
+    ddAngular[3](0, 1) = ddAngular[3](1, 0) = 1.0;
+    ddAngular[4](0, 2) = ddAngular[4](2, 0) = 1.0;
+    ddAngular[5](1, 2) = ddAngular[5](2, 1) = 1.0;
+    break;
+  case D5:
+    // Order in d0, d+1, d-1, d+2, d-2, as in pointD5
+    angular[0] = z * z - dr2;
+    angular[1] = x * z;
+    angular[2] = y * z;
+    angular[3] = x * x - y * y;
+    angular[4] = x * y;
+    dAngular[0] = Vector3d(-2.0 * x, -2.0 * y, 0.0);
+    dAngular[1] = Vector3d(z, 0.0, x);
+    dAngular[2] = Vector3d(0.0, z, y);
+    dAngular[3] = Vector3d(2.0 * x, -2.0 * y, 0.0);
+    dAngular[4] = Vector3d(y, x, 0.0);
+    ddAngular[0](0, 0) = ddAngular[0](1, 1) = -2.0;
+    ddAngular[1](0, 2) = ddAngular[1](2, 0) = 1.0;
+    ddAngular[2](1, 2) = ddAngular[2](2, 1) = 1.0;
+    ddAngular[3](0, 0) = 2.0;
+    ddAngular[3](1, 1) = -2.0;
+    ddAngular[4](0, 1) = ddAngular[4](1, 0) = 1.0;
+    break;
+  default:
+    return;
+  }
+
+  unsigned int baseIndex = set->m_moIndices[basis];
+  for (int c = 0; c < components; ++c) {
+    values[baseIndex + c] = angular[c] * radial[c];
+    if (gradients) {
+      gradients[baseIndex + c] = dAngular[c] * radial[c]
+          + angular[c] * slope[c] * delta;
+    }
+    if (hessians) {
+      // The product rule for angular * radial
+      Matrix3d cross = slope[c] * dAngular[c] * delta.transpose();
+      hessians[baseIndex + c] = ddAngular[c] * radial[c] + cross
+          + cross.transpose() + angular[c]
+          * (slope[c] * Matrix3d::Identity()
+             + curvature[c] * delta * delta.transpose());
+    }
+  }
 }
 
 inline double GaussianSet::pointS(GaussianSet *set, unsigned int moIndex,
-                                  double dr2, unsigned int indexMO)
+                                  double dr2)
 {
   // If the MO coefficient is very small skip it
-  if (isSmall(set->m_moMatrix.coeffRef(set->m_moIndices[moIndex], indexMO))) {
+  if (isSmall(set->m_moCoeffs[set->m_moIndices[moIndex]])) {
     return 0.0;
   }
 
@@ -497,12 +1540,11 @@ inline double GaussianSet::pointS(GaussianSet *set, unsigned int moIndex,
     tmp += set->m_gtoCN[cIndex++] * exp(-set->m_gtoA[i] * dr2);
   }
   // There is one MO coefficient per S shell basis
-  return tmp * set->m_moMatrix.coeffRef(set->m_moIndices[moIndex], indexMO);
+  return tmp * set->m_moCoeffs[set->m_moIndices[moIndex]];
 }
 
 inline double GaussianSet::pointP(GaussianSet *set, unsigned int moIndex,
-                                  const Vector3d &delta,
-                                  double dr2, unsigned int indexMO)
+                                  const Vector3d &delta, double dr2)
 {
   // P type orbitals have three components and each component has a different
   // independent MO weighting. Many things can be cached to save time though
@@ -520,16 +1562,15 @@ inline double GaussianSet::pointP(GaussianSet *set, unsigned int moIndex,
   }
 
   // Calculate the prefactors for Px, Py and Pz
-  double Px = set->m_moMatrix.coeffRef(baseIndex  , indexMO);
-  double Py = set->m_moMatrix.coeffRef(baseIndex+1, indexMO);
-  double Pz = set->m_moMatrix.coeffRef(baseIndex+2, indexMO);
+  double Px = set->m_moCoeffs[baseIndex];
+  double Py = set->m_moCoeffs[baseIndex+1];
+  double Pz = set->m_moCoeffs[baseIndex+2];
 
   return Px*x + Py*y + Pz*z;
 }
 
 inline double GaussianSet::pointD(GaussianSet *set, unsigned int moIndex,
-                                  const Vector3d &delta,
-                                  double dr2, unsigned int indexMO)
+                                  const Vector3d &delta, double dr2)
 {
   // D type orbitals have six components and each component has a different
   // independent MO weighting. Many things can be cached to save time though
@@ -551,24 +1592,23 @@ inline double GaussianSet::pointD(GaussianSet *set, unsigned int moIndex,
   }
 
   // Calculate the prefactors
-  double Dxx = set->m_moMatrix.coeffRef(baseIndex  , indexMO) * delta.x()
+  double Dxx = set->m_moCoeffs[baseIndex] * delta.x()
       * delta.x();
-  double Dyy = set->m_moMatrix.coeffRef(baseIndex+1, indexMO) * delta.y()
+  double Dyy = set->m_moCoeffs[baseIndex+1] * delta.y()
       * delta.y();
-  double Dzz = set->m_moMatrix.coeffRef(baseIndex+2, indexMO) * delta.z()
+  double Dzz = set->m_moCoeffs[baseIndex+2] * delta.z()
       * delta.z();
-  double Dxy = set->m_moMatrix.coeffRef(baseIndex+3, indexMO) * delta.x()
+  double Dxy = set->m_moCoeffs[baseIndex+3] * delta.x()
       * delta.y();
-  double Dxz = set->m_moMatrix.coeffRef(baseIndex+4, indexMO) * delta.x()
+  double Dxz = set->m_moCoeffs[baseIndex+4] * delta.x()
       * delta.z();
-  double Dyz = set->m_moMatrix.coeffRef(baseIndex+5, indexMO) * delta.y()
+  double Dyz = set->m_moCoeffs[baseIndex+5] * delta.y()
       * delta.z();
   return Dxx*xx + Dyy*yy + Dzz*zz + Dxy*xy + Dxz*xz + Dyz*yz;
 }
 
 inline double GaussianSet::pointD5(GaussianSet *set, unsigned int moIndex,
-                                   const Vector3d &delta,
-                                   double dr2, unsigned int indexMO)
+                                   const Vector3d &delta, double dr2)
 {
   // D type orbitals have five components and each component has a different
   // MO weighting. Many things can be cached to save time
@@ -596,11 +1636,11 @@ inline double GaussianSet::pointD5(GaussianSet *set, unsigned int moIndex,
   double xz = delta.x() * delta.z();
   double yz = delta.y() * delta.z();
 
-  double D0  = set->m_moMatrix.coeffRef(baseIndex  , indexMO) * (zz - dr2);
-  double D1p = set->m_moMatrix.coeffRef(baseIndex+1, indexMO) * xz;
-  double D1n = set->m_moMatrix.coeffRef(baseIndex+2, indexMO) * yz;
-  double D2p = set->m_moMatrix.coeffRef(baseIndex+3, indexMO) * (xx - yy);
-  double D2n = set->m_moMatrix.coeffRef(baseIndex+4, indexMO) * xy;
+  double D0  = set->m_moCoeffs[baseIndex] * (zz - dr2);
+  double D1p = set->m_moCoeffs[baseIndex+1] * xz;
+  double D1n = set->m_moCoeffs[baseIndex+2] * yz;
+  double D2p = set->m_moCoeffs[baseIndex+3] * (xx - yy);
+  double D2n = set->m_moCoeffs[baseIndex+4] * xy;
 
   return D0*d0 + D1p*d1p + D1n*d1n + D2p*d2p + D2n*d2n;
 }
@@ -714,6 +1754,8 @@ inline void GaussianSet::pointD5(GaussianSet *set, const Eigen::Vector3d &delta,
 unsigned int GaussianSet::numMOs()
 {
   // Return the total number of MOs
+  if (m_orbitalSource)
+    return m_orbitalSource->numMOs();
   return m_moMatrix.rows();
 }
 
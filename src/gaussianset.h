@@ -19,8 +19,11 @@
 #define GAUSSIANSET_H
 
 #include "basisset.h"
+#include "orbitalsource.h"
 
 #include <QtCore/QFuture>
+#include <QtCore/QHash>
+#include <QtCore/QSharedPointer>
 
 #include <Eigen/Core>
 #include <vector>
@@ -64,7 +67,8 @@ public:
   GaussianSet();
 
   /**
-   * Destructor.
+   * Destructor. A calculation that is still running is canceled, and its
+   * cube unlocked.
    */
   ~GaussianSet();
 
@@ -105,11 +109,39 @@ public:
    */
   void addMO(double MO);
 
+  /**
+   * Remove the MO coefficients, added with addMOs or read from an orbital
+   * source, numMOs() is zero afterwards.
+   */
+  void clearMOs();
+
+  /**
+   * Remove the atoms, the basis functions, the MOs and the density matrix,
+   * so that another basis set can be read in.
+   */
+  void clear();
+
   /**
    * Set the SCF density matrix for the GaussianSet.
    */
   bool setDensityMatrix(const Eigen::MatrixXd &m);
 
+  /**
+   * Read the MO coefficients and density matrix from @a source when they
+   * are needed, rather than adding them up front. Replaces any MOs added
+   * with addMOs.
+   */
+  void setOrbitalSource(const QSharedPointer<OrbitalSource> &source);
+
+  /**
+   * @return The source the MO coefficients are read from, null if they were
+   * added with addMOs.
+   */
+  QSharedPointer<OrbitalSource> orbitalSource() const
+  {
+    return m_orbitalSource;
+  }
+
   /**
    * Debug routine, outputs all of the data in the GaussianSet.
    */
@@ -140,22 +172,53 @@ public:
    */
   bool calculateCubeDensity(Cube *cube);
 
+  /**
+   * Prepare the calculation of single points with pointValue.
+   */
+  bool initPointValues(Cube::Type type, unsigned int mo = 1);
+
+  /**
+   * @return The value prepared by initPointValues at @a pos (in Angstrom).
+   */
+  double pointValue(const Eigen::Vector3d &pos);
+
   /**
    * When performing a calculation the QFutureWatcher is useful if you want
    * to update a progress bar.
    */
   QFutureWatcher<void> & watcher() { return m_watcher; }
 
+  bool isCalculating() const { return m_cube != 0; }
+
   /**
    * Create a deep copy of @a this and return a pointer to it.
    */
   virtual BasisSet * clone();
 
-signals:
   /**
-   * Emitted when the calculation is complete.
+   * With an orbital source only the MO or the density matrix of the cube is
+   * hashed, along with the basis functions.
    */
-  void finished();
+  QByteArray cubeHash(Cube::Type type, unsigned int mo) const;
+
+  /**
+   * The number of Hermite Gaussians of the electrostatic potential, up to
+   * the fourth order needed by pairs of d shells.
+   */
+  static const int HERMITE_COUNT = 35;
+
+protected:
+  void hashContent(QCryptographicHash &hash) const;
+  std::vector<Eigen::Vector3d> nuclearPositions() const;
+  void calculateTile(const Eigen::Vector3d *points, unsigned int count,
+                     const Eigen::Vector3d &center, double radius,
+                     double *values, Eigen::Vector3d *gradients,
+                     Eigen::Matrix3d *hessians, double *kineticEnergies);
+  double valueLengthUnit() const;
+  bool gradientBounds(const Cube *cube,
+                      const std::vector<Eigen::Vector3d> &min,
+                      const std::vector<Eigen::Vector3d> &max,
+                      std::vector<double> &bounds, QFuture<void> &future);
 
 private slots:
   /**
@@ -164,6 +227,8 @@ private slots:
   void calculationComplete();
 
 private:
+  friend class BasisSetSnapshot;
+
   // New storage of the data
   std::vector<int> m_symmetry;             //! Symmetry of the basis, S, P...
   std::vector<unsigned int> m_atomIndices; //! Indices into the atomPos vector
@@ -175,6 +240,10 @@ private:
   std::vector<double> m_gtoCN;             //! The GTO contraction coefficient (normalized)
   Eigen::MatrixXd m_moMatrix;              //! MO coefficient matrix
   Eigen::MatrixXd m_density;               //! Density matrix
+  QSharedPointer<OrbitalSource> m_orbitalSource; //! Source of the MOs, if any
+  QHash<unsigned int, Eigen::VectorXd> m_moColumns; //! MOs read from source
+  const double *m_moCoeffs; //! Coefficients of the MO being calculated
+  Cube::Type m_pointType;   //! The type calculated by pointValue
 
   unsigned int m_numMOs;    //! The number of GTOs
   unsigned int m_numAtoms;  //! Total number of atoms in the basis set
@@ -184,24 +253,67 @@ private:
   QFutureWatcher<void> m_watcher;
   Cube *m_cube; //! Cube to put the results into
   QVector<GaussianShell> *m_gaussianShells;
+  std::vector<BoundTile> *m_boundTiles; //! Of a gradientBounds job, if any
+
+  /// A pair of primitives of the density expanded in Hermite Gaussians, for
+  /// the electrostatic potential
+  struct HermitePair
+  {
+    double exponent;         //! Sum of the exponents of the primitives
+    Eigen::Vector3d center;  //! Center of their product, in Bohr
+    unsigned int order;      //! Largest t + u + v of the expansion
+    unsigned int offset;     //! Into m_hermiteCoefficients
+  };
+
+  /// A pair of shells of the density, with the multipoles used far from it
+  struct ShellPair
+  {
+    unsigned int first, last;       //! Range of m_hermitePairs
+    Eigen::Vector3d center;         //! Origin of the multipoles, in Bohr
+    double extent;                  //! Distance beyond which they are used
+    unsigned int order;             //! Largest order of the multipoles
+    double multipoles[HERMITE_COUNT]; //! Hermite multipoles
+  };
+
+  std::vector<HermitePair> m_hermitePairs;
+  std::vector<double> m_hermiteCoefficients; //! Times 2 pi / exponent
+  std::vector<ShellPair> m_shellPairs;
+  QByteArray m_espHash; //! hash() of the basis set m_shellPairs expand
 
   static bool isSmall(double val);
 
   void initCalculation();  //! Perform initialisation before any calculations
+  bool loadMO(unsigned int indexMO); //! Point m_moCoeffs at the MO, false if missing
+  bool loadDensity();      //! Read the density matrix in, false if missing
+  bool initESP();          //! Expand the density into m_shellPairs, once
+  /// The electrostatic potential at @a count @a points, in Angstrom
+  void calculateESP(const Eigen::Vector3d *points, unsigned int count,
+                    const Eigen::Vector3d &center, double radius,
+                    double *values) const;
+  void calculateLevel();   //! Start the calculation of the current level
+  /// Boxes whose gradient bounds are worked out together
+  struct BoundTile;
+  static void boundTile(BoundTile &tile);
   /// Re-entrant single point forms of the calculations
   static void processPoint(GaussianShell &shell);
   static void processDensity(GaussianShell &shell);
+  /// Value of the loaded MO, or the density, at pos in Bohr
+  static double moValue(GaussianSet *set, const Eigen::Vector3d &pos);
+  static double densityValue(GaussianSet *set, const Eigen::Vector3d &pos);
   static double pointS(GaussianSet *set, unsigned int moIndex,
-                       double dr2, unsigned int indexMO);
+                       double dr2);
   static double pointP(GaussianSet *set, unsigned int moIndex,
-                       const Eigen::Vector3d &delta,
-                       double dr2, unsigned int indexMO);
+                       const Eigen::Vector3d &delta, double dr2);
   static double pointD(GaussianSet *set, unsigned int moIndex,
-                       const Eigen::Vector3d &delta,
-                       double dr2, unsigned int indexMO);
+                       const Eigen::Vector3d &delta, double dr2);
   static double pointD5(GaussianSet *set, unsigned int moIndex,
-                        const Eigen::Vector3d &delta,
-                        double dr2, unsigned int indexMO);
+                        const Eigen::Vector3d &delta, double dr2);
+  /// Values, and gradients and Hessians if not null, of the components of
+  /// a shell
+  static void shellValues(GaussianSet *set, unsigned int basis,
+                          const Eigen::Vector3d &delta, double dr2,
+                          double *values, Eigen::Vector3d *gradients,
+                          Eigen::Matrix3d *hessians);
   /// Calculate the basis for the density
   static void pointS(GaussianSet *set, double dr2, int basis,
                      Eigen::MatrixXd &out);
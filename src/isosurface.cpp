@@ -0,0 +1,432 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "isosurface.h"
+
+#include "cube.h"
+#include "cubescheduler.h"
+
+#include <QtCore/QReadLocker>
+#include <QtCore/QReadWriteLock>
+
+#include <algorithm>
+
+using Eigen::Vector3d;
+using Eigen::Vector3f;
+using std::vector;
+
+namespace OpenQube {
+
+namespace {
+
+// The number of cells along each side of a brick
+const int BRICK_SIZE = 16;
+
+/**
+ * The marching cubes cases. Corner c of a cell is offset by (c & 1,
+ * c >> 1 & 1, c >> 2 & 1) points from its origin, and bit c of a case is set
+ * if that corner is beyond the isovalue. Edges 0-3 run along x, 4-7 along y
+ * and 8-11 along z.
+ *
+ * Rather than being written out, the cases are derived from the faces of the
+ * cell: on each face the surface cuts off every run of corners that are
+ * beyond the isovalue, and the cuts are joined into polygons. A face is cut
+ * the same way by both cells sharing it, so the surface has no cracks even
+ * where the face is ambiguous.
+ */
+class CaseTable
+{
+public:
+  CaseTable();
+
+  int edgeAxis[12];    // The axis each edge runs along
+  int edgeCorner[12];  // The corner each edge starts from
+  int triangleCount[256];
+  int triangles[256][30]; // Three edges per triangle
+
+private:
+  int edge(int a, int b) const;
+};
+
+CaseTable::CaseTable()
+{
+  for (int e = 0; e < 12; ++e) {
+    int axis = e / 4;
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    edgeAxis[e] = axis;
+    edgeCorner[e] = (e & 1) << u | (e >> 1 & 1) << v;
+  }
+
+  for (int c = 0; c < 256; ++c) {
+    // The cut on each face runs from the edge entering a run of corners to
+    // the edge leaving it, walking the face counter-clockwise from outside
+    int next[12];
+    for (int e = 0; e < 12; ++e)
+      next[e] = -1;
+    for (int face = 0; face < 6; ++face) {
+      int axis = face / 2, side = face % 2;
+      int u = (axis + 1) % 3, v = (axis + 2) % 3;
+      int corners[4] = { side << axis, side << axis | 1 << u,
+                         side << axis | 1 << u | 1 << v,
+                         side << axis | 1 << v };
+      if (!side)
+        std::swap(corners[1], corners[3]);
+      bool beyond[4];
+      for (int i = 0; i < 4; ++i)
+        beyond[i] = c >> corners[i] & 1;
+      for (int i = 0; i < 4; ++i) {
+        if (!beyond[i] || beyond[(i + 3) % 4])
+          continue;
+        int j = i;
+        while (beyond[(j + 1) % 4])
+          j = (j + 1) % 4;
+        int entry = edge(corners[(i + 3) % 4], corners[i]);
+        int exit = edge(corners[j], corners[(j + 1) % 4]);
+        next[entry] = exit;
+      }
+    }
+
+    // Each closed chain of cuts is a polygon, split into a fan of triangles
+    triangleCount[c] = 0;
+    bool used[12] = { false };
+    for (int e = 0; e < 12; ++e) {
+      if (next[e] < 0 || used[e])
+        continue;
+      int polygon[12];
+      int size = 0;
+      for (int f = e; !used[f]; f = next[f]) {
+        used[f] = true;
+        polygon[size++] = f;
+      }
+      for (int i = 1; i + 1 < size; ++i) {
+        int *triangle = triangles[c] + 3 * triangleCount[c]++;
+        triangle[0] = polygon[0];
+        triangle[1] = polygon[i];
+        triangle[2] = polygon[i + 1];
+      }
+    }
+  }
+}
+
+int CaseTable::edge(int a, int b) const
+{
+  for (int e = 0; e < 12; ++e)
+    if (edgeCorner[e] == std::min(a, b) && edgeCorner[e] + (1 << edgeAxis[e])
+        == std::max(a, b))
+      return e;
+  return -1;
+}
+
+struct Extraction;
+
+// A cell the surface passes through, and its case
+struct Cell
+{
+  int i, j, k, c;
+};
+
+/**
+ * A brick of cells, which owns the edges leaving its points in the positive
+ * direction. The last brick along each axis also owns the last points.
+ */
+struct Brick
+{
+  Extraction *extraction;
+  int begin[3];   // The first point
+  int end[3];     // One past the last point owned
+  int cellEnd[3]; // One past the last cell
+  double minValue, maxValue;
+  bool active;
+  vector<int> edges; // Vertex of each owned edge, -1 if it is not cut
+  vector<Vector3f> vertices, normals;
+  vector<Cell> cells;
+  unsigned int triangleCount, vertexOffset, triangleOffset;
+};
+
+/**
+ * The state shared by the bricks of one cube.
+ */
+struct Extraction
+{
+  const double *data;
+  int points[3];
+  int strides[3];
+  Vector3d min, spacing;
+  int brickCounts[3];
+  vector<Brick> bricks;
+  CaseTable table;
+  // The surface being extracted, negated for negative isovalues so that the
+  // values beyond it are always the larger ones
+  double level, sign;
+  Isosurface::Mesh *mesh;
+
+  unsigned int index(int i, int j, int k) const
+  {
+    return i * strides[0] + j * strides[1] + k;
+  }
+
+  Vector3d gradient(int i, int j, int k) const;
+  const Brick & owner(int i, int j, int k) const;
+};
+
+Vector3d Extraction::gradient(int i, int j, int k) const
+{
+  int p[3] = { i, j, k };
+  unsigned int center = index(i, j, k);
+  Vector3d g;
+  for (int a = 0; a < 3; ++a) {
+    // Central differences inside the cube, one-sided on its faces
+    unsigned int lower = p[a] > 0 ? center - strides[a] : center;
+    unsigned int upper = p[a] + 1 < points[a] ? center + strides[a] : center;
+    int steps = (p[a] > 0) + (p[a] + 1 < points[a]);
+    g[a] = steps ? (data[upper] - data[lower]) / (steps * spacing[a]) : 0.0;
+  }
+  return g;
+}
+
+const Brick & Extraction::owner(int i, int j, int k) const
+{
+  int b[3] = { i / BRICK_SIZE, j / BRICK_SIZE, k / BRICK_SIZE };
+  for (int a = 0; a < 3; ++a)
+    if (b[a] >= brickCounts[a])
+      b[a] = brickCounts[a] - 1;
+  return bricks[(b[0] * brickCounts[1] + b[1]) * brickCounts[2] + b[2]];
+}
+
+// Find the range of the values on the cells of the brick
+void findRange(Brick &brick)
+{
+  const Extraction &e = *brick.extraction;
+  double minValue = e.data[e.index(brick.begin[0], brick.begin[1],
+                                   brick.begin[2])];
+  double maxValue = minValue;
+  for (int i = brick.begin[0]; i <= brick.cellEnd[0]; ++i) {
+    for (int j = brick.begin[1]; j <= brick.cellEnd[1]; ++j) {
+      const double *row = e.data + e.index(i, j, 0);
+      for (int k = brick.begin[2]; k <= brick.cellEnd[2]; ++k) {
+        minValue = std::min(minValue, row[k]);
+        maxValue = std::max(maxValue, row[k]);
+      }
+    }
+  }
+  brick.minValue = minValue;
+  brick.maxValue = maxValue;
+}
+
+// Create the vertices on the cut edges owned by the brick, and find the cells
+// the surface passes through
+void findVertices(Brick &brick)
+{
+  const Extraction &e = *brick.extraction;
+  brick.edges.clear();
+  brick.vertices.clear();
+  brick.normals.clear();
+  brick.cells.clear();
+  brick.triangleCount = 0;
+
+  // Every cut edge a brick's cells touch is owned by an active brick, as
+  // both of its points lie on the cells of its owner
+  double low = e.sign > 0 ? brick.minValue : -brick.maxValue;
+  double high = e.sign > 0 ? brick.maxValue : -brick.minValue;
+  brick.active = high > e.level && low <= e.level;
+  if (!brick.active)
+    return;
+
+  // Which side of the surface each point of the cells is on. The owned
+  // points are a subset, so the edges can be classified from them too.
+  int size[3];
+  for (int a = 0; a < 3; ++a)
+    size[a] = brick.cellEnd[a] - brick.begin[a] + 1;
+  vector<unsigned char> beyond(size[0] * size[1] * size[2]);
+  unsigned char *b = &beyond[0];
+  for (int i = brick.begin[0]; i <= brick.cellEnd[0]; ++i) {
+    for (int j = brick.begin[1]; j <= brick.cellEnd[1]; ++j) {
+      const double *row = e.data + e.index(i, j, 0);
+      for (int k = brick.begin[2]; k <= brick.cellEnd[2]; ++k)
+        *b++ = e.sign * row[k] > e.level;
+    }
+  }
+  int strides[3] = { size[1] * size[2], size[2], 1 };
+
+  brick.edges.resize((brick.end[0] - brick.begin[0])
+                     * (brick.end[1] - brick.begin[1])
+                     * (brick.end[2] - brick.begin[2]) * 3, -1);
+  int *edge = &brick.edges[0];
+  for (int i = brick.begin[0]; i < brick.end[0]; ++i) {
+    for (int j = brick.begin[1]; j < brick.end[1]; ++j) {
+      b = &beyond[0] + (i - brick.begin[0]) * strides[0]
+          + (j - brick.begin[1]) * strides[1];
+      for (int k = brick.begin[2]; k < brick.end[2]; ++k, ++b, edge += 3) {
+        int p[3] = { i, j, k };
+        for (int a = 0; a < 3; ++a) {
+          if (p[a] + 1 >= e.points[a] || *b == b[strides[a]])
+            continue;
+
+          unsigned int index = e.index(i, j, k);
+          double value = e.sign * e.data[index];
+          double other = e.sign * e.data[index + e.strides[a]];
+          double t = (e.level - value) / (other - value);
+          Vector3d position(i, j, k);
+          position[a] += t;
+          Vector3d gradient = (1.0 - t) * e.gradient(i, j, k);
+          p[a] += 1;
+          gradient += t * e.gradient(p[0], p[1], p[2]);
+          p[a] -= 1;
+          // The values beyond the isovalue are inside the surface
+          Vector3d normal = -e.sign * gradient;
+          if (normal.squaredNorm() > 0.0)
+            normal.normalize();
+
+          edge[a] = static_cast<int>(brick.vertices.size());
+          brick.vertices.push_back((e.min + e.spacing.cwiseProduct(position))
+                                   .cast<float>());
+          brick.normals.push_back(normal.cast<float>());
+        }
+      }
+    }
+  }
+
+  int offsets[8];
+  for (int corner = 0; corner < 8; ++corner)
+    offsets[corner] = (corner & 1) * strides[0] + (corner >> 1 & 1)
+        * strides[1] + (corner >> 2 & 1);
+  for (int i = brick.begin[0]; i < brick.cellEnd[0]; ++i) {
+    for (int j = brick.begin[1]; j < brick.cellEnd[1]; ++j) {
+      b = &beyond[0] + (i - brick.begin[0]) * strides[0]
+          + (j - brick.begin[1]) * strides[1];
+      for (int k = brick.begin[2]; k < brick.cellEnd[2]; ++k, ++b) {
+        int c = 0;
+        for (int corner = 0; corner < 8; ++corner)
+          c |= b[offsets[corner]] << corner;
+        if (c == 0 || c == 255)
+          continue;
+        Cell cell = { i, j, k, c };
+        brick.cells.push_back(cell);
+        brick.triangleCount += e.table.triangleCount[c];
+      }
+    }
+  }
+}
+
+// Copy the vertices of the brick into the mesh and write its triangles
+void writeTriangles(Brick &brick)
+{
+  if (!brick.active)
+    return;
+  const Extraction &e = *brick.extraction;
+  Isosurface::Mesh &mesh = *e.mesh;
+  std::copy(brick.vertices.begin(), brick.vertices.end(),
+            mesh.vertices.begin() + brick.vertexOffset);
+  std::copy(brick.normals.begin(), brick.normals.end(),
+            mesh.normals.begin() + brick.vertexOffset);
+
+  unsigned int *index = brick.triangleCount
+      ? &mesh.indices[3 * brick.triangleOffset] : 0;
+  for (vector<Cell>::const_iterator cell = brick.cells.begin();
+       cell != brick.cells.end(); ++cell) {
+    int count = 3 * e.table.triangleCount[cell->c];
+    for (int n = 0; n < count; ++n) {
+      int edge = e.table.triangles[cell->c][n];
+      int corner = e.table.edgeCorner[edge];
+      int p[3] = { cell->i + (corner & 1), cell->j + (corner >> 1 & 1),
+                   cell->k + (corner >> 2 & 1) };
+      const Brick &owner = e.owner(p[0], p[1], p[2]);
+      int local = ((p[0] - owner.begin[0]) * (owner.end[1] - owner.begin[1])
+                   + p[1] - owner.begin[1])
+          * (owner.end[2] - owner.begin[2]) + p[2] - owner.begin[2];
+      *index++ = owner.vertexOffset
+          + owner.edges[3 * local + e.table.edgeAxis[edge]];
+    }
+  }
+}
+
+} // End anonymous namespace
+
+Isosurface::Mesh Isosurface::extract(const Cube &cube, double isovalue)
+{
+  return extract(cube, vector<double>(1, isovalue)).front();
+}
+
+vector<Isosurface::Mesh> Isosurface::extract(const Cube &cube,
+                                             const vector<double> &isovalues)
+{
+  vector<Mesh> meshes(isovalues.size());
+  for (unsigned int i = 0; i < isovalues.size(); ++i)
+    meshes[i].isovalue = isovalues[i];
+
+  QReadLocker locker(cube.lock());
+  Eigen::Vector3i points = cube.dimensions();
+  if (points.minCoeff() < 2 || cube.data()->size()
+      != static_cast<size_t>(points[0]) * points[1] * points[2])
+    return meshes;
+
+  Extraction e;
+  e.data = &(*cube.data())[0];
+  e.min = cube.min();
+  e.spacing = cube.spacing();
+  for (int a = 0; a < 3; ++a) {
+    e.points[a] = points[a];
+    e.brickCounts[a] = (points[a] - 2) / BRICK_SIZE + 1;
+  }
+  e.strides[0] = points[1] * points[2];
+  e.strides[1] = points[2];
+  e.strides[2] = 1;
+
+  e.bricks.resize(e.brickCounts[0] * e.brickCounts[1] * e.brickCounts[2]);
+  vector<Brick>::iterator brick = e.bricks.begin();
+  for (int i = 0; i < e.brickCounts[0]; ++i) {
+    for (int j = 0; j < e.brickCounts[1]; ++j) {
+      for (int k = 0; k < e.brickCounts[2]; ++k, ++brick) {
+        int b[3] = { i, j, k };
+        brick->extraction = &e;
+        for (int a = 0; a < 3; ++a) {
+          brick->begin[a] = b[a] * BRICK_SIZE;
+          bool last = b[a] + 1 == e.brickCounts[a];
+          brick->end[a] = last ? points[a] : brick->begin[a] + BRICK_SIZE;
+          brick->cellEnd[a] = last ? points[a] - 1
+                                   : brick->begin[a] + BRICK_SIZE;
+        }
+      }
+    }
+  }
+  CubeScheduler *scheduler = CubeScheduler::instance();
+  scheduler->blockingMap(CubeScheduler::Interactive, e.bricks, findRange);
+
+  for (unsigned int m = 0; m < meshes.size(); ++m) {
+    Mesh &mesh = meshes[m];
+    e.sign = mesh.isovalue < 0.0 ? -1.0 : 1.0;
+    e.level = e.sign * mesh.isovalue;
+    e.mesh = &mesh;
+    scheduler->blockingMap(CubeScheduler::Interactive, e.bricks,
+                           findVertices);
+
+    unsigned int vertices = 0, triangles = 0;
+    for (brick = e.bricks.begin(); brick != e.bricks.end(); ++brick) {
+      brick->vertexOffset = vertices;
+      brick->triangleOffset = triangles;
+      vertices += brick->vertices.size();
+      triangles += brick->triangleCount;
+    }
+    mesh.vertices.resize(vertices);
+    mesh.normals.resize(vertices);
+    mesh.indices.resize(3 * triangles);
+    scheduler->blockingMap(CubeScheduler::Interactive, e.bricks,
+                           writeTriangles);
+  }
+  return meshes;
+}
+
+} // End namespace
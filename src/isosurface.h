@@ -0,0 +1,83 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_ISOSURFACE_H
+#define OQ_ISOSURFACE_H
+
+#include "openqubeabi.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+namespace OpenQube {
+
+class Cube;
+
+/**
+ * @class Isosurface isosurface.h <openqube/isosurface.h>
+ * @brief Isosurface extracts triangle meshes of the isosurfaces of a Cube
+ * with marching cubes.
+ *
+ * The cube is split into bricks of cells that are processed in parallel, in
+ * the Interactive class of CubeScheduler.
+ * Bricks whose values cannot straddle the isovalue are skipped without
+ * looking at their cells, so the cost is mostly in the bricks the surface
+ * passes through. Every vertex lies on a grid edge and is created once, by
+ * the brick that owns the edge, so the meshes are welded without any shared
+ * lookup table.
+ *
+ * The surface separates the values beyond the isovalue from the rest, that
+ * is the values above a positive isovalue or below a negative one. Normals
+ * are taken from the gradient of the field and point away from the values
+ * beyond the isovalue, so both lobes of an orbital drawn at +0.02 and -0.02
+ * face outwards. Triangles are wound counter-clockwise seen from the side
+ * the normals point to.
+ */
+
+class OPENQUBE_EXPORT Isosurface
+{
+public:
+  /**
+   * @struct Mesh
+   * An indexed triangle mesh.
+   */
+  struct Mesh
+  {
+    Mesh() : isovalue(0.0) {}
+    double isovalue;                       ///< The isovalue of the surface.
+    std::vector<Eigen::Vector3f> vertices; ///< Vertex positions.
+    std::vector<Eigen::Vector3f> normals;  ///< Unit normal of each vertex.
+    std::vector<unsigned int> indices;     ///< Three vertices per triangle.
+  };
+
+  /**
+   * Extract the isosurface of @a cube at @a isovalue. The cube is locked for
+   * reading while the mesh is extracted.
+   */
+  static Mesh extract(const Cube &cube, double isovalue);
+
+  /**
+   * Extract the isosurfaces of @a cube at each of @a isovalues, sharing the
+   * work that does not depend on the isovalue.
+   * @return One mesh for each isovalue, in the same order.
+   */
+  static std::vector<Mesh> extract(const Cube &cube,
+                                   const std::vector<double> &isovalues);
+};
+
+} // End namespace
+
+#endif
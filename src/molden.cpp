@@ -16,7 +16,9 @@
 
 #include "molden.h"
 
-#include <QtCore/QFile>
+#include "compressedfile.h"
+
+#include <QtCore/QCryptographicHash>
 #include <QtCore/QStringList>
 #include <QtCore/QDebug>
 
@@ -31,40 +33,95 @@ namespace OpenQube
 {
 
 MoldenFile::MoldenFile(const QString &filename, GaussianSet* basis):
-  m_coordFactor(1.0), m_currentMode(NotParsing)
+  m_coordFactor(1.0), m_currentMode(NotParsing), m_electrons(0),
+  m_numBasisFunctions(0)
 {
-  // Open the file for reading and process it
-  QFile* file = new QFile(filename);
+  if (CompressedFile::format(filename) != CompressedFile::None) {
+    readCompressed(filename);
+  }
+  else {
+    // The file is mapped by the orbital source, which reads the MOs from it
+    m_source = QSharedPointer<MoldenOrbitalSource>(
+          new MoldenOrbitalSource(filename));
+    m_in = LineReader(m_source->begin(), m_source->end());
+
+    qDebug() << "File" << filename << "opened.";
+
+    // Process the formatted checkpoint and extract all the information we
+    // need
+    while (!m_in.atEnd()) {
+      processLine();
+    }
+  }
 
-  file->open(QIODevice::ReadOnly | QIODevice::Text);
-  m_in = file;
+  // Now it should all be loaded load it into the basis set
+  load(basis);
+}
 
-  qDebug() << "File" << filename << "opened.";
+MoldenFile::~MoldenFile()
+{
+}
+
+// Sections start with their name in brackets, such as [GTO]
+static bool isSectionHeader(const char *line, const char *end)
+{
+  const char *p = skipSpaces(line, end);
+  return p < end && *p == '[';
+}
+
+static bool isMOSection(const char *begin, const char *end)
+{
+  const char *newline = static_cast<const char *>(
+        memchr(begin, '\n', end - begin));
+  QByteArray header(begin, static_cast<int>((newline ? newline : end) - begin));
+  return header.toLower().contains("[mo]");
+}
 
-  // Process the formatted checkpoint and extract all the information we need
-  while (!m_in->atEnd()) {
-    processLine();
+void MoldenFile::readCompressed(const QString &filename)
+{
+  // Only the [MO] section is kept, by the orbital source that reads the MOs
+  // from it, the rest is dropped once parsed
+  m_source = QSharedPointer<MoldenOrbitalSource>(new MoldenOrbitalSource);
+  CompressedFile file(filename);
+  if (!file.open(QIODevice::ReadOnly)) {
+    qDebug() << "Cannot decompress" << filename;
+    return;
   }
 
-  // Now it should all be loaded load it into the basis set
-  load(basis);
+  qDebug() << "File" << filename << "opened.";
 
-  delete file;
+  RecordReader sections(&file, isSectionHeader);
+  const char *begin, *end;
+  while (sections.readRecord(begin, end)) {
+    if (isMOSection(begin, end)) {
+      const char *text = m_source->keepText(begin, end);
+      end = text + (end - begin);
+      begin = text;
+    }
+    m_in = LineReader(begin, end);
+    while (!m_in.atEnd())
+      processLine();
+  }
+  m_in = LineReader();
 }
 
-MoldenFile::~MoldenFile()
+QString MoldenFile::readLine()
 {
+  const char *line, *end;
+  if (!m_in.readLine(line, end))
+    return QString();
+  return QString::fromLatin1(line, end - line).trimmed();
 }
 
 void MoldenFile::processLine()
 {
   // First truncate the line, remove trailing white space and check for blank lines
-  QString key = m_in->readLine().trimmed();
-  while(key.isEmpty() && !m_in->atEnd()) {
-    key = m_in->readLine().trimmed();
+  QString key = readLine();
+  while(key.isEmpty() && !m_in.atEnd()) {
+    key = readLine();
   }
 
-  if (m_in->atEnd())
+  if (key.isEmpty())
     return;
 
   QStringList list = key.split(' ', QString::SkipEmptyParts);
@@ -79,7 +136,9 @@ void MoldenFile::processLine()
   } else if (key.contains("[gto]", Qt::CaseInsensitive)) {
     m_currentMode = GTO;
   } else if (key.contains("[mo]", Qt::CaseInsensitive)) {
-    m_currentMode = MO;
+    // Only the position of each MO is recorded, see indexMOs
+    indexMOs();
+    m_currentMode = NotParsing;
   } else if (key.contains("[")) { // unknown section
     m_currentMode = NotParsing;
   } else {
@@ -103,7 +162,7 @@ void MoldenFile::processLine()
       // TODO: detect dead files and make bullet-proof
       int atom = list[0].toInt();
 
-      key = m_in->readLine().trimmed();
+      key = readLine();
       while (!key.isEmpty()) { // read the shell types in this GTO
         list = key.split(' ', QString::SkipEmptyParts);
         shell = list[0].toLower();
@@ -131,40 +190,96 @@ void MoldenFile::processLine()
 
         // now read all the exponents and contraction coefficients
         for (unsigned int gto = 0; gto < numGTOs; ++gto) {
-          key = m_in->readLine().trimmed();
+          key = readLine();
           list = key.split(' ', QString::SkipEmptyParts);
           m_a.push_back(list[0].toDouble());
           m_c.push_back(list[1].toDouble());
           if (shellType == SP && list.size() > 2)
             m_csp.push_back(list[2].toDouble());
         } // finished parsing a new GTO
-        key = m_in->readLine().trimmed(); // start reading the next shell
+        key = readLine(); // start reading the next shell
       }
     }
     break;
 
-    case MO:
-      // parse occ, spin, energy, etc.
-      while (!key.isEmpty() && key.contains('=')) {
-        key = m_in->readLine().trimmed();
-        list = key.split(' ', QString::SkipEmptyParts);
-        if (key.contains("occup", Qt::CaseInsensitive))
-          m_electrons += (int)list[1].toDouble();
-      }
-
-      // parse MO coefficients
-      while (!key.isEmpty() && !key.contains('=')) {
-        list = key.split(' ', QString::SkipEmptyParts);
-        if (list.size() < 2)
-          break;
+    default:
+      ;
+    }
+  }
+}
 
-        m_MOcoeffs.push_back(list[1].toDouble());
-        key = m_in->readLine().trimmed();
-      } // finished parsing a new MO
+// Check if the text from begin to end is key, ignoring case
+static bool isKey(const char *begin, const char *end, const char *key)
+{
+  if (static_cast<size_t>(end - begin) != strlen(key))
+    return false;
+  for (; begin != end; ++begin, ++key) {
+    char c = *begin;
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    if (c != *key)
+      return false;
+  }
+  return true;
+}
 
+void MoldenFile::indexMOs()
+{
+  // Each MO starts with lines such as Ene= -20.5 and Occup= 2.0, followed by
+  // lines with the index and value of each coefficient. Only the metadata is
+  // parsed, the coefficient lines are just found.
+  MoldenOrbitalSource::Orbital orbital;
+  bool inOrbital = false;
+  bool inHeader = false;
+  const char *line, *end;
+  while (!m_in.atEnd()) {
+    const char *start = m_in.pos();
+    m_in.readLine(line, end);
+    const char *p = skipSpaces(line, end);
+    if (p == end)
+      continue;
+    if (*p == '[') {
+      // The next section, leave it for processLine
+      m_in.seek(start);
       break;
     }
+
+    const char *equals = static_cast<const char *>(memchr(p, '=', end - p));
+    if (!equals) {
+      // A coefficient line
+      if (inHeader) {
+        orbital.begin = line;
+        inHeader = false;
+      }
+      orbital.end = end;
+      continue;
+    }
+
+    if (!inHeader) {
+      // The first line of the next MO
+      if (inOrbital)
+        m_source->addOrbital(orbital);
+      orbital = MoldenOrbitalSource::Orbital();
+      inOrbital = inHeader = true;
+    }
+    const char *keyEnd = equals;
+    while (keyEnd > p && isSpace(*(keyEnd - 1)))
+      --keyEnd;
+    const char *value = equals + 1;
+    if (isKey(p, keyEnd, "ene"))
+      parseDouble(value, end, orbital.energy);
+    else if (isKey(p, keyEnd, "occup")) {
+      parseDouble(value, end, orbital.occupation);
+      m_electrons += static_cast<int>(orbital.occupation);
+    }
+    else if (isKey(p, keyEnd, "spin")) {
+      value = skipSpaces(value, end);
+      orbital.beta = value != end && (*value == 'b' || *value == 'B');
+    }
   }
+  if (inOrbital)
+    m_source->addOrbital(orbital);
+  qDebug() << "Indexed" << m_source->numMOs() << "MOs.";
 }
 
 void MoldenFile::load(GaussianSet* basis)
@@ -180,6 +295,26 @@ void MoldenFile::load(GaussianSet* basis)
   int nGTO = 0;
   int nSP = 0; // number of SP shells
   for (unsigned int i = 0; i < m_shellTypes.size(); ++i) {
+    // Count the basis functions, the coefficients of each MO
+    switch (m_shellTypes.at(i)) {
+    case S:
+      m_numBasisFunctions += 1;
+      break;
+    case P:
+      m_numBasisFunctions += 3;
+      break;
+    case SP:
+      m_numBasisFunctions += 4;
+      break;
+    case D:
+      m_numBasisFunctions += 6;
+      break;
+    case F:
+      m_numBasisFunctions += 10;
+      break;
+    default:
+      ;
+    }
 
     // Handle the SP case separately - this should possibly be a distinct type
     if (m_shellTypes.at(i) == SP)  {
@@ -201,9 +336,10 @@ void MoldenFile::load(GaussianSet* basis)
       }
     }
   }
-  // Now to load in the MO coefficients
-  if (m_MOcoeffs.size())
-    basis->addMOs(m_MOcoeffs);
+  // The MO coefficients are read in when they are needed
+  m_source->setNumBasisFunctions(m_numBasisFunctions);
+  if (m_source->numMOs())
+    basis->setOrbitalSource(m_source);
 }
 
 void MoldenFile::outputAll()
@@ -213,9 +349,65 @@ void MoldenFile::outputAll()
     qDebug() << i << ": type =" << m_shellTypes.at(i)
              << ", number =" << m_shellNums.at(i)
              << ", atom =" << m_shelltoAtom.at(i);
-  qDebug() << "MO coefficients.";
-  for (unsigned int i = 0; i < m_MOcoeffs.size(); ++i)
-    qDebug() << m_MOcoeffs.at(i);
+  qDebug() << "MOs.";
+  for (unsigned int i = 0; i < m_source->numMOs(); ++i)
+    qDebug() << i << ": energy =" << m_source->orbital(i).energy
+             << ", occupation =" << m_source->orbital(i).occupation
+             << ", beta =" << m_source->orbital(i).beta;
+}
+
+MoldenOrbitalSource::MoldenOrbitalSource(const QString &filename)
+  : m_numBasisFunctions(0)
+{
+  if (!filename.isEmpty())
+    m_file.open(filename);
+}
+
+MoldenOrbitalSource::~MoldenOrbitalSource()
+{
+}
+
+const char * MoldenOrbitalSource::keepText(const char *begin, const char *end)
+{
+  m_texts.push_back(std::vector<char>(begin, end));
+  return &m_texts.back()[0];
+}
+
+bool MoldenOrbitalSource::readMO(unsigned int mo,
+                                 Eigen::VectorXd &column) const
+{
+  if (mo >= m_orbitals.size())
+    return false;
+
+  // Coefficients that are left out are zero
+  column = Eigen::VectorXd::Zero(m_numBasisFunctions);
+  const Orbital &orbital = m_orbitals[mo];
+  if (!orbital.begin)
+    return true;
+  LineReader in(orbital.begin, orbital.end);
+  const char *line, *end;
+  while (in.readLine(line, end)) {
+    const char *p = line;
+    int index;
+    double value;
+    if (!parseInt(p, end, index) || !parseDouble(p, end, value)) {
+      qDebug() << "Malformed MO coefficient:" << QByteArray(line, end - line);
+      return false;
+    }
+    if (index >= 1 && index <= static_cast<int>(m_numBasisFunctions))
+      column[index - 1] = value;
+  }
+  return true;
+}
+
+void MoldenOrbitalSource::hashContent(QCryptographicHash &hash) const
+{
+  hash.addData(reinterpret_cast<const char *>(&m_numBasisFunctions),
+               sizeof(m_numBasisFunctions));
+  for (unsigned int i = 0; i < m_orbitals.size(); ++i)
+    if (m_orbitals[i].begin)
+      hash.addData(m_orbitals[i].begin,
+                   static_cast<int>(m_orbitals[i].end - m_orbitals[i].begin));
 }
 
 }
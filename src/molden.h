@@ -18,13 +18,65 @@
 #define MOLDEN_H
 
 #include <Eigen/Core>
+#include <list>
 #include <vector>
 
 #include "gaussianset.h"
+#include "orbitalsource.h"
+#include "textparser.h"
 
 namespace OpenQube
 {
 
+/**
+ * Reads the MO coefficients of a Molden file on demand, from an index of the
+ * [MO] section built by MoldenFile. Holds the file mapped in memory for as
+ * long as the basis set, or any of its clones, needs it. Compressed files
+ * cannot be mapped, so a copy of just their [MO] section is held instead.
+ */
+class MoldenOrbitalSource : public OrbitalSource
+{
+public:
+  /// The position and metadata of an MO in the file
+  struct Orbital
+  {
+    Orbital() : energy(0.0), occupation(0.0), beta(false), begin(0), end(0) {}
+    double energy;
+    double occupation;
+    bool beta;
+    const char *begin; // Start of the first coefficient line
+    const char *end;   // End of the last coefficient line
+  };
+
+  /// Map @a filename, or hold nothing until keepText is called if empty
+  explicit MoldenOrbitalSource(const QString &filename = QString());
+  ~MoldenOrbitalSource();
+
+  /// The contents of the file
+  const char * begin() const { return m_file.begin(); }
+  const char * end() const { return m_file.end(); }
+
+  /// Keep a copy of the text from @a begin to @a end for as long as this
+  /// object exists, @return The start of the copy
+  const char * keepText(const char *begin, const char *end);
+
+  void addOrbital(const Orbital &orbital) { m_orbitals.push_back(orbital); }
+  const Orbital & orbital(unsigned int mo) const { return m_orbitals[mo]; }
+  void setNumBasisFunctions(unsigned int n) { m_numBasisFunctions = n; }
+
+  unsigned int numMOs() const { return m_orbitals.size(); }
+  bool readMO(unsigned int mo, Eigen::VectorXd &column) const;
+  bool hasDensity() const { return false; }
+  bool readDensity(Eigen::MatrixXd &) const { return false; }
+  void hashContent(QCryptographicHash &hash) const;
+
+private:
+  MappedFile m_file;
+  std::list<std::vector<char> > m_texts; //! Copies made by keepText
+  std::vector<Orbital> m_orbitals;
+  unsigned int m_numBasisFunctions;
+};
+
 class MoldenFile
 {
   // Parsing mode: section of the file currently being parsed
@@ -34,8 +86,13 @@ public:
   ~MoldenFile();
   void outputAll();
 private:
-  QIODevice *m_in;
+  QSharedPointer<MoldenOrbitalSource> m_source;
+  LineReader m_in;
+  /// Parse a compressed file a section at a time as it is decompressed
+  void readCompressed(const QString &filename);
+  QString readLine();
   void processLine();
+  void indexMOs();
   void load(GaussianSet* basis);
 
   double m_coordFactor;
@@ -50,8 +107,6 @@ private:
   std::vector<double> m_a;
   std::vector<double> m_c;
   std::vector<double> m_csp;
-  std::vector<double> m_orbitalEnergy;
-  std::vector<double> m_MOcoeffs;
 };
 
 } // End namespace
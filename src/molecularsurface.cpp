@@ -0,0 +1,583 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "molecularsurface.h"
+
+#include "cube.h"
+#include "cubescheduler.h"
+#include "molecule.h"
+
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QDebug>
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+using Eigen::Vector4d;
+using std::vector;
+
+namespace OpenQube {
+
+namespace {
+
+// Van der Waals radii in Angstrom by atomic number, zero where there is none
+const int RADII_COUNT = 93;
+const double VDW_RADII[RADII_COUNT] = {
+  0.00,
+  1.20, 1.40,                                                       // H-He
+  1.82, 1.53, 1.92, 1.70, 1.55, 1.52, 1.47, 1.54,                   // Li-Ne
+  2.27, 1.73, 1.84, 2.10, 1.80, 1.80, 1.75, 1.88,                   // Na-Ar
+  2.75, 2.31, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 1.63, 1.40, // K-Cu
+  1.39, 1.87, 2.11, 1.85, 1.90, 1.85, 2.02,                         // Zn-Kr
+  3.03, 2.49, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 1.63, 1.72, // Rb-Ag
+  1.58, 1.93, 2.17, 2.06, 2.06, 1.98, 2.16,                         // Cd-Xe
+  3.43, 2.68, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, // Cs-Gd
+  0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, 0.00, // Tb-Ir
+  1.75, 1.66, 1.55, 1.96, 2.02, 2.07, 1.97, 2.02, 2.20,             // Pt-Rn
+  3.48, 2.83, 0.00, 0.00, 0.00, 1.86                                // Fr-U
+};
+const double DEFAULT_RADIUS = 2.0;
+
+// Spheres sorted into a uniform grid of cells
+struct CellList
+{
+  Vector3d min;
+  double cellSize;
+  Vector3i cells;
+  vector<unsigned int> first;   // The first sphere of each cell, and the end
+  vector<Vector4d> spheres;     // Center and radius, ordered by cell
+};
+
+// Sort the van der Waals spheres of the atoms, expanded by the probe radius,
+// into cells as wide as the cutoff plus the largest radius, so that every
+// sphere reaching within the cutoff of a point is in the cell of the point or
+// a neighbouring one
+void buildCellList(const Molecule &molecule, double probe, double cutoff,
+                   CellList &list)
+{
+  vector<Vector4d> spheres;
+  for (size_t i = 0; i < molecule.numAtoms(); ++i) {
+    short atomicNumber = molecule.atomAtomicNumber(i);
+    if (atomicNumber <= 0)
+      continue;
+    Vector3d pos = molecule.atomPos(i);
+    spheres.push_back(Vector4d(pos.x(), pos.y(), pos.z(),
+                               MolecularSurface::vdwRadius(atomicNumber)
+                               + probe));
+  }
+  list.spheres.clear();
+  list.first.assign(1, 0);
+  list.min = Vector3d::Zero();
+  list.cellSize = cutoff;
+  list.cells = Vector3i::Zero();
+  if (spheres.empty())
+    return;
+
+  Vector3d min = spheres[0].head<3>(), max = min;
+  double largest = 0.0;
+  for (size_t i = 0; i < spheres.size(); ++i) {
+    min = min.cwiseMin(Vector3d(spheres[i].head<3>()));
+    max = max.cwiseMax(Vector3d(spheres[i].head<3>()));
+    largest = std::max(largest, spheres[i].w());
+  }
+  list.min = min;
+  list.cellSize = cutoff + largest;
+  for (int i = 0; i < 3; ++i)
+    list.cells[i] = static_cast<int>((max[i] - min[i]) / list.cellSize) + 1;
+
+  // Count the spheres of each cell, then place them by a prefix sum
+  vector<unsigned int> cellOf(spheres.size());
+  list.first.assign(list.cells.prod() + 1, 0);
+  for (size_t i = 0; i < spheres.size(); ++i) {
+    Vector3i c;
+    for (int j = 0; j < 3; ++j)
+      c[j] = std::min(static_cast<int>((spheres[i][j] - min[j])
+                                       / list.cellSize), list.cells[j] - 1);
+    cellOf[i] = (c.x() * list.cells.y() + c.y()) * list.cells.z() + c.z();
+    ++list.first[cellOf[i] + 1];
+  }
+  for (size_t c = 1; c < list.first.size(); ++c)
+    list.first[c] += list.first[c - 1];
+  vector<unsigned int> next(list.first.begin(), list.first.end() - 1);
+  list.spheres.resize(spheres.size());
+  for (size_t i = 0; i < spheres.size(); ++i)
+    list.spheres[next[cellOf[i]]++] = spheres[i];
+}
+
+const unsigned int NO_POINT = ~0u;
+
+// The index of the sphere pos is deepest in, looking only at those reaching
+// within cutoff of it, and that depth. NO_POINT and -cutoff if there are
+// none.
+inline unsigned int deepestSphere(const CellList &list, const Vector3d &pos,
+                                  double cutoff, double &depth)
+{
+  // The range of cells neighbouring the point, empty beyond the cells
+  int lower[3], upper[3];
+  for (int a = 0; a < 3; ++a) {
+    double cell = std::floor((pos[a] - list.min[a]) / list.cellSize);
+    cell = std::max(-2.0, std::min(cell, double(list.cells[a]) + 1.0));
+    lower[a] = std::max(static_cast<int>(cell) - 1, 0);
+    upper[a] = std::min(static_cast<int>(cell) + 1, list.cells[a] - 1);
+  }
+
+  depth = -cutoff;
+  unsigned int deepest = NO_POINT;
+  for (int x = lower[0]; x <= upper[0]; ++x) {
+    for (int y = lower[1]; y <= upper[1]; ++y) {
+      unsigned int row = (x * list.cells.y() + y) * list.cells.z();
+      for (unsigned int s = list.first[row + lower[2]];
+           s < list.first[row + upper[2] + 1]; ++s) {
+        const Vector4d &sphere = list.spheres[s];
+        double sphereDepth = sphere.w() - (pos - sphere.head<3>()).norm();
+        deepest = sphereDepth > depth ? s : deepest;
+        depth = std::max(depth, sphereDepth);
+      }
+    }
+  }
+  return deepest;
+}
+
+// A plane of points of the cube
+struct PlaneTask
+{
+  const CellList *list;
+  const Cube *cube;
+  double cutoff;
+  vector<double> *values;
+  vector<unsigned int> *deepest;
+  int plane;
+};
+
+void fillDepthPlane(PlaneTask &task)
+{
+  Vector3i dim = task.cube->dimensions();
+  Vector3d spacing = task.cube->spacing();
+  unsigned int index = task.plane * dim.y() * dim.z();
+  Vector3d pos = task.cube->min();
+  pos.x() += task.plane * spacing.x();
+  for (int j = 0; j < dim.y(); ++j) {
+    pos.y() = task.cube->min().y() + j * spacing.y();
+    for (int k = 0; k < dim.z(); ++k, ++index) {
+      pos.z() = task.cube->min().z() + k * spacing.z();
+      double depth;
+      unsigned int deepest = deepestSphere(*task.list, pos, task.cutoff,
+                                           depth);
+      (*task.values)[index] = depth;
+      if (task.deepest)
+        (*task.deepest)[index] = deepest;
+    }
+  }
+}
+
+// The depth of each point of the cube within the spheres of the list,
+// clamped to -cutoff, and optionally the sphere it is deepest in, NO_POINT
+// beyond the cutoff
+void sphereDepths(const CellList &list, double cutoff, const Cube &cube,
+                  vector<double> &depths, vector<unsigned int> *deepest)
+{
+  Vector3i dim = cube.dimensions();
+  depths.resize(dim.x() * dim.y() * dim.z());
+  if (deepest)
+    deepest->resize(depths.size());
+  vector<PlaneTask> tasks(dim.x());
+  for (int i = 0; i < dim.x(); ++i) {
+    tasks[i].list = &list;
+    tasks[i].cube = &cube;
+    tasks[i].cutoff = cutoff;
+    tasks[i].values = &depths;
+    tasks[i].deepest = deepest;
+    tasks[i].plane = i;
+  }
+  CubeScheduler::instance()->blockingMap(CubeScheduler::Interactive, tasks,
+                                         fillDepthPlane);
+}
+
+const double UNREACHED = std::numeric_limits<double>::infinity();
+
+// Replace each of the n samples f(q) of a line, spaced by h, with the least
+// f(r) + ((q - r) h)^2, and its feature with that of r, using the lower
+// envelope of the parabolas rooted at the samples (Felzenszwalb and
+// Huttenlocher). Unreached samples root no parabola, and stay unreached if
+// there is none.
+void transformLine(double *f, unsigned int *features, int n, double h,
+                   vector<int> &roots, vector<double> &starts,
+                   vector<double> &result, vector<unsigned int> &nearest)
+{
+  double h2 = h * h;
+  int k = -1;
+  for (int q = 0; q < n; ++q) {
+    if (f[q] == UNREACHED)
+      continue;
+    // Drop the parabolas hidden by this one, then start it where it meets the
+    // last one left
+    double start = -UNREACHED;
+    while (k >= 0) {
+      int r = roots[k];
+      start = (f[q] - f[r] + h2 * (q * q - r * r)) / (2.0 * h2 * (q - r));
+      if (start > starts[k])
+        break;
+      --k;
+    }
+    ++k;
+    roots[k] = q;
+    starts[k] = k ? start : -UNREACHED;
+  }
+  if (k < 0)
+    return;
+
+  int j = 0;
+  for (int q = 0; q < n; ++q) {
+    while (j < k && starts[j + 1] < q)
+      ++j;
+    int r = roots[j];
+    result[q] = f[r] + h2 * (q - r) * (q - r);
+    nearest[q] = features[r];
+  }
+  std::copy(result.begin(), result.begin() + n, f);
+  std::copy(nearest.begin(), nearest.begin() + n, features);
+}
+
+// The lines of the cube along one axis, in one plane across another axis
+struct LineTask
+{
+  vector<double> *squared;
+  vector<unsigned int> *features;
+  Vector3i dim;
+  double spacing;
+  int axis;
+  int plane;
+};
+
+void transformLines(LineTask &task)
+{
+  const Vector3i &dim = task.dim;
+  int n = dim[task.axis];
+  // The lines along z are contiguous, the others are gathered, along y in a
+  // plane of constant x and along x in a plane of constant y
+  int stride, lines, lineStep;
+  unsigned int first;
+  if (task.axis == 2) {
+    stride = 1;
+    lines = dim.y();
+    lineStep = dim.z();
+    first = task.plane * dim.y() * dim.z();
+  }
+  else if (task.axis == 1) {
+    stride = dim.z();
+    lines = dim.z();
+    lineStep = 1;
+    first = task.plane * dim.y() * dim.z();
+  }
+  else {
+    stride = dim.y() * dim.z();
+    lines = dim.z();
+    lineStep = 1;
+    first = task.plane * dim.z();
+  }
+
+  vector<double> line(n), starts(n), result(n);
+  vector<unsigned int> features(n), nearest(n);
+  vector<int> roots(n);
+  for (int l = 0; l < lines; ++l) {
+    unsigned int offset = first + l * lineStep;
+    for (int q = 0; q < n; ++q) {
+      line[q] = (*task.squared)[offset + q * stride];
+      features[q] = (*task.features)[offset + q * stride];
+    }
+    transformLine(&line[0], &features[0], n, task.spacing, roots, starts,
+                  result, nearest);
+    for (int q = 0; q < n; ++q) {
+      (*task.squared)[offset + q * stride] = line[q];
+      (*task.features)[offset + q * stride] = features[q];
+    }
+  }
+}
+
+// Replace the squared distances, zero at the seeds and unreached elsewhere,
+// with the squared distance to the nearest seed, and the features with the
+// index of that seed. One pass is made along each axis of the cube, and the
+// lines of each pass are transformed in parallel.
+void distanceTransform(vector<double> &squared,
+                       vector<unsigned int> &features, const Cube &cube)
+{
+  Vector3i dim = cube.dimensions();
+  if (squared.empty())
+    return;
+  for (int axis = 2; axis >= 0; --axis) {
+    // The planes across x, or across y for the lines along x
+    int planes = axis ? dim.x() : dim.y();
+    vector<LineTask> tasks(planes);
+    for (int i = 0; i < planes; ++i) {
+      tasks[i].squared = &squared;
+      tasks[i].features = &features;
+      tasks[i].dim = dim;
+      tasks[i].spacing = cube.spacing()[axis];
+      tasks[i].axis = axis;
+      tasks[i].plane = i;
+    }
+    CubeScheduler::instance()->blockingMap(CubeScheduler::Interactive, tasks,
+                                           transformLines);
+  }
+}
+
+// The index of the nearest of the seeds to each point of the cube, NO_POINT
+// if there are none
+void nearestSeeds(const vector<char> &seeds, const Cube &cube,
+                  vector<unsigned int> &nearest)
+{
+  vector<double> squared(seeds.size());
+  nearest.resize(seeds.size());
+  for (size_t i = 0; i < seeds.size(); ++i) {
+    squared[i] = seeds[i] ? 0.0 : UNREACHED;
+    nearest[i] = seeds[i] ? i : NO_POINT;
+  }
+  distanceTransform(squared, nearest, cube);
+}
+
+// Points closer than this to the surfaces of the spheres are taken to be on
+// them
+const double SURFACE_TOLERANCE = 1e-9;
+
+// Lower distance to the point of the sphere nearest to pos, if it lies on the
+// surface of the union of the spheres. Otherwise the point is moved to the
+// circle where the sphere meets the one covering it, nearest to pos, and
+// tried once more.
+void trySurfacePoint(const CellList &list, const Vector3d &pos,
+                     unsigned int sphereIndex, double cutoff,
+                     double &distance)
+{
+  const Vector4d &sphere = list.spheres[sphereIndex];
+  Vector3d center = sphere.head<3>();
+  Vector3d direction = pos - center;
+  if (direction.norm() == 0.0)
+    direction = Vector3d::UnitX();
+  Vector3d candidate = center + direction * (sphere.w() / direction.norm());
+  double depth;
+  unsigned int other = deepestSphere(list, candidate, cutoff, depth);
+  if (depth <= SURFACE_TOLERANCE) {
+    distance = std::min(distance, (pos - candidate).norm());
+    return;
+  }
+
+  const Vector4d &otherSphere = list.spheres[other];
+  Vector3d axis = otherSphere.head<3>() - center;
+  double separation = axis.norm();
+  if (separation == 0.0)
+    return;
+  axis /= separation;
+  double along = (separation * separation + sphere.w() * sphere.w()
+                  - otherSphere.w() * otherSphere.w()) / (2.0 * separation);
+  double radius2 = sphere.w() * sphere.w() - along * along;
+  Vector3d across = direction - direction.dot(axis) * axis;
+  if (radius2 <= 0.0)
+    return;
+  if (across.norm() == 0.0)
+    across = axis.unitOrthogonal();
+  candidate = center + along * axis
+      + across * (std::sqrt(radius2) / across.norm());
+  deepestSphere(list, candidate, cutoff, depth);
+  if (depth <= SURFACE_TOLERANCE)
+    distance = std::min(distance, (pos - candidate).norm());
+}
+
+// A plane of points inside the spheres, with the nearest points of the cube
+// outside them
+struct ReachTask
+{
+  const CellList *list;
+  const Cube *cube;
+  const vector<double> *depths;
+  const vector<unsigned int> *deepest;
+  const vector<unsigned int> *nearest;
+  double cutoff;
+  double target;
+  double window;
+  vector<double> *values;
+  int plane;
+};
+
+// The distance from each point inside the spheres to the region outside them
+// is at most the distance to the nearest point of the cube outside them.
+// Within the window around the target distance, the faces of the sphere the
+// point is deepest in and of the sphere the outside point is deepest in are
+// tried, along with the circles where they meet the spheres covering them.
+void fillReachPlane(ReachTask &task)
+{
+  const vector<unsigned int> &deepest = *task.deepest;
+  Vector3i dim = task.cube->dimensions();
+  unsigned int first = task.plane * dim.y() * dim.z();
+  unsigned int last = first + dim.y() * dim.z();
+  for (unsigned int i = first; i < last; ++i) {
+    if ((*task.depths)[i] <= 0.0)
+      continue;
+    unsigned int outside = (*task.nearest)[i];
+    if (outside == NO_POINT) {
+      (*task.values)[i] = UNREACHED;
+      continue;
+    }
+    Vector3d pos = task.cube->position(i);
+    double distance = (pos - task.cube->position(outside)).norm();
+    if (std::abs(distance - task.target) < task.window) {
+      trySurfacePoint(*task.list, pos, deepest[i], task.cutoff, distance);
+      if (deepest[outside] != NO_POINT && deepest[outside] != deepest[i])
+        trySurfacePoint(*task.list, pos, deepest[outside], task.cutoff,
+                        distance);
+    }
+    (*task.values)[i] = distance;
+  }
+}
+
+bool calculateSolventSurface(const Molecule &molecule, Cube *cube,
+                             double probe, bool excluded)
+{
+  if (probe < 0.0) {
+    qDebug() << "Invalid probe radius passed to MolecularSurface.";
+    return false;
+  }
+
+  // The depths within the spheres expanded by the probe radius, exact
+  // outside them for a band of points wide enough to hold the points
+  // nearest to the surface
+  double band = 2.0 * cube->spacing().maxCoeff();
+  CellList list;
+  buildCellList(molecule, probe, band, list);
+  vector<double> depths;
+  vector<unsigned int> deepest;
+  sphereDepths(list, band, *cube, depths, &deepest);
+  unsigned int count = depths.size();
+
+  // The distances from the points inside the accessible surface to the region
+  // the center of the probe can reach, outside it, found from the nearest
+  // point of the region, and refined near the surface
+  vector<char> seeds(count);
+  for (unsigned int i = 0; i < count; ++i)
+    seeds[i] = depths[i] <= 0.0;
+  vector<unsigned int> nearest;
+  nearestSeeds(seeds, *cube, nearest);
+  vector<double> values(count);
+  int planes = cube->dimensions().x();
+  vector<ReachTask> tasks(planes);
+  for (int i = 0; i < planes; ++i) {
+    tasks[i].list = &list;
+    tasks[i].cube = cube;
+    tasks[i].depths = &depths;
+    tasks[i].deepest = &deepest;
+    tasks[i].nearest = &nearest;
+    tasks[i].cutoff = band;
+    tasks[i].target = excluded ? probe : 0.0;
+    tasks[i].window = 2.0 * band;
+    tasks[i].values = &values;
+    tasks[i].plane = i;
+  }
+  CubeScheduler::instance()->blockingMap(CubeScheduler::Interactive, tasks,
+                                         fillReachPlane);
+
+  // The distances from the points outside, exact within the band and beyond
+  // it the distance to the sphere of the nearest point inside
+  for (unsigned int i = 0; i < count; ++i)
+    seeds[i] = !seeds[i];
+  nearestSeeds(seeds, *cube, nearest);
+  for (unsigned int i = 0; i < count; ++i) {
+    if (seeds[i])
+      continue;
+    if (depths[i] > -band) {
+      values[i] = depths[i];
+    }
+    else if (nearest[i] == NO_POINT) {
+      values[i] = -UNREACHED;
+    }
+    else {
+      const Vector4d &sphere = list.spheres[deepest[nearest[i]]];
+      values[i] = sphere.w() - (cube->position(i) - sphere.head<3>()).norm();
+    }
+  }
+
+  // The excluded surface is the reachable region grown by the probe, so
+  // inside it the distance is the distance to the region less the probe
+  // radius. Outside it this is a lower bound, as is the distance to the
+  // accessible surface plus the probe radius beyond that, and both are exact
+  // where the nearest point of the surface lies along the normal through the
+  // point.
+  if (excluded)
+    for (unsigned int i = 0; i < count; ++i)
+      values[i] -= probe;
+
+  // Beyond any surface within the cube, the distances are clamped to its
+  // diagonal
+  double diagonal = (cube->max() - cube->min()).norm();
+  for (unsigned int i = 0; i < count; ++i)
+    values[i] = std::max(-diagonal, std::min(values[i], diagonal));
+
+  cube->lock()->lockForWrite();
+  bool success = cube->setData(values);
+  cube->setCubeType(excluded ? Cube::SolventExcluded
+                             : Cube::SolventAccessible);
+  cube->lock()->unlock();
+  return success;
+}
+
+}
+
+double MolecularSurface::vdwRadius(int atomicNumber)
+{
+  if (atomicNumber > 0 && atomicNumber < RADII_COUNT
+      && VDW_RADII[atomicNumber] > 0.0)
+    return VDW_RADII[atomicNumber];
+  return DEFAULT_RADIUS;
+}
+
+bool MolecularSurface::calculateVdW(const Molecule &molecule, Cube *cube,
+                                    double cutoff)
+{
+  if (cutoff <= 0.0) {
+    qDebug() << "Invalid cutoff passed to MolecularSurface::calculateVdW.";
+    return false;
+  }
+
+  CellList list;
+  buildCellList(molecule, 0.0, cutoff, list);
+  vector<double> values;
+  sphereDepths(list, cutoff, *cube, values, 0);
+
+  cube->lock()->lockForWrite();
+  bool success = cube->setData(values);
+  cube->setCubeType(Cube::VdW);
+  cube->lock()->unlock();
+  return success;
+}
+
+bool MolecularSurface::calculateSolventAccessible(const Molecule &molecule,
+                                                  Cube *cube,
+                                                  double probeRadius)
+{
+  return calculateSolventSurface(molecule, cube, probeRadius, false);
+}
+
+bool MolecularSurface::calculateSolventExcluded(const Molecule &molecule,
+                                                Cube *cube,
+                                                double probeRadius)
+{
+  return calculateSolventSurface(molecule, cube, probeRadius, true);
+}
+
+} // End namespace
@@ -0,0 +1,112 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_MOLECULARSURFACE_H
+#define OQ_MOLECULARSURFACE_H
+
+#include "openqubeabi.h"
+
+namespace OpenQube {
+
+class Cube;
+class Molecule;
+
+/**
+ * @class MolecularSurface molecularsurface.h <openqube/molecularsurface.h>
+ * @brief MolecularSurface fills cubes with the signed distance to surfaces
+ * built from the van der Waals spheres of the atoms of a Molecule: the van
+ * der Waals, solvent accessible and solvent excluded surfaces.
+ *
+ * The distances are positive inside the surface and negative outside, like
+ * the electron density, so Isosurface::extract(cube, 0.0) gives the surface
+ * with its normals facing outwards. The positions of the atoms are taken to
+ * be in the units of the cube, Angstrom, and atoms with an atomic number of
+ * zero are ignored.
+ *
+ * The spheres are sorted into a uniform grid of cells at least as wide as
+ * the largest sphere plus the cutoff distance, so each point of the cube only
+ * looks at the spheres of the cell it lies in and of its neighbours. The
+ * cost grows linearly with the number of points of the cube, and does not
+ * depend on the number of atoms.
+ *
+ * The solvent surfaces are found from the spheres expanded by the probe
+ * radius, whose union is bounded by the solvent accessible surface. A
+ * separable Euclidean distance transform, one pass along each axis in time
+ * linear in the number of points and parallel over the lines of the cube,
+ * gives each point the nearest point of the cube on the other side of the
+ * surface. Near the surface the distance is then refined on the faces of the
+ * nearby spheres and the circles where they meet, so it is not limited by
+ * the spacing of the cube. The solvent excluded surface is the region the
+ * center of the probe can reach grown by the probe radius, so its distances
+ * follow from those to the solvent accessible surface.
+ *
+ * The planes and lines of the cube are shared out by CubeScheduler, as
+ * Interactive work.
+ */
+
+class OPENQUBE_EXPORT MolecularSurface
+{
+public:
+  /**
+   * @return The van der Waals radius of the element in Angstrom, from Bondi
+   * and, for the main group elements Bondi did not give, Mantina et al. Other
+   * elements default to 2.0.
+   */
+  static double vdwRadius(int atomicNumber);
+
+  /**
+   * Fill @a cube with the signed distance to the van der Waals surface of
+   * @a molecule, the union of the spheres of the atoms, and set its type to
+   * Cube::VdW. Outside the distance is exact, and is clamped to
+   * -@a cutoff further away. Inside it is the largest depth of the point
+   * within any one sphere, which is never more than its distance to the
+   * surface.
+   * @return True on success.
+   */
+  static bool calculateVdW(const Molecule &molecule, Cube *cube,
+                           double cutoff = 2.0);
+
+  /**
+   * Fill @a cube with the signed distance to the solvent accessible surface
+   * of @a molecule, traced by the center of a probe sphere of
+   * @a probeRadius rolling over the van der Waals spheres, and set its type
+   * to Cube::SolventAccessible. The cube should reach a few spacings beyond
+   * the surface. Points with no surface within the cube are clamped to the
+   * length of its diagonal.
+   * @return True on success.
+   */
+  static bool calculateSolventAccessible(const Molecule &molecule,
+                                         Cube *cube,
+                                         double probeRadius = 1.4);
+
+  /**
+   * Fill @a cube with the signed distance to the solvent excluded surface
+   * of @a molecule, the surface of the region a probe sphere of
+   * @a probeRadius rolling over the van der Waals spheres cannot enter, and
+   * set its type to Cube::SolventExcluded. Only the positions of the probe
+   * within the cube are considered, so the cube should reach a few spacings
+   * beyond the solvent accessible surface. Cavities the probe fits in are
+   * taken to be reachable, and have surfaces of their own. Points with no
+   * surface within the cube are clamped to the length of its diagonal.
+   * @return True on success.
+   */
+  static bool calculateSolventExcluded(const Molecule &molecule, Cube *cube,
+                                       double probeRadius = 1.4);
+};
+
+} // End namespace
+
+#endif
@@ -16,10 +16,11 @@
 
 #include "mopacaux.h"
 
+#include "compressedfile.h"
+#include "cubescheduler.h"
 #include "molecule.h"
 #include "slaterset.h"
 
-#include <QtCore/QFile>
 #include <QtCore/QStringList>
 #include <QtCore/QDebug>
 
@@ -30,19 +31,152 @@ using Eigen::Vector3d;
 namespace OpenQube
 {
 
-MopacAux::MopacAux(QString filename, SlaterSet* basis)
+// Arrays are written in free format, several numbers to a line. Large arrays
+// are split into chunks of lines that are decoded in parallel, once the
+// numbers in every chunk have been counted to find where its values go. The
+// chunks are run by the cube scheduler in the batch class, so that loading
+// shares the threads with cube calculations rather than competing for them.
+static const unsigned int CHUNK_LINES = 1024;
+
+namespace {
+struct TextChunk
+{
+  const char *begin;        // Start of the first line of the chunk
+  const char *end;          // End of the last line of the chunk
+  unsigned int first;       // Index of the first value in the chunk
+  unsigned int count;       // Number of values in the chunk
+  double *values;           // Destination of the array
+  bool ok;
+};
+}
+
+static void countChunk(TextChunk &chunk)
+{
+  unsigned int count = 0;
+  bool space = true;
+  for (const char *p = chunk.begin; p < chunk.end; ++p) {
+    if (space && !isSpace(*p))
+      ++count;
+    space = isSpace(*p);
+  }
+  chunk.count = count;
+}
+
+static void decodeChunk(TextChunk &chunk)
+{
+  const char *p = chunk.begin;
+  double *values = chunk.values + chunk.first;
+  for (unsigned int k = 0; k < chunk.count; ++k) {
+    if (!parseDouble(p, chunk.end, values[k])
+        || (p < chunk.end && !isSpace(*p))) {
+      chunk.ok = false;
+      return;
+    }
+  }
+  chunk.ok = true;
+}
+
+// Lines of numbers start with a digit, a sign or a decimal point
+static bool isNumberLine(const char *begin, const char *end)
+{
+  const char *p = skipSpaces(begin, end);
+  return p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+'
+                     || *p == '.');
+}
+
+// Read the first n values of the array starting at the current line of in,
+// which runs until the next line that is not a line of numbers.
+static bool readValues(LineReader &in, unsigned int n, double *values)
+{
+  std::vector<TextChunk> chunks;
+  for (unsigned int lines = 0; ; ++lines) {
+    const char *pos = in.pos();
+    const char *line, *end;
+    if (!in.readLine(line, end) || !isNumberLine(line, end)) {
+      in.seek(pos);
+      break;
+    }
+    if (lines % CHUNK_LINES == 0) {
+      TextChunk chunk = { line, end, 0, 0, values, false };
+      chunks.push_back(chunk);
+    }
+    chunks.back().end = end;
+  }
+
+  if (chunks.size() > 1)
+    CubeScheduler::instance()->blockingMap(CubeScheduler::Batch, chunks,
+                                           countChunk);
+  else if (chunks.size())
+    countChunk(chunks[0]);
+
+  // Work out where the values of each chunk go, dropping any past the n-th
+  unsigned int first = 0;
+  for (unsigned int c = 0; c < chunks.size(); ++c) {
+    chunks[c].first = first;
+    if (chunks[c].count > n - first)
+      chunks[c].count = n - first;
+    first += chunks[c].count;
+  }
+  if (first < n) {
+    qDebug() << "Expected" << n << "values, found" << first;
+    return false;
+  }
+
+  if (chunks.size() > 1)
+    CubeScheduler::instance()->blockingMap(CubeScheduler::Batch, chunks,
+                                           decodeChunk);
+  else
+    decodeChunk(chunks[0]);
+
+  for (unsigned int c = 0; c < chunks.size(); ++c) {
+    if (!chunks[c].ok) {
+      qDebug() << "Could not read the values from" << chunks[c].first;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Each keyword line, such as AO_ZETA[0004]=, starts a section of the file,
+// and the values never contain an equals sign
+static bool isKeywordLine(const char *line, const char *end)
 {
-  // Open the file for reading and process it
-  QFile file(filename);
-  if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
-    return;
+  return memchr(line, '=', end - line) != 0;
+}
+
+MopacAux::MopacAux(QString filename, SlaterSet* basis) : m_electrons(0)
+{
+  if (CompressedFile::format(filename) != CompressedFile::None) {
+    // Rather than holding all of the text, compressed files are parsed a
+    // section at a time as they are decompressed
+    CompressedFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+      qDebug() << "Cannot decompress" << filename;
+      return;
+    }
+    qDebug() << "File" << filename << "opened.";
+    RecordReader sections(&file, isKeywordLine);
+    const char *begin, *end;
+    while (sections.readRecord(begin, end)) {
+      m_in = LineReader(begin, end);
+      while (!m_in.atEnd())
+        processLine();
+    }
+    m_in = LineReader();
+  }
+  else {
+    // Open the file for reading and process it
+    if (!m_file.open(filename))
+      return;
+    m_in = LineReader(m_file.begin(), m_file.end());
 
-  qDebug() << "File" << filename << "opened.";
+    qDebug() << "File" << filename << "opened.";
 
-  // Process the formatted checkpoint and extract all the information we need
-  m_in.setDevice(&file);
-  while (!m_in.atEnd()) {
-    processLine();
+    // Process the formatted checkpoint and extract all the information we
+    // need
+    while (!m_in.atEnd()) {
+      processLine();
+    }
   }
 
   // Now it should all be loaded load it into the basis set
@@ -53,10 +187,18 @@ MopacAux::~MopacAux()
 {
 }
 
+QString MopacAux::readLine()
+{
+  const char *line, *end;
+  if (!m_in.readLine(line, end))
+    return QString();
+  return QString::fromLatin1(line, end - line);
+}
+
 void MopacAux::processLine()
 {
   // First truncate the line, remove trailing white space and check
-  QString line = m_in.readLine();
+  QString line = readLine();
   QString key = line;
   key = key.trimmed();
   //    QStringList list = tmp.split("=", QString::SkipEmptyParts);
@@ -101,22 +243,21 @@ void MopacAux::processLine()
     m_atomPos = readArrayVec(tmp.toInt());
   }
   else if (key.contains("OVERLAP_MATRIX")) {
-    QString tmp = key.mid(key.indexOf('[')+1, 6);
-    qDebug() << "Size of lower half triangle of overlap matrix =" << tmp.toInt();
-    readOverlapMatrix(tmp.toInt());
+    // The counters of the matrices overflow for large molecules, so their
+    // sizes are worked out from the number of atomic orbitals
+    qDebug() << "Size of lower half triangle of overlap matrix ="
+             << m_zeta.size() * (m_zeta.size() + 1) / 2;
+    readLowerTriangle(m_overlap);
   }
   else if (key.contains("EIGENVECTORS")) {
-    // For large molecules the Eigenvectors counter overflows to [*****]
-    // So just use the square of the m_atomIndex array
-    //      QString tmp = key.mid(key.indexOf('[')+1, 6);
     qDebug() << "Size of eigen vectors matrix ="
-             << m_atomIndex.size() * m_atomIndex.size();
-    readEigenVectors(m_atomIndex.size() * m_atomIndex.size());
+             << m_zeta.size() * m_zeta.size();
+    readEigenVectors();
   }
   else if (key.contains("TOTAL_DENSITY_MATRIX")) {
-    QString tmp = key.mid(key.indexOf('[')+1, 6);
-    qDebug() << "Size of lower half triangle of density matrix =" << tmp.toInt();
-    readDensityMatrix(tmp.toInt());
+    qDebug() << "Size of lower half triangle of density matrix ="
+             << m_zeta.size() * (m_zeta.size() + 1) / 2;
+    readLowerTriangle(m_density);
   }
 }
 
@@ -129,9 +270,13 @@ void MopacAux::load(SlaterSet* basis)
   basis->addZetas(m_zeta);
   basis->addPQNs(m_pqn);
   basis->setNumElectrons(m_electrons);
+  // Let go of each matrix once the basis set has its copy
   basis->addOverlapMatrix(m_overlap);
+  std::vector<double>().swap(m_overlap);
   basis->addEigenVectors(m_eigenVectors);
+  m_eigenVectors.resize(0, 0);
   basis->addDensityMatrix(m_density);
+  std::vector<double>().swap(m_density);
 
   Molecule &mol = basis->moleculeRef();
   mol.clearAtoms();
@@ -149,24 +294,21 @@ void MopacAux::load(SlaterSet* basis)
 vector<int> MopacAux::readArrayI(unsigned int n)
 {
   vector<int> tmp;
-  while (tmp.size() < n) {
-    QString line = m_in.readLine();
-    QStringList list = line.split(' ', QString::SkipEmptyParts);
-    for (int i = 0; i < list.size(); ++i)
-      tmp.push_back(list.at(i).toInt());
+  while (tmp.size() < n && !m_in.atEnd()) {
+    const char *p, *end;
+    m_in.readLine(p, end);
+    int value;
+    while (parseInt(p, end, value))
+      tmp.push_back(value);
   }
   return tmp;
 }
 
 vector<double> MopacAux::readArrayD(unsigned int n)
 {
-  vector<double> tmp;
-  while (tmp.size() < n) {
-    QString line = m_in.readLine();
-    QStringList list = line.split(' ', QString::SkipEmptyParts);
-    for (int i = 0; i < list.size(); ++i)
-      tmp.push_back(list.at(i).toDouble());
-  }
+  vector<double> tmp(n);
+  if (n && !readValues(m_in, n, &tmp[0]))
+    tmp.clear();
   return tmp;
 }
 
@@ -174,8 +316,8 @@ vector<int> MopacAux::readArraySym(unsigned int n)
 {
   int type;
   vector<int> tmp;
-  while (tmp.size() < n) {
-    QString line = m_in.readLine();
+  while (tmp.size() < n && !m_in.atEnd()) {
+    QString line = readLine();
     QStringList list = line.split(' ', QString::SkipEmptyParts);
     for (int i = 0; i < list.size(); ++i) {
       if (list.at(i) == "S") type = SlaterSet::S;
@@ -197,89 +339,37 @@ vector<int> MopacAux::readArraySym(unsigned int n)
 vector<Vector3d> MopacAux::readArrayVec(unsigned int n)
 {
   vector<Vector3d> tmp(n/3);
-  double *ptr = tmp[0].data();
-  unsigned int cnt = 0;
-  while (cnt < n) {
-    QString line = m_in.readLine();
-    QStringList list = line.split(' ', QString::SkipEmptyParts);
-    for (int i = 0; i < list.size(); ++i) {
-      ptr[cnt++] = list.at(i).toDouble();
-    }
-  }
+  if (tmp.size() && !readValues(m_in, 3 * tmp.size(), tmp[0].data()))
+    tmp.clear();
   return tmp;
 }
 
-bool MopacAux::readOverlapMatrix(unsigned int n)
-{
-  m_overlap.resize(m_zeta.size(), m_zeta.size());
-  unsigned int cnt = 0;
-  unsigned int i = 0, j = 0;
-  unsigned int f = 1;
-  // Skip the first commment line...
-  m_in.readLine();
-  while (cnt < n) {
-    QString line = m_in.readLine();
-    QStringList list = line.split(' ', QString::SkipEmptyParts);
-    for (int k = 0; k < list.size(); ++k) {
-      //m_overlap.part<Eigen::SelfAdjoint>()(i, j) = list.at(k).toDouble();
-      m_overlap(i, j) = m_overlap(j, i) = list.at(k).toDouble();
-      ++i; ++cnt;
-      if (i == f) {
-        // We need to move down to the next row and increment f - lower tri
-        i = 0;
-        ++f;
-        ++j;
-      }
-    }
-  }
-  return true;
-}
-
-bool MopacAux::readEigenVectors(unsigned int n)
+bool MopacAux::readLowerTriangle(vector<double> &lower)
 {
-  m_eigenVectors.resize(m_zeta.size(), m_zeta.size());
-  unsigned int cnt = 0;
-  unsigned int i = 0, j = 0;
-  while (cnt < n) {
-    QString line = m_in.readLine();
-    QStringList list = line.split(' ', QString::SkipEmptyParts);
-    for (int k = 0; k < list.size(); ++k) {
-      m_eigenVectors(i, j) = list.at(k).toDouble();
-      ++i; ++cnt;
-      if (i == m_zeta.size()) {
-        // We need to move down to the next row and increment f - lower tri
-        i = 0;
-        ++j;
-      }
-    }
-  }
-  return true;
+  // The matrix is read as written, which is the packed storage of SlaterSet
+  unsigned int size = m_zeta.size();
+  lower.resize(size * (size + 1) / 2);
+  // Skip the comment line
+  const char *pos = m_in.pos();
+  const char *line, *end;
+  if (m_in.readLine(line, end) && isNumberLine(line, end))
+    m_in.seek(pos);
+  if (lower.empty() || readValues(m_in, lower.size(), &lower[0]))
+    return true;
+  lower.clear();
+  return false;
 }
 
-bool MopacAux::readDensityMatrix(unsigned int n)
+bool MopacAux::readEigenVectors()
 {
-  m_density.resize(m_zeta.size(), m_zeta.size());
-  unsigned int cnt = 0;
-  unsigned int i = 0, j = 0;
-  unsigned int f = 1;
-  // Skip the first commment line...
-  m_in.readLine();
-  while (cnt < n) {
-    QString line = m_in.readLine();
-    QStringList list = line.split(' ', QString::SkipEmptyParts);
-    for (int k = 0; k < list.size(); ++k) {
-      //m_overlap.part<Eigen::SelfAdjoint>()(i, j) = list.at(k).toDouble();
-      m_density(i, j) = m_density(j, i) = list.at(k).toDouble();
-      ++i; ++cnt;
-      if (i == f) {
-        // We need to move down to the next row and increment f - lower tri
-        i = 0;
-        ++f;
-        ++j;
-      }
-    }
-  }
-  return true;
+  // The eigenvectors are written one after another, straight into the
+  // columns of the matrix
+  unsigned int size = m_zeta.size();
+  m_eigenVectors.resize(size, size);
+  if (!size || readValues(m_in, size * size, m_eigenVectors.data()))
+    return true;
+  m_eigenVectors.resize(0, 0);
+  return false;
 }
 
 void MopacAux::outputAll()
@@ -17,16 +17,24 @@
 #ifndef MOPACAUX_H
 #define MOPACAUX_H
 
-#include <QtCore/QTextStream>
 #include <Eigen/Core>
 #include <vector>
 
+#include "textparser.h"
+
 class QString;
 
 namespace OpenQube
 {
 class SlaterSet;
 
+/**
+ * Reads MOPAC aux files. The file is memory mapped, and the large matrices
+ * are decoded in parallel chunks straight into the storage handed to the
+ * SlaterSet, with the overlap and density matrices kept as packed lower
+ * triangles. Compressed files are parsed a section at a time as they are
+ * decompressed, see RecordReader.
+ */
 class MopacAux
 {
 public:
@@ -35,16 +43,17 @@ public:
   void outputAll();
 
 private:
-  QTextStream m_in;
+  MappedFile m_file;
+  LineReader m_in;
+  QString readLine();
   void processLine();
   void load(SlaterSet* basis);
   std::vector<int> readArrayI(unsigned int n);
   std::vector<double> readArrayD(unsigned int n);
   std::vector<int> readArraySym(unsigned int n);
   std::vector<Eigen::Vector3d> readArrayVec(unsigned int n);
-  bool readOverlapMatrix(unsigned int n);
-  bool readEigenVectors(unsigned int n);
-  bool readDensityMatrix(unsigned int n);
+  bool readLowerTriangle(std::vector<double> &lower);
+  bool readEigenVectors();
 
   int m_electrons;
   std::vector<int> m_aNums;
@@ -64,9 +73,9 @@ private:
   std::vector<int> m_pqn;
   std::vector<Eigen::Vector3d> m_atomPos;
 
-  Eigen::MatrixXd m_overlap;     /// Overlap matrix
+  std::vector<double> m_overlap; /// Overlap matrix, packed lower triangle
   Eigen::MatrixXd m_eigenVectors;
-  Eigen::MatrixXd m_density;     /// Total density matrix
+  std::vector<double> m_density; /// Total density matrix, packed likewise
 };
 
 } // End namespace
@@ -0,0 +1,72 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "multicube.h"
+
+#include <QtCore/QDebug>
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+
+namespace OpenQube {
+
+MultiCube::MultiCube(int channels) : m_channels(channels > 0 ? channels : 1)
+{
+  for (size_t i = 0; i < m_channels.size(); ++i)
+    m_channels[i] = new Cube;
+}
+
+MultiCube::~MultiCube()
+{
+  for (size_t i = 0; i < m_channels.size(); ++i)
+    delete m_channels[i];
+}
+
+Cube * MultiCube::channel(int i)
+{
+  if (i < 0 || i >= channelCount())
+    return 0;
+  return m_channels[i];
+}
+
+const Cube * MultiCube::channel(int i) const
+{
+  if (i < 0 || i >= channelCount())
+    return 0;
+  return m_channels[i];
+}
+
+bool MultiCube::setLimits(const Vector3d &min, const Vector3i &dim,
+                          double spacing)
+{
+  for (size_t i = 0; i < m_channels.size(); ++i) {
+    if (!m_channels[i]->setLimits(min, dim, spacing)) {
+      qDebug() << "Invalid limits passed to MultiCube::setLimits.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MultiCube::setLimits(const Cube &cube)
+{
+  for (size_t i = 0; i < m_channels.size(); ++i)
+    if (!m_channels[i]->setLimits(cube))
+      return false;
+  return true;
+}
+
+} // End namespace
@@ -0,0 +1,105 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_MULTICUBE_H
+#define OQ_MULTICUBE_H
+
+#include "openqubeabi.h"
+
+#include "cube.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+namespace OpenQube {
+
+/**
+ * @class MultiCube multicube.h <openqube/multicube.h>
+ * @brief MultiCube holds several scalar fields over the same grid.
+ *
+ * Each channel is an ordinary Cube, so it can be contoured or written out on
+ * its own, while the channels are calculated together in a single pass, for
+ * example by BasisSet::calculateDensityDerivatives.
+ */
+
+class OPENQUBE_EXPORT MultiCube
+{
+public:
+  /**
+   * Constructor, @a channels is the number of fields held.
+   */
+  explicit MultiCube(int channels);
+  ~MultiCube();
+
+  /**
+   * @return The number of channels.
+   */
+  int channelCount() const { return static_cast<int>(m_channels.size()); }
+
+  /**
+   * @return The cube of channel @a i, or 0 if it is out of range.
+   */
+  Cube * channel(int i);
+  const Cube * channel(int i) const;
+
+  /**
+   * Set the limits of every channel.
+   * @param min The minimum point in the cube.
+   * @param dim The integer dimensions of the cube in x, y and z.
+   * @param spacing The interval between points in the cube.
+   */
+  bool setLimits(const Eigen::Vector3d &min, const Eigen::Vector3i &dim,
+                 double spacing);
+
+  /**
+   * Set the limits of every channel to those of @a cube.
+   */
+  bool setLimits(const Cube &cube);
+
+  /**
+   * @return The minimum point in the cube.
+   */
+  Eigen::Vector3d min() const { return m_channels[0]->min(); }
+
+  /**
+   * @return The spacing of the grid.
+   */
+  Eigen::Vector3d spacing() const { return m_channels[0]->spacing(); }
+
+  /**
+   * @return The x, y and z dimensions of the cube.
+   */
+  Eigen::Vector3i dimensions() const { return m_channels[0]->dimensions(); }
+
+  /**
+   * @return The position of point @a index, as for Cube::position.
+   */
+  Eigen::Vector3d position(unsigned int index) const
+  {
+    return m_channels[0]->position(index);
+  }
+
+private:
+  // The channels own their locks, and cannot be copied
+  MultiCube(const MultiCube &);
+  MultiCube & operator=(const MultiCube &);
+
+  std::vector<Cube *> m_channels;
+};
+
+} // End namespace
+
+#endif
@@ -0,0 +1,194 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "orbitalprefetcher.h"
+
+#include "basisset.h"
+#include "cubecache.h"
+
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QTimer>
+#include <QtCore/QDebug>
+
+namespace OpenQube {
+
+// The number of requested MOs remembered to predict the next ones
+static const int HISTORY_SIZE = 8;
+
+OrbitalPrefetcher::OrbitalPrefetcher(BasisSet *basis, CubeCache *cache,
+                                     QObject *parent) : QObject(parent),
+  m_basis(basis), m_clone(0), m_cache(cache), m_min(Eigen::Vector3d::Zero()),
+  m_max(Eigen::Vector3d::Zero()), m_points(Eigen::Vector3i::Zero()),
+  m_cube(0), m_depth(2), m_enabled(true), m_waiting(false), m_canceled(false)
+{
+  connect(m_basis, SIGNAL(finished()), this, SLOT(explicitFinished()));
+}
+
+OrbitalPrefetcher::~OrbitalPrefetcher()
+{
+  // Deleting the clone stops its calculation and unlocks the cube
+  delete m_clone;
+  m_clone = 0;
+  delete m_cube;
+  m_cube = 0;
+}
+
+void OrbitalPrefetcher::setLimits(const Cube &cube)
+{
+  cancel();
+  m_min = cube.min();
+  m_max = cube.max();
+  m_points = cube.dimensions();
+}
+
+void OrbitalPrefetcher::setEnabled(bool enabled)
+{
+  m_enabled = enabled;
+  if (!m_enabled)
+    cancel();
+}
+
+QList<unsigned int> OrbitalPrefetcher::predictions() const
+{
+  QList<unsigned int> result;
+  if (m_history.isEmpty())
+    return result;
+
+  int numMOs = static_cast<int>(m_basis->numMOs());
+  int last = static_cast<int>(m_history.last());
+  // MOs are numbered from 1, as in BasisSet::calculateCubeMO
+  int homo = static_cast<int>(m_basis->numElectrons() / 2);
+  int lumo = homo + 1;
+
+  // Keep going in the direction of the last step, away from the frontier
+  // orbitals if there is no last step yet.
+  int step = last > homo ? 1 : -1;
+  if (m_history.size() > 1) {
+    int previous = static_cast<int>(m_history[m_history.size() - 2]);
+    if (last != previous)
+      step = last > previous ? 1 : -1;
+  }
+
+  QList<int> candidates;
+  candidates << last + step;
+  if (homo > 0)
+    candidates << homo << lumo;
+  candidates << last + 2 * step << last - step;
+
+  for (int i = 0; i < candidates.size() && result.size() < m_depth; ++i) {
+    int mo = candidates[i];
+    if (mo < 1 || mo > numMOs)
+      continue;
+    // MOs that were requested recently are likely to be cached already
+    if (m_history.contains(mo) || result.contains(mo))
+      continue;
+    result << static_cast<unsigned int>(mo);
+  }
+  return result;
+}
+
+void OrbitalPrefetcher::orbitalRequested(unsigned int mo)
+{
+  cancel();
+
+  m_history.removeAll(mo);
+  m_history.append(mo);
+  while (m_history.size() > HISTORY_SIZE)
+    m_history.removeFirst();
+
+  if (!m_points.prod())
+    return;
+
+  // If the MO is cached no calculation will follow to resume after, and the
+  // calculation may also fail to start. Either way the basis set never
+  // emits finished, which resume checks for once the request is handled.
+  m_waiting = !m_cache->contains(CubeCache::key(m_basis, Cube::MO, mo, m_min,
+                                                m_max, m_points));
+  QTimer::singleShot(0, this, SLOT(resume()));
+}
+
+void OrbitalPrefetcher::resume()
+{
+  // One speculative calculation at a time, and never alongside an explicit
+  // one. A canceled calculation must drain before the clone can be reused.
+  if (m_waiting && !m_basis->watcher().isRunning())
+    m_waiting = false;
+  if (!m_enabled || m_waiting || m_cube || !m_points.prod())
+    return;
+
+  QByteArray hash = m_basis->hash();
+  if (!m_clone || m_cloneHash != hash) {
+    delete m_clone;
+    m_clone = m_basis->clone();
+    m_cloneHash = hash;
+    m_clone->setEvaluationMode(BasisSet::Direct);
+    m_clone->setPriority(CubeScheduler::Background);
+    connect(m_clone, SIGNAL(finished()), this, SLOT(speculationFinished()));
+  }
+
+  QList<unsigned int> mos = predictions();
+  for (int i = 0; i < mos.size(); ++i) {
+    QByteArray key = CubeCache::key(m_basis, Cube::MO, mos[i], m_min, m_max,
+                                    m_points);
+    if (m_cache->contains(key))
+      continue;
+
+    m_cube = new Cube;
+    m_cube->setLimits(m_min, m_max, m_points);
+    m_cubeKey = key;
+    m_canceled = false;
+    if (m_clone->calculateCubeMO(m_cube, mos[i]))
+      return;
+
+    qDebug() << "Failed to prefetch MO" << mos[i];
+    delete m_cube;
+    m_cube = 0;
+  }
+}
+
+void OrbitalPrefetcher::explicitFinished()
+{
+  m_waiting = false;
+  resume();
+}
+
+void OrbitalPrefetcher::speculationFinished()
+{
+  Cube *cube = m_cube;
+  m_cube = 0;
+  if (!cube)
+    return;
+
+  if (m_canceled)
+    delete cube;
+  else
+    m_cache->insert(m_cubeKey, cube);
+
+  // Carry on with the next prediction
+  resume();
+}
+
+void OrbitalPrefetcher::cancel()
+{
+  // The points already handed to threads finish, but no more are started.
+  // The clone still emits finished once they are done.
+  if (m_cube && !m_canceled) {
+    m_canceled = true;
+    m_clone->watcher().cancel();
+  }
+}
+
+} // End namespace
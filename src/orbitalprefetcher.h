@@ -0,0 +1,134 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_ORBITALPREFETCHER_H
+#define OQ_ORBITALPREFETCHER_H
+
+#include "openqubeabi.h"
+
+#include "cube.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+
+namespace OpenQube {
+
+class BasisSet;
+class CubeCache;
+
+/**
+ * @class OrbitalPrefetcher orbitalprefetcher.h <openqube/orbitalprefetcher.h>
+ * @brief OrbitalPrefetcher calculates the MOs a user is likely to look at
+ * next into a CubeCache.
+ *
+ * Users tend to step through the orbitals one at a time away from the
+ * frontier orbitals, for example HOMO, HOMO-1, LUMO, LUMO+1. The prefetcher
+ * is told about every MO the user asks for with orbitalRequested(), and
+ * predicts the next ones from the direction of the last step and from the
+ * HOMO and LUMO. Once the explicit calculation has finished the predicted
+ * MOs are calculated, one at a time, on a clone of the basis set and added
+ * to the cache. The speculative calculations run in the
+ * CubeScheduler::Background priority class and are canceled as soon as
+ * another MO is requested, so that they never delay an explicit calculation.
+ *
+ * The cubes are calculated over the limits set with setLimits, which must
+ * match the limits used for the explicit calculations for the cache to hit.
+ * Set the same cache on the basis set with BasisSet::setCubeCache for its
+ * explicit calculations to pick the prefetched MOs up without blocking.
+ */
+
+class OPENQUBE_EXPORT OrbitalPrefetcher : public QObject
+{
+  Q_OBJECT
+
+public:
+  /**
+   * Constructor.
+   * @param basis The basis set the user is browsing, not owned.
+   * @param cache The cache to calculate the MOs into, not owned.
+   */
+  OrbitalPrefetcher(BasisSet *basis, CubeCache *cache, QObject *parent = 0);
+
+  /**
+   * Destructor, cancels any speculative calculation.
+   */
+  ~OrbitalPrefetcher();
+
+  /**
+   * Set the limits of the cubes to calculate - copied from @a cube.
+   */
+  void setLimits(const Cube &cube);
+
+  /**
+   * Set the number of MOs to calculate ahead of the user, defaults to 2.
+   */
+  void setDepth(int depth) { m_depth = depth; }
+  int depth() const { return m_depth; }
+
+  /**
+   * Enable or disable the prefetcher, disabling cancels any speculative
+   * calculation.
+   */
+  void setEnabled(bool enabled);
+  bool isEnabled() const { return m_enabled; }
+
+  /**
+   * @return The MOs predicted to be requested next, most likely first. MOs
+   * are numbered as in BasisSet::calculateCubeMO.
+   */
+  QList<unsigned int> predictions() const;
+
+public slots:
+  /**
+   * Must be called when the user requests MO @a mo, before it is calculated.
+   * Cancels speculative work immediately. Speculation resumes once the basis
+   * set emits finished(), or straight away if @a mo is already cached or no
+   * calculation was started.
+   */
+  void orbitalRequested(unsigned int mo);
+
+  /**
+   * Start calculating the predicted MOs that are not in the cache yet.
+   */
+  void resume();
+
+private slots:
+  void explicitFinished();
+  void speculationFinished();
+
+private:
+  void cancel();
+
+  BasisSet *m_basis;
+  BasisSet *m_clone;          //! Clone the speculative work is done on
+  QByteArray m_cloneHash;     //! Hash of m_basis when it was cloned
+  CubeCache *m_cache;
+  Eigen::Vector3d m_min;      //! Limits of the cubes to calculate
+  Eigen::Vector3d m_max;
+  Eigen::Vector3i m_points;   //! Zero until setLimits is called
+  Cube *m_cube;               //! Cube being calculated, 0 if none
+  QByteArray m_cubeKey;       //! Cache key of m_cube
+  QList<unsigned int> m_history; //! The last MOs requested, most recent last
+  int m_depth;
+  bool m_enabled;
+  bool m_waiting;             //! An explicit calculation is running
+  bool m_canceled;            //! The calculation of m_cube was canceled
+};
+
+} // End namespace
+
+#endif
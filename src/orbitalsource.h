@@ -0,0 +1,95 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_ORBITALSOURCE_H
+#define OQ_ORBITALSOURCE_H
+
+#include "openqubeabi.h"
+
+#include <Eigen/Core>
+
+class QCryptographicHash;
+
+namespace OpenQube {
+
+/**
+ * @class OrbitalSource orbitalsource.h <openqube/orbitalsource.h>
+ * @brief OrbitalSource reads MO coefficients and density matrices on demand.
+ *
+ * Parsers that index a file rather than reading all of it hand an
+ * OrbitalSource to the basis set, which reads the MO coefficients of an
+ * orbital or the density matrix only once a calculation needs them. The
+ * source is shared between a basis set and its clones, so all functions must
+ * be thread safe.
+ */
+
+class OPENQUBE_EXPORT OrbitalSource
+{
+public:
+  virtual ~OrbitalSource() {}
+
+  /**
+   * @return The number of MOs that can be read.
+   */
+  virtual unsigned int numMOs() const = 0;
+
+  /**
+   * Read the coefficients of MO @a mo, numbered from zero, into @a column.
+   * @return True on success.
+   */
+  virtual bool readMO(unsigned int mo, Eigen::VectorXd &column) const = 0;
+
+  /**
+   * @return True if the source has a density matrix.
+   */
+  virtual bool hasDensity() const = 0;
+
+  /**
+   * Read the density matrix into @a density. As the matrix is symmetric only
+   * its lower triangle has to be filled in.
+   * @return True on success.
+   */
+  virtual bool readDensity(Eigen::MatrixXd &density) const = 0;
+
+  /**
+   * Add the MO coefficients and density matrix of the source to @a hash,
+   * so that basis sets can be hashed without reading all of them in.
+   */
+  virtual void hashContent(QCryptographicHash &hash) const = 0;
+
+  /**
+   * Add the coefficients of MO @a mo, numbered from zero, to @a hash.
+   * Defaults to hashContent, sources that can find a single MO without
+   * reading the others should only add its coefficients.
+   */
+  virtual void hashMO(unsigned int mo, QCryptographicHash &hash) const
+  {
+    (void)mo;
+    hashContent(hash);
+  }
+
+  /**
+   * Add the density matrix to @a hash. Defaults to hashContent.
+   */
+  virtual void hashDensity(QCryptographicHash &hash) const
+  {
+    hashContent(hash);
+  }
+};
+
+} // End namespace
+
+#endif
@@ -0,0 +1,110 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "outputwatcher.h"
+
+#include "gamessus.h"
+#include "gamessukout.h"
+#include "gaussianset.h"
+
+#include <QtCore/QFileInfo>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QStringList>
+#include <QtCore/QTimer>
+#include <QtCore/QDebug>
+
+namespace OpenQube {
+
+OutputWatcher::OutputWatcher(const QString &filename, GaussianSet *basis,
+                             QObject *parent) : QObject(parent),
+  m_fileName(filename), m_basis(basis), m_gamessUS(0), m_gamessUK(0),
+  m_fileWatcher(new QFileSystemWatcher(this)), m_timer(new QTimer(this)),
+  m_deferred(false)
+{
+  QString completeSuffix = QFileInfo(filename).completeSuffix();
+  if (completeSuffix.contains("gamout", Qt::CaseInsensitive)
+      || completeSuffix.contains("gamess", Qt::CaseInsensitive)) {
+    m_gamessUS = new GAMESSUSOutput(filename);
+  }
+  else if (completeSuffix.contains("gukout", Qt::CaseInsensitive)) {
+    m_gamessUK = new GamessukOut(filename);
+  }
+  else {
+    qDebug() << "Cannot follow the output of" << filename;
+    return;
+  }
+
+  connect(m_fileWatcher, SIGNAL(fileChanged(QString)), this, SLOT(poll()));
+  connect(m_timer, SIGNAL(timeout()), this, SLOT(poll()));
+  connect(m_basis, SIGNAL(finished()), this, SLOT(calculationFinished()));
+  m_fileWatcher->addPath(filename);
+  QTimer::singleShot(0, this, SLOT(poll()));
+}
+
+OutputWatcher::~OutputWatcher()
+{
+  delete m_gamessUS;
+  m_gamessUS = 0;
+  delete m_gamessUK;
+  m_gamessUK = 0;
+}
+
+void OutputWatcher::setPollInterval(int msec)
+{
+  if (msec > 0 && isValid())
+    m_timer->start(msec);
+  else
+    m_timer->stop();
+}
+
+int OutputWatcher::pollInterval() const
+{
+  return m_timer->isActive() ? m_timer->interval() : 0;
+}
+
+bool OutputWatcher::poll()
+{
+  // A file that is replaced rather than appended to is no longer watched
+  if (isValid() && !m_fileWatcher->files().contains(m_fileName)
+      && QFileInfo(m_fileName).exists())
+    m_fileWatcher->addPath(m_fileName);
+
+  // The MOs and the atoms are read by running calculations, so they are
+  // only replaced once the calculation has finished
+  if (m_basis->isCalculating()) {
+    m_deferred = isValid();
+    return false;
+  }
+  m_deferred = false;
+
+  bool updated = false;
+  if (m_gamessUS)
+    updated = m_gamessUS->update(m_basis);
+  else if (m_gamessUK)
+    updated = m_gamessUK->update(m_basis);
+
+  if (updated)
+    emit orbitalsUpdated();
+  return updated;
+}
+
+void OutputWatcher::calculationFinished()
+{
+  if (m_deferred)
+    poll();
+}
+
+} // End namespace
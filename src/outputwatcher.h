@@ -0,0 +1,124 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_OUTPUTWATCHER_H
+#define OQ_OUTPUTWATCHER_H
+
+#include "openqubeabi.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+class QFileSystemWatcher;
+class QTimer;
+
+namespace OpenQube {
+
+class GaussianSet;
+class GAMESSUSOutput;
+class GamessukOut;
+
+/**
+ * @class OutputWatcher outputwatcher.h <openqube/outputwatcher.h>
+ * @brief OutputWatcher follows the log of a calculation that is still
+ * running.
+ *
+ * The watcher reads the output appended to a GAMESS-US or GAMESS-UK log into
+ * a basis set whenever the file changes, only ever reading the new output,
+ * and emits orbitalsUpdated() once a new set of MOs has been printed. The
+ * type of the log is chosen from the file name as in BasisSetLoader.
+ *
+ * Changes are noticed with QFileSystemWatcher, which uses inotify on Linux.
+ * File systems that do not report changes, such as network file systems
+ * shared with a cluster, can be polled instead with setPollInterval(), or
+ * by calling poll() directly.
+ *
+ * The hash of the basis set changes with its MOs, so cubes in a CubeCache
+ * calculated from earlier MOs are never returned for the new ones. Output
+ * that appears while the basis set is calculating a cube is read once the
+ * calculation has finished.
+ */
+
+class OPENQUBE_EXPORT OutputWatcher : public QObject
+{
+  Q_OBJECT
+
+public:
+  /**
+   * Constructor, the output already written is read once control returns to
+   * the event loop.
+   * @param filename The log to follow.
+   * @param basis The empty basis set to read the output into, not owned.
+   */
+  OutputWatcher(const QString &filename, GaussianSet *basis,
+                QObject *parent = 0);
+
+  /**
+   * Destructor.
+   */
+  ~OutputWatcher();
+
+  /**
+   * @return True if the type of the log is supported.
+   */
+  bool isValid() const { return m_gamessUS || m_gamessUK; }
+
+  /**
+   * @return The name of the log being followed.
+   */
+  QString fileName() const { return m_fileName; }
+
+  /**
+   * Poll the log every @a msec milliseconds as well as when it is reported
+   * to have changed, 0 (the default) to only rely on the reports.
+   */
+  void setPollInterval(int msec);
+  int pollInterval() const;
+
+public slots:
+  /**
+   * Read any output appended to the log since the last poll. If the basis
+   * set is calculating a cube the output is read once it has finished.
+   * @return True if new MOs were read.
+   */
+  bool poll();
+
+signals:
+  /**
+   * Emitted when the geometry and the MOs of the basis set have been
+   * replaced by newly printed ones.
+   */
+  void orbitalsUpdated();
+
+private slots:
+  /**
+   * Poll again if a poll was put off by a running calculation.
+   */
+  void calculationFinished();
+
+private:
+  QString m_fileName;
+  GaussianSet *m_basis;
+  GAMESSUSOutput *m_gamessUS;
+  GamessukOut *m_gamessUK;
+  QFileSystemWatcher *m_fileWatcher;
+  QTimer *m_timer;
+  bool m_deferred; //! A poll is waiting for a calculation to finish
+};
+
+} // End namespace
+
+#endif
@@ -28,9 +28,9 @@
 #include <Eigen/LU>
 #include <Eigen/QR>
 
+#include <algorithm>
 #include <cmath>
 
-#include <QtCore/QtConcurrentMap>
 #include <QtCore/QFuture>
 #include <QtCore/QFutureWatcher>
 #include <QtCore/QReadWriteLock>
@@ -39,6 +39,7 @@
 using std::vector;
 using Eigen::Vector3d;
 using Eigen::Vector3i;
+using Eigen::Matrix3d;
 using Eigen::MatrixXd;
 using Eigen::SelfAdjointEigenSolver;
 
@@ -57,49 +58,94 @@ using std::vector;
 static const double BOHR_TO_ANGSTROM = 0.529177249;
 static const double ANGSTROM_TO_BOHR = 1.0 / 0.529177249;
 
-SlaterSet::SlaterSet() : m_initialized(false)
+// Slaters with zeta * r above this at every point of a batch are skipped,
+// exp(-40) being negligible
+static const double SCREENING_EXPONENT = 40.0;
+
+// The dimension of a symmetric matrix stored as a packed lower triangle
+static unsigned int packedDimension(size_t size)
 {
+  unsigned int n = static_cast<unsigned int>((sqrt(8.0 * size + 1.0) - 1.0)
+                                             / 2.0 + 0.5);
+  return static_cast<size_t>(n) * (n + 1) / 2 == size ? n : 0;
 }
 
-SlaterSet::~SlaterSet()
+// Store the lower triangle of m packed, row by row
+static void packLower(const MatrixXd &m, vector<double> &lower)
+{
+  unsigned int n = static_cast<unsigned int>(m.rows());
+  lower.resize(static_cast<size_t>(n) * (n + 1) / 2);
+  size_t k = 0;
+  for (unsigned int i = 0; i < n; ++i)
+    for (unsigned int j = 0; j <= i; ++j)
+      lower[k++] = m(i, j);
+}
+
+SlaterSet::SlaterSet() : m_initialized(false), m_pointType(Cube::MO),
+  m_pointMO(0), m_cube(0)
 {
+}
 
+SlaterSet::~SlaterSet()
+{
+  // The tasks of a calculation that is still running refer to this set
+  if (m_cube) {
+    m_watcher.cancel();
+    m_watcher.waitForFinished();
+    m_cube->lock()->unlock();
+  }
 }
 
 bool SlaterSet::addAtoms(const std::vector<Eigen::Vector3d> &pos)
 {
   m_atomPos = pos;
+  contentChanged();
   return true;
 }
 
 bool SlaterSet::addSlaterIndices(const std::vector<int> &i)
 {
   m_slaterIndices = i;
+  contentChanged();
   return true;
 }
 
 bool SlaterSet::addSlaterTypes(const std::vector<int> &t)
 {
   m_slaterTypes = t;
+  contentChanged();
   return true;
 }
 
 bool SlaterSet::addZetas(const std::vector<double> &zetas)
 {
   m_zetas = zetas;
+  contentChanged();
   return true;
 }
 
 bool SlaterSet::addPQNs(const std::vector<int> &pqns)
 {
   m_pqns = pqns;
+  contentChanged();
   return true;
 }
 
 bool SlaterSet::addOverlapMatrix(const Eigen::MatrixXd &m)
 {
-  m_overlap.resize(m.rows(), m.cols());
-  m_overlap = m;
+  packLower(m, m_overlap);
+  contentChanged();
+  return true;
+}
+
+bool SlaterSet::addOverlapMatrix(const std::vector<double> &lower)
+{
+  if (!lower.empty() && !packedDimension(lower.size())) {
+    qDebug() << lower.size() << "elements are not a lower triangle.";
+    return false;
+  }
+  m_overlap = lower;
+  contentChanged();
   return true;
 }
 
@@ -107,19 +153,31 @@ bool SlaterSet::addEigenVectors(const Eigen::MatrixXd &e)
 {
   m_eigenVectors.resize(e.rows(), e.cols());
   m_eigenVectors = e;
+  contentChanged();
   return true;
 }
 
 bool SlaterSet::addDensityMatrix(const Eigen::MatrixXd &d)
 {
-  m_density.resize(d.rows(), d.cols());
-  m_density = d;
+  packLower(d, m_density);
+  contentChanged();
+  return true;
+}
+
+bool SlaterSet::addDensityMatrix(const std::vector<double> &lower)
+{
+  if (!lower.empty() && !packedDimension(lower.size())) {
+    qDebug() << lower.size() << "elements are not a lower triangle.";
+    return false;
+  }
+  m_density = lower;
+  contentChanged();
   return true;
 }
 
 unsigned int SlaterSet::numMOs()
 {
-  return m_overlap.cols();
+  return packedDimension(m_overlap.size());
 }
 
 inline bool SlaterSet::isSmall(double val)
@@ -146,12 +204,29 @@ bool SlaterSet::calculateCubeMO(Cube *cube, unsigned int state)
 {
   // Set up the calculation and ideally use the new QtConcurrent code to
   // multithread the calculation...
-  if (state < 1 || static_cast<int>(state) > m_overlap.rows())
+  if (state < 1 || state > numMOs())
     return false;
 
+  m_cube = cube;
+
+  // Lock the cube until we are done.
+  cube->lock()->lockForWrite();
+
+  // Set the cube type
+  cube->setCubeType(Cube::MO);
+
+  // Watch for the future
+  connect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
+
+  // Cached cubes do not need to be calculated
+  if (loadFromCache(cube, Cube::MO, state))
+    return true;
+
   if (!m_initialized)
     initialize();
 
+  initLevels(cube);
+
   // It is more efficient to process each shell over the entire cube than it
   // is to process each MO at each point in the cube. This is probably the best
   // point at which to multithread too - QtConcurrent!
@@ -162,34 +237,38 @@ bool SlaterSet::calculateCubeMO(Cube *cube, unsigned int state)
   for (int i = 0; i < m_slaterShells.size(); ++i) {
     m_slaterShells[i].set = this;
     m_slaterShells[i].cube = cube;
-    m_slaterShells[i].pos = i;
     m_slaterShells[i].state = state;
   }
 
+  calculateLevel();
+
+  return true;
+}
+
+bool SlaterSet::calculateCubeDensity(Cube *cube)
+{
+  // Set up the calculation and ideally use the new QtConcurrent code to
+  // multithread the calculation...
+  m_cube = cube;
+
   // Lock the cube until we are done.
   cube->lock()->lockForWrite();
 
   // Set the cube type
-  cube->setCubeType(Cube::MO);
+  cube->setCubeType(Cube::ElectronDensity);
 
   // Watch for the future
   connect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
 
-  // The main part of the mapped reduced function...
-  m_future = QtConcurrent::map(m_slaterShells, SlaterSet::processPoint);
-  // Connect our watcher to our future
-  m_watcher.setFuture(m_future);
-
-  return true;
-}
+  // Cached cubes do not need to be calculated
+  if (loadFromCache(cube, Cube::ElectronDensity, 0))
+    return true;
 
-bool SlaterSet::calculateCubeDensity(Cube *cube)
-{
-  // Set up the calculation and ideally use the new QtConcurrent code to
-  // multithread the calculation...
   if (!m_initialized)
     initialize();
 
+  initLevels(cube);
+
   // It is more efficient to process each shell over the entire cube than it
   // is to process each MO at each point in the cube. This is probably the best
   // point at which to multithread too - QtConcurrent!
@@ -200,32 +279,57 @@ bool SlaterSet::calculateCubeDensity(Cube *cube)
   for (int i = 0; i < m_slaterShells.size(); ++i) {
     m_slaterShells[i].set = this;
     m_slaterShells[i].cube = cube;
-    m_slaterShells[i].pos = i;
     m_slaterShells[i].state = 0;
   }
 
-  // Lock the cube until we are done.
-  cube->lock()->lockForWrite();
+  calculateLevel();
 
-  // Set the cube type
-  cube->setCubeType(Cube::ElectronDensity);
+  return true;
+}
 
-  // Watch for the future
-  connect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
+bool SlaterSet::initPointValues(Cube::Type type, unsigned int mo)
+{
+  if (isCalculating()) {
+    qDebug() << "Point values cannot be prepared while a cube is calculated.";
+    return false;
+  }
+  if (type == Cube::MO && (mo < 1 || mo > numMOs()))
+    return false;
+  if (type != Cube::MO && type != Cube::ElectronDensity)
+    return false;
 
-  // The main part of the mapped reduced function...
-  m_future = QtConcurrent::map(m_slaterShells, SlaterSet::processDensity);
-  // Connect our watcher to our future
-  m_watcher.setFuture(m_future);
+  if (!m_initialized)
+    initialize();
 
+  if (type == Cube::ElectronDensity && m_density.empty())
+    return false;
+
+  m_pointType = type;
+  m_pointMO = mo - 1;
   return true;
 }
 
+double SlaterSet::pointValue(const Vector3d &pos)
+{
+  if (m_pointType == Cube::ElectronDensity)
+    return densityValue(this, pos);
+  return moValue(this, pos, m_pointMO);
+}
+
 BasisSet * SlaterSet::clone()
 {
   SlaterSet *result = new SlaterSet();
+  result->m_molecule = this->m_molecule;
+  result->m_electrons = this->m_electrons;
+  result->m_valid = this->m_valid;
+  {
+    QMutexLocker locker(&m_contentHashMutex);
+    result->m_contentHash = m_contentHash;
+  }
+
   result->m_atomPos = this->m_atomPos;
   result->m_slaterIndices = this->m_slaterIndices;
+  result->m_slaterTypes = this->m_slaterTypes;
   result->m_zetas = this->m_zetas;
   result->m_pqns = this->m_pqns;
   result->m_PQNs = this->m_PQNs;
@@ -241,25 +345,78 @@ BasisSet * SlaterSet::clone()
   return result;
 }
 
+void SlaterSet::hashContent(QCryptographicHash &hash) const
+{
+  addToHash(hash, m_atomPos);
+  addToHash(hash, m_slaterIndices);
+  addToHash(hash, m_slaterTypes);
+  addToHash(hash, m_zetas);
+  addToHash(hash, m_pqns);
+  addToHash(hash, m_overlap);
+  addToHash(hash, m_eigenVectors);
+  addToHash(hash, m_density);
+}
+
+void SlaterSet::calculateLevel()
+{
+  // The main part of the mapped reduced function, over the current level...
+  CubeScheduler *scheduler = CubeScheduler::instance();
+  // In Adaptive mode the points of a level are only known once it starts
+  for (unsigned int i = levelBegin(); i < levelEnd(); ++i)
+    m_slaterShells[i].pos = pointIndex(i);
+  QVector<SlaterShell>::iterator shells = m_slaterShells.begin();
+  if (m_cube->cubeType() == Cube::ElectronDensity)
+    m_future = scheduler->map(m_priority, shells + levelBegin(),
+                              shells + levelEnd(), SlaterSet::processDensity);
+  else
+    m_future = scheduler->map(m_priority, shells + levelBegin(),
+                              shells + levelEnd(), SlaterSet::processPoint);
+  // Connect our watcher to our future
+  m_watcher.setFuture(m_future);
+}
+
 void SlaterSet::calculationComplete()
 {
+  // The blocking calculations complete without waiting for the event loop
+  if (!m_cube || !m_watcher.isFinished())
+    return;
+  // Progressive calculations carry on with the next level, Adaptive ones
+  // once the cells to refine have been bounded
+  if (nextLevel(m_cube)) {
+    if (!isRefining())
+      calculateLevel();
+    return;
+  }
   disconnect(&m_watcher, SIGNAL(finished()), this, SLOT(calculationComplete()));
-  qDebug() << m_slaterShells[0].cube->data()->at(0) << m_slaterShells[0].cube->data()->at(1);
+  qDebug() << m_cube->data()->at(0) << m_cube->data()->at(1);
   qDebug() << "Calculation complete - cube map...";
-  m_slaterShells[0].cube->lock()->unlock();
+  storeInCache(m_cube);
+  m_cube->lock()->unlock();
+  if (!m_pointOrder.empty() && !m_watcher.future().isCanceled())
+    emit cubeRefined(m_level, m_levelEnds.size());
+  m_cube = 0;
+  emit finished();
 }
 
 bool SlaterSet::initialize()
 {
-  m_normalized.resize(m_overlap.cols(), m_overlap.rows());
+  unsigned int size = numMOs();
+  m_normalized.resize(size, size);
 
-  SelfAdjointEigenSolver<MatrixXd> s(m_overlap);
+  // The eigen solver only reads the lower triangle
+  MatrixXd overlap(size, size);
+  size_t k = 0;
+  for (unsigned int i = 0; i < size; ++i)
+    for (unsigned int j = 0; j <= i; ++j)
+      overlap(i, j) = m_overlap[k++];
+
+  SelfAdjointEigenSolver<MatrixXd> s(overlap);
   MatrixXd p = s.eigenvectors();
   MatrixXd m = p * s.eigenvalues().array().inverse().array().sqrt()
                     .matrix().asDiagonal() * p.inverse();
   m_normalized = m * m_eigenVectors;
 
-  if (!(m_overlap*m*m).isIdentity())
+  if (!(overlap.selfadjointView<Eigen::Lower>()*m*m).isIdentity())
     qDebug() << "Identity test FAILED - do you need a newer version of Eigen?";
   //    std::cout << m_normalized << std::endl << std::endl;
   //    std::cout << s.eigenvalues() << std::endl << std::endl;
@@ -319,7 +476,23 @@ bool SlaterSet::initialize()
 
 void SlaterSet::processPoint(SlaterShell &shell)
 {
-  SlaterSet *set = shell.set;
+  // Calculate our position
+  Vector3d pos = shell.cube->position(shell.pos);// * ANGSTROM_TO_BOHR;
+  // Set the value, the state is simply the row of the matrix to operate on
+  shell.cube->setValue(shell.pos, moValue(shell.set, pos, shell.state - 1));
+}
+
+void SlaterSet::processDensity(SlaterShell &shell)
+{
+  // Calculate our position
+  Vector3d pos = shell.cube->position(shell.pos);// * ANGSTROM_TO_BOHR;
+  // Set the value
+  shell.cube->setValue(shell.pos, densityValue(shell.set, pos));
+}
+
+double SlaterSet::moValue(SlaterSet *set, const Vector3d &pos,
+                          unsigned int indexMO)
+{
   unsigned int atomsSize = set->m_atomPos.size();
   unsigned int basisSize = set->m_zetas.size();
 
@@ -328,12 +501,6 @@ void SlaterSet::processPoint(SlaterShell &shell)
   deltas.reserve(atomsSize);
   dr.reserve(atomsSize);
 
-  // Simply the row of the matrix to operate on
-  unsigned int indexMO = shell.state - 1;
-
-  // Calculate our position
-  Vector3d pos = shell.cube->position(shell.pos);// * ANGSTROM_TO_BOHR;
-
   // Calculate the deltas for the position
   for (unsigned int i = 0; i < atomsSize; ++i) {
     deltas.push_back(pos - set->m_atomPos[i]);
@@ -343,29 +510,24 @@ void SlaterSet::processPoint(SlaterShell &shell)
   // Now calculate the value at this point in space
   double tmp = 0.0;
   for (unsigned int i = 0; i < basisSize; ++i) {
-    tmp += pointSlater(shell.set, deltas[set->m_slaterIndices[i]],
+    tmp += pointSlater(set, deltas[set->m_slaterIndices[i]],
                        dr[set->m_slaterIndices[i]], i, indexMO);
   }
-  // Set the value
-  shell.cube->setValue(shell.pos, tmp);
+  return tmp;
 }
 
-void SlaterSet::processDensity(SlaterShell &shell)
+double SlaterSet::densityValue(SlaterSet *set, const Vector3d &pos)
 {
   // Calculate the electron density
-  SlaterSet *set = shell.set;
   unsigned int atomsSize = set->m_atomPos.size();
   unsigned int basisSize = set->m_zetas.size();
-  unsigned int matrixSize = set->m_density.rows();
+  unsigned int matrixSize = packedDimension(set->m_density.size());
 
   vector<Vector3d> deltas;
   vector<double> dr;
   deltas.reserve(atomsSize);
   dr.reserve(atomsSize);
 
-  // Calculate our position
-  Vector3d pos = shell.cube->position(shell.pos);// * ANGSTROM_TO_BOHR;
-
   // Calculate the deltas for the position
   for (unsigned int i = 0; i < atomsSize; ++i) {
     deltas.push_back(pos - set->m_atomPos[i]);
@@ -381,25 +543,110 @@ void SlaterSet::processDensity(SlaterShell &shell)
   // Now calculate the value of the density at this point in space
   double rho = 0.0;
   for (unsigned int i = 0; i < matrixSize; ++i) {
+    // Row i of the packed lower triangle, which ends with the diagonal
+    const double *row = &set->m_density[static_cast<size_t>(i) * (i + 1) / 2];
     // Calculate the off-diagonal parts of the matrix
     for (unsigned int j = 0; j < i; ++j) {
-      if (isSmall(set->m_density.coeffRef(i, j))) continue;
+      if (isSmall(row[j])) continue;
       double a = 0.0, b = 0.0;
       // Do the first basis
-      a = calcSlater(shell.set, deltas[set->m_slaterIndices[i]],
+      a = calcSlater(set, deltas[set->m_slaterIndices[i]],
                      dr[set->m_slaterIndices[i]], i);
-      b = calcSlater(shell.set, deltas[set->m_slaterIndices[j]],
+      b = calcSlater(set, deltas[set->m_slaterIndices[j]],
                      dr[set->m_slaterIndices[j]], j);
-      rho += 2.0 * set->m_density.coeffRef(i, j) * (a*b);
+      rho += 2.0 * row[j] * (a*b);
     }
     // Now calculate the matrix diagonal
     double tmp = 0.0;
-    tmp = calcSlater(shell.set, deltas[set->m_slaterIndices[i]],
+    tmp = calcSlater(set, deltas[set->m_slaterIndices[i]],
                      dr[set->m_slaterIndices[i]], i);
-    rho += set->m_density.coeffRef(i, i) * (tmp*tmp);
+    rho += row[i] * (tmp*tmp);
+  }
+  return rho;
+}
+
+void SlaterSet::calculateTile(const Vector3d *points, unsigned int count,
+                              const Vector3d &center, double radius,
+                              double *values, Vector3d *gradients,
+                              Matrix3d *hessians, double *kineticEnergies)
+{
+  // Skip the Slaters that are negligible at every point of the tile
+  unsigned int basisSize = m_zetas.size();
+  unsigned int matrixSize = packedDimension(m_density.size());
+  vector<unsigned int> slaters;
+  for (unsigned int i = 0; i < basisSize; ++i) {
+    double distance = std::max(0.0, (center - m_atomPos[m_slaterIndices[i]])
+                               .norm() - radius);
+    if (m_zetas[i] * distance <= SCREENING_EXPONENT)
+      slaters.push_back(i);
+  }
+
+  vector<double> phi(slaters.size());
+  bool derivatives = gradients || hessians || kineticEnergies;
+  vector<Vector3d> dphi(slaters.size());
+  vector<Matrix3d> ddphi(hessians ? slaters.size() : 0);
+  for (unsigned int p = 0; p < count; ++p) {
+    for (unsigned int i = 0; i < slaters.size(); ++i) {
+      Vector3d delta = points[p] - m_atomPos[m_slaterIndices[slaters[i]]];
+      if (derivatives)
+        phi[i] = calcSlater(this, delta, delta.norm(), slaters[i], dphi[i],
+                            hessians ? &ddphi[i] : 0);
+      else
+        phi[i] = calcSlater(this, delta, delta.norm(), slaters[i]);
+    }
+
+    double value = 0.0;
+    Vector3d gradient = Vector3d::Zero();
+    Matrix3d hessian = Matrix3d::Zero();
+    double kinetic = 0.0;
+    if (m_pointType == Cube::ElectronDensity) {
+      // rho = sum_ij D_ij phi_i phi_j, from the packed lower triangle of D,
+      // with the derivatives as in GaussianSet::calculateTile
+      for (unsigned int i = 0; i < slaters.size(); ++i) {
+        unsigned int a = slaters[i];
+        if (a >= matrixSize)
+          break;
+        double u = 0.0;
+        Vector3d w = Vector3d::Zero();
+        for (unsigned int j = 0; j < slaters.size(); ++j) {
+          unsigned int b = slaters[j];
+          if (b >= matrixSize)
+            break;
+          double d = b <= a
+              ? m_density[static_cast<size_t>(a) * (a + 1) / 2 + b]
+              : m_density[static_cast<size_t>(b) * (b + 1) / 2 + a];
+          u += d * phi[j];
+          if (hessians || kineticEnergies)
+            w += d * dphi[j];
+        }
+        value += phi[i] * u;
+        if (gradients)
+          gradient += 2.0 * u * dphi[i];
+        if (hessians)
+          hessian += 2.0 * (u * ddphi[i] + dphi[i] * w.transpose());
+        if (kineticEnergies)
+          kinetic += 0.5 * dphi[i].dot(w);
+      }
+    }
+    else {
+      for (unsigned int i = 0; i < slaters.size(); ++i) {
+        double c = m_normalized.coeffRef(slaters[i], m_pointMO);
+        value += c * phi[i];
+        if (derivatives)
+          gradient += c * dphi[i];
+        if (hessians)
+          hessian += c * ddphi[i];
+      }
+      kinetic = 0.5 * gradient.squaredNorm();
+    }
+    values[p] = value;
+    if (gradients)
+      gradients[p] = gradient;
+    if (hessians)
+      hessians[p] = hessian;
+    if (kineticEnergies)
+      kineticEnergies[p] = kinetic;
   }
-  // Set the value
-  shell.cube->setValue(shell.pos, rho);
 }
 
 inline double SlaterSet::pointSlater(SlaterSet *set, const Eigen::Vector3d &delta,
@@ -532,4 +779,90 @@ inline double SlaterSet::calcSlater(SlaterSet *set, const Eigen::Vector3d &delta
   return tmp;
 }
 
+inline double SlaterSet::calcSlater(SlaterSet *set, const Eigen::Vector3d &delta,
+                                    double dr, unsigned int slater,
+                                    Eigen::Vector3d &gradient,
+                                    Eigen::Matrix3d *hessian)
+{
+  // The radial part f r^n exp(-zeta r) and its derivative with respect to r
+  // divided by r, taken as zero at the nucleus where it has no direction.
+  // The Hessian of the radial part is slope * I + curvature * delta delta^T,
+  // where curvature is (R'' - R' / r) / r^2.
+  int n = set->m_PQNs[slater];
+  double zeta = set->m_zetas[slater];
+  double radial = set->m_factors[slater] * exp(- zeta * dr);
+  for (int i = 0; i < n; ++i)
+    radial *= dr;
+  double slope = 0.0, curvature = 0.0;
+  if (dr > 0.0) {
+    double ratio = n / dr - zeta;
+    slope = radial * ratio / dr;
+    curvature = (radial * (ratio * ratio - n / (dr * dr)) - slope)
+        / (dr * dr);
+  }
+
+  double x = delta.x(), y = delta.y(), z = delta.z();
+  double angular;
+  Vector3d dAngular;
+  Matrix3d ddAngular = Matrix3d::Zero();
+  switch (set->m_slaterTypes[slater]) {
+  case S:
+    angular = 1.0;
+    dAngular = Vector3d::Zero();
+    break;
+  case PX:
+    angular = x;
+    dAngular = Vector3d::UnitX();
+    break;
+  case PY:
+    angular = y;
+    dAngular = Vector3d::UnitY();
+    break;
+  case PZ:
+    angular = z;
+    dAngular = Vector3d::UnitZ();
+    break;
+  case X2: // (x^2 - y^2)r^n
+    angular = x * x - y * y;
+    dAngular = Vector3d(2.0 * x, -2.0 * y, 0.0);
+    ddAngular(0, 0) = 2.0;
+    ddAngular(1, 1) = -2.0;
+    break;
+  case XZ: // xzr^n
+    angular = x * z;
+    dAngular = Vector3d(z, 0.0, x);
+    ddAngular(0, 2) = ddAngular(2, 0) = 1.0;
+    break;
+  case Z2: // (2z^2 - x^2 - y^2)r^n
+    angular = 2.0 * z * z - x * x - y * y;
+    dAngular = Vector3d(-2.0 * x, -2.0 * y, 4.0 * z);
+    ddAngular(0, 0) = ddAngular(1, 1) = -2.0;
+    ddAngular(2, 2) = 4.0;
+    break;
+  case YZ: // yzr^n
+    angular = y * z;
+    dAngular = Vector3d(0.0, z, y);
+    ddAngular(1, 2) = ddAngular(2, 1) = 1.0;
+    break;
+  case XY: // xyr^n
+    angular = x * y;
+    dAngular = Vector3d(y, x, 0.0);
+    ddAngular(0, 1) = ddAngular(1, 0) = 1.0;
+    break;
+  default:
+    gradient = Vector3d::Zero();
+    if (hessian)
+      *hessian = Matrix3d::Zero();
+    return 0.0;
+  }
+  gradient = dAngular * radial + angular * slope * delta;
+  if (hessian) {
+    Matrix3d cross = slope * dAngular * delta.transpose();
+    *hessian = ddAngular * radial + cross + cross.transpose()
+        + angular * (slope * Matrix3d::Identity()
+                     + curvature * delta * delta.transpose());
+  }
+  return angular * radial;
+}
+
 }
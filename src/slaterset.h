@@ -58,7 +58,8 @@ public:
   SlaterSet();
 
   /**
-   * Destructor.
+   * Destructor. A calculation that is still running is canceled, and its
+   * cube unlocked.
    */
   ~SlaterSet();
 
@@ -105,6 +106,14 @@ public:
    */
   bool addOverlapMatrix(const Eigen::MatrixXd &m);
 
+  /**
+   * The overlap matrix as its packed lower triangle, element (i, j) with
+   * j <= i at index i * (i + 1) / 2 + j, which is how MOPAC writes it.
+   * Symmetric matrices are stored packed, so this is the cheapest way to
+   * add one.
+   */
+  bool addOverlapMatrix(const std::vector<double> &lower);
+
   /**
    * Add Eigen Vectors to the SlaterSet.
    * @param MOs Matrix of the eigen vectors for the SlaterSet.
@@ -117,6 +126,12 @@ public:
    */
   bool addDensityMatrix(const Eigen::MatrixXd &d);
 
+  /**
+   * Add the density matrix as its packed lower triangle, laid out as for
+   * addOverlapMatrix().
+   */
+  bool addDensityMatrix(const std::vector<double> &lower);
+
   /**
    * @return The number of MOs in the BasisSet.
    */
@@ -128,13 +143,26 @@ public:
 
   bool calculateCubeDensity(Cube *cube);
 
+  bool initPointValues(Cube::Type type, unsigned int mo = 1);
+
+  double pointValue(const Eigen::Vector3d &pos);
+
   QFutureWatcher<void> & watcher() { return m_watcher; }
 
+  bool isCalculating() const { return m_cube != 0; }
+
   /**
    * Create a deep copy of @a this and return a pointer to it.
    */
   virtual BasisSet * clone();
 
+protected:
+  void hashContent(QCryptographicHash &hash) const;
+  void calculateTile(const Eigen::Vector3d *points, unsigned int count,
+                     const Eigen::Vector3d &center, double radius,
+                     double *values, Eigen::Vector3d *gradients,
+                     Eigen::Matrix3d *hessians, double *kineticEnergies);
+
 private Q_SLOTS:
   /**
    * Slot to set the cube data once Qt Concurrent is done
@@ -142,6 +170,8 @@ private Q_SLOTS:
   void calculationComplete();
 
 private:
+  friend class BasisSetSnapshot;
+
   std::vector<Eigen::Vector3d> m_atomPos;
   std::vector<int> m_slaterIndices;
   std::vector<int> m_slaterTypes;
@@ -149,11 +179,13 @@ private:
   std::vector<int> m_pqns, m_PQNs;
 
   std::vector<double> m_factors;
-  Eigen::MatrixXd m_overlap;
+  std::vector<double> m_overlap; // Packed lower triangles
   Eigen::MatrixXd m_eigenVectors;
-  Eigen::MatrixXd m_density;
+  std::vector<double> m_density;
   Eigen::MatrixXd m_normalized;
   bool m_initialized;
+  Cube::Type m_pointType;  // The type calculated by pointValue
+  unsigned int m_pointMO;  // The MO calculated by pointValue
 
   QFuture<void> m_future;
   QFutureWatcher<void> m_watcher;
@@ -161,12 +193,16 @@ private:
   QVector<SlaterShell> m_slaterShells;
 
   bool initialize();
+  void calculateLevel(); // Start the calculation of the current level
 
   static bool isSmall(double val);
   unsigned int factorial(unsigned int n);
 
   static void processPoint(SlaterShell &shell);
   static void processDensity(SlaterShell &shell);
+  static double moValue(SlaterSet *set, const Eigen::Vector3d &pos,
+                        unsigned int indexMO);
+  static double densityValue(SlaterSet *set, const Eigen::Vector3d &pos);
   static double pointSlater(SlaterSet *set, const Eigen::Vector3d &delta,
                             double dr2, unsigned int slater,
                             unsigned int indexMO);
@@ -175,6 +211,9 @@ private:
                             unsigned int indexMO, double expZeta);
   static double calcSlater(SlaterSet *set, const Eigen::Vector3d &delta,
                            double dr2, unsigned int slater);
+  static double calcSlater(SlaterSet *set, const Eigen::Vector3d &delta,
+                           double dr, unsigned int slater,
+                           Eigen::Vector3d &gradient, Eigen::Matrix3d *hessian);
 };
 
 } // End namespace
@@ -0,0 +1,141 @@
+
+#include <cmath>
+#include <iostream>
+
+#include "adaptivecube.h"
+#include "cube.h"
+#include "gaussianset.h"
+#include "testhelpers.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEventLoop>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::AdaptiveCube;
+using OpenQube::Cube;
+using OpenQube::GaussianSet;
+
+using Eigen::Vector3d;
+
+int testadaptivecube(int argc, char *argv[])
+{
+  // Cube calculations are completed from the event loop
+  QCoreApplication application(argc, argv);
+  bool error = false;
+  cout << "Testing adaptive cubes..." << endl;
+
+  GaussianSet *basis = createHydrogenBasisSet();
+  AdaptiveCube cube;
+  if (!checkResult(cube.setLimits(Vector3d(-3.0, -3.0, -3.0),
+                                  Vector3d(3.0, 3.0, 3.7), 0.05, 4), true))
+    return 1;
+  cube.setTolerance(1e-4);
+  if (!checkResult(basis->calculateAdaptiveCubeDensity(&cube), true))
+    return 1;
+
+  // Far fewer points than the uniform grid, which is only used close to the
+  // atoms
+  unsigned int uniform = 121 * 121 * 135;
+  if (!checkResult(cube.pointCount() < uniform / 2, true))
+    error = true;
+  if (!checkResult(cube.level(Vector3d(0.0, 0.0, 0.0)), 3))
+    error = true;
+  if (!checkResult(cube.level(Vector3d(-2.9, -2.9, -2.9)) < 3, true))
+    error = true;
+  if (!checkResult(cube.value(Vector3d(10.0, 0.0, 0.0)), 0.0))
+    error = true;
+
+  // The values interpolated from the blocks that were not refined all the
+  // way are within a few times the tolerance
+  basis->initPointValues(Cube::ElectronDensity);
+  double maxError = 0.0;
+  for (int i = 0; i < 1000; ++i) {
+    Vector3d pos(std::sin(i * 1.1) * 2.9, std::sin(i * 1.3) * 2.9,
+                 std::sin(i * 1.7) * 2.9 + 0.35);
+    if (cube.level(pos) == 3)
+      continue;
+    maxError = std::max(maxError, std::abs(cube.value(pos)
+                                           - basis->pointValue(pos)));
+  }
+  if (maxError > 5e-4) {
+    cerr << "Error, the largest interpolation error is " << maxError << endl;
+    error = true;
+  }
+
+  // The values are continuous where blocks of different levels meet, along
+  // lines parallel to the x axis through the molecule
+  int boundaries = 0;
+  double maxJump = 0.0;
+  for (int line = 0; line < 49; ++line) {
+    double y = -1.5 + (line / 7) * 0.5 + 0.013;
+    double z = -1.5 + (line % 7) * 0.5 + 0.37;
+    for (int i = 0; i < 600; ++i) {
+      Vector3d pos(-3.0 + i * 0.01, y, z);
+      Vector3d next = pos + Vector3d(0.01, 0.0, 0.0);
+      if (cube.level(pos) == cube.level(next))
+        continue;
+      // Bisect down to the boundary between the levels
+      for (int j = 0; j < 40; ++j) {
+        Vector3d middle = 0.5 * (pos + next);
+        if (cube.level(middle) == cube.level(pos))
+          pos = middle;
+        else
+          next = middle;
+      }
+      ++boundaries;
+      maxJump = std::max(maxJump,
+                         std::abs(cube.value(next) - cube.value(pos)));
+    }
+  }
+  if (!checkResult(boundaries > 0, true))
+    error = true;
+  if (maxJump > 1e-9) {
+    cerr << "Error, the values jump by " << maxJump
+         << " between levels" << endl;
+    error = true;
+  }
+
+  // Points of the finest blocks, around the nuclei, are exact in the uniform
+  // cube
+  Cube uniformCube;
+  uniformCube.setLimits(cube.min(), Eigen::Vector3i(61, 61, 61), 0.05);
+  if (!checkResult(cube.toCube(&uniformCube), true))
+    error = true;
+  if (!checkResult(uniformCube.cubeType(), Cube::ElectronDensity))
+    error = true;
+  Vector3d pos = uniformCube.position((60 * 61 + 60) * 61 + 60);
+  if (std::abs(uniformCube.value(60, 60, 60) - basis->pointValue(pos))
+      > 1e-12) {
+    cerr << "Error, a point of a finest block was interpolated" << endl;
+    error = true;
+  }
+
+  // MOs out of range cannot be calculated
+  if (!checkResult(basis->calculateAdaptiveCubeMO(&cube, 9), false))
+    error = true;
+
+  // Nor can anything while a cube is calculated, as they would share the
+  // coefficients
+  Cube *running = new Cube;
+  running->setLimits(Vector3d(-1.0, -1.0, -1.0), Eigen::Vector3i(5, 5, 5),
+                     0.5);
+  QEventLoop loop;
+  QObject::connect(basis, SIGNAL(finished()), &loop, SLOT(quit()));
+  if (!checkResult(basis->calculateCubeMO(running, 2), true))
+    return 1;
+  if (!checkResult(basis->isCalculating(), true)
+      || !checkResult(basis->calculateAdaptiveCubeMO(&cube, 1), false)
+      || !checkResult(basis->initPointValues(Cube::ElectronDensity), false))
+    error = true;
+  loop.exec();
+  if (!checkResult(basis->isCalculating(), false)
+      || !checkResult(basis->calculateAdaptiveCubeMO(&cube, 1), true))
+    error = true;
+  delete running;
+
+  delete basis;
+  return error ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+
+#include <cmath>
+#include <math.h>
+#include <iostream>
+
+#include "baderanalysis.h"
+#include "cube.h"
+#include "molecule.h"
+#include "testhelpers.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::BaderAnalysis;
+using OpenQube::Cube;
+using OpenQube::Molecule;
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+
+namespace {
+
+// The exponents of two 1s densities of one electron each, in inverse Bohr
+const double EXPONENTS[2] = { 1.0, 1.6 };
+
+// Their sum at pos, in Angstrom, and its gradient per Angstrom
+double slaterDensity(const Molecule &molecule, const Vector3d &pos,
+                     Vector3d &gradient)
+{
+  double value = 0.0;
+  gradient = Vector3d::Zero();
+  for (int a = 0; a < 2; ++a) {
+    Vector3d delta = (pos - molecule.atomPos(a)) / 0.529177249;
+    double r = delta.norm();
+    double zeta = EXPONENTS[a];
+    double term = zeta * zeta * zeta / M_PI * std::exp(-2.0 * zeta * r);
+    value += term;
+    if (r > 0.0)
+      gradient -= 2.0 * zeta * term * delta / r / 0.529177249;
+  }
+  return value;
+}
+
+// The atom whose nucleus the steepest ascent path from pos ends at, followed
+// in steps much smaller than the spacing of the cube
+int ascendToNucleus(const Molecule &molecule, Vector3d pos)
+{
+  for (int step = 0; step < 20000; ++step) {
+    for (int a = 0; a < 2; ++a)
+      if ((pos - molecule.atomPos(a)).norm() < 0.02)
+        return a;
+    Vector3d gradient;
+    slaterDensity(molecule, pos, gradient);
+    pos += 0.002 * gradient.normalized();
+  }
+  return -1;
+}
+
+// The atom nearest to the maximum each point of the cube rises to along the
+// steepest of its 26 neighbours, the partition without the near-grid
+// refinement, -1 in vacuum
+void onGridBasins(const Cube &cube, const Molecule &molecule, double vacuum,
+                  std::vector<int> &atoms)
+{
+  const std::vector<double> &data = *cube.data();
+  Vector3i dim = cube.dimensions();
+  std::vector<unsigned int> ascent(data.size());
+  for (int i = 0; i < dim.x(); ++i) {
+    for (int j = 0; j < dim.y(); ++j) {
+      for (int k = 0; k < dim.z(); ++k) {
+        unsigned int index = (i * dim.y() + j) * dim.z() + k;
+        ascent[index] = index;
+        double slope = 0.0;
+        for (int n = 0; n < 27; ++n) {
+          Vector3i step(n / 9 - 1, n / 3 % 3 - 1, n % 3 - 1);
+          Vector3i next = Vector3i(i, j, k) + step;
+          if (step.isZero() || (next.array() < 0).any()
+              || (next.array() >= dim.array()).any())
+            continue;
+          unsigned int neighbour = (next.x() * dim.y() + next.y()) * dim.z()
+              + next.z();
+          double rise = (data[neighbour] - data[index])
+              / step.cast<double>().cwiseProduct(cube.spacing()).norm();
+          if (rise > slope) {
+            ascent[index] = neighbour;
+            slope = rise;
+          }
+        }
+      }
+    }
+  }
+  atoms.assign(data.size(), -1);
+  for (unsigned int i = 0; i < data.size(); ++i) {
+    if (data[i] < vacuum)
+      continue;
+    unsigned int root = i;
+    while (ascent[root] != root)
+      root = ascent[root];
+    Vector3d maximum = cube.position(root);
+    atoms[i] = (maximum - molecule.atomPos(0)).norm()
+        < (maximum - molecule.atomPos(1)).norm() ? 0 : 1;
+  }
+}
+
+}
+
+int testbaderanalysis(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing Bader analysis..." << endl;
+
+  // Two hydrogen 1s densities, in electrons per cubic Bohr, on a bond that
+  // does not lie along the axes of the cube
+  Molecule molecule;
+  Vector3d bond = Vector3d(1.0, 0.6, 0.3).normalized() * 0.74;
+  molecule.addAtom(Vector3d(0.02, 0.013, -0.007), 1);
+  molecule.addAtom(molecule.atomPos(0) + bond, 1);
+  Cube density;
+  density.setLimits(molecule, 0.1, 3.0);
+  std::vector<double> values(density.dimensions().prod());
+  double total = 0.0;
+  for (unsigned int i = 0; i < values.size(); ++i) {
+    for (int a = 0; a < 2; ++a) {
+      double r = (density.position(i) - molecule.atomPos(a)).norm()
+          / 0.529177249;
+      values[i] += std::exp(-2.0 * r) / M_PI;
+    }
+    total += values[i];
+  }
+  density.setData(values);
+  Vector3d spacing = density.spacing() / 0.529177249;
+  total *= spacing.prod();
+
+  BaderAnalysis::Partition partition =
+      BaderAnalysis::partition(density, molecule);
+  if (!checkResult(partition.basins.size() == 2, true))
+    return 1;
+  if (!checkResult(partition.pointBasins.size() == values.size(), true))
+    error = true;
+  double sum = partition.vacuumPopulation;
+  for (int b = 0; b < 2; ++b) {
+    const BaderAnalysis::Basin &basin = partition.basins[b];
+    sum += basin.population;
+    if (!checkResult(basin.atom, b))
+      error = true;
+    if ((basin.maximum - molecule.atomPos(b)).norm() > 0.1) {
+      cerr << "Error, maximum " << b << " lies at " << basin.maximum.transpose()
+           << endl;
+      error = true;
+    }
+  }
+  if (std::abs(sum - total) > 1e-10) {
+    cerr << "Error, the basins hold " << sum << " electrons, expected "
+         << total << endl;
+    error = true;
+  }
+
+  // The atoms are the same, so they split the density evenly
+  if (std::abs(partition.populations[0] - partition.populations[1]) > 1e-3
+      || std::abs(partition.volumes[0] - partition.volumes[1]) > 1e-2
+      || std::abs(partition.charges[0] - (1.0 - partition.populations[0]))
+      > 1e-12) {
+    cerr << "Error, the atoms hold " << partition.populations[0] << " and "
+         << partition.populations[1] << " electrons" << endl;
+    error = true;
+  }
+
+  // Two atoms of different sizes, so the zero-flux surface between them is
+  // curved and closer to the smaller one. The basin of each point is checked
+  // against the end of its steepest ascent path, followed accurately.
+  Molecule unequal;
+  unequal.addAtom(Vector3d(0.02, 0.013, -0.007), 1);
+  unequal.addAtom(unequal.atomPos(0)
+                  + Vector3d(1.0, 0.6, 0.3).normalized() * 1.1, 3);
+  density.setLimits(unequal, 0.1, 2.5);
+  values.assign(density.dimensions().prod(), 0.0);
+  Vector3d gradient;
+  for (unsigned int i = 0; i < values.size(); ++i)
+    values[i] = slaterDensity(unequal, density.position(i), gradient);
+  density.setData(values);
+  partition = BaderAnalysis::partition(density, unequal);
+  if (!checkResult(partition.basins.size() == 2, true))
+    return 1;
+  std::vector<int> onGrid, exact(values.size(), -1);
+  onGridBasins(density, unequal, 1e-3, onGrid);
+  for (unsigned int i = 0; i < values.size(); ++i)
+    if (partition.pointBasins[i] >= 0)
+      exact[i] = ascendToNucleus(unequal, density.position(i));
+
+  // Only the points next to the surface may end up on the wrong side of it,
+  // and the refinement puts far fewer there than the ascent on the grid
+  Vector3i dim = density.dimensions();
+  int errors = 0, onGridErrors = 0, distantErrors = 0, onGridDistantErrors = 0;
+  double populations[2] = { 0.0, 0.0 }, onGridPopulations[2] = { 0.0, 0.0 };
+  for (unsigned int i = 0; i < values.size(); ++i) {
+    if (exact[i] < 0)
+      continue;
+    populations[exact[i]] += values[i];
+    onGridPopulations[onGrid[i]] += values[i];
+    Vector3i point(i / (dim.y() * dim.z()), i / dim.z() % dim.y(),
+                   i % dim.z());
+    bool distant = true;
+    for (int n = 0; n < 27; ++n) {
+      Vector3i next = point + Vector3i(n / 9 - 1, n / 3 % 3 - 1, n % 3 - 1);
+      if ((next.array() >= 0).all() && (next.array() < dim.array()).all()) {
+        int other = exact[(next.x() * dim.y() + next.y()) * dim.z()
+            + next.z()];
+        if (other >= 0 && other != exact[i])
+          distant = false;
+      }
+    }
+    if (partition.basins[partition.pointBasins[i]].atom != exact[i]) {
+      ++errors;
+      if (distant)
+        ++distantErrors;
+    }
+    if (onGrid[i] != exact[i]) {
+      ++onGridErrors;
+      if (distant)
+        ++onGridDistantErrors;
+    }
+  }
+  if (distantErrors || !onGridDistantErrors || errors * 5 > onGridErrors) {
+    cerr << "Error, " << errors << " points are in the wrong basin, "
+         << distantErrors << " away from the surface, and "
+         << onGridErrors << " and " << onGridDistantErrors
+         << " with the ascent on the grid" << endl;
+    error = true;
+  }
+  double volume = (density.spacing() / 0.529177249).prod();
+  for (int a = 0; a < 2; ++a) {
+    double expected = populations[a] * volume;
+    double difference = std::abs(partition.populations[a] - expected);
+    if (difference > 2.5e-3
+        || difference > std::abs(onGridPopulations[a] * volume - expected)) {
+      cerr << "Error, atom " << a << " holds " << partition.populations[a]
+           << " electrons, expected " << expected << endl;
+      error = true;
+    }
+  }
+
+  // No points, so no basins
+  if (!checkResult(BaderAnalysis::partition(Cube()).basins.empty(), true))
+    error = true;
+
+  return error ? 1 : 0;
+}
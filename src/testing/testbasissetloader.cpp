@@ -0,0 +1,153 @@
+
+#include <iostream>
+
+#include "basissetloader.h"
+#include "basisset.h"
+#include "testhelpers.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::BasisSet;
+using OpenQube::BasisSetLoader;
+
+namespace {
+
+// A hydrogen atom with a single s function and MO
+const char HYDROGEN_FCHK[] =
+    "Hydrogen atom\n"
+    "SP        RHF                                                   STO-3G\n"
+    "Number of atoms                            I                1\n"
+    "Number of electrons                        I                1\n"
+    "Number of basis functions                  I                1\n"
+    "Atomic numbers                             I   N=           1\n"
+    "           1\n"
+    "Current cartesian coordinates              R   N=           3\n"
+    "  0.00000000E+00  0.00000000E+00  0.00000000E+00\n"
+    "Shell types                                I   N=           1\n"
+    "           0\n"
+    "Number of primitives per shell             I   N=           1\n"
+    "           1\n"
+    "Shell to atom map                          I   N=           1\n"
+    "           1\n"
+    "Primitive exponents                        R   N=           1\n"
+    "  1.00000000E+00\n"
+    "Contraction coefficients                   R   N=           1\n"
+    "  1.00000000E+00\n"
+    "Alpha MO coefficients                      R   N=           1\n"
+    "  1.00000000E+00\n";
+
+bool writeFile(const QString &filename, const char *text)
+{
+  QFile file(filename);
+  return file.open(QIODevice::WriteOnly) && file.write(text) > 0;
+}
+
+// Delete the basis sets of the results that were reported
+void deleteResults(const QFuture<BasisSetLoader::LoadResult> &future)
+{
+  QList<BasisSetLoader::LoadResult> results = future.results();
+  for (int i = 0; i < results.size(); ++i)
+    delete results[i].basis;
+}
+
+}
+
+int testbasissetloader(int argc, char *argv[])
+{
+  // Basis sets that are not reported are deleted from the event loop
+  QCoreApplication application(argc, argv);
+  bool error = false;
+  cout << "Testing loading basis sets..." << endl;
+
+  // Loaded files among one that is missing and one of an unknown type
+  QDir dir = QDir::temp();
+  QStringList filenames;
+  for (int i = 0; i < 8; ++i) {
+    filenames << dir.filePath(QString("openqube-testbasissetloader%1.fchk")
+                              .arg(i));
+    if (!checkResult(writeFile(filenames.last(), HYDROGEN_FCHK), true))
+      return 1;
+  }
+  filenames.insert(3, dir.filePath("openqube-testbasissetloader.missing"));
+  filenames.insert(5, dir.filePath("openqube-testbasissetloader.txt"));
+  if (!checkResult(writeFile(filenames[5], "text\n"), true))
+    return 1;
+
+  // Each result is at the index of its file, whatever order they end in
+  BasisSetLoader::SetMaxThreadCount(4);
+  QFuture<BasisSetLoader::LoadResult> future =
+      BasisSetLoader::LoadBasisSets(filenames);
+  future.waitForFinished();
+  if (!checkResult(future.resultCount(), filenames.size()))
+    error = true;
+  for (int i = 0; i < future.resultCount(); ++i) {
+    BasisSetLoader::LoadResult result = future.resultAt(i);
+    bool loaded = i != 3 && i != 5;
+    if (!checkResult(result.fileName == filenames[i], true)
+        || !checkResult(result.basis != 0, loaded)
+        || !checkResult(result.error.isEmpty(), loaded)) {
+      error = true;
+    }
+    else if (loaded && !checkResult(result.basis->numMOs(), 1u)) {
+      error = true;
+    }
+  }
+  // The progress is counted in files
+  if (!checkResult(future.progressMinimum(), 0)
+      || !checkResult(future.progressMaximum(), filenames.size())
+      || !checkResult(future.progressValue(), filenames.size()))
+    error = true;
+  deleteResults(future);
+
+  // Formatted checkpoint files are read up front unless indexing is asked for
+  for (int indexed = 0; indexed < 2; ++indexed) {
+    BasisSet *basis = BasisSetLoader::LoadBasisSet(filenames[0], false,
+                                                   indexed != 0);
+    if (!checkResult(basis != 0, true)
+        || !checkResult(basis->numMOs(), 1u))
+      error = true;
+    delete basis;
+  }
+
+  // Canceling skips the files that have not started, and the files that
+  // were still loading are not reported. The files are small, so the loader
+  // may finish all of them before the cancel arrives; either way every
+  // reported result must be a complete basis set.
+  QStringList many;
+  for (int i = 0; i < 50; ++i)
+    many << filenames[i % 3];
+  BasisSetLoader::SetMaxThreadCount(1);
+  future = BasisSetLoader::LoadBasisSets(many);
+  future.cancel();
+  future.waitForFinished();
+  QList<BasisSetLoader::LoadResult> results = future.results();
+  if (results.size() < many.size() && !future.isCanceled()) {
+    cerr << "Error, files were skipped without canceling" << endl;
+    error = true;
+  }
+  for (int i = 0; i < results.size(); ++i) {
+    if (!checkResult(results[i].basis != 0, true))
+      error = true;
+  }
+  deleteResults(future);
+  QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+  BasisSetLoader::SetMaxThreadCount(QThread::idealThreadCount());
+
+  // No files, so the future is finished straight away
+  future = BasisSetLoader::LoadBasisSets(QStringList());
+  if (!checkResult(future.isFinished(), true)
+      || !checkResult(future.resultCount(), 0))
+    error = true;
+
+  for (int i = 0; i < filenames.size(); ++i)
+    QFile::remove(filenames[i]);
+  return error ? 1 : 0;
+}
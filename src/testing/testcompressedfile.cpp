@@ -0,0 +1,264 @@
+
+#include <cstring>
+#include <iostream>
+
+#include "basissetloader.h"
+#include "compressedfile.h"
+#include "textparser.h"
+#include "testfixtures.h"
+#include "testhelpers.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+#ifdef OPENQUBE_HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef OPENQUBE_HAVE_LZMA
+# include <lzma.h>
+#endif
+#ifdef OPENQUBE_HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::BasisSet;
+using OpenQube::BasisSetLoader;
+using OpenQube::CompressedFile;
+using OpenQube::MappedFile;
+using OpenQube::RecordReader;
+
+namespace {
+
+// Compress text as a single gzip member, xz stream or zstd frame, empty if
+// the format is not supported
+QByteArray compress(CompressedFile::Format format, const QByteArray &text)
+{
+  QByteArray result;
+  switch (format) {
+#ifdef OPENQUBE_HAVE_ZLIB
+  case CompressedFile::Gzip: {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // A gzip rather than a zlib header
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      return result;
+    result.resize(deflateBound(&stream, text.size()));
+    stream.next_in = reinterpret_cast<Bytef *>(
+          const_cast<char *>(text.constData()));
+    stream.avail_in = text.size();
+    stream.next_out = reinterpret_cast<Bytef *>(result.data());
+    stream.avail_out = result.size();
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+      result.resize(stream.total_out);
+    else
+      result.clear();
+    deflateEnd(&stream);
+    break;
+  }
+#endif
+#ifdef OPENQUBE_HAVE_LZMA
+  case CompressedFile::Xz: {
+    result.resize(lzma_stream_buffer_bound(text.size()));
+    size_t size = 0;
+    if (lzma_easy_buffer_encode(1, LZMA_CHECK_CRC64, 0,
+          reinterpret_cast<const uint8_t *>(text.constData()), text.size(),
+          reinterpret_cast<uint8_t *>(result.data()), &size, result.size())
+        == LZMA_OK)
+      result.resize(size);
+    else
+      result.clear();
+    break;
+  }
+#endif
+#ifdef OPENQUBE_HAVE_ZSTD
+  case CompressedFile::Zstd: {
+    result.resize(ZSTD_compressBound(text.size()));
+    size_t size = ZSTD_compress(result.data(), result.size(),
+                                text.constData(), text.size(), 1);
+    if (ZSTD_isError(size))
+      result.clear();
+    else
+      result.resize(size);
+    break;
+  }
+#endif
+  default:
+    break;
+  }
+  return result;
+}
+
+bool writeFile(const QString &filename, const QByteArray &data)
+{
+  QFile file(filename);
+  return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+// Read the whole file through CompressedFile, in pieces that do not line up
+// with its blocks
+bool readStream(const QString &filename, QByteArray &text)
+{
+  CompressedFile file(filename);
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+  text.clear();
+  static char buffer[100003];
+  qint64 n;
+  while ((n = file.read(buffer, sizeof(buffer))) > 0)
+    text.append(buffer, static_cast<int>(n));
+  return n == 0;
+}
+
+// Lines of multiples of 1000 start the records
+bool isThousand(const char *begin, const char *end)
+{
+  const char *p = begin;
+  int value;
+  return OpenQube::parseInt(p, end, value) && value % 1000 == 0;
+}
+
+// Read the file a record at a time, with blocks that split lines
+bool readRecords(const QString &filename, QByteArray &text, int &records)
+{
+  CompressedFile file(filename);
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+  text.clear();
+  records = 0;
+  RecordReader reader(&file, isThousand, 4099);
+  const char *begin, *end;
+  while (reader.readRecord(begin, end)) {
+    if (!isThousand(begin, end))
+      return false;
+    text.append(begin, static_cast<int>(end - begin));
+    ++records;
+  }
+  return !reader.hasError();
+}
+
+// Load @a text as the file @a name, and compressed in @a format, through
+// BasisSetLoader, and check that both give the same orbitals
+bool checkLoad(CompressedFile::Format format, const QString &name,
+               const QByteArray &text, bool density)
+{
+  QString plain = QDir::temp().filePath(name);
+  QString compressed = plain + (format == CompressedFile::Gzip ? ".gz"
+                                : format == CompressedFile::Xz ? ".xz"
+                                                               : ".zst");
+  bool ok = false;
+  if (checkResult(writeFile(plain, text), true)
+      && checkResult(writeFile(compressed, compress(format, text)), true)) {
+    BasisSet *expected = BasisSetLoader::LoadBasisSet(plain);
+    BasisSet *basis = BasisSetLoader::LoadBasisSet(compressed);
+    ok = checkResult(expected != 0 && basis != 0, true)
+        && checkResult(basis->numElectrons(), expected->numElectrons())
+        && checkResult(basis->moleculeRef().numAtoms(),
+                       expected->moleculeRef().numAtoms())
+        && checkOrbitals(basis, expected, density);
+    delete basis;
+    delete expected;
+  }
+  if (!ok)
+    cerr << "Error, the compressed " << name.toStdString() << " differs"
+         << endl;
+  QFile::remove(plain);
+  QFile::remove(compressed);
+  return ok;
+}
+
+}
+
+int testcompressedfile(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing compressed files..." << endl;
+
+  // A few megabytes, so the output is queued in several blocks
+  QByteArray text;
+  for (int i = 0; i < 200000; ++i) {
+    text += QByteArray::number(i) + "  "
+        + QByteArray::number(i * 0.001, 'E', 8) + '\n';
+  }
+
+  QString filename = QDir::temp().filePath("openqube-testcompressedfile");
+  CompressedFile::Format formats[3] = { CompressedFile::Gzip,
+                                        CompressedFile::Xz,
+                                        CompressedFile::Zstd };
+  for (int f = 0; f < 3; ++f) {
+    CompressedFile::Format format = formats[f];
+    if (!CompressedFile::isSupported(format))
+      continue;
+
+    // Two members, as written by parallel compressors
+    int half = text.size() / 2;
+    QByteArray compressed = compress(format, text.left(half))
+        + compress(format, text.mid(half));
+    if (!checkResult(writeFile(filename, compressed), true))
+      return 1;
+    if (!checkResult(CompressedFile::format(filename), format))
+      error = true;
+
+    QByteArray read;
+    if (!checkResult(readStream(filename, read), true))
+      error = true;
+    else if (!checkResult(read == text, true))
+      error = true;
+
+    int records;
+    if (!checkResult(readRecords(filename, read, records), true))
+      error = true;
+    else if (!checkResult(read == text, true)
+             || !checkResult(records, 200))
+      error = true;
+
+    MappedFile mapped;
+    if (!checkResult(mapped.open(filename), true))
+      error = true;
+    else if (!checkResult(QByteArray(mapped.begin(),
+                                     mapped.end() - mapped.begin()) == text,
+                          true))
+      error = true;
+
+    // Cut off in the middle of the second member
+    if (!checkResult(writeFile(filename,
+                               compressed.left(compressed.size() - 10)),
+                     true))
+      return 1;
+    if (!checkResult(readStream(filename, read), false))
+      error = true;
+    if (!checkResult(readRecords(filename, read, records), false))
+      error = true;
+    if (!checkResult(mapped.open(filename), false))
+      error = true;
+
+    // The parsers read compressed files through CompressedFile, or
+    // MappedFile for GAMESS-US, and should not notice the difference. The
+    // formatted checkpoint file and the MOPAC aux file are large enough to
+    // be decoded in parallel chunks.
+    if (!checkLoad(format, "openqube-testcompressedfile.fchk",
+                   gaussianFchk(192), true)
+        || !checkLoad(format, "openqube-testcompressedfile.molden",
+                      moldenFile(), false)
+        || !checkLoad(format, "openqube-testcompressedfile.aux",
+                      mopacAux(128), true)
+        || !checkLoad(format, "openqube-testcompressedfile.gamout",
+                      gamessUSHeader() + gamessUSStep(0) + gamessUSStep(1),
+                      false))
+      error = true;
+  }
+  QFile::remove(filename);
+
+  // Text that is not compressed is not recognized
+  if (!checkResult(writeFile(filename, text.left(100)), true))
+    return 1;
+  if (!checkResult(CompressedFile::format(filename), CompressedFile::None))
+    error = true;
+  QFile::remove(filename);
+
+  return error ? 1 : 0;
+}
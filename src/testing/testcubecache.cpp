@@ -0,0 +1,171 @@
+
+#include <cmath>
+#include <iostream>
+
+#include "cubecache.h"
+#include "cubediskcache.h"
+#include "cube.h"
+#include "gaussianset.h"
+#include "testhelpers.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QEventLoop>
+#include <QtCore/QReadWriteLock>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::Cube;
+using OpenQube::CubeCache;
+using OpenQube::CubeDiskCache;
+using OpenQube::GaussianSet;
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+
+// A cube holding 1000 doubles, 8000 bytes
+Cube * createCube()
+{
+  Cube *cube = new Cube;
+  cube->setLimits(Vector3d(0.0, 0.0, 0.0), Vector3i(10, 10, 10), 0.5);
+  return cube;
+}
+
+int testcubecache(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing the cube cache class..." << endl;
+
+  CubeCache cache(20000);
+
+  Cube *a = createCube();
+  cache.insert("a", a);
+  cache.insert("b", createCube());
+  if (!checkResult(cache.count(), 2))
+    error = true;
+  if (!checkResult(cache.memoryUsed(), 16000))
+    error = true;
+
+  // A hit returns the cached cube itself, and makes it most recently used
+  QSharedPointer<const Cube> hit = cache.find("a");
+  if (!checkResult(hit.data(), a))
+    error = true;
+
+  // Over budget, so the least recently used cube (b) is evicted
+  cache.insert("c", createCube());
+  if (!checkResult(cache.count(), 2))
+    error = true;
+  if (!checkResult(cache.find("b").isNull(), true))
+    error = true;
+  if (!checkResult(cache.find("a").isNull(), false))
+    error = true;
+
+  // Cubes in use stay valid once evicted
+  cache.setMemoryBudget(0);
+  if (!checkResult(cache.count(), 0))
+    error = true;
+  if (!checkResult(hit->data()->size(), 1000))
+    error = true;
+
+  // Calculated cubes are unlocked before they are returned, without an event
+  // loop, and stay valid even though the cache cannot hold them
+  GaussianSet basis;
+  unsigned int atom = basis.addAtom(Vector3d(0.0, 0.0, 0.0), 1);
+  basis.addGTO(basis.addBasis(atom, OpenQube::S), 0.5, 1.0);
+  basis.addMOs(std::vector<double>(1, 1.0));
+  basis.setNumElectrons(1);
+  Cube limits;
+  limits.setLimits(Vector3d(-2.0, -2.0, -2.0), Vector3i(8, 8, 8), 0.5);
+  QSharedPointer<const Cube> mo = cache.cubeMO(&basis, limits, 1);
+  if (!checkResult(mo.isNull(), false))
+    return 1;
+  if (!checkResult(mo->lock()->tryLockForWrite(), true))
+    error = true;
+  else
+    mo->lock()->unlock();
+  Cube direct;
+  direct.setLimits(limits);
+  if (!checkResult(basis.blockingCalculateCubeMO(&direct, 1), true))
+    return 1;
+  double expected = direct.value(3, 5, 2);
+  if (std::abs(mo->value(3, 5, 2) - expected) > 1e-12) {
+    cerr << "Error, the cached MO is " << mo->value(3, 5, 2) << ", expected "
+         << expected << endl;
+    error = true;
+  }
+
+  // With the cache set on the basis set, the cube of an asynchronous
+  // calculation shares the values of a hit, and the calculation finishes
+  // without calculating anything
+  CubeCache shared(20000);
+  Cube *marked = new Cube;
+  marked->setLimits(limits);
+  marked->setCubeType(Cube::MO);
+  marked->setData(std::vector<double>(marked->data()->size(), 42.0));
+  shared.insert(CubeCache::key(&basis, Cube::MO, 1, limits), marked);
+  basis.setCubeCache(&shared);
+  Cube async;
+  async.setLimits(limits);
+  QEventLoop loop;
+  QObject::connect(&basis, SIGNAL(finished()), &loop, SLOT(quit()));
+  if (!checkResult(basis.calculateCubeMO(&async, 1), true))
+    return 1;
+  if (!checkResult(basis.watcher().future().isFinished(), true))
+    error = true;
+  loop.exec();
+  if (!checkResult(async.value(3, 5, 2), 42.0))
+    error = true;
+  // The values are only copied once the cube changes them
+  const Cube &cached = *marked;
+  const Cube &sharing = async;
+  if (!checkResult(sharing.data(), cached.data()))
+    error = true;
+  async.setValue(3, 5, 2, 1.0);
+  if (!checkResult(sharing.data() != cached.data(), true)
+      || !checkResult(cached.value(3, 5, 2), 42.0))
+    error = true;
+  if (!checkResult(async.lock()->tryLockForWrite(), true))
+    error = true;
+  else
+    async.lock()->unlock();
+  // The blocking wrapper then returns the cached cube rather than a copy
+  if (!checkResult(shared.cubeMO(&basis, limits, 1).data(),
+                   static_cast<const Cube *>(marked)))
+    error = true;
+  basis.setCubeCache(0);
+
+  // The disk cache drops the least recently used cube too, with each file
+  // holding a small header and the 8000 bytes of data
+  QString path = QDir::temp().filePath("openqube-testcubecache");
+  CubeDiskCache disk(path, 20000);
+  disk.clear();
+  Cube *stored = createCube();
+  disk.store("a", *stored);
+  disk.store("b", *stored);
+  Cube loaded;
+  loaded.setLimits(*stored);
+  if (!checkResult(disk.load("a", &loaded), true))
+    error = true;
+  disk.store("c", *stored);
+  if (!checkResult(disk.load("b", &loaded), false))
+    error = true;
+  if (!checkResult(disk.load("a", &loaded), true))
+    error = true;
+  if (!checkResult(disk.size() > 16000 && disk.size() <= 20000, true))
+    error = true;
+  // Lowering the maximum size evicts straight away, leaving the most
+  // recently used cube
+  disk.setMaxSize(10000);
+  if (!checkResult(disk.size() > 8000 && disk.size() <= 10000, true))
+    error = true;
+  if (!checkResult(disk.load("c", &loaded), false))
+    error = true;
+  if (!checkResult(disk.load("a", &loaded), true))
+    error = true;
+  disk.clear();
+  QDir().rmdir(path);
+  delete stored;
+
+  return error ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+#include <iostream>
+
+#include "cube.h"
+#include "cubecache.h"
+#include "gaussianset.h"
+#include "testhelpers.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEventLoop>
+#include <QtCore/QReadWriteLock>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::BasisSet;
+using OpenQube::Cube;
+using OpenQube::CubeCache;
+using OpenQube::GaussianSet;
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+
+namespace {
+
+// Calculate the second MO or the density into a new cube in the evaluation
+// mode of the basis set, running the event loop until the calculation has
+// finished. The calculation is canceled straight away if @a cancel is set.
+Cube * calculate(GaussianSet *basis, Cube::Type type, bool cancel = false)
+{
+  Cube *cube = new Cube;
+  // The number of points along each axis is not a multiple of the stride
+  cube->setLimits(Vector3d(-2.0, -2.0, -2.0), Vector3i(21, 18, 23), 0.2);
+  QEventLoop loop;
+  QObject::connect(basis, SIGNAL(finished()), &loop, SLOT(quit()));
+  bool success = type == Cube::MO ? basis->calculateCubeMO(cube, 2)
+                                  : basis->calculateCubeDensity(cube);
+  if (!success) {
+    delete cube;
+    return 0;
+  }
+  if (cancel)
+    basis->watcher().cancel();
+  loop.exec();
+  return cube;
+}
+
+// Count the edges between neighbouring points of the Direct cube that an
+// isovalue crosses, and those at which the Adaptive cube differs
+void compareCrossings(const Cube &direct, const Cube &adaptive,
+                      const std::vector<double> &isovalues, int &crossings,
+                      int &differences)
+{
+  Vector3i dim = direct.dimensions();
+  const std::vector<double> &d = *direct.data();
+  const std::vector<double> &a = *adaptive.data();
+  int steps[3] = { dim.y() * dim.z(), dim.z(), 1 };
+  crossings = differences = 0;
+  for (int i = 0; i < dim.x(); ++i) {
+    for (int j = 0; j < dim.y(); ++j) {
+      for (int k = 0; k < dim.z(); ++k) {
+        int index = i * steps[0] + j * steps[1] + k;
+        int next[3] = { i + 1, j + 1, k + 1 };
+        for (int axis = 0; axis < 3; ++axis) {
+          if (next[axis] >= dim[axis])
+            continue;
+          int neighbour = index + steps[axis];
+          for (size_t v = 0; v < isovalues.size(); ++v) {
+            if ((d[index] - isovalues[v]) * (d[neighbour] - isovalues[v])
+                > 0.0)
+              continue;
+            ++crossings;
+            if (a[index] != d[index] || a[neighbour] != d[neighbour])
+              ++differences;
+          }
+        }
+      }
+    }
+  }
+}
+
+}
+
+int testevaluationmode(int argc, char *argv[])
+{
+  // The levels of a calculation are chained from the event loop
+  QCoreApplication application(argc, argv);
+  bool error = false;
+  cout << "Testing the evaluation modes..." << endl;
+
+  GaussianSet *basis = createHydrogenBasisSet();
+  for (int density = 0; density < 2; ++density) {
+    Cube::Type type = density ? Cube::ElectronDensity : Cube::MO;
+    basis->setEvaluationMode(BasisSet::Direct);
+    Cube *direct = calculate(basis, type);
+    basis->setEvaluationMode(BasisSet::Progressive);
+    Cube *progressive = calculate(basis, type);
+    if (!direct || !progressive) {
+      cerr << "Error, the cubes could not be calculated" << endl;
+      return 1;
+    }
+
+    // Progressive calculations only change the order of the points
+    if (!checkResult(*progressive->data() == *direct->data(), true))
+      error = true;
+    if (!checkResult(progressive->lock()->tryLockForWrite(), true))
+      error = true;
+    else
+      progressive->lock()->unlock();
+    delete direct;
+    delete progressive;
+  }
+
+  // Adaptive calculations give the same values as Direct ones at the points
+  // around the isovalues, so the isosurfaces are the same
+  for (int density = 0; density < 2; ++density) {
+    Cube::Type type = density ? Cube::ElectronDensity : Cube::MO;
+    // Isovalues near the peaks, which the corners of the cells around them
+    // do not reach. Those cells are only refined because the margin of the
+    // gradient bound over them, times half their diagonal, reaches the
+    // isovalue.
+    std::vector<double> isovalues;
+    if (density) {
+      isovalues.push_back(0.6);
+    }
+    else {
+      isovalues.push_back(-0.056);
+    }
+    basis->setIsovalues(isovalues);
+    basis->setEvaluationMode(BasisSet::Direct);
+    Cube *direct = calculate(basis, type);
+    basis->setEvaluationMode(BasisSet::Adaptive);
+    Cube *adaptive = calculate(basis, type);
+    if (!direct || !adaptive) {
+      cerr << "Error, the cubes could not be calculated" << endl;
+      return 1;
+    }
+
+    int crossings, differences;
+    compareCrossings(*direct, *adaptive, isovalues, crossings, differences);
+    if (crossings == 0) {
+      cerr << "Error, no isovalue crosses the cube" << endl;
+      error = true;
+    }
+    if (!checkResult(differences, 0))
+      error = true;
+    // The cells of the MO away from its isovalues are interpolated, the
+    // density is refined almost everywhere in so small a cube
+    if (!density
+        && !checkResult(*adaptive->data() == *direct->data(), false))
+      error = true;
+    delete direct;
+    delete adaptive;
+  }
+
+  // Interpolated cubes are not cached, so a Direct calculation that follows
+  // an Adaptive one is not handed the interpolated values
+  basis->setIsovalues(std::vector<double>(1, -0.056));
+  basis->setEvaluationMode(BasisSet::Direct);
+  Cube *reference = calculate(basis, Cube::MO);
+  CubeCache cache(1 << 24);
+  basis->setCubeCache(&cache);
+  basis->setEvaluationMode(BasisSet::Adaptive);
+  Cube *adaptive = calculate(basis, Cube::MO);
+  if (!checkResult(cache.count(), 0))
+    error = true;
+  basis->setEvaluationMode(BasisSet::Direct);
+  Cube *direct = calculate(basis, Cube::MO);
+  if (!reference || !adaptive || !direct) {
+    cerr << "Error, the cubes could not be calculated" << endl;
+    return 1;
+  }
+  if (!checkResult(*direct->data() == *reference->data(), true))
+    error = true;
+  if (!checkResult(cache.count(), 1))
+    error = true;
+  basis->setCubeCache(0);
+  delete reference;
+  delete adaptive;
+  delete direct;
+  basis->setIsovalues(std::vector<double>());
+
+  // A canceled calculation stops at the level it was canceled in, and
+  // unlocks the cube
+  basis->setEvaluationMode(BasisSet::Progressive);
+  Cube *canceled = calculate(basis, Cube::MO, true);
+  if (!checkResult(basis->watcher().isCanceled(), true))
+    error = true;
+  if (!checkResult(canceled->lock()->tryLockForWrite(), true))
+    error = true;
+  else
+    canceled->lock()->unlock();
+  delete canceled;
+
+  delete basis;
+  return error ? 1 : 0;
+}
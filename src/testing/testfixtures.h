@@ -0,0 +1,316 @@
+#ifndef OQ_TESTFIXTURES_H
+#define OQ_TESTFIXTURES_H
+
+#include <vector>
+
+#include "gaussianset.h"
+#include "slaterset.h"
+
+#include <QtCore/QByteArray>
+
+// Output files written by the tests, with the basis sets they hold built
+// directly for comparison
+
+// Made up values with three decimals, which are read back exactly
+inline double fixtureValue(int i)
+{
+  return ((i * 7919) % 2001 - 1000) / 1000.0;
+}
+
+// The header of a formatted checkpoint section, the name padded to 43
+// columns followed by the type and the value or size
+inline QByteArray fchkHeader(const char *name, char type, int n, bool array)
+{
+  return QByteArray(name).leftJustified(43, ' ') + type
+      + (array ? "   N=" + QByteArray::number(n).rightJustified(12)
+               : QByteArray::number(n).rightJustified(17)) + '\n';
+}
+
+inline QByteArray fchkIntegers(const char *name, const std::vector<int> &values)
+{
+  QByteArray text = fchkHeader(name, 'I', values.size(), true);
+  for (size_t i = 0; i < values.size(); ++i) {
+    text += QByteArray::number(values[i]).rightJustified(12);
+    if (i % 6 == 5 || i + 1 == values.size())
+      text += '\n';
+  }
+  return text;
+}
+
+inline QByteArray fchkReals(const char *name,
+                            const std::vector<double> &values)
+{
+  QByteArray text = fchkHeader(name, 'R', values.size(), true);
+  for (size_t i = 0; i < values.size(); ++i) {
+    text += QByteArray::number(values[i], 'E', 8).rightJustified(16);
+    if (i % 5 == 4 || i + 1 == values.size())
+      text += '\n';
+  }
+  return text;
+}
+
+// The atom, exponents, MO coefficients and packed density matrix of
+// gaussianFchk(@a functions)
+inline void gaussianFchkArrays(int functions, Eigen::Vector3d &position,
+                               std::vector<double> &exponents,
+                               std::vector<double> &mos,
+                               std::vector<double> &density)
+{
+  int n = functions;
+  position = Eigen::Vector3d(0.1, -0.2, 0.3);
+  exponents.resize(n);
+  mos.resize(n * n);
+  density.resize(n * (n + 1) / 2);
+  for (int i = 0; i < n; ++i)
+    exponents[i] = (i + 1) / 20.0;
+  for (size_t i = 0; i < mos.size(); ++i)
+    mos[i] = fixtureValue(i);
+  for (size_t i = 0; i < density.size(); ++i)
+    density[i] = fixtureValue(i + 1);
+}
+
+// A formatted checkpoint file of one atom with @a functions s functions of
+// different exponents
+inline QByteArray gaussianFchk(int functions)
+{
+  int n = functions;
+  Eigen::Vector3d position;
+  std::vector<double> exponents, mos, density;
+  gaussianFchkArrays(n, position, exponents, mos, density);
+
+  QByteArray text = "Large basis\n"
+      "SP        RHF                                                   Test\n";
+  text += fchkHeader("Number of atoms", 'I', 1, false);
+  text += fchkHeader("Number of electrons", 'I', 2, false);
+  text += fchkHeader("Number of basis functions", 'I', n, false);
+  text += fchkIntegers("Atomic numbers", std::vector<int>(1, 1));
+  text += fchkReals("Current cartesian coordinates",
+                    std::vector<double>(position.data(), position.data() + 3));
+  text += fchkIntegers("Shell types", std::vector<int>(n, 0));
+  text += fchkIntegers("Number of primitives per shell",
+                       std::vector<int>(n, 1));
+  text += fchkIntegers("Shell to atom map", std::vector<int>(n, 1));
+  text += fchkReals("Primitive exponents", exponents);
+  text += fchkReals("Contraction coefficients", std::vector<double>(n, 1.0));
+  text += fchkReals("Alpha MO coefficients", mos);
+  text += fchkReals("Total SCF Density", density);
+  return text;
+}
+
+// The basis set of gaussianFchk(@a functions)
+inline OpenQube::GaussianSet * createGaussianFchkBasisSet(int functions)
+{
+  int n = functions;
+  Eigen::Vector3d position;
+  std::vector<double> exponents, mos, density;
+  gaussianFchkArrays(n, position, exponents, mos, density);
+
+  OpenQube::GaussianSet *basis = new OpenQube::GaussianSet;
+  basis->addAtom(position, 1);
+  for (int i = 0; i < n; ++i)
+    basis->addGTO(basis->addBasis(0, OpenQube::S), 1.0, exponents[i]);
+  basis->addMOs(mos);
+  Eigen::MatrixXd matrix(n, n);
+  for (int i = 0, k = 0; i < n; ++i) {
+    for (int j = 0; j <= i; ++j, ++k)
+      matrix(i, j) = matrix(j, i) = density[k];
+  }
+  basis->setDensityMatrix(matrix);
+  basis->setNumElectrons(2);
+  return basis;
+}
+
+// A Molden file of a hydrogen molecule with an s and a p shell on each atom,
+// and made up MOs
+inline QByteArray moldenFile()
+{
+  QByteArray shells = " s    2 1.00\n"
+      "  3.42525091  0.15432897\n"
+      "  0.62391373  0.53532814\n"
+      " p    1 1.00\n"
+      "  0.80000000  1.00000000\n\n";
+  QByteArray text = "[Molden Format]\n"
+      "[Atoms] AU\n"
+      "H     1    1   0.000000   0.000000   0.000000\n"
+      "H     2    1   0.000000   0.000000   1.400000\n"
+      "[GTO]\n  1 0\n" + shells + "  2 0\n" + shells + "[MO]\n";
+  for (int mo = 0, k = 0; mo < 8; ++mo) {
+    text += " Sym=  1a\n Ene= " + QByteArray::number(-0.5 + 0.1 * mo, 'f', 4)
+        + "\n Spin= Alpha\n Occup= " + (mo ? "0.000000\n" : "2.000000\n");
+    for (int i = 1; i <= 8; ++i, ++k)
+      text += QByteArray::number(i).rightJustified(4)
+          + QByteArray::number(fixtureValue(k), 'f', 6).rightJustified(12)
+          + '\n';
+  }
+  return text;
+}
+
+// A MOPAC aux file of a hydrogen molecule with @a functions s orbitals split
+// between its atoms, ten numbers to a line
+inline QByteArray mopacAux(int functions)
+{
+  int n = functions;
+  int packed = n * (n + 1) / 2;
+  QByteArray text = " START OF MOPAC FILE\n"
+      " ATOM_EL[0002]=\n H  H\n"
+      " ATOM_CORE[0002]=\n  1  1\n"
+      " ATOM_X_OPT:ANGSTROMS[0006]=\n"
+      "    0.0000    0.0000    0.0000\n"
+      "    0.0000    0.0000    0.7400\n";
+  QByteArray count = QByteArray::number(n).rightJustified(4, '0');
+  text += " AO_ATOMINDEX[" + count + "]=\n";
+  for (int i = 0; i < n; ++i)
+    text += QByteArray(" ") + (i % 2 ? '2' : '1') + (i % 10 == 9 ? "\n" : "");
+  text += "\n ATOM_SYMTYPE[" + count + "]=\n";
+  for (int i = 0; i < n; ++i)
+    text += QByteArray(" S") + (i % 10 == 9 ? "\n" : "");
+  text += "\n AO_ZETA[" + count + "]=\n";
+  for (int i = 0; i < n; ++i)
+    text += QByteArray::number((50 + i) / 100.0, 'f', 4).rightJustified(10)
+        + (i % 10 == 9 ? "\n" : "");
+  text += "\n ATOM_PQN[" + count + "]=\n";
+  for (int i = 0; i < n; ++i)
+    text += QByteArray(" 1") + (i % 10 == 9 ? "\n" : "");
+  text += "\n NUM_ELECTRONS=2\n";
+
+  // The counts of the matrices overflow, the sizes come from the functions
+  text += " OVERLAP_MATRIX[" + QByteArray::number(packed % 10000)
+      .rightJustified(4, '0') + "]=\n # Lower half triangle only\n";
+  for (int i = 0, k = 0; i < n; ++i) {
+    for (int j = 0; j <= i; ++j, ++k)
+      text += (i == j ? "    1.0000" : "    0.0000")
+          + QByteArray(k % 10 == 9 ? "\n" : "");
+  }
+  text += "\n EIGENVECTORS[" + QByteArray::number(n * n % 10000)
+      .rightJustified(4, '0') + "]=\n";
+  for (int k = 0; k < n * n; ++k)
+    text += QByteArray::number(fixtureValue(k), 'f', 4).rightJustified(10)
+        + (k % 10 == 9 ? "\n" : "");
+  text += "\n TOTAL_DENSITY_MATRIX[" + QByteArray::number(packed % 10000)
+      .rightJustified(4, '0') + "]=\n # Lower half triangle only\n";
+  for (int k = 0; k < packed; ++k)
+    text += QByteArray::number(fixtureValue(k + 1), 'f', 4)
+        .rightJustified(10) + (k % 10 == 9 ? "\n" : "");
+  text += "\n END OF MOPAC FILE\n";
+  return text;
+}
+
+// The basis set of mopacAux(@a functions)
+inline OpenQube::SlaterSet * createMopacBasisSet(int functions)
+{
+  int n = functions;
+  int packed = n * (n + 1) / 2;
+  std::vector<Eigen::Vector3d> positions;
+  positions.push_back(Eigen::Vector3d(0.0, 0.0, 0.0));
+  positions.push_back(Eigen::Vector3d(0.0, 0.0, 0.74));
+  std::vector<int> indices(n), types(n, OpenQube::SlaterSet::S), pqns(n, 1);
+  std::vector<double> zetas(n), overlap(packed, 0.0), density(packed);
+  Eigen::MatrixXd eigenVectors(n, n);
+  for (int i = 0; i < n; ++i) {
+    indices[i] = i % 2;
+    zetas[i] = (50 + i) / 100.0;
+    overlap[i * (i + 1) / 2 + i] = 1.0;
+  }
+  for (int k = 0; k < n * n; ++k)
+    eigenVectors.data()[k] = fixtureValue(k);
+  for (int k = 0; k < packed; ++k)
+    density[k] = fixtureValue(k + 1);
+
+  OpenQube::SlaterSet *basis = new OpenQube::SlaterSet;
+  basis->addAtoms(positions);
+  basis->addSlaterIndices(indices);
+  basis->addSlaterTypes(types);
+  basis->addZetas(zetas);
+  basis->addPQNs(pqns);
+  basis->setNumElectrons(2);
+  basis->addOverlapMatrix(overlap);
+  basis->addEigenVectors(eigenVectors);
+  basis->addDensityMatrix(density);
+  return basis;
+}
+
+// The top of a GAMESS-US log of a hydrogen molecule in the STO-3G basis, up
+// to the number of electrons
+inline QByteArray gamessUSHeader()
+{
+  // Narrower than the real thing, the columns are split at spaces
+  QByteArray shells = "      1   S   1     3.425250914    0.154328967495\n"
+      "      1   S   2     0.623913730    0.535328142282\n"
+      "      1   S   3     0.168855404    0.444634542185\n\n";
+  return QByteArray(" ----- GAMESS execution script -----\n\n"
+      "     ATOM      ATOMIC           COORDINATES (BOHR)\n"
+      "             CHARGE      X             Y             Z\n"
+      " H      1.0    0.0000000000  0.0000000000  0.0000000000\n"
+      " H      1.0    0.0000000000  0.0000000000  1.3983972400\n\n"
+      "     ATOMIC BASIS SET\n"
+      "     ----------------\n"
+      " THE CONTRACTED PRIMITIVE FUNCTIONS HAVE BEEN UNNORMALIZED\n"
+      " THE CONTRACTED BASIS FUNCTIONS ARE NOW NORMALIZED TO UNITY\n\n"
+      "  SHELL TYPE  PRIMITIVE   EXPONENT   CONTRACTION COEFFICIENT(S)\n\n"
+      " H\n\n") + shells + " H\n\n"
+      + QByteArray(shells).replace("1   S", "2   S")
+      + " TOTAL NUMBER OF BASIS SET SHELLS             =    2\n"
+      " NUMBER OF CARTESIAN GAUSSIAN BASIS FUNCTIONS =    2\n"
+      " NUMBER OF ELECTRONS                          =    2\n";
+}
+
+// The bond length and the MO coefficients of step @a step of a made up
+// geometry optimization, with two decimals
+inline double gamessUSBond(int step) { return (74 + 2 * step) / 100.0; }
+inline double gamessUSBonding(int step) { return (50 + step) / 100.0; }
+inline double gamessUSAntibonding(int step) { return (120 - step) / 100.0; }
+
+// The geometry of step @a step in angstrom, and if @a orbitals the
+// EIGENVECTORS block printed after it
+inline QByteArray gamessUSStep(int step, bool orbitals = true)
+{
+  QByteArray text = "\n COORDINATES OF ALL ATOMS ARE (ANGS)\n"
+      "   ATOM   CHARGE       X              Y              Z\n"
+      " ------------------------------------------------------------\n"
+      " H           1.0   0.0000000000   0.0000000000   0.0000000000\n"
+      " H           1.0   0.0000000000   0.0000000000   "
+      + QByteArray::number(gamessUSBond(step), 'f', 10) + "\n\n";
+  if (!orbitals)
+    return text;
+  QByteArray a = QByteArray::number(gamessUSBonding(step), 'f', 6);
+  QByteArray b = QByteArray::number(gamessUSAntibonding(step), 'f', 6);
+  return text + "          ------------\n"
+      "          EIGENVECTORS\n"
+      "          ------------\n\n"
+      "                      1          2\n"
+      "                   -0.5782     0.6703\n"
+      "                     A          A\n"
+      "    1  H  1  S    " + a.rightJustified(9) + b.rightJustified(11) + "\n"
+      "    2  H  2  S    " + a.rightJustified(9) + ('-' + b).rightJustified(11)
+      + "\n ...... END OF RHF CALCULATION ......\n";
+}
+
+// The basis set of gamessUSHeader() with the geometry of step @a geometry
+// and the MOs of step @a orbitals, none if it is negative
+inline OpenQube::GaussianSet * createGamessUSBasisSet(int geometry,
+                                                      int orbitals)
+{
+  const double exponents[3] = { 3.425250914, 0.623913730, 0.168855404 };
+  const double coefficients[3] = { 0.154328967495, 0.535328142282,
+                                   0.444634542185 };
+  OpenQube::GaussianSet *basis = new OpenQube::GaussianSet;
+  basis->addAtom(Eigen::Vector3d(0.0, 0.0, 0.0), 1);
+  basis->addAtom(Eigen::Vector3d(0.0, 0.0, gamessUSBond(geometry)
+                                 * (1.0 / 0.529177249)), 1);
+  for (int atom = 0; atom < 2; ++atom) {
+    unsigned int shell = basis->addBasis(atom, OpenQube::S);
+    for (int i = 0; i < 3; ++i)
+      basis->addGTO(shell, coefficients[i], exponents[i]);
+  }
+  basis->setNumElectrons(2);
+  if (orbitals >= 0) {
+    std::vector<double> mos(4);
+    mos[0] = mos[1] = gamessUSBonding(orbitals);
+    mos[2] = gamessUSAntibonding(orbitals);
+    mos[3] = -gamessUSAntibonding(orbitals);
+    basis->addMOs(mos);
+  }
+  return basis;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include <iostream>
+
+#include "gamessus.h"
+#include "gaussianset.h"
+#include "testfixtures.h"
+#include "testhelpers.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::GAMESSUSOutput;
+using OpenQube::GaussianSet;
+
+namespace {
+
+bool writeFile(const QString &filename, const QByteArray &text)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly) || file.write(text) != text.size()) {
+    cerr << "Could not write " << filename.toStdString() << endl;
+    return false;
+  }
+  return true;
+}
+
+// Check that @a basis has the geometry of step @a geometry and the MOs of
+// step @a orbitals of the fixture
+bool checkStep(GaussianSet *basis, int geometry, int orbitals)
+{
+  GaussianSet *expected = createGamessUSBasisSet(geometry, orbitals);
+  // The values of the MOs depend on the positions of the atoms as well
+  bool ok = checkResult(basis->moleculeRef().numAtoms(), size_t(2))
+      && checkOrbitals(basis, expected);
+  delete expected;
+  if (!ok)
+    cerr << "Error, expected step " << geometry << " with the orbitals of "
+         << orbitals << endl;
+  return ok;
+}
+
+}
+
+int testgamessus(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing GAMESS-US logs..." << endl;
+
+  QString filename = QDir::temp().filePath("openqube-testgamessus.gamout");
+
+  // The last orbitals are found searching backwards from the end of the log
+  if (!writeFile(filename, gamessUSHeader() + gamessUSStep(0)
+                 + gamessUSStep(1)))
+    return 1;
+  {
+    GaussianSet basis;
+    GAMESSUSOutput output(filename, &basis);
+    if (!checkResult(basis.numElectrons(), 2u) || !checkStep(&basis, 1, 1))
+      error = true;
+  }
+
+  // An optimization ends with a geometry that has no orbitals printed after
+  // it. Read in full the MOs of the last step are kept with it, a frame of
+  // it on its own has none.
+  if (!writeFile(filename, gamessUSHeader() + gamessUSStep(0)
+                 + gamessUSStep(1) + gamessUSStep(2, false)))
+    return 1;
+  {
+    GaussianSet basis;
+    GAMESSUSOutput output(filename, &basis, true);
+    if (!checkStep(&basis, 2, 1) || !checkResult(output.frameCount(), 3))
+      error = true;
+    for (int frame = 0; frame < 3 && !error; ++frame) {
+      int orbitals = frame < 2 ? frame : -1;
+      if (!checkResult(output.readFrame(frame, &basis), true)
+          || !checkStep(&basis, frame, orbitals))
+        error = true;
+    }
+    // Going back to a frame with orbitals after one without
+    if (!error && (!checkResult(output.readFrame(0, &basis), true)
+                   || !checkStep(&basis, 0, 0)))
+      error = true;
+    if (!checkResult(output.readFrame(3, &basis), false))
+      error = true;
+  }
+  QFile::remove(filename);
+
+  return error ? 1 : 0;
+}
@@ -0,0 +1,54 @@
+#include <iostream>
+
+#include "basissetloader.h"
+#include "gaussianset.h"
+#include "testfixtures.h"
+#include "testhelpers.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::BasisSet;
+using OpenQube::BasisSetLoader;
+using OpenQube::GaussianSet;
+
+// More than enough basis functions for the MO coefficients and the density
+// matrix to be decoded in several chunks
+static const int BASIS_FUNCTIONS = 192;
+
+int testgaussianfchk(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing formatted checkpoint files..." << endl;
+
+  GaussianSet *expected = createGaussianFchkBasisSet(BASIS_FUNCTIONS);
+  QByteArray text = gaussianFchk(BASIS_FUNCTIONS);
+
+  QString filename = QDir::temp().filePath("openqube-testgaussianfchk.fchk");
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly) || file.write(text) != text.size()) {
+    cerr << "Could not write " << filename.toStdString() << endl;
+    return 1;
+  }
+  file.close();
+
+  // The arrays are decoded in parallel both when read up front, and when
+  // indexed, for the density matrix
+  for (int indexed = 0; indexed < 2; ++indexed) {
+    BasisSet *basis = BasisSetLoader::LoadBasisSet(filename, false,
+                                                   indexed != 0);
+    if (!checkResult(basis != 0, true))
+      return 1;
+    if (!checkOrbitals(basis, expected, true))
+      error = true;
+    delete basis;
+  }
+  QFile::remove(filename);
+  delete expected;
+
+  return error ? 1 : 0;
+}
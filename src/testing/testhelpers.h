@@ -0,0 +1,104 @@
+
+#ifndef OQ_TESTHELPERS_H
+#define OQ_TESTHELPERS_H
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "gaussianset.h"
+
+// Helpers shared by the tests, which are all linked into one executable
+
+template<typename A, typename B>
+bool checkResult(const A& result, const B& expected)
+{
+  if (result != expected) {
+    std::cerr << "Error, expected result " << expected << ", got " << result
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Hydrogen molecule 1.4 Bohr long with s and p shells on each atom, and d
+// shells as well if @a dShells is set. The MO coefficients are made up, and
+// the density matrix is the identity.
+inline OpenQube::GaussianSet * createHydrogenBasisSet(bool dShells = false)
+{
+  OpenQube::GaussianSet *basis = new OpenQube::GaussianSet;
+  for (int i = 0; i < 2; ++i) {
+    unsigned int atom = basis->addAtom(Eigen::Vector3d(0.0, 0.0, 1.4 * i), 1);
+    unsigned int s = basis->addBasis(atom, OpenQube::S);
+    basis->addGTO(s, 0.15, 3.4);
+    basis->addGTO(s, 0.54, 0.62);
+    unsigned int p = basis->addBasis(atom, OpenQube::P);
+    basis->addGTO(p, 1.0, 0.8);
+    if (dShells) {
+      unsigned int d = basis->addBasis(atom, OpenQube::D5);
+      basis->addGTO(d, 1.0, 1.1);
+    }
+  }
+  int n = dShells ? 18 : 8;
+  std::vector<double> mos(n * n);
+  for (size_t i = 0; i < mos.size(); ++i)
+    mos[i] = 0.01 * i - 0.3;
+  basis->addMOs(mos);
+  basis->setDensityMatrix(Eigen::MatrixXd::Identity(n, n));
+  basis->setNumElectrons(2);
+  return basis;
+}
+
+// Check that values calculated at a number of points match the expected
+// ones, to within rounding
+inline bool checkValues(const std::vector<double> &values,
+                        const std::vector<double> &expected)
+{
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (std::abs(values[i] - expected[i])
+        > 1e-10 * (1.0 + std::abs(expected[i]))) {
+      std::cerr << "Error, expected value " << expected[i] << " at point "
+                << i << ", got " << values[i] << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Check that @a basis has the MOs of @a expected, and its density too if
+// @a density is set, by comparing their values at a few points
+inline bool checkOrbitals(OpenQube::BasisSet *basis,
+                          OpenQube::BasisSet *expected, bool density = false)
+{
+  if (!checkResult(basis->numMOs(), expected->numMOs()))
+    return false;
+  std::vector<Eigen::Vector3d> points;
+  for (int i = 0; i < 8; ++i)
+    points.push_back(Eigen::Vector3d(0.3 * i - 1.0, 0.17 * i, 0.5 - 0.11 * i));
+  std::vector<double> values(points.size()), reference(points.size());
+  for (unsigned int mo = 1; mo <= expected->numMOs(); ++mo) {
+    if (!checkResult(basis->calculateMOValues(&points[0], points.size(), mo,
+                                              &values[0]), true)
+        || !checkResult(expected->calculateMOValues(&points[0], points.size(),
+                                                    mo, &reference[0]), true)
+        || !checkValues(values, reference)) {
+      std::cerr << "Error, MO " << mo << " differs" << std::endl;
+      return false;
+    }
+  }
+  if (density
+      && (!checkResult(basis->calculateDensityValues(&points[0],
+                                                     points.size(),
+                                                     &values[0]), true)
+          || !checkResult(expected->calculateDensityValues(&points[0],
+                                                           points.size(),
+                                                           &reference[0]),
+                          true)
+          || !checkValues(values, reference))) {
+    std::cerr << "Error, the density differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,123 @@
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <utility>
+
+#include "isosurface.h"
+#include "cube.h"
+#include "testhelpers.h"
+
+#include <Eigen/Geometry>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::Cube;
+using OpenQube::Isosurface;
+
+using Eigen::Vector3d;
+using Eigen::Vector3f;
+using Eigen::Vector3i;
+
+// A cone of height 1 - |r - center|, larger than one brick along each axis
+Cube * createCube(const Vector3d &center)
+{
+  Cube *cube = new Cube;
+  int n = 37;
+  cube->setLimits(Vector3d(-2.0, -2.0, -2.0), Vector3i(n, n, n),
+                  4.0 / (n - 1));
+  std::vector<double> values(n * n * n);
+  for (int i = 0; i < n; ++i)
+    for (int j = 0; j < n; ++j)
+      for (int k = 0; k < n; ++k)
+        values[(i * n + j) * n + k] =
+            1.0 - (cube->position((i * n + j) * n + k) - center).norm();
+  cube->setData(values);
+  return cube;
+}
+
+// Count the triangles that are not part of a closed surface, or that face
+// the wrong way
+int checkMesh(const Isosurface::Mesh &mesh, const Vector3d &center,
+              bool outwards)
+{
+  int errors = 0;
+  std::map<std::pair<unsigned int, unsigned int>, int> edges;
+  for (size_t t = 0; t < mesh.indices.size(); t += 3) {
+    const Vector3f &a = mesh.vertices[mesh.indices[t]];
+    const Vector3f &b = mesh.vertices[mesh.indices[t + 1]];
+    const Vector3f &c = mesh.vertices[mesh.indices[t + 2]];
+    Vector3f normal = (b - a).cross(c - a);
+    Vector3f direction = (a + b + c) / 3.0f - center.cast<float>();
+    if (normal.squaredNorm() > 0.0f && (normal.dot(direction) > 0.0f)
+        != outwards)
+      ++errors;
+    for (int i = 0; i < 3; ++i)
+      ++edges[std::make_pair(mesh.indices[t + i],
+                             mesh.indices[t + (i + 1) % 3])];
+  }
+  // Each edge of a closed, consistently wound surface is used once in each
+  // direction
+  std::map<std::pair<unsigned int, unsigned int>, int>::const_iterator it;
+  for (it = edges.begin(); it != edges.end(); ++it)
+    if (it->second != 1 || !edges.count(std::make_pair(it->first.second,
+                                                       it->first.first)))
+      ++errors;
+  for (size_t v = 0; v < mesh.vertices.size(); ++v)
+    if ((mesh.normals[v].dot(mesh.vertices[v] - center.cast<float>()) > 0.0f)
+        != outwards)
+      ++errors;
+  return errors;
+}
+
+int testisosurface(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing isosurface extraction..." << endl;
+
+  Vector3d center(0.1, -0.05, 0.2);
+  Cube *cube = createCube(center);
+  std::vector<double> isovalues;
+  isovalues.push_back(0.25);
+  isovalues.push_back(-0.4);
+  std::vector<Isosurface::Mesh> meshes = Isosurface::extract(*cube,
+                                                             isovalues);
+  if (!checkResult(meshes.size(), isovalues.size()))
+    return 1;
+
+  // Spheres of radius 0.75 and 1.4, facing away from the values beyond the
+  // isovalue
+  double radius[2] = { 0.75, 1.4 };
+  for (int m = 0; m < 2; ++m) {
+    const Isosurface::Mesh &mesh = meshes[m];
+    if (!checkResult(mesh.isovalue, isovalues[m]))
+      error = true;
+    if (!checkResult(mesh.indices.empty(), false))
+      error = true;
+    if (!checkResult(mesh.normals.size(), mesh.vertices.size()))
+      error = true;
+    // A closed surface of genus zero
+    if (!checkResult(static_cast<int>(mesh.vertices.size())
+                     - static_cast<int>(mesh.indices.size() / 6), 2))
+      error = true;
+    if (!checkResult(checkMesh(mesh, center, m == 0), 0))
+      error = true;
+    for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+      double distance = (mesh.vertices[v].cast<double>() - center).norm();
+      if (std::abs(distance - radius[m]) > cube->spacing().x()) {
+        cerr << "Error, vertex " << v << " is off the sphere" << endl;
+        error = true;
+        break;
+      }
+    }
+  }
+
+  // Nothing to extract beyond the range of the cube
+  if (!checkResult(Isosurface::extract(*cube, 2.0).vertices.size(), 0u))
+    error = true;
+
+  delete cube;
+  return error ? 1 : 0;
+}
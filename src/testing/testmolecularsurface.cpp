@@ -0,0 +1,182 @@
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "molecularsurface.h"
+#include "molecule.h"
+#include "cube.h"
+#include "testhelpers.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::Cube;
+using OpenQube::MolecularSurface;
+using OpenQube::Molecule;
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+
+// Carbon, nitrogen, oxygen and hydrogen atoms scattered over a box a few
+// cells wide
+Molecule createMolecule()
+{
+  Molecule molecule;
+  short elements[4] = { 1, 6, 7, 8 };
+  for (int i = 0; i < 60; ++i) {
+    molecule.addAtom(Vector3d(std::sin(i * 1.1) * 8.0, std::sin(i * 1.3) * 6.0,
+                              std::sin(i * 1.7) * 7.0), elements[i % 4]);
+  }
+  // A dummy atom, which is ignored
+  molecule.addAtom(Vector3d(20.0, 0.0, 0.0), 0);
+  return molecule;
+}
+
+int testmolecularsurface(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing molecular surfaces..." << endl;
+
+  if (!checkResult(MolecularSurface::vdwRadius(6), 1.70))
+    error = true;
+  if (!checkResult(MolecularSurface::vdwRadius(26), 2.0))
+    error = true;
+
+  // The cell list gives the same distances as looking at every atom, in a
+  // cube reaching beyond the atoms
+  Molecule molecule = createMolecule();
+  Cube cube;
+  cube.setLimits(Vector3d(-13.0, -11.0, -12.0), Vector3i(53, 45, 49), 0.5);
+  double cutoff = 1.5;
+  if (!checkResult(MolecularSurface::calculateVdW(molecule, &cube, cutoff),
+                   true))
+    return 1;
+  if (!checkResult(cube.cubeType(), Cube::VdW))
+    error = true;
+  for (unsigned int i = 0; i < cube.data()->size(); ++i) {
+    Vector3d pos = cube.position(i);
+    double expected = -cutoff;
+    for (size_t a = 0; a + 1 < molecule.numAtoms(); ++a) {
+      double radius =
+          MolecularSurface::vdwRadius(molecule.atomAtomicNumber(a));
+      expected = std::max(expected,
+                          radius - (pos - molecule.atomPos(a)).norm());
+    }
+    if (std::abs((*cube.data())[i] - expected) > 1e-12) {
+      cerr << "Error, the distance at point " << i << " is "
+           << (*cube.data())[i] << ", expected " << expected << endl;
+      error = true;
+      break;
+    }
+  }
+
+  // No atoms, so every point is beyond the cutoff
+  if (!checkResult(MolecularSurface::calculateVdW(Molecule(), &cube, cutoff),
+                   true))
+    error = true;
+  if (!checkResult(cube.maxValue(), -cutoff))
+    error = true;
+
+  if (!checkResult(MolecularSurface::calculateVdW(molecule, &cube, 0.0),
+                   false))
+    error = true;
+
+  // The solvent surfaces of a single atom are spheres grown by the probe
+  // radius and of the van der Waals radius, exact near the surface
+  Molecule atom;
+  Vector3d center(0.1, 0.03, -0.07);
+  atom.addAtom(center, 6);
+  Cube sphere;
+  sphere.setLimits(Vector3d(-5.5, -5.5, -5.5), Vector3i(45, 45, 45), 0.25);
+  for (int excluded = 0; excluded < 2; ++excluded) {
+    double radius = excluded ? 1.7 : 1.7 + 1.4;
+    bool success = excluded
+        ? MolecularSurface::calculateSolventExcluded(atom, &sphere, 1.4)
+        : MolecularSurface::calculateSolventAccessible(atom, &sphere, 1.4);
+    if (!checkResult(success, true))
+      return 1;
+    if (!checkResult(sphere.cubeType(), excluded ? Cube::SolventExcluded
+                                                 : Cube::SolventAccessible))
+      error = true;
+    for (unsigned int i = 0; i < sphere.data()->size(); ++i) {
+      double expected = radius - (sphere.position(i) - center).norm();
+      double tolerance = std::abs(expected) < 0.5 ? 1e-9 : 0.3;
+      if (std::abs((*sphere.data())[i] - expected) > tolerance) {
+        cerr << "Error, the distance to the solvent surface at point " << i
+             << " is " << (*sphere.data())[i] << ", expected " << expected
+             << endl;
+        error = true;
+        break;
+      }
+    }
+  }
+
+  if (!checkResult(MolecularSurface::calculateSolventExcluded(atom, &sphere,
+                                                              -1.0), false))
+    error = true;
+
+  // Between two atoms the probe touching both traces a circle, and the
+  // excluded surface is the torus it sweeps out, the probe radius away from
+  // the circle. Within the accessible surface the excluded surface is at the
+  // probe radius from the region the probe can reach, the nearest point of
+  // which lies on one of the expanded spheres or on the circle.
+  Molecule pair;
+  Vector3d first(-1.5, 0.02, 0.01), second(1.5, 0.02, 0.01);
+  pair.addAtom(first, 6);
+  pair.addAtom(second, 8);
+  double probe = 1.4;
+  double radii[2] = { 1.7 + probe, 1.52 + probe };
+  double separation = (second - first).norm();
+  Vector3d axis = (second - first) / separation;
+  double along = (separation * separation + radii[0] * radii[0]
+                  - radii[1] * radii[1]) / (2.0 * separation);
+  double circle = std::sqrt(radii[0] * radii[0] - along * along);
+  Cube torus;
+  torus.setLimits(Vector3d(-6.0, -4.5, -4.5), Vector3i(61, 46, 46), 0.2);
+  if (!checkResult(MolecularSurface::calculateSolventExcluded(pair, &torus,
+                                                              probe), true))
+    return 1;
+  int reentrant = 0;
+  for (unsigned int i = 0; i < torus.data()->size(); ++i) {
+    Vector3d pos = torus.position(i) - first;
+    double x = pos.dot(axis);
+    double r = (pos - x * axis).norm();
+    double reach = std::sqrt((x - along) * (x - along)
+                             + (r - circle) * (r - circle));
+    bool onCircle = true;
+    Vector3d centers[2] = { Vector3d::Zero(), separation * axis };
+    for (int a = 0; a < 2; ++a) {
+      // The nearest point of the expanded sphere, if the other one does not
+      // cover it
+      Vector3d out = pos - centers[a];
+      if (out.norm() > radii[a])
+        continue;
+      Vector3d nearest = centers[a] + out.normalized() * radii[a];
+      if ((nearest - centers[1 - a]).norm() >= radii[1 - a]
+          && radii[a] - out.norm() < reach) {
+        reach = radii[a] - out.norm();
+        onCircle = false;
+      }
+    }
+    if ((pos - centers[0]).norm() > radii[0]
+        && (pos - centers[1]).norm() > radii[1])
+      continue;
+    double expected = reach - probe;
+    double tolerance = std::abs(expected) < 0.5 ? 1e-9 : 0.3;
+    if (onCircle && std::abs(expected) < 0.5)
+      ++reentrant;
+    if (std::abs((*torus.data())[i] - expected) > tolerance) {
+      cerr << "Error, the distance to the excluded surface at point " << i
+           << " is " << (*torus.data())[i] << ", expected " << expected
+           << endl;
+      error = true;
+      break;
+    }
+  }
+  if (!checkResult(reentrant > 100, true))
+    error = true;
+
+  return error ? 1 : 0;
+}
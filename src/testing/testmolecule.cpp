@@ -3,9 +3,9 @@
 
 #include "molecule.h"
 #include "atom.h"
+#include "testhelpers.h"
 
 using std::cout;
-using std::cerr;
 using std::endl;
 
 using OpenQube::Atom;
@@ -13,16 +13,6 @@ using OpenQube::Molecule;
 
 using Eigen::Vector3d;
 
-template<typename A, typename B>
-bool checkResult(const A& result, const B& expected)
-{
-  if (result != expected) {
-    cerr << "Error, expected result " << expected << ", got " << result << endl;
-    return false;
-  }
-  return true;
-}
-
 int testmolecule(int argc, char *argv[])
 {
   bool error = false;
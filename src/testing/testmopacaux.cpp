@@ -0,0 +1,52 @@
+#include <iostream>
+
+#include "basissetloader.h"
+#include "slaterset.h"
+#include "testfixtures.h"
+#include "testhelpers.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::BasisSet;
+using OpenQube::BasisSetLoader;
+using OpenQube::SlaterSet;
+
+int testmopacaux(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing MOPAC aux files..." << endl;
+
+  // A small file, and one whose eigenvectors are long enough to be split
+  // into several chunks that are decoded in parallel
+  QString filename = QDir::temp().filePath("openqube-testmopacaux.aux");
+  int sizes[2] = { 2, 128 };
+  for (int i = 0; i < 2; ++i) {
+    QByteArray text = mopacAux(sizes[i]);
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly) || file.write(text) != text.size()) {
+      cerr << "Could not write " << filename.toStdString() << endl;
+      return 1;
+    }
+    file.close();
+
+    SlaterSet *expected = createMopacBasisSet(sizes[i]);
+    BasisSet *basis = BasisSetLoader::LoadBasisSet(filename);
+    if (!checkResult(basis != 0, true))
+      return 1;
+    if (!checkResult(basis->numElectrons(), 2u)
+        || !checkResult(basis->moleculeRef().numAtoms(), 2u)
+        || !checkOrbitals(basis, expected, true))
+      error = true;
+    delete basis;
+    delete expected;
+  }
+
+  QFile::remove(filename);
+
+  return error ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+
+#include "gamessus.h"
+#include "gaussianset.h"
+#include "outputwatcher.h"
+#include "testfixtures.h"
+#include "testhelpers.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::GAMESSUSOutput;
+using OpenQube::GaussianSet;
+using OpenQube::OutputWatcher;
+
+namespace {
+
+// Write @a text to @a filename, replacing what it held unless @a append
+bool writeLog(const QString &filename, const QByteArray &text,
+              bool append = false)
+{
+  QFile file(filename);
+  if (!file.open(append ? QIODevice::Append : QIODevice::WriteOnly)
+      || file.write(text) != text.size()) {
+    cerr << "Could not write " << filename.toStdString() << endl;
+    return false;
+  }
+  return true;
+}
+
+// Check that @a basis has the geometry of step @a geometry and the MOs of
+// step @a orbitals of the fixture
+bool checkStep(GaussianSet *basis, int geometry, int orbitals)
+{
+  GaussianSet *expected = createGamessUSBasisSet(geometry, orbitals);
+  bool ok = checkResult(basis->moleculeRef().numAtoms(), size_t(2))
+      && checkOrbitals(basis, expected);
+  delete expected;
+  if (!ok)
+    cerr << "Error, expected step " << geometry << " with the orbitals of "
+         << orbitals << endl;
+  return ok;
+}
+
+}
+
+int testoutputwatcher(int argc, char *argv[])
+{
+  QCoreApplication application(argc, argv);
+  bool error = false;
+  cout << "Testing following running calculations..." << endl;
+
+  QString filename =
+      QDir::temp().filePath("openqube-testoutputwatcher.gamout");
+
+  // Output is read as it is appended, a block that is still being written
+  // is left for the next update
+  QByteArray step1 = gamessUSStep(1);
+  if (!writeLog(filename, gamessUSHeader() + gamessUSStep(0, false)))
+    return 1;
+  {
+    GaussianSet basis;
+    GAMESSUSOutput output(filename, true);
+    if (!checkResult(output.update(&basis), false)
+        || !writeLog(filename, gamessUSStep(0).mid(gamessUSStep(0, false)
+                                                   .size()), true)
+        || !checkResult(output.update(&basis), true)
+        || !checkStep(&basis, 0, 0))
+      error = true;
+    if (!error && (!writeLog(filename, step1.left(step1.size() - 20), true)
+                   || !checkResult(output.update(&basis), false)
+                   || !checkStep(&basis, 0, 0)
+                   || !writeLog(filename, step1.right(20), true)
+                   || !checkResult(output.update(&basis), true)
+                   || !checkStep(&basis, 1, 1)
+                   || !checkResult(output.frameCount(), 2)))
+      error = true;
+
+    // A restarted calculation truncates the log, and the basis set is read
+    // again from the new one
+    if (!error && (!writeLog(filename, gamessUSHeader() + gamessUSStep(3))
+                   || !checkResult(output.update(&basis), true)
+                   || !checkStep(&basis, 3, 3)
+                   || !checkResult(output.frameCount(), 1)))
+      error = true;
+
+    // The log of a restart may have grown past what was read by the time it
+    // is looked at. It is read again as well, rather than carrying on in the
+    // middle of it, which would leave the frames of the old log indexed.
+    if (!error && (!writeLog(filename, gamessUSHeader() + gamessUSStep(4)
+                             + gamessUSStep(5) + gamessUSStep(6))
+                   || !checkResult(output.update(&basis), true)
+                   || !checkStep(&basis, 6, 6)
+                   || !checkResult(output.frameCount(), 3)
+                   || !checkResult(output.readFrame(0, &basis), true)
+                   || !checkStep(&basis, 4, 4)))
+      error = true;
+  }
+
+  // The watcher reads the log in full the first time, and then what is
+  // appended to it, the same way
+  if (!writeLog(filename, gamessUSHeader() + gamessUSStep(0)))
+    return 1;
+  {
+    GaussianSet basis;
+    OutputWatcher watcher(filename, &basis);
+    if (!checkResult(watcher.isValid(), true)
+        || !checkResult(watcher.poll(), true)
+        || !checkStep(&basis, 0, 0)
+        || !checkResult(watcher.poll(), false)
+        || !writeLog(filename, gamessUSStep(1), true)
+        || !checkResult(watcher.poll(), true)
+        || !checkStep(&basis, 1, 1)
+        || !writeLog(filename, gamessUSHeader() + gamessUSStep(2))
+        || !checkResult(watcher.poll(), true)
+        || !checkStep(&basis, 2, 2))
+      error = true;
+  }
+  QFile::remove(filename);
+
+  return error ? 1 : 0;
+}
@@ -0,0 +1,255 @@
+
+#include <algorithm>
+#include <cmath>
+#include <math.h>
+#include <iostream>
+
+#include "gaussianset.h"
+#include "multicube.h"
+#include "testhelpers.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::Cube;
+using OpenQube::GaussianSet;
+using OpenQube::MultiCube;
+
+using Eigen::Matrix3d;
+using Eigen::MatrixXd;
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+
+namespace {
+
+// Compare a batch calculation with single points and finite differences
+bool checkBatch(GaussianSet *basis, Cube::Type type,
+                const std::vector<Vector3d> &points,
+                const std::vector<double> &values,
+                const std::vector<Vector3d> &gradients,
+                const std::vector<Matrix3d> &hessians)
+{
+  basis->initPointValues(type, 2);
+  double h = 1e-5;
+  for (size_t i = 0; i < points.size(); ++i) {
+    if (std::abs(values[i] - basis->pointValue(points[i])) > 1e-12) {
+      cerr << "Error, the value at point " << i << " differs" << endl;
+      return false;
+    }
+    for (int j = 0; j < 3; ++j) {
+      Vector3d step = Vector3d::Zero();
+      step[j] = h;
+      double derivative = (basis->pointValue(points[i] + step)
+                           - basis->pointValue(points[i] - step)) / (2.0 * h);
+      if (std::abs(gradients[i][j] - derivative) > 1e-6) {
+        cerr << "Error, the gradient at point " << i << " is "
+             << gradients[i][j] << ", expected " << derivative << endl;
+        return false;
+      }
+      // The diagonal of the Hessian from second differences
+      step[j] = 1e-4;
+      double second = (basis->pointValue(points[i] + step)
+                       - 2.0 * values[i]
+                       + basis->pointValue(points[i] - step)) / 1e-8;
+      if (std::abs(hessians[i](j, j) - second) > 1e-4) {
+        cerr << "Error, the second derivative at point " << i << " is "
+             << hessians[i](j, j) << ", expected " << second << endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}
+
+int testpointvalues(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing batches of point values..." << endl;
+
+  // A density matrix with off-diagonal elements
+  GaussianSet *basis = createHydrogenBasisSet(true);
+  MatrixXd density(18, 18);
+  for (int i = 0; i < 18; ++i)
+    for (int j = 0; j < 18; ++j)
+      density(i, j) = std::cos(0.3 * (i + j));
+  basis->setDensityMatrix(density);
+  std::vector<Vector3d> points;
+  for (int i = 0; i < 500; ++i) {
+    points.push_back(Vector3d(std::sin(i * 1.1) * 3.0, std::sin(i * 1.3) * 3.0,
+                              std::sin(i * 1.7) * 3.0 + 0.7));
+  }
+
+  std::vector<double> values(points.size());
+  std::vector<Vector3d> gradients(points.size());
+  std::vector<Matrix3d> hessians(points.size());
+  if (!basis->calculateMOValues(&points[0], points.size(), 2, &values[0],
+                                &gradients[0], &hessians[0])
+      || !checkBatch(basis, Cube::MO, points, values, gradients, hessians))
+    error = true;
+
+  if (!basis->calculateDensityValues(&points[0], points.size(), &values[0],
+                                     &gradients[0], &hessians[0])
+      || !checkBatch(basis, Cube::ElectronDensity, points, values, gradients,
+                     hessians))
+    error = true;
+
+  // The fused density cube matches the points calculated in batches
+  MultiCube cube(GaussianSet::DensityChannelCount);
+  cube.setLimits(Vector3d(-2.0, -2.0, -1.3), Vector3i(9, 10, 11), 0.4);
+  if (!basis->calculateDensityDerivatives(&cube))
+    error = true;
+  unsigned int index = (5 * 10 + 3) * 11 + 7;
+  Vector3d pos = cube.position(index);
+  basis->calculateDensityValues(&pos, 1, &values[0], &gradients[0],
+                                &hessians[0]);
+  double expected[GaussianSet::DensityChannelCount] = {
+    values[0], gradients[0].x(), gradients[0].y(), gradients[0].z(),
+    hessians[0].trace() };
+  for (int c = 0; c < GaussianSet::DensityChannelCount; ++c) {
+    if (std::abs((*cube.channel(c)->data())[index] - expected[c]) > 1e-12) {
+      cerr << "Error, channel " << c << " of the density cube differs" << endl;
+      error = true;
+    }
+  }
+
+  // A doubly occupied orbital has no excess kinetic energy, so the ELF is
+  // one wherever the density is not negligible
+  MatrixXd orbital(18, 1);
+  for (int i = 0; i < 18; ++i)
+    orbital(i, 0) = std::sin(0.7 * i);
+  basis->setDensityMatrix(2.0 * orbital * orbital.transpose());
+  Cube elf;
+  elf.setLimits(Vector3d(-1.0, -1.0, -0.5), Vector3i(6, 6, 7), 0.4);
+  if (!basis->calculateCubeElectronLocalization(&elf)
+      || elf.cubeType() != Cube::ElectronLocalization)
+    error = true;
+  for (unsigned int i = 0; i < elf.data()->size(); ++i) {
+    pos = elf.position(i);
+    basis->calculateDensityValues(&pos, 1, &values[0]);
+    if (values[0] > 1e-3 && std::abs((*elf.data())[i] - 1.0) > 1e-6) {
+      cerr << "Error, the ELF of a single orbital is " << (*elf.data())[i]
+           << endl;
+      error = true;
+      break;
+    }
+  }
+
+  // The reduced density gradient, in atomic units, and the signed density
+  Cube rdg, signedDensity;
+  rdg.setLimits(elf);
+  if (!basis->calculateCubeReducedDensityGradient(&rdg, &signedDensity))
+    error = true;
+  pos = rdg.position(100);
+  basis->calculateDensityValues(&pos, 1, &values[0], &gradients[0]);
+  double s = gradients[0].norm() * 0.529177249
+      / (2.0 * std::pow(3.0 * M_PI * M_PI, 1.0 / 3.0)
+         * std::pow(values[0], 4.0 / 3.0));
+  if (std::abs((*rdg.data())[100] - s) > 1e-9 * s
+      || std::abs(std::abs((*signedDensity.data())[100]) - values[0]) > 1e-12)
+    error = true;
+
+  // The electrostatic potential satisfies Poisson's equation away from the
+  // nuclei, in atomic units
+  Vector3d nucleus(0.0, 0.0, 1.4 * 0.529177249);
+  double h = 1e-3;
+  for (int i = 0; i < 50; ++i) {
+    // Closer in, where the density is not negligible
+    pos = 0.5 * points[i];
+    if (pos.norm() < 0.5 || (pos - nucleus).norm() < 0.5)
+      continue;
+    Vector3d stencil[7];
+    stencil[0] = pos;
+    for (int j = 0; j < 3; ++j) {
+      Vector3d step = Vector3d::Zero();
+      step[j] = h;
+      stencil[2 * j + 1] = pos + step;
+      stencil[2 * j + 2] = pos - step;
+    }
+    double potential[7];
+    if (!basis->calculateESPValues(stencil, 7, potential)) {
+      error = true;
+      break;
+    }
+    double laplacian = 0.0;
+    for (int j = 1; j < 7; ++j)
+      laplacian += potential[j] - potential[0];
+    laplacian /= (h / 0.529177249) * (h / 0.529177249);
+    basis->calculateDensityValues(&pos, 1, &values[0]);
+    if (std::abs(laplacian - 4.0 * M_PI * values[0])
+        > 1e-4 * std::max(1.0, 4.0 * M_PI * std::abs(values[0]))) {
+      cerr << "Error, the Laplacian of the potential at point " << i << " is "
+           << laplacian << ", expected " << 4.0 * M_PI * values[0] << endl;
+      error = true;
+    }
+  }
+
+  // Far from the molecule the shell pairs are replaced by their multipoles,
+  // unless a point of the same batch is close to them. The two agree across
+  // the distances at which the pairs switch over.
+  double maxDifference = 0.0;
+  for (int i = 0; i < 200; ++i) {
+    Vector3d direction(std::sin(i * 1.1), std::sin(i * 1.3),
+                       std::sin(i * 1.7));
+    Vector3d batch[2] = { nucleus + (2.0 + 0.1 * i) * direction.normalized(),
+                          Vector3d::Zero() };
+    double far, near[2];
+    if (!basis->calculateESPValues(batch, 1, &far)
+        || !basis->calculateESPValues(batch, 2, near)) {
+      error = true;
+      break;
+    }
+    maxDifference = std::max(maxDifference, std::abs(far - near[0]));
+  }
+  if (maxDifference > 1e-8) {
+    cerr << "Error, the multipoles are off by " << maxDifference << endl;
+    error = true;
+  }
+
+  // MOs out of range cannot be calculated
+  if (basis->calculateMOValues(&points[0], points.size(), 19, &values[0]))
+    error = true;
+
+  delete basis;
+
+  // A normalized s function of exponent a gives a Gaussian charge of
+  // exponent 2a, whose potential is erf(sqrt(2a) r) / r. The normalization
+  // of the s functions is rounded to eight digits.
+  basis = new GaussianSet;
+  Vector3d center(0.1, -0.2, 0.3);
+  unsigned int atom = basis->addAtom(center / 0.529177249, 1);
+  basis->addGTO(basis->addBasis(atom, OpenQube::S), 1.0, 0.8);
+  basis->setDensityMatrix(MatrixXd::Identity(1, 1));
+  for (int i = 1; i <= 100; ++i) {
+    Vector3d direction(std::sin(i * 1.1), std::sin(i * 1.3),
+                       std::sin(i * 1.7));
+    double r = 0.2 * i;
+    pos = center + r * 0.529177249 * direction.normalized();
+    double potential;
+    if (!basis->calculateESPValues(&pos, 1, &potential)) {
+      error = true;
+      break;
+    }
+    double expected = (1.0 - erf(std::sqrt(1.6) * r)) / r;
+    if (std::abs(potential - expected) > 1e-8 / r) {
+      cerr << "Error, the potential at " << r << " Bohr is " << potential
+           << ", expected " << expected << endl;
+      error = true;
+    }
+  }
+
+  // The expansion of the density is kept between batches, but not once the
+  // density has changed
+  basis->setDensityMatrix(2.0 * MatrixXd::Identity(1, 1));
+  pos = center + 0.529177249 * Vector3d(0.0, 0.0, 1.0);
+  double potential;
+  if (!basis->calculateESPValues(&pos, 1, &potential)
+      || std::abs(potential - (1.0 - 2.0 * erf(std::sqrt(1.6)))) > 1e-8) {
+    cerr << "Error, the potential did not change with the density" << endl;
+    error = true;
+  }
+  delete basis;
+  return error ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+
+#include <iostream>
+
+#include "basissetsnapshot.h"
+#include "cube.h"
+#include "gaussianset.h"
+#include "testhelpers.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QtEndian>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::BasisSetSnapshot;
+using OpenQube::Cube;
+using OpenQube::GaussianSet;
+
+using Eigen::Vector3d;
+using Eigen::Vector3i;
+using Eigen::VectorXd;
+
+namespace {
+
+// Overwrite entry @a index of section @a id of the snapshot @a filename with
+// @a value. The section table follows the 96 byte header, 24 bytes an entry
+// of id, type, rows, columns and offset, all little-endian.
+bool damageSnapshot(const QString &filename, quint32 id, int index,
+                    quint32 value)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadWrite))
+    return false;
+  QByteArray data = file.readAll();
+  uchar *p = reinterpret_cast<uchar *>(data.data());
+  quint32 count = qFromLittleEndian<quint32>(p + 12);
+  for (quint32 i = 0; i < count; ++i) {
+    uchar *entry = p + 96 + 24 * i;
+    if (qFromLittleEndian<quint32>(entry) != id)
+      continue;
+    quint64 offset = qFromLittleEndian<quint64>(entry + 16) + 4 * index;
+    qToLittleEndian<quint32>(value, p + offset);
+    return file.seek(0) && file.write(data) == data.size();
+  }
+  return false;
+}
+
+}
+
+int testsnapshot(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing basis set snapshots..." << endl;
+
+  // Snapshots are only written for files that exist
+  QString source = QDir::temp().filePath("openqube-testsnapshot.fchk");
+  QFile file(source);
+  if (!file.open(QIODevice::WriteOnly)) {
+    cerr << "Could not create " << source.toStdString() << endl;
+    return 1;
+  }
+  file.write("test\n");
+  file.close();
+
+  GaussianSet *basis = createHydrogenBasisSet();
+  if (!checkResult(BasisSetSnapshot::write(basis, source), true))
+    error = true;
+  if (!checkResult(BasisSetSnapshot::isFresh(source), true))
+    error = true;
+
+  GaussianSet *read = qobject_cast<GaussianSet *>(
+        BasisSetSnapshot::read(source));
+  if (!checkResult(read != 0, true))
+    return 1;
+
+  // The snapshot holds the same content, so the cubes are interchangeable
+  if (!checkResult(read->hash() == basis->hash(), true))
+    error = true;
+  if (!checkResult(read->numMOs(), basis->numMOs()))
+    error = true;
+  if (!checkResult(read->numElectrons(), 2))
+    error = true;
+
+  // The MOs are read from the snapshot on demand
+  VectorXd column;
+  if (!checkResult(read->orbitalSource()->readMO(3, column), true))
+    error = true;
+  if (!checkResult(column.size(), 8))
+    error = true;
+  else if (!checkResult(column[5], 0.01 * (3 * 8 + 5) - 0.3))
+    error = true;
+
+  // Cubes calculated from the snapshot match those of the basis set, the
+  // density included
+  Cube cube, expected;
+  cube.setLimits(Vector3d(-1.5, -1.5, -1.5), Vector3i(8, 8, 10), 0.4);
+  expected.setLimits(cube);
+  if (!checkResult(read->blockingCalculateCubeDensity(&cube), true)
+      || !checkResult(basis->blockingCalculateCubeDensity(&expected), true)
+      || !checkValues(*cube.data(), *expected.data()))
+    error = true;
+  if (!checkOrbitals(read, basis, true))
+    error = true;
+
+  // Snapshots with index arrays that run past the arrays they index, or
+  // are out of order, are not read. The sections are numbered GTOIndices =
+  // 19, MOIndices = 18 in the file.
+  if (!checkResult(damageSnapshot(BasisSetSnapshot::fileName(source), 19, 1,
+                                  1000), true)
+      || !checkResult(BasisSetSnapshot::read(source) == 0, true))
+    error = true;
+  if (!checkResult(BasisSetSnapshot::write(basis, source), true)
+      || !checkResult(damageSnapshot(BasisSetSnapshot::fileName(source), 18, 0,
+                                     5), true)
+      || !checkResult(BasisSetSnapshot::read(source) == 0, true))
+    error = true;
+
+  // A changed source makes the snapshot stale
+  file.open(QIODevice::WriteOnly | QIODevice::Append);
+  file.write("more\n");
+  file.close();
+  if (!checkResult(BasisSetSnapshot::isFresh(source), false))
+    error = true;
+
+  // So does a change that keeps the size, even within the same second
+  if (!checkResult(BasisSetSnapshot::write(basis, source), true))
+    error = true;
+  file.open(QIODevice::ReadWrite);
+  file.write("T");
+  file.close();
+  if (!checkResult(BasisSetSnapshot::isFresh(source), false))
+    error = true;
+
+  delete read;
+  delete basis;
+  QFile::remove(BasisSetSnapshot::fileName(source));
+  QFile::remove(source);
+
+  return error ? 1 : 0;
+}
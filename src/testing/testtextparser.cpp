@@ -0,0 +1,89 @@
+
+#include <iostream>
+#include <cstring>
+
+#include "textparser.h"
+#include "testhelpers.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using OpenQube::LineReader;
+
+bool checkDouble(const char *text, double expected)
+{
+  const char *p = text;
+  double value = 0.0;
+  if (!OpenQube::parseDouble(p, text + strlen(text), value)) {
+    cerr << "Error, could not parse " << text << endl;
+    return false;
+  }
+  return checkResult(value, expected);
+}
+
+int testtextparser(int argc, char *argv[])
+{
+  bool error = false;
+  cout << "Testing the text parser..." << endl;
+
+  // Fast path, exponent letters and the Fortran three digit exponent
+  if (!checkDouble("  -1.23456789E+00", -1.23456789))
+    error = true;
+  if (!checkDouble("0.5D-03", 0.5e-3))
+    error = true;
+  if (!checkDouble("1.0e22", 1.0e22))
+    error = true;
+  if (!checkDouble("0.12345678-100", 0.12345678e-100))
+    error = true;
+  // Slow path, too many digits and large exponents
+  if (!checkDouble("3.14159265358979323846", 3.14159265358979323846))
+    error = true;
+  if (!checkDouble("1.7976931348623157E+308", 1.7976931348623157e308))
+    error = true;
+
+  // Run-together fields are two numbers, not a number with an exponent
+  const char *fields = "-0.123-0.456";
+  const char *f = fields;
+  double first = 0.0, second = 0.0;
+  if (!checkResult(OpenQube::parseDouble(f, fields + 12, first)
+                   && OpenQube::parseDouble(f, fields + 12, second)
+                   && f == fields + 12, true))
+    error = true;
+  if (!checkResult(first, -0.123) || !checkResult(second, -0.456))
+    error = true;
+  if (!checkDouble("1.5-12", 1.5))
+    error = true;
+
+  const char *bad = "E+05";
+  double value;
+  if (!checkResult(OpenQube::parseDouble(bad, bad + 4, value), false))
+    error = true;
+
+  // Integers followed by more text
+  const char *ints = "  12 -7";
+  const char *p = ints;
+  int i = 0;
+  if (!checkResult(OpenQube::parseInt(p, ints + 7, i) && i == 12, true))
+    error = true;
+  if (!checkResult(OpenQube::parseInt(p, ints + 7, i) && i == -7, true))
+    error = true;
+  const char *header = "Atomic numbers        I   N=          12";
+  if (!checkResult(OpenQube::parseLastInt(header, header + strlen(header), i)
+                   && i == 12, true))
+    error = true;
+
+  // Lines with both kinds of line ending, and no ending on the last line
+  const char *text = "one\r\ntwo\nthree";
+  LineReader reader(text, text + strlen(text));
+  const char *begin, *end;
+  int lines = 0;
+  while (reader.readLine(begin, end))
+    ++lines;
+  if (!checkResult(lines, 3))
+    error = true;
+  if (!checkResult(end - begin, 5))
+    error = true;
+
+  return error ? 1 : 0;
+}
@@ -0,0 +1,535 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "textparser.h"
+
+#include "compressedfile.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+
+#ifndef Q_OS_WIN
+# include <sys/stat.h>
+#endif
+
+namespace OpenQube {
+
+// Powers of ten that are exactly representable as doubles
+static const double EXACT_POWERS[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+  1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+static const int MAX_EXACT_POWER = 22;
+// Integers up to 2^53 are exactly representable as doubles
+static const quint64 MAX_EXACT_MANTISSA = Q_UINT64_C(9007199254740992);
+// More digits than this could overflow the mantissa
+static const int MAX_MANTISSA_DIGITS = 19;
+
+bool MappedFile::open(const QString &filename)
+{
+  m_file.close();
+  m_buffer.clear();
+  m_begin = m_end = 0;
+
+  if (CompressedFile::format(filename) != CompressedFile::None) {
+    if (!readCompressed(filename))
+      return false;
+  }
+  else {
+    m_file.setFileName(filename);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+      qDebug() << "Cannot open" << filename;
+      return false;
+    }
+    qint64 size = m_file.size();
+    if (size > 0)
+      m_begin = reinterpret_cast<const char *>(m_file.map(0, size));
+    if (m_begin) {
+      m_end = m_begin + size;
+      return true;
+    }
+    if (!readAll())
+      return false;
+  }
+
+  // Empty files still have a valid, empty text
+  m_begin = m_buffer.empty() ? "" : &m_buffer[0];
+  m_end = m_begin + m_buffer.size();
+  return true;
+}
+
+bool MappedFile::readAll()
+{
+  qint64 size = m_file.size();
+  if (size < 0 || static_cast<quint64>(size) > m_buffer.max_size()) {
+    qDebug() << "Cannot read" << m_file.fileName();
+    return false;
+  }
+  m_buffer.resize(static_cast<size_t>(size));
+  bool success = size == 0 || m_file.read(&m_buffer[0], size) == size;
+  m_file.close();
+  if (!success) {
+    qDebug() << "Error reading" << m_file.fileName();
+    m_buffer.clear();
+  }
+  return success;
+}
+
+bool MappedFile::readCompressed(const QString &filename)
+{
+  CompressedFile file(filename);
+  if (!file.open(QIODevice::ReadOnly)) {
+    qDebug() << "Cannot decompress" << filename;
+    return false;
+  }
+
+  // Size the buffer up front if the file says how big it is. The worker
+  // thread decompresses the next blocks while this one is copied.
+  qint64 size = file.sizeHint();
+  if (size > 0 && static_cast<quint64>(size) < m_buffer.max_size())
+    m_buffer.resize(static_cast<size_t>(size) + 1);
+  else
+    m_buffer.resize(1 << 20);
+  size_t used = 0;
+  while (true) {
+    if (used == m_buffer.size()) {
+      if (used > m_buffer.max_size() / 2) {
+        qDebug() << "Uncompressed file too large to read" << filename;
+        m_buffer.clear();
+        return false;
+      }
+      m_buffer.resize(2 * used);
+    }
+    qint64 n = file.read(&m_buffer[used], m_buffer.size() - used);
+    if (n < 0) {
+      qDebug() << "Error decompressing" << filename << file.errorString();
+      m_buffer.clear();
+      return false;
+    }
+    if (n == 0)
+      break;
+    used += static_cast<size_t>(n);
+  }
+  m_buffer.resize(used);
+  return true;
+}
+
+RecordReader::RecordReader(QIODevice *device, RecordStart isStart,
+                           int blockSize)
+  : m_device(device), m_isStart(isStart),
+    m_blockSize(blockSize > 0 ? blockSize : 1), m_begin(0), m_used(0),
+    m_atEnd(false), m_error(false)
+{
+}
+
+bool RecordReader::readRecord(const char *&begin, const char *&end)
+{
+  // Drop the last record, so that the buffer only grows for larger records
+  if (m_begin) {
+    std::copy(m_buffer.begin() + m_begin, m_buffer.begin() + m_used,
+              m_buffer.begin());
+    m_used -= m_begin;
+    m_begin = 0;
+  }
+  if (m_used == 0 && !fill())
+    return false;
+
+  // Offsets rather than pointers, as filling the buffer may move it
+  size_t line = 0;
+  while (true) {
+    char *start = &m_buffer[0] + line;
+    char *newline = static_cast<char *>(memchr(start, '\n', m_used - line));
+    if (!newline) {
+      if (fill())
+        continue;
+      if (m_error)
+        return false;
+      // The last line has no line ending
+      start = &m_buffer[0] + line;
+      if (!line || !m_isStart(start, &m_buffer[0] + m_used))
+        line = m_used;
+      break;
+    }
+    const char *lineEnd = newline;
+    if (lineEnd > start && *(lineEnd - 1) == '\r')
+      --lineEnd;
+    if (line && m_isStart(start, lineEnd))
+      break;
+    line = newline - &m_buffer[0] + 1;
+    if (line == m_used && !fill()) {
+      if (m_error)
+        return false;
+      break;
+    }
+  }
+
+  begin = &m_buffer[0];
+  end = begin + line;
+  m_begin = line;
+  return true;
+}
+
+bool RecordReader::fill()
+{
+  if (m_atEnd || m_error)
+    return false;
+  if (m_buffer.size() - m_used < static_cast<size_t>(m_blockSize))
+    m_buffer.resize(std::max(2 * m_buffer.size(), m_used + m_blockSize));
+  qint64 n = m_device->read(&m_buffer[m_used], m_blockSize);
+  if (n < 0) {
+    qDebug() << "Error reading" << m_device->errorString();
+    m_error = true;
+    return false;
+  }
+  if (n == 0) {
+    m_atEnd = true;
+    return false;
+  }
+  m_used += static_cast<size_t>(n);
+  return true;
+}
+
+inline bool isDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+bool parseInt(const char *&p, const char *end, int &value)
+{
+  const char *s = skipSpaces(p, end);
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = *s++ == '-';
+  if (s >= end || !isDigit(*s))
+    return false;
+
+  qint64 result = 0;
+  while (s < end && isDigit(*s)) {
+    result = result * 10 + (*s++ - '0');
+    if (result > Q_INT64_C(2147483648))
+      return false;
+  }
+  if (negative)
+    result = -result;
+  if (result > Q_INT64_C(2147483647))
+    return false;
+
+  value = static_cast<int>(result);
+  p = s;
+  return true;
+}
+
+// A sign directly after the digits of a number only starts an exponent when
+// it is followed by exactly three digits, the width Fortran writes. Anything
+// else, such as the next number of a run-together field, ends the number.
+static inline bool isFortranExponent(const char *s, const char *end)
+{
+  return end - s >= 4 && isDigit(s[1]) && isDigit(s[2]) && isDigit(s[3])
+      && (end - s == 4 || (!isDigit(s[4]) && s[4] != '.'));
+}
+
+// Slow but exact conversion for the numbers the fast path cannot handle
+static bool parseDoubleSlow(const char *begin, const char *end, double &value)
+{
+  // Rewrite the number in the form understood by QByteArray::toDouble
+  char buffer[64];
+  int length = 0;
+  bool exponent = false;
+  for (const char *s = begin; s < end; ++s) {
+    if (length >= static_cast<int>(sizeof(buffer)) - 2)
+      return false;
+    char c = *s;
+    if (c == 'D' || c == 'd' || c == 'e')
+      c = 'E';
+    if (c == 'E')
+      exponent = true;
+    // A sign after the digits starts an exponent without a letter
+    else if ((c == '+' || c == '-') && s != begin && !exponent) {
+      buffer[length++] = 'E';
+      exponent = true;
+    }
+    buffer[length++] = c;
+  }
+  buffer[length] = '\0';
+
+  bool ok = false;
+  value = QByteArray::fromRawData(buffer, length).toDouble(&ok);
+  return ok;
+}
+
+bool parseDouble(const char *&p, const char *end, double &value)
+{
+  const char *s = skipSpaces(p, end);
+  const char *begin = s;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = *s++ == '-';
+
+  // Accumulate the significant digits into an integer mantissa
+  quint64 mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool anyDigits = false;
+  bool truncated = false;
+  while (s < end && isDigit(*s)) {
+    anyDigits = true;
+    if (digits < MAX_MANTISSA_DIGITS) {
+      mantissa = mantissa * 10 + (*s - '0');
+      if (mantissa)
+        ++digits;
+    }
+    else {
+      ++exponent;
+      truncated = true;
+    }
+    ++s;
+  }
+  if (s < end && *s == '.') {
+    ++s;
+    while (s < end && isDigit(*s)) {
+      anyDigits = true;
+      if (digits < MAX_MANTISSA_DIGITS) {
+        mantissa = mantissa * 10 + (*s - '0');
+        if (mantissa)
+          ++digits;
+        --exponent;
+      }
+      else {
+        truncated = true;
+      }
+      ++s;
+    }
+  }
+  if (!anyDigits)
+    return false;
+
+  // The exponent, with a letter or just a sign (Fortran, three digits)
+  if (s < end && (*s == 'E' || *s == 'e' || *s == 'D' || *s == 'd')) {
+    const char *e = s + 1;
+    bool negativeExponent = false;
+    if (e < end && (*e == '+' || *e == '-'))
+      negativeExponent = *e++ == '-';
+    if (e >= end || !isDigit(*e))
+      return false;
+    int power = 0;
+    while (e < end && isDigit(*e)) {
+      if (power < 10000)
+        power = power * 10 + (*e - '0');
+      ++e;
+    }
+    exponent += negativeExponent ? -power : power;
+    s = e;
+  }
+  else if (s < end && (*s == '+' || *s == '-') && isFortranExponent(s, end)) {
+    int power = (s[1] - '0') * 100 + (s[2] - '0') * 10 + (s[3] - '0');
+    exponent += *s == '-' ? -power : power;
+    s += 4;
+  }
+
+  // Exact when both the mantissa and the power of ten are exact doubles
+  if (mantissa == 0) {
+    value = 0.0;
+  }
+  else if (!truncated && mantissa <= MAX_EXACT_MANTISSA
+           && exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER) {
+    value = static_cast<double>(mantissa);
+    if (exponent < 0)
+      value /= EXACT_POWERS[-exponent];
+    else
+      value *= EXACT_POWERS[exponent];
+  }
+  else {
+    if (!parseDoubleSlow(begin, s, value))
+      return false;
+    p = s;
+    return true;
+  }
+
+  if (negative)
+    value = -value;
+  p = s;
+  return true;
+}
+
+const char * findText(const char *begin, const char *end, const char *text)
+{
+  size_t length = strlen(text);
+  if (!length || static_cast<size_t>(end - begin) < length)
+    return 0;
+  const char *last = end - length;
+  for (const char *p = begin; p <= last; ++p) {
+    p = static_cast<const char *>(memchr(p, text[0], last - p + 1));
+    if (!p)
+      return 0;
+    if (memcmp(p, text, length) == 0)
+      return p;
+  }
+  return 0;
+}
+
+const char * findLastText(const char *begin, const char *end,
+                          const char *text)
+{
+  size_t length = strlen(text);
+  if (!length || static_cast<size_t>(end - begin) < length)
+    return 0;
+  for (const char *p = end - length + 1; p > begin; ) {
+    --p;
+    if (*p == text[0] && memcmp(p, text, length) == 0)
+      return p;
+  }
+  return 0;
+}
+
+bool parseLastInt(const char *begin, const char *end, int &value)
+{
+  while (end > begin && isSpace(*(end - 1)))
+    --end;
+  const char *start = end;
+  while (start > begin && !isSpace(*(start - 1)))
+    --start;
+  const char *p = start;
+  return parseInt(p, end, value) && p == end;
+}
+
+// Where the bytes before @a offset that a ReadMark compares start
+static qint64 tailStart(qint64 offset)
+{
+  return qMax<qint64>(0, offset - ReadMark::SAMPLE_SIZE);
+}
+
+// The size, modification time and inode of @a filename, which tell a file
+// that has been replaced from one that has been appended to
+static void fileIdentity(const QString &filename, qint64 &size,
+                         qint64 &modified, quint64 &inode)
+{
+  QFileInfo info(filename);
+  size = info.size();
+  modified = info.lastModified().toTime_t();
+  inode = 0;
+#ifndef Q_OS_WIN
+  struct stat buf;
+  if (stat(QFile::encodeName(filename).constData(), &buf) == 0)
+    inode = buf.st_ino;
+#endif
+}
+
+bool ReadMark::readSamples(const QString &filename, qint64 offset,
+                           QByteArray &head, QByteArray &tail)
+{
+  // Compressed files are read forward only
+  QFile file(filename);
+  CompressedFile compressed(filename);
+  QIODevice *device = &file;
+  if (CompressedFile::format(filename) != CompressedFile::None)
+    device = &compressed;
+  if (!device->open(QIODevice::ReadOnly))
+    return false;
+
+  head = device->read(qMin<qint64>(offset, SAMPLE_SIZE));
+  qint64 start = tailStart(offset);
+  if (start < head.size()) {
+    tail = head.mid(static_cast<int>(start));
+  }
+  else {
+    tail.clear();
+    for (qint64 pos = head.size(); pos < start; ) {
+      QByteArray skipped = device->read(qMin<qint64>(start - pos, 1 << 16));
+      if (skipped.isEmpty())
+        return false;
+      pos += skipped.size();
+    }
+  }
+  tail += device->read(offset - start - tail.size());
+  return tail.size() == offset - start;
+}
+
+void ReadMark::set(const QString &filename, qint64 offset,
+                   const QByteArray &head, const QByteArray &tail)
+{
+  m_offset = offset;
+  fileIdentity(filename, m_size, m_modified, m_inode);
+  m_head = head;
+  m_tail = tail;
+}
+
+void ReadMark::set(const QString &filename, qint64 offset)
+{
+  QByteArray head, tail;
+  if (!readSamples(filename, offset, head, tail))
+    qDebug() << "Cannot read back" << filename;
+  set(filename, offset, head, tail);
+}
+
+void ReadMark::set(const QString &filename, const char *begin, qint64 offset)
+{
+  qint64 tail = tailStart(offset);
+  set(filename, offset,
+      QByteArray(begin, static_cast<int>(qMin<qint64>(offset, SAMPLE_SIZE))),
+      QByteArray(begin + tail, static_cast<int>(offset - tail)));
+}
+
+bool ReadMark::isContinuedBy(const QString &filename, const QByteArray &head,
+                             const QByteArray &tail) const
+{
+  if (m_offset <= 0)
+    return true;
+  qint64 size, modified;
+  quint64 inode;
+  fileIdentity(filename, size, modified, inode);
+  return inode == m_inode && size >= m_size && modified >= m_modified
+      && head == m_head && tail == m_tail;
+}
+
+bool ReadMark::isContinuedBy(const QString &filename) const
+{
+  if (m_offset <= 0)
+    return true;
+  QByteArray head, tail;
+  return readSamples(filename, m_offset, head, tail)
+      && isContinuedBy(filename, head, tail);
+}
+
+bool ReadMark::isContinuedBy(const QString &filename, const char *begin,
+                             const char *end) const
+{
+  if (m_offset <= 0)
+    return true;
+  if (end - begin < m_offset)
+    return false;
+  qint64 tail = tailStart(m_offset);
+  return isContinuedBy(filename,
+                       QByteArray::fromRawData(begin, m_head.size()),
+                       QByteArray::fromRawData(begin + tail,
+                                               static_cast<int>(m_offset
+                                                                - tail)));
+}
+
+void ReadMark::clear()
+{
+  m_offset = 0;
+  m_size = 0;
+  m_modified = 0;
+  m_inode = 0;
+  m_head.clear();
+  m_tail.clear();
+}
+
+} // End namespace
@@ -0,0 +1,346 @@
+/******************************************************************************
+
+  This source file is part of the OpenQube project.
+
+  Copyright 2026 agent
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef OQ_TEXTPARSER_H
+#define OQ_TEXTPARSER_H
+
+#include "openqubeabi.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+
+#include <cstring>
+#include <vector>
+
+namespace OpenQube {
+
+/**
+ * Functions and classes to parse numbers and lines straight out of a block
+ * of text in memory, such as a memory mapped output file. Nothing is
+ * allocated, and the numbers are parsed in the C locale whatever the locale
+ * of the application.
+ */
+
+/**
+ * @return True if @a c is a space, tab or line ending.
+ */
+inline bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * @return The first character from @a p on that is not a space, or @a end.
+ */
+inline const char * skipSpaces(const char *p, const char *end)
+{
+  while (p < end && isSpace(*p))
+    ++p;
+  return p;
+}
+
+/**
+ * Parse an integer, skipping leading spaces. On success @a p is moved past
+ * the number.
+ * @return True if an integer was parsed.
+ */
+OPENQUBE_EXPORT bool parseInt(const char *&p, const char *end, int &value);
+
+/**
+ * Parse a floating point number, skipping leading spaces. The exponent may
+ * be introduced by E or D, or just by its sign as written by Fortran for
+ * exponents with three digits. Any other sign after the digits ends the
+ * number, as in run-together fields. On success @a p is moved past the
+ * number.
+ * @return True if a number was parsed.
+ */
+OPENQUBE_EXPORT bool parseDouble(const char *&p, const char *end,
+                                 double &value);
+
+/**
+ * Parse the last integer on the line from @a begin to @a end, such as the
+ * number of elements on a section header.
+ * @return True if the line ends with an integer.
+ */
+OPENQUBE_EXPORT bool parseLastInt(const char *begin, const char *end,
+                                  int &value);
+
+/**
+ * @return True if the text from @a begin to @a end starts with @a prefix.
+ */
+inline bool startsWith(const char *begin, const char *end, const char *prefix)
+{
+  size_t length = strlen(prefix);
+  return static_cast<size_t>(end - begin) >= length
+      && memcmp(begin, prefix, length) == 0;
+}
+
+/**
+ * @return The first occurrence of @a text from @a begin to @a end, or 0 if
+ * there is none.
+ */
+OPENQUBE_EXPORT const char * findText(const char *begin, const char *end,
+                                      const char *text);
+
+/**
+ * @return The last occurrence of @a text from @a begin to @a end, or 0 if
+ * there is none. The search runs backwards from @a end.
+ */
+OPENQUBE_EXPORT const char * findLastText(const char *begin, const char *end,
+                                          const char *text);
+
+/**
+ * @return The start of the line containing @a p, which must not be before
+ * @a begin.
+ */
+inline const char * lineStart(const char *begin, const char *p)
+{
+  while (p > begin && *(p - 1) != '\n')
+    --p;
+  return p;
+}
+
+/**
+ * @class LineReader textparser.h
+ * @brief Splits a block of text into lines without copying it.
+ */
+class LineReader
+{
+public:
+  LineReader() : m_pos(0), m_end(0) {}
+  LineReader(const char *begin, const char *end) : m_pos(begin), m_end(end) {}
+
+  /**
+   * @return True if there are no more lines.
+   */
+  bool atEnd() const { return m_pos >= m_end; }
+
+  /**
+   * @return The position of the next line.
+   */
+  const char * pos() const { return m_pos; }
+
+  /**
+   * @return The end of the text.
+   */
+  const char * end() const { return m_end; }
+
+  /**
+   * Continue reading from @a pos, which must be the start of a line.
+   */
+  void seek(const char *pos) { m_pos = pos; }
+
+  /**
+   * Read the next line, setting @a begin and @a end to its first character
+   * and one past its last character, excluding the line ending.
+   * @return False if there are no more lines.
+   */
+  bool readLine(const char *&begin, const char *&end)
+  {
+    if (m_pos >= m_end)
+      return false;
+    begin = m_pos;
+    const char *newline = static_cast<const char *>(
+          memchr(m_pos, '\n', m_end - m_pos));
+    if (newline) {
+      end = newline;
+      m_pos = newline + 1;
+    }
+    else {
+      end = m_end;
+      m_pos = m_end;
+    }
+    if (end > begin && *(end - 1) == '\r')
+      --end;
+    return true;
+  }
+
+private:
+  const char *m_pos;
+  const char *m_end;
+};
+
+/**
+ * @class RecordReader textparser.h
+ * @brief Reads a stream a record at a time, so that parsers can work through
+ * compressed files as they are decompressed.
+ *
+ * A record is a line for which the function passed to the constructor
+ * returns true, followed by the lines up to the next such line. Any lines
+ * before the first such line make up a record of their own. Only the record
+ * being parsed and the block read after it are held in memory, rather than
+ * the whole text as with MappedFile.
+ */
+class OPENQUBE_EXPORT RecordReader
+{
+public:
+  /// Whether the line from @a begin to @a end, excluding its line ending,
+  /// starts a record
+  typedef bool (*RecordStart)(const char *begin, const char *end);
+
+  /**
+   * Read records from @a device, which must be open, @a blockSize bytes at
+   * a time.
+   */
+  RecordReader(QIODevice *device, RecordStart isStart,
+               int blockSize = 1 << 20);
+
+  /**
+   * Read the next record, setting @a begin and @a end to its text including
+   * the line ending of its last line. The text stays valid until the next
+   * call.
+   * @return False if there are no more records, or the stream could not be
+   * read, see hasError().
+   */
+  bool readRecord(const char *&begin, const char *&end);
+
+  /**
+   * @return True if reading the stream failed.
+   */
+  bool hasError() const { return m_error; }
+
+private:
+  /// Read another block onto the end of the buffer, false if there is none
+  bool fill();
+
+  QIODevice *m_device;
+  RecordStart m_isStart;
+  int m_blockSize;
+  std::vector<char> m_buffer;
+  size_t m_begin;  //! Start of the unread text in m_buffer
+  size_t m_used;   //! End of the text in m_buffer
+  bool m_atEnd;
+  bool m_error;
+};
+
+/**
+ * @class MappedFile textparser.h
+ * @brief Maps a file into memory, falling back on reading it in if it
+ * cannot be mapped.
+ *
+ * Files compressed in a format CompressedFile recognizes are decompressed
+ * into memory as they are read, without a temporary file. The whole
+ * uncompressed text is held, which may be larger than 2 GB, so parsers that
+ * read the file from start to end use a RecordReader on a CompressedFile
+ * instead. GAMESSUSOutput, which searches the log from its end, is the one
+ * parser that reads compressed files through MappedFile.
+ */
+class MappedFile
+{
+public:
+  MappedFile() : m_begin(0), m_end(0) {}
+
+  /**
+   * Open and map @a filename, unmapping any file mapped before.
+   * @return False if the file could not be read.
+   */
+  bool open(const QString &filename);
+
+  /**
+   * @return The contents of the file, valid as long as this object is.
+   */
+  const char * begin() const { return m_begin; }
+  const char * end() const { return m_end; }
+
+private:
+  /// Read the uncompressed contents of @a filename into m_buffer
+  bool readCompressed(const QString &filename);
+
+  /// Read the file in if it cannot be mapped
+  bool readAll();
+
+  QFile m_file;
+  std::vector<char> m_buffer; //! Contents of compressed or unmappable files
+  const char *m_begin;
+  const char *m_end;
+};
+
+/**
+ * @class ReadMark textparser.h
+ * @brief Remembers how far the log of a running calculation has been read,
+ * and tells whether the file has only been appended to since.
+ *
+ * A calculation that is restarted truncates, rewrites or replaces its log,
+ * after which an offset into the old log means nothing. With the offset the
+ * size, modification time and, where there is one, the inode of the file
+ * are kept, as well as the first bytes of the file and the last bytes read.
+ * The file is taken to continue what was read as long as it is the same
+ * file, no shorter and no older, and these bytes are unchanged.
+ */
+class OPENQUBE_EXPORT ReadMark
+{
+public:
+  /// The number of bytes compared at the start and before the offset
+  static const int SAMPLE_SIZE = 256;
+
+  ReadMark() { clear(); }
+
+  /**
+   * @return The offset the unread output starts at, zero if nothing has been
+   * read.
+   */
+  qint64 offset() const { return m_offset; }
+
+  /**
+   * Record that @a filename has been read up to @a offset. The bytes kept
+   * are read from the file, decompressing it if it is compressed.
+   */
+  void set(const QString &filename, qint64 offset);
+
+  /**
+   * Record that @a filename, the text of which starts at @a begin, has been
+   * read up to @a offset.
+   */
+  void set(const QString &filename, const char *begin, qint64 offset);
+
+  /**
+   * @return True if @a filename continues the text read so far, always true
+   * if nothing has been read.
+   */
+  bool isContinuedBy(const QString &filename) const;
+
+  /**
+   * @return True if @a filename, the text of which is from @a begin to
+   * @a end, continues the text read so far.
+   */
+  bool isContinuedBy(const QString &filename, const char *begin,
+                     const char *end) const;
+
+  /**
+   * Forget what was read, offset() is zero afterwards.
+   */
+  void clear();
+
+private:
+  /// Read the bytes compared for @a offset from @a filename
+  static bool readSamples(const QString &filename, qint64 offset,
+                          QByteArray &head, QByteArray &tail);
+  void set(const QString &filename, qint64 offset, const QByteArray &head,
+           const QByteArray &tail);
+  bool isContinuedBy(const QString &filename, const QByteArray &head,
+                     const QByteArray &tail) const;
+
+  qint64 m_offset;
+  qint64 m_size;       //! Of the file on disk, compressed or not
+  qint64 m_modified;   //! Modification time in seconds
+  quint64 m_inode;     //! Zero where files have none
+  QByteArray m_head;   //! The first bytes of the file
+  QByteArray m_tail;   //! The bytes before m_offset
+};
+
+} // End namespace
+
+#endif